@@ -0,0 +1,430 @@
+#ifndef GEO_CONCURRENTQUADTREE_HPP_
+#define GEO_CONCURRENTQUADTREE_HPP_
+
+#include <stdexcept>
+#include <utility>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <tuple>
+#include <cstdint>
+
+#include "QuadTree.hpp"
+#include "internal/Morton.hpp"
+
+namespace geo {
+
+/**
+* Quad Tree which might be modified by many threads at once.
+*
+* The field is divided into 4^shardLevels equal squares (shards), i.e. the nodes of the top
+* shardLevels levels of a QuadTree covering it. Each shard is a separate QuadTree guarded by its
+* own mutex, so threads which modify different parts of the field don't wait for each other.
+* Operations concerning a single point (insert, erase, near) lock only the shard which owns that
+* point: the one given by the top 2 * shardLevels bits of the point's location code.
+*
+* Shards have shardLevels less levels than the whole tree, so the smallest nodes are exactly the
+* same as in a QuadTree<ElementType, maxLevels>. Shards are ordered along the Z-order curve, so
+* iteration visits elements in the same order as QuadTree does.
+*
+* @param ElementType Type of elements that will be stored inside the tree.
+* @param maxLevels   Maximum number of tree levels, including levels above shards. Must be higher
+*                    than shardLevels. Default is 10.
+* @param Allocator   Allocator used by all shards. Default is std::allocator.
+* @param shardLevels Number of levels of the tree replaced by shards. There are 4^shardLevels
+*                    shards. Default is 2 (16 shards).
+*/
+template <typename ElementType, size_t maxLevels = 10,
+          typename Allocator = std::allocator<ElementType>, size_t shardLevels = 2>
+class ConcurrentQuadTree
+{
+    static_assert(shardLevels < maxLevels, "shards must have at least 1 level");
+    static_assert(shardLevels <= 16, "too many shard levels");
+
+public:
+    typedef QuadTree<ElementType, maxLevels - shardLevels, Allocator> ShardType;
+    typedef Allocator allocator_type;
+
+private:
+    struct Shard
+    {
+        Shard(size_t width, int startX, int startY, size_t capacity, const Allocator& alloc)
+            : tree(width, startX, startY, capacity, alloc) {}
+
+        std::mutex mutex;
+        ShardType tree;
+    };
+
+    typedef std::vector<std::unique_ptr<Shard> > Shards;
+
+public:
+    /**
+     * Forward iterator over all elements. It's valid only as long as the tree isn't modified, so
+     * it mustn't be used concurrently with modifications. @see forEach()
+     */
+    class iterator : public std::iterator<std::forward_iterator_tag, ElementType>
+    {
+    public:
+        iterator() : shards(nullptr), shard(0) {}
+
+        ElementType& operator*() const
+        {
+            return *it;
+        }
+
+        ElementType* operator->() const
+        {
+            return &(operator*());
+        }
+
+        iterator& operator++()
+        {
+            ++it;
+            skipEmpty();
+            return *this;
+        }
+
+        iterator operator++(int)
+        {
+            iterator ret(*this);
+            operator++();
+            return ret;
+        }
+
+        bool operator==(const iterator& rhs) const
+        {
+            return shard == rhs.shard && (shard == shards->size() || it == rhs.it);
+        }
+
+        bool operator!=(const iterator& rhs) const
+        {
+            return !(operator==(rhs));
+        }
+
+    private:
+        friend class ConcurrentQuadTree;
+
+        iterator(const Shards* shards, size_t shard) : shards(shards), shard(shard)
+        {
+            if (shard < shards->size())
+            {
+                it = (*shards)[shard]->tree.begin();
+                skipEmpty();
+            }
+        }
+
+        // Moves to the beginning of the next non-empty shard when the current one is exhausted.
+        void skipEmpty()
+        {
+            while (shard < shards->size() && it == (*shards)[shard]->tree.end())
+            {
+                if (++shard < shards->size())
+                    it = (*shards)[shard]->tree.begin();
+            }
+        }
+
+        const Shards* shards;
+        size_t shard;
+        typename ShardType::iterator it;
+    };
+
+public:
+    /**
+     * ConcurrentQuadTree Constructor.
+     * Parameters startX and startY are set to 0.
+     *
+     * @see ConcurrentQuadTree(size_t width, int startX, int startY, capacity)
+     */
+    ConcurrentQuadTree(size_t width, size_t capacity, const Allocator& alloc = Allocator())
+        : ConcurrentQuadTree(width, 0, 0, capacity, alloc)
+    {
+    }
+
+    /**
+     * ConcurrentQuadTree Constructor.
+     *
+     * @param width    Width of the field. It must be a power of 2 and it must be at least
+     *                 2^shardLevels, so each shard is at least 1 wide.
+     * @param startX   Starting point of represented field in x-axis.
+     * @param startY   Starting point of represented field in y-axis.
+     * @param capacity Maximum capacity of a single tree node. @see QuadTree
+     * @param alloc    Allocator instance used by all shards.
+     */
+    ConcurrentQuadTree(size_t width, int startX, int startY, size_t capacity,
+                       const Allocator& alloc = Allocator())
+        : width(width), startX(startX), startY(startY)
+    {
+        if (width < shardsPerSide() || ((width - 1) & width) != 0)
+            throw std::invalid_argument("size is not power of 2 or it's smaller than shards");
+
+        size_t shardWidth = width / shardsPerSide();
+        shards.resize(shardsPerSide() * shardsPerSide());
+        for (uint32_t col = 0; col < shardsPerSide(); ++col)
+        {
+            for (uint32_t row = 0; row < shardsPerSide(); ++row)
+            {
+                shards[shardIndex(col, row)].reset(new Shard(shardWidth,
+                    static_cast<int>(startX + col * shardWidth),
+                    static_cast<int>(startY + row * shardWidth), capacity, alloc));
+            }
+        }
+    }
+
+    ConcurrentQuadTree(const ConcurrentQuadTree&) = delete;
+    ConcurrentQuadTree& operator=(const ConcurrentQuadTree&) = delete;
+
+    allocator_type get_allocator() const
+    {
+        return shards[0]->tree.get_allocator();
+    }
+
+    iterator begin()
+    {
+        return iterator(&shards, 0);
+    }
+
+    iterator end()
+    {
+        return iterator(&shards, shards.size());
+    }
+
+    /**
+     * Inserts a single element. Only the shard which owns (x, y) is locked.
+     *
+     * @return Whether the element was inserted, i.e. (x, y) is inside the field.
+     */
+    bool insert(double x, double y, const ElementType& val)
+    {
+        return insert(x, y, ElementType(val));
+    }
+
+    bool insert(double x, double y, ElementType&& val)
+    {
+        Shard* shard = owner(x, y);
+        if (shard == nullptr)
+            return false;
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        // QuadTree::insert() returns an empty iterator when the shard rejects the element.
+        return static_cast<bool>(shard->tree.insert(x, y, std::move(val)));
+    }
+
+    /**
+     * Inserts all elements from a given range. Elements are grouped by shards first and each
+     * shard is locked once for all of its elements, which are inserted with QuadTree::bulkLoad().
+     *
+     * @param  first Beginning of the range. @see QuadTree::bulkLoad()
+     * @param  last  End of the range.
+     * @return       Number of inserted elements.
+     */
+    template <typename InputIterator>
+    size_t bulkLoad(InputIterator first, InputIterator last)
+    {
+        typedef std::tuple<double, double, ElementType> Located;
+        std::vector<std::vector<Located> > groups(shards.size());
+        for (; first != last; ++first)
+        {
+            double x = std::get<0>(*first);
+            double y = std::get<1>(*first);
+            size_t shard = ownerIndex(x, y);
+            if (shard != shards.size())
+                groups[shard].push_back(Located(x, y, std::get<2>(*first)));
+        }
+
+        size_t inserted = 0;
+        for (size_t i = 0; i < groups.size(); ++i)
+        {
+            if (groups[i].empty())
+                continue;
+            std::lock_guard<std::mutex> lock(shards[i]->mutex);
+            inserted += shards[i]->tree.bulkLoad(std::make_move_iterator(groups[i].begin()),
+                                                 std::make_move_iterator(groups[i].end()));
+        }
+        return inserted;
+    }
+
+    /**
+     * Removes all elements that match given coordinates. Only the shard which owns (x, y) is
+     * locked. @see QuadTree::erase()
+     */
+    void erase(double x, double y)
+    {
+        Shard* shard = owner(x, y);
+        if (shard != nullptr)
+        {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            shard->tree.erase(x, y);
+        }
+    }
+
+    /**
+     * Calls a given visitor for each element near (x, y), i.e. for each element of the range
+     * which QuadTree::near() would return. The visitor is called while the owning shard is locked.
+     *
+     * @return The visitor, after it has been called for all found elements.
+     */
+    template <typename Visitor>
+    Visitor near(double x, double y, Visitor visitor)
+    {
+        Shard* shard = owner(x, y);
+        if (shard != nullptr)
+        {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            std::pair<typename ShardType::iterator, typename ShardType::iterator> range =
+                shard->tree.near(x, y);
+            for (; range.first != range.second; ++range.first)
+                visitor(*range.first);
+        }
+        return visitor;
+    }
+
+    /**
+     * Calls a given visitor for each element inside an axis-aligned rectangle. Shards which
+     * intersect the rectangle are locked one by one. @see QuadTree::withinRect()
+     */
+    template <typename Visitor>
+    Visitor withinRect(double minX, double minY, double maxX, double maxY, Visitor visitor)
+    {
+        for (size_t i = 0; i < shards.size(); ++i)
+        {
+            if (!shardIntersects(i, minX, minY, maxX, maxY))
+                continue;
+            std::lock_guard<std::mutex> lock(shards[i]->mutex);
+            visitor = shards[i]->tree.withinRect(minX, minY, maxX, maxY, visitor);
+        }
+        return visitor;
+    }
+
+    /**
+     * Calls a given visitor for each element, in the same order as iterators do. Shards are locked
+     * one by one, so it might be called concurrently with modifications. Elements inserted or
+     * erased meanwhile might be visited or not.
+     *
+     * @return The visitor, after it has been called for all elements.
+     */
+    template <typename Visitor>
+    Visitor forEach(Visitor visitor)
+    {
+        for (size_t i = 0; i < shards.size(); ++i)
+        {
+            std::lock_guard<std::mutex> lock(shards[i]->mutex);
+            for (typename ShardType::iterator it = shards[i]->tree.begin();
+                 it != shards[i]->tree.end(); ++it)
+                visitor(*it);
+        }
+        return visitor;
+    }
+
+    /**
+     * Removes all elements. Shards are cleared one by one.
+     */
+    void clear()
+    {
+        for (size_t i = 0; i < shards.size(); ++i)
+        {
+            std::lock_guard<std::mutex> lock(shards[i]->mutex);
+            shards[i]->tree.clear();
+        }
+    }
+
+    /**
+     * @return Total number of elements. Shards aren't locked: their sizes are read atomically, so
+     *         concurrent modifications might be counted or not.
+     */
+    size_t size() const
+    {
+        size_t total = 0;
+        for (size_t i = 0; i < shards.size(); ++i)
+            total += shards[i]->tree.size();
+        return total;
+    }
+
+    /**
+     * @return Number of shards.
+     */
+    static size_t shardCount()
+    {
+        return size_t(1) << (2 * shardLevels);
+    }
+
+    /**
+     * @return Shard with a given number, in the Z-order. It might be used for reading without
+     *         locks when no one modifies the tree, e.g. to process shards in parallel.
+     */
+    const ShardType& shard(size_t shardNo) const
+    {
+        return shards[shardNo]->tree;
+    }
+
+private:
+    static uint32_t shardsPerSide()
+    {
+        return uint32_t(1) << shardLevels;
+    }
+
+    // Shards are numbered like Morton keys, so their order is the Z-order.
+    static size_t shardIndex(uint32_t col, uint32_t row)
+    {
+        return morton::Codec<uint32_t>::interleave(col, row);
+    }
+
+    /**
+     * @return Column (or row) of a shard which contains a given coordinate. The coordinate must be
+     *         inside the field.
+     */
+    static uint32_t shardColumn(double coordinate, double start, double shardWidth)
+    {
+        uint32_t col = static_cast<uint32_t>((coordinate - start) / shardWidth);
+        if (col >= shardsPerSide())
+            col = shardsPerSide() - 1;
+        // Shards check their ranges exactly, so a rounding error must not send a point to a
+        // neighbouring shard.
+        while (col > 0 && coordinate < start + col * shardWidth)
+            --col;
+        while (col + 1 < shardsPerSide() && coordinate >= start + (col + 1) * shardWidth)
+            ++col;
+        return col;
+    }
+
+    /**
+     * @return Number of the shard which owns a given point or the number of shards when the point
+     *         is outside of the field.
+     */
+    size_t ownerIndex(double x, double y) const
+    {
+        if (!(x >= startX && x < startX + static_cast<double>(width) &&
+              y >= startY && y < startY + static_cast<double>(width)))
+            return shards.size();
+
+        double shardWidth = static_cast<double>(width / shardsPerSide());
+        return shardIndex(shardColumn(x, startX, shardWidth), shardColumn(y, startY, shardWidth));
+    }
+
+    Shard* owner(double x, double y)
+    {
+        size_t index = ownerIndex(x, y);
+        return index == shards.size() ? nullptr : shards[index].get();
+    }
+
+    bool shardIntersects(size_t shardNo, double minX, double minY, double maxX,
+                         double maxY) const
+    {
+        double shardWidth = static_cast<double>(width / shardsPerSide());
+        double left = startX + morton::Codec<uint32_t>::x(static_cast<uint32_t>(shardNo)) *
+                      shardWidth;
+        double bottom = startY + morton::Codec<uint32_t>::y(static_cast<uint32_t>(shardNo)) *
+                        shardWidth;
+        return minX < left + shardWidth && maxX >= left && minY < bottom + shardWidth &&
+               maxY >= bottom;
+    }
+
+private:
+    size_t width;
+    double startX;
+    double startY;
+    Shards shards;
+};
+
+} // namespace geo
+
+#endif
@@ -0,0 +1,491 @@
+#ifndef GEO_INGEST_HPP_
+#define GEO_INGEST_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <istream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "internal/Coordinates.hpp"
+#include "internal/Parallel.hpp"
+
+namespace geo {
+
+/**
+ * Counters of ingest() progress. They're updated while ingest() runs, so other threads might read
+ * them to report progress.
+ */
+struct IngestProgress
+{
+    IngestProgress() : bytes(0), records(0), inserted(0), rejected(0) {}
+
+    // Bytes read from the input.
+    std::atomic<uint64_t> bytes;
+    // Records parsed so far.
+    std::atomic<uint64_t> records;
+    // Records inserted into the tree, i.e. parsed ones which lie inside the tree range.
+    std::atomic<uint64_t> inserted;
+    // Malformed records which were skipped.
+    std::atomic<uint64_t> rejected;
+};
+
+/**
+ * Parameters of ingest().
+ */
+struct IngestOptions
+{
+    IngestOptions()
+        : chunkSize(1 << 20), threads(std::thread::hardware_concurrency()), chunksInFlight(0) {}
+
+    // Number of bytes read from the input at once. Chunks are extended to the end of the last
+    // record they contain.
+    size_t chunkSize;
+    // Maximum number of threads (including the calling one).
+    unsigned threads;
+    // Maximum number of chunks which were read, but not inserted yet. Reading stops until the
+    // tree catches up, which bounds memory used by the pipeline. Default (0) is 2 * threads.
+    size_t chunksInFlight;
+};
+
+/**
+ * Parses a CSV field into an element of an arithmetic type or a string.
+ */
+template <typename T, typename = void>
+struct CsvValue
+{
+    bool operator()(const char* first, const char* last, T& value) const
+    {
+        value = T(first, last);
+        return true;
+    }
+};
+
+template <typename T>
+struct CsvValue<T, typename std::enable_if<std::is_arithmetic<T>::value>::type>
+{
+    /**
+     * @param first Beginning of the field. Fields are followed by a separator, a line end or a
+     *              terminating null character, so they might be parsed by strtod() and alike.
+     * @param last  End of the field.
+     */
+    bool operator()(const char* first, const char* last, T& value) const
+    {
+        while (last > first && (last[-1] == ' ' || last[-1] == '\t'))
+            --last;
+        if (first == last)
+            return false;
+        char* end;
+        value = parse(first, &end, std::is_floating_point<T>(), std::is_signed<T>());
+        return end == last;
+    }
+
+private:
+    template <typename Signed>
+    static T parse(const char* first, char** end, std::true_type, Signed)
+    {
+        return static_cast<T>(std::strtod(first, end));
+    }
+
+    static T parse(const char* first, char** end, std::false_type, std::true_type)
+    {
+        return static_cast<T>(std::strtoll(first, end, 10));
+    }
+
+    static T parse(const char* first, char** end, std::false_type, std::false_type)
+    {
+        return static_cast<T>(std::strtoull(first, end, 10));
+    }
+};
+
+/**
+ * Text format with a single record per line: "x,y,value". Lines which can't be parsed (e.g. a
+ * header) or whose coordinates aren't finite are rejected. Both "\n" and "\r\n" line ends are
+ * accepted.
+ *
+ * @param ElementType Type of elements.
+ * @param ValueParser Functor which parses the value field: bool(first, last, ElementType&).
+ */
+template <typename ElementType, typename ValueParser = CsvValue<ElementType> >
+class CsvFormat
+{
+public:
+    typedef ElementType element_type;
+
+    explicit CsvFormat(char separator = ',', const ValueParser& parseValue = ValueParser())
+        : separator(separator), parseValue(parseValue) {}
+
+    /**
+     * @return Length of the longest prefix of given data which consists of whole records.
+     */
+    size_t split(const char* data, size_t size) const
+    {
+        const char* last = data + size;
+        while (last != data && last[-1] != '\n')
+            --last;
+        return static_cast<size_t>(last - data);
+    }
+
+    /**
+     * Appends records parsed from given data to a batch. The data is followed by a null character.
+     *
+     * @return Number of rejected records.
+     */
+    template <typename Batch>
+    size_t parse(const char* first, const char* last, Batch& batch) const
+    {
+        CsvValue<double> parseCoordinate;
+        size_t rejected = 0;
+        while (first != last)
+        {
+            const char* lineEnd = std::find(first, last, '\n');
+            const char* end = lineEnd;
+            if (end != first && end[-1] == '\r')
+                --end;
+            if (end != first)
+            {
+                const char* second = std::find(first, end, separator);
+                const char* third = second == end ? end : std::find(second + 1, end, separator);
+                double x;
+                double y;
+                ElementType value;
+                if (third != end && parseCoordinate(first, second, x) && std::isfinite(x) &&
+                    parseCoordinate(second + 1, third, y) && std::isfinite(y) &&
+                    parseValue(third + 1, end, value))
+                    batch.push_back(std::make_tuple(x, y, std::move(value)));
+                else
+                    ++rejected;
+            }
+            first = lineEnd == last ? last : lineEnd + 1;
+        }
+        return rejected;
+    }
+
+private:
+    char separator;
+    ValueParser parseValue;
+};
+
+/**
+ * Binary format of packed records: x and y as doubles followed by the bytes of an element, all in
+ * the native byte order and without any padding.
+ */
+template <typename ElementType>
+class BinaryFormat
+{
+public:
+    typedef ElementType element_type;
+
+    static const size_t recordSize = 2 * sizeof(double) + sizeof(ElementType);
+
+    BinaryFormat()
+    {
+        static_assert(std::is_trivially_copyable<ElementType>::value,
+                      "only trivially copyable elements might be read byte by byte");
+    }
+
+    size_t split(const char*, size_t size) const
+    {
+        return size - size % recordSize;
+    }
+
+    /**
+     * @see CsvFormat::parse() Incomplete record at the end of the input is rejected.
+     */
+    template <typename Batch>
+    size_t parse(const char* first, const char* last, Batch& batch) const
+    {
+        size_t size = static_cast<size_t>(last - first);
+        batch.reserve(batch.size() + size / recordSize);
+        for (; first + recordSize <= last; first += recordSize)
+        {
+            double x;
+            double y;
+            ElementType value;
+            std::memcpy(&x, first, sizeof(double));
+            std::memcpy(&y, first + sizeof(double), sizeof(double));
+            std::memcpy(&value, first + 2 * sizeof(double), sizeof(ElementType));
+            batch.push_back(std::make_tuple(x, y, value));
+        }
+        return first != last ? 1 : 0;
+    }
+};
+
+template <typename ElementType>
+const size_t BinaryFormat<ElementType>::recordSize;
+
+/**
+ * Pipeline which runs ingest(). Chunks of the input are read in turns by all workers (so only
+ * one of them reads at once) and each worker parses the chunk it has read, computes location
+ * codes of its records and sorts them along the Z-order. The calling thread inserts parsed
+ * batches into the tree in the order of the input, so the result doesn't depend on the number of
+ * threads. It also reads and parses chunks when the next batch isn't ready, so it never waits for
+ * threads which couldn't be started.
+ */
+template <typename Tree, typename Format>
+class IngestPipeline
+{
+public:
+    typedef typename Format::element_type ElementType;
+    typedef std::tuple<double, double, ElementType> Record;
+    typedef std::vector<Record> Records;
+    // Elements located by a worker, which the tree takes without computing their codes again.
+    typedef typename Tree::StoredObject Located;
+    typedef std::vector<Located> Batch;
+
+    IngestPipeline(std::istream& in, Tree& tree, const Format& format,
+                   const IngestOptions& options, IngestProgress& progress)
+        : in(in), tree(tree), format(format), options(options), progress(progress),
+        threads(std::max(1u, options.threads)),
+        inFlight(options.chunksInFlight != 0 ? options.chunksInFlight : 2 * size_t(threads)),
+        batches(inFlight), ready(inFlight, false), nextChunk(0), insertedChunks(0),
+        reading(false), ended(false), failed(false), inserted(0)
+    {
+        if (options.chunkSize == 0)
+            throw std::invalid_argument("chunk size is 0");
+    }
+
+    /**
+     * @return Number of inserted elements.
+     */
+    size_t run()
+    {
+        auto work = [this](unsigned worker) {
+            try
+            {
+                this->work(worker);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!error)
+                    error = std::current_exception();
+                failed = true;
+                changed.notify_all();
+            }
+        };
+        runWorkers(threads, work);
+
+        if (error)
+            std::rethrow_exception(error);
+        return inserted;
+    }
+
+private:
+    void work(unsigned worker)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!failed)
+        {
+            size_t slot = insertedChunks % inFlight;
+            if (worker == 0 && ready[slot])
+            {
+                Batch batch;
+                batch.swap(batches[slot]);
+                lock.unlock();
+                tree.loadSorted(batch.begin(), batch.end());
+                size_t count = batch.size();
+                inserted += count;
+                progress.inserted += count;
+                batch = Batch();
+                lock.lock();
+                ready[slot] = false;
+                ++insertedChunks;
+                changed.notify_all();
+            }
+            else if (!reading && !ended && nextChunk - insertedChunks < inFlight)
+            {
+                size_t chunk = nextChunk++;
+                reading = true;
+                lock.unlock();
+                Batch batch = readAndParse();
+                lock.lock();
+                batches[chunk % inFlight].swap(batch);
+                ready[chunk % inFlight] = true;
+                changed.notify_all();
+            }
+            else if (ended && !reading && (worker != 0 || insertedChunks == nextChunk))
+            {
+                return;
+            }
+            else
+            {
+                changed.wait(lock);
+            }
+        }
+    }
+
+    /**
+     * Reads the next chunk, which is ended by the last complete record, and lets other workers
+     * read while it's parsed.
+     */
+    Batch readAndParse()
+    {
+        std::string chunk;
+        bool last;
+        try
+        {
+            last = read(chunk);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            reading = false;
+            throw;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            reading = false;
+            ended = last;
+            changed.notify_all();
+        }
+
+        Records parsed;
+        size_t rejected = format.parse(chunk.data(), chunk.data() + chunk.size(), parsed);
+        progress.records += parsed.size();
+        progress.rejected += rejected;
+        return located(parsed);
+    }
+
+    /**
+     * @return Whether the input ended.
+     */
+    bool read(std::string& chunk)
+    {
+        chunk.swap(carry);
+        carry.clear();
+        for (;;)
+        {
+            size_t old = chunk.size();
+            chunk.resize(old + options.chunkSize);
+            in.read(&chunk[old], static_cast<std::streamsize>(options.chunkSize));
+            size_t count = static_cast<size_t>(in.gcount());
+            chunk.resize(old + count);
+            progress.bytes += count;
+            if (in.bad())
+                throw std::runtime_error("cannot read input");
+            if (count < options.chunkSize)
+                return true;
+
+            size_t records = format.split(chunk.data(), chunk.size());
+            if (records != 0)
+            {
+                carry.assign(chunk, records, std::string::npos);
+                chunk.resize(records);
+                return false;
+            }
+        }
+    }
+
+    /**
+     * @return Records of a batch which lie in the tree range, with their location codes and in the
+     *         Z-order (records with equal codes keep their order).
+     */
+    Batch located(Records& batch) const
+    {
+        typedef decltype(std::declval<Located&>().location) Location;
+
+        std::vector<double> xs(batch.size());
+        std::vector<double> ys(batch.size());
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+            xs[i] = std::get<0>(batch[i]);
+            ys[i] = std::get<1>(batch[i]);
+        }
+        std::vector<typename Tree::code_type> codes(batch.size());
+        tree.encode(xs.data(), ys.data(), batch.size(), codes.data());
+
+        std::vector<std::pair<typename Tree::code_type, size_t> > order;
+        order.reserve(batch.size());
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+            if (tree.coordinatesAreOk(xs[i], ys[i]))
+                order.push_back(std::make_pair(codes[i], i));
+        }
+        std::sort(order.begin(), order.end());
+
+        Batch result;
+        result.reserve(order.size());
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            size_t index = order[i].second;
+            Location code;
+            code.key = order[i].first;
+            result.push_back(Located(std::move(code), Coordinates(xs[index], ys[index]),
+                                     std::move(std::get<2>(batch[index]))));
+        }
+        return result;
+    }
+
+    std::istream& in;
+    Tree& tree;
+    const Format& format;
+    const IngestOptions& options;
+    IngestProgress& progress;
+    unsigned threads;
+    size_t inFlight;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    // Parsed batches waiting for insertion, indexed by chunk number modulo inFlight.
+    std::vector<Batch> batches;
+    std::vector<bool> ready;
+    size_t nextChunk;
+    size_t insertedChunks;
+    bool reading;
+    bool ended;
+    bool failed;
+    std::exception_ptr error;
+    // Beginning of a record which didn't fit into the previous chunk. Used only by the reader.
+    std::string carry;
+    size_t inserted;
+};
+
+/**
+ * Loads points from a stream into a tree without reading the whole input into memory. The input
+ * is read in chunks, which are parsed, encoded and sorted along the Z-order by many threads, while
+ * the calling thread hands sorted batches over to the tree as bulkLoad() would, without locating
+ * them again (so an empty tree is built by the bulk builder from the first batch and other batches
+ * are inserted in the Z-order).
+ * At most options.chunksInFlight chunks are held in memory at once: reading waits until the tree
+ * catches up.
+ *
+ * Batches are inserted in the order of the input, so the resulting tree doesn't depend on the
+ * number of threads. Records outside of the tree range are skipped, as by bulkLoad().
+ *
+ * If anything throws (reading, parsing or inserting), no further chunks are read and the first
+ * exception is rethrown after all workers finish. Batches inserted before stay in the tree.
+ *
+ * @param  in       Input stream, e.g. a file opened in binary mode.
+ * @param  tree     Tree to insert into. It mustn't be used by other threads during ingest().
+ * @param  format   Format of records: CsvFormat, BinaryFormat or any class with the same split()
+ *                  and parse() methods.
+ * @param  options  Chunk size, number of threads and limit of chunks in memory.
+ * @param  progress Counters updated during ingestion (optional).
+ * @return          Number of inserted elements.
+ */
+template <typename Tree, typename Format>
+size_t ingest(std::istream& in, Tree& tree, const Format& format,
+              const IngestOptions& options = IngestOptions(), IngestProgress* progress = nullptr)
+{
+    IngestProgress ignored;
+    IngestPipeline<Tree, Format> pipeline(in, tree, format, options,
+                                          progress != nullptr ? *progress : ignored);
+    return pipeline.run();
+}
+
+} // namespace geo
+
+#endif
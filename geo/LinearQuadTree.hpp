@@ -0,0 +1,508 @@
+#ifndef GEO_LINEARQUADTREE_HPP_
+#define GEO_LINEARQUADTREE_HPP_
+
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+
+#include "internal/Coordinates.hpp"
+#include "internal/LocationCode.hpp"
+#include "internal/Morton.hpp"
+#include "internal/LeafIterator.hpp"
+
+namespace geo {
+
+/**
+* Pointerless (linear) Quad Tree.
+*
+* It divides a field exactly the same way as QuadTree does, but instead of keeping a hierarchy of
+* separately allocated nodes, it only stores leaves. Leaves are kept in an array sorted by Morton
+* keys (interleaved location codes) of their lower-left corners. Because leaves cover the whole
+* field without overlapping, a leaf containing a given point is found by a binary search on that
+* array and no pointers have to be followed. Iteration is a linear walk over the array.
+*
+* The array is cut into blocks of at most maxBlockLeaves consecutive leaves and elements of all
+* leaves of a block are kept together in one vector, in the order of the leaves. So splitting or
+* merging leaves and inserting or erasing elements move only a single block, and leaves don't
+* allocate memory on their own. A block which grows too big is split in two.
+*
+* Iteration order is the same as in QuadTree (Z-order curve). Leaves are split and merged as in
+* QuadTree, so both trees divide the field the same way after the same modifications.
+*
+* @param ElementType Type of elements that will be stored inside LinearQuadTree.
+* @param maxLevels   Maximum number of tree levels (used for practical reasons). Must be higher than
+*                    0 and smaller than 32. Default is 10.
+*/
+template <typename ElementType, size_t maxLevels = 10>
+class LinearQuadTree
+{
+private:
+    typedef ObjectWithLocationCode<ElementType, maxLevels> StoredObject;
+    typedef std::vector<StoredObject> StoredObjects;
+    typedef typename LocationCode<maxLevels>::KeyType KeyType;
+
+    struct Leaf
+    {
+        Leaf(KeyType key, size_t level, size_t first) : key(key), level(level), first(first) {}
+
+        KeyType key;
+        size_t level;
+        // Position of the first element of the leaf in objects of its block.
+        size_t first;
+    };
+
+    struct Block
+    {
+        /**
+         * @return Position right after the last element of a given leaf.
+         */
+        size_t end(size_t leaf) const
+        {
+            return leaf + 1 < leaves.size() ? leaves[leaf + 1].first : objects.size();
+        }
+
+        size_t count(size_t leaf) const
+        {
+            return end(leaf) - leaves[leaf].first;
+        }
+
+        std::vector<Leaf> leaves;
+        StoredObjects objects;
+    };
+
+    typedef std::vector<Block> Blocks;
+
+    struct Position
+    {
+        Position(size_t block, size_t leaf) : block(block), leaf(leaf) {}
+
+        size_t block;
+        size_t leaf;
+    };
+
+    // Blocks are split when they have more leaves.
+    static const size_t maxBlockLeaves = 64;
+
+public:
+    typedef LeafIterator<Blocks, ElementType> iterator;
+
+public:
+    /**
+     * LinearQuadTree Constructor.
+     * Parameters startX, startY and nodeCapacity are set to 0.
+     *
+     *  @see LinearQuadTree(size_t width, int startX, int startY, capacity)
+     */
+    explicit LinearQuadTree(size_t width)
+        : width(width), startX(0), startY(0), nodeCapacity(0), elements(0),
+        tr(startX, startY, width, width)
+    {
+        checkRequirements();
+        clear();
+    }
+
+    /**
+     * LinearQuadTree Constructor
+     * Parameters startX and startY are set to 0.
+     *
+     *  @see LinearQuadTree(size_t width, int startX, int startY, capacity)
+     */
+    LinearQuadTree(size_t width, size_t capacity)
+        : width(width), startX(0), startY(0), nodeCapacity(capacity), elements(0),
+        tr(startX, startY, width, width)
+    {
+        checkRequirements();
+        clear();
+    }
+
+    /**
+     * LinearQuadTree Constructor
+     * Parameter capacity is set to 0.
+     *
+     *  @see LinearQuadTree(size_t width, int startX, int startY, capacity)
+     */
+    LinearQuadTree(size_t width, int startX, int startY)
+        : width(width), startX(startX), startY(startY), nodeCapacity(0), elements(0),
+        tr(startX, startY, width, width)
+    {
+        checkRequirements();
+        clear();
+    }
+
+    /**
+     * LinearQuadTree Constructor.
+     *
+     * @see QuadTree(size_t width, int startX, int startY, size_t capacity)
+     */
+    LinearQuadTree(size_t width, int startX, int startY, size_t capacity)
+        : width(width), startX(startX), startY(startY), nodeCapacity(capacity), elements(0),
+        tr(startX, startY, width, width)
+    {
+        checkRequirements();
+        clear();
+    }
+
+    iterator begin()
+    {
+        iterator it(&blocks, 0, 0);
+        it.skipEmpty();
+        return it;
+    }
+
+    iterator end()
+    {
+        return iterator(&blocks, blocks.size(), 0);
+    }
+
+    /**
+     * Clear the tree, removing and destroying all elements stored inside the LinearQuadTree
+     * container.
+     */
+    void clear()
+    {
+        blocks.clear();
+        blocks.push_back(Block());
+        blocks.back().leaves.push_back(Leaf(0, maxLevels - 1, 0));
+        elements = 0;
+    }
+
+    /**
+     * Removes from the LinearQuadTree container all elements that match given coordinates. They
+     * are then destroyed. Leaves are merged afterwards as in QuadTree::erase(double x, double y).
+     *
+     * @param x X-axis coordinate of the element to be removed.
+     * @param y Y-axis coordinate of the element to be removed.
+     */
+    void erase(double x, double y)
+    {
+        if (coordinatesAreOk(x, y))
+        {
+            LocationCode<maxLevels> code(tr.forward(Coordinates(x, y)));
+            Position at = findLeaf(code.key);
+            Block& block = blocks[at.block];
+            typename StoredObjects::iterator first =
+                block.objects.begin() + block.leaves[at.leaf].first;
+            typename StoredObjects::iterator last = block.objects.begin() + block.end(at.leaf);
+            typename StoredObjects::iterator kept = std::remove_if(first, last,
+                [&code](const StoredObject& object) { return code == object.location; });
+            size_t removed = static_cast<size_t>(last - kept);
+            if (removed == 0)
+                return;
+
+            block.objects.erase(kept, last);
+            for (size_t i = at.leaf + 1; i < block.leaves.size(); ++i)
+                block.leaves[i].first -= removed;
+            elements -= removed;
+            merge(at);
+        }
+    }
+
+    /**
+     * Insert a single element into LinearQuadtree at given coordinates.
+     *
+     * @see QuadTree::insert(double x, double y, const ElementType& val)
+     */
+    iterator insert(double x, double y, const ElementType& val)
+    {
+        if (coordinatesAreOk(x, y))
+        {
+            return insert(StoredObject(
+                LocationCode<maxLevels>(tr.forward(Coordinates(x, y))), val));
+        }
+        return iterator();
+    }
+
+    /**
+     * @see insert(double x, double y, const ElementType& newObject)
+     */
+    iterator insert(double x, double y, ElementType&& val)
+    {
+        if (coordinatesAreOk(x, y))
+        {
+            return insert(StoredObject(
+                LocationCode<maxLevels>(tr.forward(Coordinates(x, y))), std::move(val)));
+        }
+        return iterator();
+    }
+
+    /**
+     * Return the bounds of a range that includes all the elements that are near specified (x, y),
+     * i.e. stored in the same leaf.
+     *
+     * @see QuadTree::near(double x, double y)
+     */
+    std::pair<iterator, iterator> near(double x, double y)
+    {
+        if (coordinatesAreOk(x, y))
+        {
+            Position at = findLeaf(LocationCode<maxLevels>(tr.forward(Coordinates(x, y))).key);
+            const Block& block = blocks[at.block];
+            iterator first(&blocks, at.block, block.leaves[at.leaf].first);
+            first.skipEmpty();
+            iterator last(&blocks, at.block, block.end(at.leaf));
+            last.skipEmpty();
+            return std::pair<iterator, iterator>(first, last);
+        }
+        return std::pair<iterator, iterator>(end(), end());
+    }
+
+    /**
+     * @return Total number of elements in LinearQuadTree.
+     */
+    size_t size() const
+    {
+        return elements;
+    }
+
+    /**
+     * @return Number of leaves (including empty ones) which the field is currently divided into.
+     */
+    size_t leafCount() const
+    {
+        size_t count = 0;
+        for (size_t i = 0; i < blocks.size(); ++i)
+            count += blocks[i].leaves.size();
+        return count;
+    }
+
+private:
+    void checkRequirements()
+    {
+        if (maxLevels < 1)
+            throw std::invalid_argument("maximum levels number is less than 1");
+        if (maxLevels > 32)
+            throw std::invalid_argument("maximum levels number is too big");
+        if (width < 1)
+            throw std::invalid_argument("size is less than 1");
+        if (((width - 1) & width) != 0)
+            throw std::invalid_argument("size is not power of 2");
+    }
+
+    bool coordinatesAreOk(double x, double y) const
+    {
+        if (x >= startX + width || y >= startY + width || x < startX || y < startY)
+            return false;
+        return true;
+    }
+
+    static bool keyLess(KeyType key, const Leaf& leaf)
+    {
+        return key < leaf.key;
+    }
+
+    static bool leafLess(const Leaf& leaf, KeyType key)
+    {
+        return leaf.key < key;
+    }
+
+    static bool blockLess(KeyType key, const Block& block)
+    {
+        return key < block.leaves.front().key;
+    }
+
+    static bool objectLess(const StoredObject& object, KeyType key)
+    {
+        return object.location.key < key;
+    }
+
+    /**
+     * Returns a position of a leaf which covers a given Morton key. Leaves cover the whole field,
+     * so it's always the last leaf which starts at or before the key.
+     */
+    Position findLeaf(KeyType key) const
+    {
+        typename Blocks::const_iterator block =
+            std::upper_bound(blocks.begin(), blocks.end(), key, blockLess) - 1;
+        typename std::vector<Leaf>::const_iterator leaf =
+            std::upper_bound(block->leaves.begin(), block->leaves.end(), key, keyLess) - 1;
+        return Position(static_cast<size_t>(block - blocks.begin()),
+                        static_cast<size_t>(leaf - block->leaves.begin()));
+    }
+
+    Position next(Position at) const
+    {
+        if (++at.leaf == blocks[at.block].leaves.size())
+        {
+            ++at.block;
+            at.leaf = 0;
+        }
+        return at;
+    }
+
+    /**
+     * Replaces a leaf with its 4 children and distributes its elements among them. Elements of
+     * each child keep their order.
+     */
+    void split(const Position& at)
+    {
+        Block& block = blocks[at.block];
+        Leaf& leaf = block.leaves[at.leaf];
+        size_t childLevel = leaf.level - 1;
+        KeyType childSpan = static_cast<KeyType>(morton::span(childLevel));
+        KeyType key = leaf.key;
+
+        typename StoredObjects::iterator first = block.objects.begin() + leaf.first;
+        typename StoredObjects::iterator last = block.objects.begin() + block.end(at.leaf);
+        std::stable_sort(first, last, [childSpan](const StoredObject& a, const StoredObject& b) {
+            return a.location.key / childSpan < b.location.key / childSpan;
+        });
+
+        leaf.level = childLevel;
+        Leaf child = leaf;
+        block.leaves.insert(block.leaves.begin() + at.leaf + 1, 3, child);
+        for (size_t i = 1; i < 4; ++i)
+        {
+            Leaf& sibling = block.leaves[at.leaf + i];
+            sibling.key = key + static_cast<KeyType>(i) * childSpan;
+            first = std::lower_bound(first, last, sibling.key, objectLess);
+            sibling.first = static_cast<size_t>(first - block.objects.begin());
+        }
+    }
+
+    /**
+     * Splits a block which has too many leaves in two halves.
+     *
+     * @return Position of a given leaf afterwards.
+     */
+    Position balance(Position at)
+    {
+        if (blocks[at.block].leaves.size() <= maxBlockLeaves)
+            return at;
+
+        Block& block = blocks[at.block];
+        size_t half = block.leaves.size() / 2;
+        size_t offset = block.leaves[half].first;
+        Block upper;
+        upper.leaves.assign(block.leaves.begin() + half, block.leaves.end());
+        for (size_t i = 0; i < upper.leaves.size(); ++i)
+            upper.leaves[i].first -= offset;
+        upper.objects.assign(std::make_move_iterator(block.objects.begin() + offset),
+                             std::make_move_iterator(block.objects.end()));
+        block.leaves.erase(block.leaves.begin() + half, block.leaves.end());
+        block.objects.erase(block.objects.begin() + offset, block.objects.end());
+        blocks.insert(blocks.begin() + at.block + 1, std::move(upper));
+
+        return at.leaf < half ? at : Position(at.block + 1, at.leaf - half);
+    }
+
+    iterator insert(StoredObject&& toStore)
+    {
+        KeyType key = toStore.location.key;
+        Position at = findLeaf(key);
+
+        // @see QuadTree::insert(StoredObject&&)
+        while (blocks[at.block].count(at.leaf) == nodeCapacity &&
+               blocks[at.block].leaves[at.leaf].level > 0)
+        {
+            const Leaf& leaf = blocks[at.block].leaves[at.leaf];
+            KeyType leafKey = leaf.key;
+            KeyType childSpan = static_cast<KeyType>(morton::span(leaf.level - 1));
+            split(at);
+            at.leaf += static_cast<size_t>((key - leafKey) / childSpan);
+            at = balance(at);
+        }
+
+        Block& block = blocks[at.block];
+        size_t position = block.end(at.leaf);
+        block.objects.insert(block.objects.begin() + position, std::move(toStore));
+        for (size_t i = at.leaf + 1; i < block.leaves.size(); ++i)
+            ++block.leaves[i].first;
+        ++elements;
+        return iterator(&blocks, at.block, position);
+    }
+
+    /**
+     * @return Number of elements in leaves which start at a given one and at keys below end, or
+     *         any number above limit if there are more of them.
+     */
+    size_t countUpTo(Position at, KeyType end, size_t limit) const
+    {
+        size_t count = 0;
+        while (at.block < blocks.size() && blocks[at.block].leaves[at.leaf].key < end)
+        {
+            count += blocks[at.block].count(at.leaf);
+            if (count > limit)
+                break;
+            at = next(at);
+        }
+        return count;
+    }
+
+    /**
+     * Merges the biggest subtree above a given leaf, which has no more than nodeCapacity elements,
+     * into a single leaf. @see QuadTree::shrinkPath()
+     */
+    void merge(const Position& at)
+    {
+        KeyType key = blocks[at.block].leaves[at.leaf].key;
+        size_t level = blocks[at.block].leaves[at.leaf].level;
+        for (; level + 1 < maxLevels; ++level)
+        {
+            KeyType span = static_cast<KeyType>(morton::span(level + 1));
+            KeyType parentKey = key - key % span;
+            if (countUpTo(findLeaf(parentKey), parentKey + span, nodeCapacity) > nodeCapacity)
+                break;
+            key = parentKey;
+        }
+        if (level != blocks[at.block].leaves[at.leaf].level)
+            collapse(key, level);
+    }
+
+    /**
+     * Replaces all leaves of a subtree with a single leaf, which takes their elements in the
+     * order of leaves.
+     */
+    void collapse(KeyType key, size_t level)
+    {
+        KeyType end = key + static_cast<KeyType>(morton::span(level));
+        Position at = findLeaf(key);
+        Block& block = blocks[at.block];
+
+        // When the subtree continues in the following blocks, it covers the rest of this block,
+        // so their elements are appended to it.
+        while (at.block + 1 < blocks.size() && blocks[at.block + 1].leaves.front().key < end)
+        {
+            Block& following = blocks[at.block + 1];
+            size_t leaves = static_cast<size_t>(
+                std::lower_bound(following.leaves.begin(), following.leaves.end(), end, leafLess) -
+                following.leaves.begin());
+            size_t objects = leaves < following.leaves.size() ? following.leaves[leaves].first :
+                                                                following.objects.size();
+            block.objects.insert(block.objects.end(),
+                                 std::make_move_iterator(following.objects.begin()),
+                                 std::make_move_iterator(following.objects.begin() + objects));
+            following.objects.erase(following.objects.begin(),
+                                    following.objects.begin() + objects);
+            following.leaves.erase(following.leaves.begin(), following.leaves.begin() + leaves);
+            for (size_t i = 0; i < following.leaves.size(); ++i)
+                following.leaves[i].first -= objects;
+            if (following.leaves.empty())
+                blocks.erase(blocks.begin() + at.block + 1);
+        }
+
+        typename std::vector<Leaf>::iterator last = std::lower_bound(
+            block.leaves.begin() + at.leaf + 1, block.leaves.end(), end, leafLess);
+        block.leaves.erase(block.leaves.begin() + at.leaf + 1, last);
+        block.leaves[at.leaf].level = level;
+    }
+
+private:
+    size_t width;
+    size_t startX;
+    size_t startY;
+    size_t nodeCapacity;
+    size_t elements;
+
+    CoordTr<0, 0, 1, 1> tr;
+    Blocks blocks;
+};
+
+template <typename ElementType, size_t maxLevels>
+const size_t LinearQuadTree<ElementType, maxLevels>::maxBlockLeaves;
+
+} // namespace geo
+
+#endif
@@ -0,0 +1,447 @@
+#ifndef GEO_MAPPEDQUADTREE_HPP_
+#define GEO_MAPPEDQUADTREE_HPP_
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <system_error>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define GEO_HAS_MMAP 1
+#endif
+
+#include "internal/Coordinates.hpp"
+#include "internal/LocationCode.hpp"
+#include "internal/Morton.hpp"
+#include "internal/LeafScan.hpp"
+#include "internal/Regions.hpp"
+#include "internal/TreeImage.hpp"
+
+namespace geo {
+
+/**
+ * Read-only tree which queries a binary image written by QuadTree::save() in place, e.g. straight
+ * from a memory-mapped file (@see MappedFile). Nothing is copied or allocated, so processes which
+ * map the same file share its pages. Opening a tree checks only its leaves, which are few compared
+ * to elements, so that corrupted images are rejected instead of being read out of bounds.
+ *
+ * Elements of an image are kept in a single array in the Z-order, so iterators are plain pointers
+ * and iteration order is the same as in QuadTree. Leaves are found by binary searches over a
+ * flat array of their Morton keys. Queries give the same results as in the saved QuadTree.
+ *
+ * The image must stay valid (e.g. mapped) as long as the tree is used. Element type must be
+ * trivially copyable, since elements are saved byte by byte.
+ *
+ * @param ElementType      Type of saved elements.
+ * @param maxLevels        Maximum number of levels of the saved tree.
+ * @param storeCoordinates Whether the saved tree stores original coordinates of elements.
+ */
+template <typename ElementType, size_t maxLevels = 10, bool storeCoordinates = false>
+class MappedQuadTree
+{
+private:
+    typedef typename LocationCode<maxLevels>::KeyType KeyType;
+    typedef std::integral_constant<bool, storeCoordinates> StoresCoordinates;
+
+public:
+    typedef const ElementType* const_iterator;
+    typedef KeyType code_type;
+
+public:
+    /**
+     * Opens a tree image.
+     *
+     * @param data Beginning of the image. It must be aligned at least to 8 bytes (and to the
+     *             alignment of ElementType, when it's bigger), as mapped memory always is.
+     * @param size Size of the image in bytes.
+     * @throws std::invalid_argument when the data isn't an image of a tree with given parameters
+     *         or it's truncated or malformed.
+     */
+    MappedQuadTree(const void* data, size_t size)
+        : base(static_cast<const char*>(data)), header(readHeader(data, size)),
+        leaves(reinterpret_cast<const image::Leaf*>(base + header.leaves)),
+        codes(reinterpret_cast<const KeyType*>(base + header.codes)),
+        objects(reinterpret_cast<const ElementType*>(base + header.objects)),
+        xs(reinterpret_cast<const double*>(base + header.xs)),
+        ys(reinterpret_cast<const double*>(base + header.ys)),
+        tr(static_cast<int>(header.startX), static_cast<int>(header.startY),
+           static_cast<size_t>(header.width), static_cast<size_t>(header.width))
+    {
+        checkLeaves();
+    }
+
+    const_iterator begin() const
+    {
+        return objects;
+    }
+
+    const_iterator end() const
+    {
+        return objects + header.elementCount;
+    }
+
+    /**
+     * @return Total number of elements in the tree.
+     */
+    size_t size() const
+    {
+        return static_cast<size_t>(header.elementCount);
+    }
+
+    /**
+     * @return Width of the field covered by the saved tree.
+     */
+    size_t width() const
+    {
+        return static_cast<size_t>(header.width);
+    }
+
+    int startX() const
+    {
+        return static_cast<int>(header.startX);
+    }
+
+    int startY() const
+    {
+        return static_cast<int>(header.startY);
+    }
+
+    /**
+     * @return Capacity of nodes of the saved tree.
+     */
+    size_t capacity() const
+    {
+        return static_cast<size_t>(header.capacity);
+    }
+
+    /**
+     * @return Location code of an element at a given position of the Z-order.
+     */
+    code_type code(size_t i) const
+    {
+        return codes[i];
+    }
+
+    /**
+     * @return Original coordinates of an element at a given position of the Z-order. Available
+     *         only when the saved tree stores them.
+     */
+    Coordinates coordinates(size_t i) const
+    {
+        static_assert(storeCoordinates, "coordinates aren't stored");
+        return Coordinates(xs[i], ys[i]);
+    }
+
+    /**
+     * Return the bounds of a range that includes all the elements that are near specified (x, y),
+     * i.e. stored in the same leaf.
+     *
+     * @see QuadTree::near(double x, double y)
+     */
+    std::pair<const_iterator, const_iterator> near(double x, double y) const
+    {
+        if (!coordinatesAreOk(x, y))
+            return std::make_pair(end(), end());
+
+        KeyType key = LocationCode<maxLevels>(tr.forward(Coordinates(x, y))).key;
+        size_t next = findLeaves(uint64_t(key) + 1, 0, static_cast<size_t>(header.leafCount));
+        if (next == 0 || leaves[next - 1].key + morton::span(leaves[next - 1].level) <= key)
+            return std::make_pair(objects + leaves[next].first, objects + leaves[next].first);
+        return std::make_pair(objects + leaves[next - 1].first, objects + leaves[next].first);
+    }
+
+    /**
+     * Calls a given visitor for each element inside a rectangle.
+     *
+     * @see QuadTree::withinRect()
+     */
+    template <typename Visitor>
+    Visitor withinRect(double minX, double minY, double maxX, double maxY, Visitor visitor) const
+    {
+        Box cells = { toCellsX(minX), toCellsY(minY), toCellsX(maxX), toCellsY(maxY) };
+        RectRegion region(cells, minX, minY, maxX, maxY);
+        visitInRegion(0, maxLevels - 1, 0, static_cast<size_t>(header.leafCount), region, visitor);
+        return visitor;
+    }
+
+    /**
+     * Calls a given visitor for each element inside a circle.
+     *
+     * @see QuadTree::withinRadius()
+     */
+    template <typename Visitor>
+    Visitor withinRadius(double x, double y, double radius, Visitor visitor) const
+    {
+        if (radius < 0)
+            return visitor;
+        double cellRadius = radius / static_cast<double>(header.width) * cellsPerSide();
+        CircleRegion region(toCellsX(x), toCellsY(y), cellRadius * cellRadius, x, y,
+                            radius * radius);
+        visitInRegion(0, maxLevels - 1, 0, static_cast<size_t>(header.leafCount), region, visitor);
+        return visitor;
+    }
+
+private:
+    typedef region::Box Box;
+    typedef region::Rect RectRegion;
+    typedef region::Circle CircleRegion;
+
+    /**
+     * Marks elements from [first, first + count) which are inside a region.
+     */
+    template <typename Region>
+    void match(const Region& region, size_t first, size_t count, uint64_t* mask,
+               std::true_type) const
+    {
+        region.match(codes + first, xs + first, ys + first, count, mask, std::true_type());
+    }
+
+    template <typename Region>
+    void match(const Region& region, size_t first, size_t count, uint64_t* mask,
+               std::false_type) const
+    {
+        region.match(codes + first, nullptr, nullptr, count, mask, std::false_type());
+    }
+
+    static const size_t scanBlock = 256;
+
+    /**
+     * @return Header of a given image.
+     * @throws std::invalid_argument when the image doesn't match the tree's parameters.
+     */
+    static image::Header readHeader(const void* data, size_t size)
+    {
+        static_assert(std::is_trivially_copyable<ElementType>::value,
+                      "only trivially copyable elements might be mapped");
+        if (size < sizeof(image::Header) || reinterpret_cast<uintptr_t>(data) % 8 != 0)
+            throw std::invalid_argument("not a tree image");
+        image::Header header;
+        std::memcpy(&header, data, sizeof(header));
+        if (std::memcmp(header.magic, image::magic, sizeof(image::magic)) != 0 ||
+            header.version != image::version || header.byteOrder != image::byteOrder)
+            throw std::invalid_argument("not a tree image");
+        if (header.maxLevels != maxLevels || header.keySize != sizeof(KeyType) ||
+            header.elementSize != sizeof(ElementType) ||
+            header.elementAlignment != alignof(ElementType) ||
+            header.coordinates != (storeCoordinates ? 1u : 0u))
+            throw std::invalid_argument("tree image has different parameters");
+
+        image::Header expected = header;
+        if (!image::layOut(expected) || header.width == 0 ||
+            (header.width & (header.width - 1)) != 0 || expected.leaves != header.leaves ||
+            expected.codes != header.codes || expected.objects != header.objects ||
+            expected.xs != header.xs || expected.ys != header.ys || expected.size != header.size ||
+            header.size > size ||
+            (reinterpret_cast<uintptr_t>(data) + header.objects) % alignof(ElementType) != 0)
+            throw std::invalid_argument("tree image is malformed or truncated");
+        return header;
+    }
+
+    /**
+     * Checks that leaves are disjoint cells of the tree sorted in the Z-order and that they split
+     * elements into consecutive ranges closed by the sentinel, which queries rely on.
+     *
+     * @throws std::invalid_argument when they aren't.
+     */
+    void checkLeaves() const
+    {
+        uint64_t keys = morton::span(maxLevels - 1);
+        uint64_t nextKey = 0;
+        uint64_t first = 0;
+        for (uint64_t i = 0; i < header.leafCount; ++i)
+        {
+            const image::Leaf& leaf = leaves[i];
+            if (leaf.level >= maxLevels || leaf.key < nextKey || leaf.key >= keys ||
+                leaf.key % morton::span(leaf.level) != 0 || leaf.first < first ||
+                leaf.first > header.elementCount)
+                throw std::invalid_argument("tree image is malformed");
+            nextKey = leaf.key + morton::span(leaf.level);
+            first = leaf.first;
+        }
+        if (leaves[header.leafCount].first != header.elementCount)
+            throw std::invalid_argument("tree image is malformed or truncated");
+    }
+
+    bool coordinatesAreOk(double x, double y) const
+    {
+        double width = static_cast<double>(header.width);
+        double startX = static_cast<double>(header.startX);
+        double startY = static_cast<double>(header.startY);
+        return x >= startX && x < startX + width && y >= startY && y < startY + width;
+    }
+
+    static double cellsPerSide()
+    {
+        return static_cast<double>(uint64_t(1) << (maxLevels - 1));
+    }
+
+    double toCellsX(double x) const
+    {
+        return ((x - static_cast<double>(header.startX)) / static_cast<double>(header.width)) *
+               cellsPerSide();
+    }
+
+    double toCellsY(double y) const
+    {
+        return ((y - static_cast<double>(header.startY)) / static_cast<double>(header.width)) *
+               cellsPerSide();
+    }
+
+    /**
+     * @return Index of the first leaf from [first, last) whose key isn't lower than a given one.
+     */
+    size_t findLeaves(uint64_t key, size_t first, size_t last) const
+    {
+        const image::Leaf* found = std::lower_bound(leaves + first, leaves + last, key,
+            [](const image::Leaf& leaf, uint64_t key) { return leaf.key < key; });
+        return static_cast<size_t>(found - leaves);
+    }
+
+    /**
+     * Visits elements of a given region inside a cell of the implicit tree, whose non-empty
+     * leaves are [firstLeaf, lastLeaf). Cells are descended until they're either fully inside the
+     * region or they're leaves themselves.
+     */
+    template <typename Region, typename Visitor>
+    void visitInRegion(uint64_t key, size_t level, size_t firstLeaf, size_t lastLeaf,
+                       const Region& region, Visitor& visitor) const
+    {
+        if (firstLeaf == lastLeaf)
+            return;
+
+        LocationCode<maxLevels> code;
+        code.key = static_cast<KeyType>(key);
+        double side = static_cast<double>(uint64_t(1) << level);
+        Box box = { static_cast<double>(code.x()), static_cast<double>(code.y()), 0, 0 };
+        box.maxX = box.minX + side;
+        box.maxY = box.minY + side;
+        if (!region.intersects(box))
+            return;
+
+        size_t first = static_cast<size_t>(leaves[firstLeaf].first);
+        size_t last = static_cast<size_t>(leaves[lastLeaf].first);
+        if (region.contains(box))
+        {
+            for (size_t i = first; i < last; ++i)
+                visitor(objects[i]);
+            return;
+        }
+
+        if (lastLeaf - firstLeaf == 1 && leaves[firstLeaf].level == level)
+        {
+            uint64_t mask[scanBlock / 64];
+            for (size_t block = first; block < last; block += scanBlock)
+            {
+                size_t count = std::min(scanBlock, last - block);
+                match(region, block, count, mask, StoresCoordinates());
+                for (size_t word = 0; word < scan::maskWords(count); ++word)
+                {
+                    for (uint64_t bits = mask[word]; bits != 0; bits &= bits - 1)
+                        visitor(objects[block + word * 64 + scan::lowestBit(bits)]);
+                }
+            }
+            return;
+        }
+
+        uint64_t childSpan = morton::span(level - 1);
+        for (uint32_t childNo = 0; childNo < 4; ++childNo)
+        {
+            size_t childLast = childNo == 3 ? lastLeaf :
+                findLeaves(key + (childNo + 1) * childSpan, firstLeaf, lastLeaf);
+            visitInRegion(key + childNo * childSpan, level - 1, firstLeaf, childLast, region,
+                          visitor);
+            firstLeaf = childLast;
+        }
+    }
+
+    const char* base;
+    image::Header header;
+    const image::Leaf* leaves;
+    const KeyType* codes;
+    const ElementType* objects;
+    const double* xs;
+    const double* ys;
+    CoordTr<0, 0, 1, 1> tr;
+};
+
+template <typename ElementType, size_t maxLevels, bool storeCoordinates>
+const size_t MappedQuadTree<ElementType, maxLevels, storeCoordinates>::scanBlock;
+
+#ifdef GEO_HAS_MMAP
+/**
+ * Read-only memory mapping of a whole file, e.g. of a tree image. @see MappedQuadTree
+ */
+class MappedFile
+{
+public:
+    /**
+     * Maps a given file.
+     *
+     * @throws std::system_error when the file can't be opened or mapped.
+     */
+    explicit MappedFile(const std::string& path) : address(nullptr), length(0)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::system_error(errno, std::generic_category(), "cannot open " + path);
+        struct stat status;
+        if (::fstat(fd, &status) != 0)
+        {
+            int error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), "cannot stat " + path);
+        }
+        length = static_cast<size_t>(status.st_size);
+        if (length > 0)
+        {
+            address = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+            if (address == MAP_FAILED)
+            {
+                int error = errno;
+                ::close(fd);
+                address = nullptr;
+                throw std::system_error(error, std::generic_category(), "cannot map " + path);
+            }
+        }
+        ::close(fd);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile()
+    {
+        if (address != nullptr)
+            ::munmap(address, length);
+    }
+
+    const void* data() const
+    {
+        return address;
+    }
+
+    size_t size() const
+    {
+        return length;
+    }
+
+private:
+    void* address;
+    size_t length;
+};
+#endif
+
+} // namespace geo
+
+#endif
@@ -2,18 +2,49 @@
 #define GEO_QUADTREE_HPP_
 
 #include <stdexcept>
+#include <exception>
 #include <utility>
 #include <iterator>
 #include <type_traits>
 #include <cstring>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <tuple>
+#include <queue>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <istream>
+#include <ostream>
+
+#if defined(__has_include) && __cplusplus >= 201703L
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#endif
+#endif
 
 #include "internal/QuadNode.hpp"
 #include "internal/Coordinates.hpp"
 #include "internal/LocationCode.hpp"
 #include "internal/TreeNodeIterator.hpp"
+#include "internal/Parallel.hpp"
+#include "internal/MortonBatch.hpp"
+#include "internal/LeafScan.hpp"
+#include "internal/Regions.hpp"
+#include "internal/Epoch.hpp"
+#include "internal/SlotMap.hpp"
+#include "internal/TreeImage.hpp"
+#include "MappedQuadTree.hpp"
 
 namespace geo {
 
+template <typename Tree, typename Format>
+class IngestPipeline;
+
 /**
 * Main class to construct a Quad Tree.
 *
@@ -30,16 +61,187 @@ namespace geo {
 * @param ElementType Type of elements that will be stored inside QuadTree.
 * @param maxLevels   Maximum number of tree levels (used for practical reasons). Must be higher than
 *                    0 and smaller than 32. Default is 10.
+* @param Allocator   Allocator used for all memory allocated by QuadTree: both nodes and elements
+*                    stored inside them. Default is std::allocator. @see geo::pmr::QuadTree.
+* @param storeCoordinates Whether original coordinates of elements are stored next to them. By
+*                    default only location codes are stored, so positions of elements are known
+*                    with the precision of the smallest tree nodes and queries (e.g. withinRadius())
+*                    are exact only up to that precision. Storing coordinates makes queries exact at
+*                    the cost of additional memory. Default is false.
 */
-template <typename ElementType, size_t maxLevels = 10>
+template <typename ElementType, size_t maxLevels = 10,
+          typename Allocator = std::allocator<ElementType>, bool storeCoordinates = false>
 class QuadTree
 {
 private:
-    typedef ObjectWithLocationCode<ElementType, maxLevels> StoredObject;
-    typedef QuadNode<ElementType, maxLevels> TreeNode;
+    typedef ObjectWithLocationCode<ElementType, maxLevels, storeCoordinates> StoredObject;
+    typedef QuadNode<ElementType, maxLevels, Allocator, storeCoordinates> TreeNode;
+    typedef std::integral_constant<bool, storeCoordinates> StoresCoordinates;
+    typedef typename std::allocator_traits<Allocator>::template rebind_alloc<StoredObject>
+        StoredObjectAllocator;
+    typedef std::vector<StoredObject, StoredObjectAllocator> StoredObjects;
+    typedef SlotMap<TreeNode, Allocator> TreeSlots;
 
 public:
     typedef TreeNodeIterator<TreeNode> iterator;
+    typedef TreeNodeIterator<const TreeNode> const_iterator;
+    typedef Allocator allocator_type;
+    typedef typename LocationCode<maxLevels>::KeyType code_type;
+    typedef ElementHandle handle_type;
+
+private:
+    struct SnapshotRegistry;
+
+public:
+    /**
+     * Read-only view of the tree as it was when the snapshot was taken (@see snapshot()). Nodes
+     * are shared with the tree until the tree modifies them, so the snapshot costs no copying
+     * itself. It's immutable, so its methods might be called by many threads at once, also
+     * concurrently with modifications of the tree. Snapshots might be copied and destroyed by any
+     * thread as well.
+     *
+     * Nodes belong to the tree, so a snapshot must be destroyed before the tree is destroyed or
+     * assigned to.
+     */
+    class Snapshot
+    {
+    public:
+        /**
+         * Creates an empty snapshot, which doesn't refer to any tree.
+         */
+        Snapshot() : tree(nullptr), node(nullptr) {}
+
+        Snapshot(const Snapshot& that) : tree(that.tree), registry(that.registry), node(that.node)
+        {
+            if (node != nullptr)
+            {
+                node->addReference();
+                registry->live.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        Snapshot(Snapshot&& that) : tree(that.tree), registry(std::move(that.registry)),
+            node(that.node)
+        {
+            that.tree = nullptr;
+            that.node = nullptr;
+        }
+
+        Snapshot& operator=(Snapshot that)
+        {
+            std::swap(tree, that.tree);
+            registry.swap(that.registry);
+            std::swap(node, that.node);
+            return *this;
+        }
+
+        ~Snapshot()
+        {
+            reset();
+        }
+
+        /**
+         * Releases the snapshot, which becomes empty. Nodes used only by the snapshot are freed by
+         * the next modification of the tree, because the tree's pool is used by a single thread.
+         */
+        void reset()
+        {
+            if (node == nullptr)
+                return;
+            {
+                std::lock_guard<std::mutex> lock(registry->mutex);
+                registry->released.push_back(node);
+                registry->pending.store(true, std::memory_order_relaxed);
+            }
+            registry->live.fetch_sub(1, std::memory_order_release);
+            registry.reset();
+            tree = nullptr;
+            node = nullptr;
+        }
+
+        /**
+         * @return Number of elements in the snapshot.
+         */
+        size_t size() const
+        {
+            return node != nullptr ? node->totalCount() : 0;
+        }
+
+        /**
+         * Calls a given visitor for each element, in the Z-order.
+         */
+        template <typename Visitor>
+        Visitor forEach(Visitor visitor) const
+        {
+            if (node != nullptr)
+                visitSubtree(rootNode(), visitor);
+            return visitor;
+        }
+
+        /**
+         * @see QuadTree::withinRect()
+         */
+        template <typename Visitor>
+        Visitor withinRect(double minX, double minY, double maxX, double maxY,
+                           Visitor visitor) const
+        {
+            if (node != nullptr)
+                visitInRegion(rootNode(), tree->rectRegion(minX, minY, maxX, maxY), visitor);
+            return visitor;
+        }
+
+        /**
+         * @see QuadTree::countInRect()
+         */
+        size_t countInRect(double minX, double minY, double maxX, double maxY) const
+        {
+            if (node == nullptr)
+                return 0;
+            return countInRegion(rootNode(), tree->rectRegion(minX, minY, maxX, maxY));
+        }
+
+        /**
+         * @see QuadTree::withinRadius()
+         */
+        template <typename Visitor>
+        Visitor withinRadius(double x, double y, double radius, Visitor visitor) const
+        {
+            if (node != nullptr && radius >= 0)
+                visitInRegion(rootNode(), tree->circleRegion(x, y, radius), visitor);
+            return visitor;
+        }
+
+        /**
+         * @see QuadTree::parallelForEach()
+         */
+        template <typename Visitor>
+        void parallelForEach(Visitor visitor,
+                             unsigned threads = std::thread::hardware_concurrency()) const
+        {
+            if (node != nullptr)
+                parallelVisit(rootNode(), threads, WorkerVisitor<Visitor>(visitor));
+        }
+
+    private:
+        friend class QuadTree;
+
+        Snapshot(const QuadTree* tree, const std::shared_ptr<SnapshotRegistry>& registry,
+                 TreeNode* node)
+            : tree(tree), registry(registry), node(node)
+        {
+            node->addReference();
+            registry->live.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        const TreeNode* rootNode() const
+        {
+            return node;
+        }
+
+        const QuadTree* tree;
+        std::shared_ptr<SnapshotRegistry> registry;
+        TreeNode* node;
+    };
 
 public:
     /**
@@ -48,9 +250,10 @@ public:
      *
      *  @see QuadTree(size_t width, int startX, int startY, capacity)
      */
-    explicit QuadTree(size_t width)
+    explicit QuadTree(size_t width, const Allocator& alloc = Allocator())
         : width(width), startX(0), startY(0), nodeCapacity(0),
-        tr(startX, startY, width, width)
+        tr(startX, startY, width, width), root(alloc), epochs(nullptr), retired(alloc),
+        handles(alloc)
     {
         checkRequirements();
     }
@@ -61,9 +264,10 @@ public:
      *
      *  @see QuadTree(size_t width, int startX, int startY, capacity)
      */
-    QuadTree(size_t width, size_t capacity)
+    QuadTree(size_t width, size_t capacity, const Allocator& alloc = Allocator())
         : width(width), startX(0), startY(0), nodeCapacity(capacity),
-        tr(startX, startY, width, width)
+        tr(startX, startY, width, width), root(alloc), epochs(nullptr), retired(alloc),
+        handles(alloc)
     {
         checkRequirements();
     }
@@ -74,9 +278,10 @@ public:
      *
      *  @see QuadTree(size_t width, int startX, int startY, capacity)
      */
-    QuadTree(size_t width, int startX, int startY)
+    QuadTree(size_t width, int startX, int startY, const Allocator& alloc = Allocator())
         : width(width), startX(startX), startY(startY), nodeCapacity(0),
-        tr(startX, startY, width, width)
+        tr(startX, startY, width, width), root(alloc), epochs(nullptr), retired(alloc),
+        handles(alloc)
     {
         checkRequirements();
     }
@@ -92,52 +297,359 @@ public:
      *                 can be stored in one node. An exception are nodes at the maximum level of the
      *                 tree which shall store all remaining elements inserted into QuadTree (because
      *                 QuadTree doesn't have a limit to maximum number of stored elements).
+     * @param alloc    Allocator instance used by the tree.
      */
-    QuadTree(size_t width, int startX, int startY, size_t capacity)
+    QuadTree(size_t width, int startX, int startY, size_t capacity,
+             const Allocator& alloc = Allocator())
         : width(width), startX(startX), startY(startY), nodeCapacity(capacity),
-        tr(startX, startY, width, width)
+        tr(startX, startY, width, width), root(alloc), epochs(nullptr), retired(alloc),
+        handles(alloc)
     {
         checkRequirements();
     }
 
     ~QuadTree() {}
 
+    allocator_type get_allocator() const
+    {
+        return root.get_allocator();
+    }
+
+    /**
+     * Switches the tree to the concurrent reads mode, in which const methods (queries, near() and
+     * iteration with const_iterator) might be called by many threads while a single thread
+     * modifies the tree. Readers must hold a guard of a given domain while they read (@see
+     * read()), e.g. for the whole query and for as long as they use returned const_iterators.
+     *
+     * In this mode a node which receives or loses elements is never modified in place. It's
+     * copied instead and the copy (split into a new subtree, if needed) replaces the original
+     * node atomically, so readers see either the old or the new version of each node. Replaced
+     * nodes are freed only after all readers which might have seen them release their guards.
+     * Counts of elements (@see size(), countInRect()) are updated separately, so they might
+     * briefly disagree with published nodes. Iterators returned by insert() are valid until the
+     * next modification.
+     *
+     * Domain might be shared by many trees. It must outlive the tree or the mode must be disabled.
+     *
+     * @throws std::logic_error when snapshots of the tree exist. @see snapshot()
+     */
+    void enableConcurrentReads(EpochDomain& domain)
+    {
+        if (snapshots.registry)
+            collectSnapshots();
+        if (snapshots.registry)
+            throw std::logic_error("snapshots are not supported in the concurrent reads mode");
+        reclaimAll();
+        // Links between leaves would be modified in place, so iterators traverse the tree instead.
+        root.unthreadLeaves();
+        epochs = &domain;
+    }
+
+    /**
+     * Switches the tree back to the default mode and frees all replaced nodes. There must be no
+     * readers at that moment.
+     */
+    void disableConcurrentReads()
+    {
+        reclaimAll();
+        if (epochs != nullptr)
+            root.threadLeaves();
+        epochs = nullptr;
+    }
+
+    /**
+     * @return Guard which allows reading the tree concurrently with modifications. @see
+     *         enableConcurrentReads()
+     */
+    EpochGuard read() const
+    {
+        if (epochs == nullptr)
+            throw std::logic_error("concurrent reads are not enabled");
+        return EpochGuard(*epochs);
+    }
+
+    /**
+     * Frees replaced nodes which no reader might see anymore. It's also done automatically
+     * by modifications, once in a while.
+     *
+     * @return Number of replaced nodes which still wait for readers.
+     */
+    size_t reclaim()
+    {
+        if (epochs == nullptr)
+            return retired.nodes.size();
+
+        uint64_t oldest = epochs->oldestPinned();
+        size_t kept = 0;
+        for (size_t i = 0; i < retired.nodes.size(); ++i)
+        {
+            if (retired.nodes[i].second < oldest)
+                TreeNode::destroyDetached(retired.nodes[i].first);
+            else
+                retired.nodes[kept++] = retired.nodes[i];
+        }
+        retired.nodes.resize(kept);
+        return kept;
+    }
+
+    /**
+     * Takes a snapshot of the tree in constant time. The snapshot shares all nodes with the tree.
+     * Later modifications of the tree copy shared nodes on the path from the root to the modified
+     * node (together with the root), instead of modifying them in place, so the snapshot keeps
+     * seeing the tree as it was. Nodes of old versions are freed when no snapshot uses them.
+     *
+     * Snapshots are taken by the thread which modifies the tree. Elements modified in place (e.g.
+     * through iterators) are modified in snapshots which share their nodes as well.
+     *
+     * @throws std::logic_error in the concurrent reads mode, which already lets readers see
+     *         consistent versions of nodes.
+     */
+    Snapshot snapshot()
+    {
+        if (epochs != nullptr)
+            throw std::logic_error("snapshots are not supported in the concurrent reads mode");
+        if (snapshots.registry)
+            collectSnapshots();
+        if (!snapshots.registry)
+            snapshots.registry = std::make_shared<SnapshotRegistry>();
+        return Snapshot(this, snapshots.registry, &rootNode());
+    }
+
+    /**
+     * Makes the tree give out stable handles of elements (@see handle()). Unlike iterators, handles
+     * stay valid when elements are moved between nodes (by splits, relocations and erasures of
+     * other elements) and they're resolved to current positions of elements in constant time
+     * (@see find()). Each element keeps a handle slot next to it and the tree keeps a table of
+     * slots, which is updated whenever elements are moved. The mode can't be disabled.
+     *
+     * In the concurrent reads mode handles are used only by the modifying thread.
+     */
+    void enableHandles()
+    {
+        if (handles.enabled)
+            return;
+        handles.enabled = true;
+        indexSlots(&rootNode());
+    }
+
+    bool handlesEnabled() const
+    {
+        return handles.enabled;
+    }
+
+    /**
+     * @return Handle of an element pointed by a given iterator.
+     * @throws std::logic_error when handles are not enabled.
+     */
+    handle_type handle(const_iterator it) const
+    {
+        if (!handles.enabled)
+            throw std::logic_error("handles are not enabled");
+        return handles.slots.handle(it.treeNode()->slot(it.index()));
+    }
+
+    /**
+     * @return Iterator pointing to an element with a given handle or an empty iterator when the
+     *         handle is invalid (i.e. the element was erased).
+     */
+    iterator find(handle_type handle)
+    {
+        const typename TreeSlots::Slot* slot = findSlot(handle);
+        if (slot == nullptr)
+            return iterator();
+        return iterator(slot->node, slot->index);
+    }
+
     iterator begin()
     {
-        if (root.child(0, 0).hasChildren() || root.child(0, 0).count() > 0)
+        if (root.nextLeaf() != nullptr)
+            return iterator(root.nextLeaf(), 0);
+        if (rootNode().hasChildren() || rootNode().count() > 0)
             return iterator(&(root.leftMostNode()), 0);
         return end();
     }
 
+    const_iterator begin() const
+    {
+        if (root.nextLeaf() != nullptr)
+            return const_iterator(root.nextLeaf(), 0);
+        if (rootNode().hasChildren() || rootNode().count() > 0)
+            return const_iterator(&(root.leftMostNode()), 0);
+        return end();
+    }
+
+    const_iterator cbegin() const
+    {
+        return begin();
+    }
+
     iterator end()
     {
         return iterator(&root, 0);
     }
 
+    const_iterator end() const
+    {
+        return const_iterator(&root, 0);
+    }
+
+    const_iterator cend() const
+    {
+        return end();
+    }
+
     /**
      * Clear the tree, removing and destroying all elements stored inside the QuadTree container.
      */
     void clear()
     {
-        root = TreeNode();
+        if (handles.enabled)
+            handles.slots.releaseAll();
+        if (epochs != nullptr || snapshots.registry)
+            publishRoot(root.createDetachedChild(0));
+        else
+            root.reset();
+    }
+
+    /**
+     * Merges every subtree which stores no more than capacity elements into a single leaf, removes
+     * empty nodes and releases memory which leaves keep after erased elements. Erases merge nodes
+     * only on paths of erased elements, so it's worth calling after many modifications, e.g. bulk
+     * erases. The order of iteration doesn't change, but all iterators are invalidated. Nodes
+     * shared with snapshots are copied first, but their memory isn't released until snapshots are.
+     *
+     * @return Number of removed nodes.
+     */
+    size_t compact()
+    {
+        if (snapshots.registry)
+            collectSnapshots();
+        return compactChildren(&root);
     }
 
     /**
      * Removes from the QuadTree container all elements that match given coordinates. They are then
-     * destroyed.
+     * destroyed. Nodes left empty are destroyed and the highest ancestor of the element's node
+     * which stores no more than capacity elements is merged with its subtree. @see compact()
      *
      * @param x X-axis coordinate of the element to be removed.
      * @param y Y-axis coordinate of the element to be removed.
      */
     void erase(double x, double y)
     {
-        // TODO: relocate elements to node->parent() if node and its siblings count is lower or equal than capacity.
         if (coordinatesAreOk(x, y))
         {
             LocationCode<maxLevels> code(tr.forward(Coordinates(x, y)));
-            TreeNode* node = getNode(code);
-            node->erase(code);
+            TreeNode* node = ownPath(getExistingNode(code));
+            bool leaf = !node->hasChildren();
+            if (handles.enabled && leaf)
+                releaseSlots(node, code);
+            if (epochs != nullptr)
+                node = publishErase(node, code);
+            else
+                node->erase(code);
+            if (handles.enabled && leaf)
+                indexSlots(node);
+            shrinkPath(node, &root);
+        }
+    }
+
+    /**
+     * Removes an element with a given handle. @see enableHandles()
+     *
+     * @return Whether the element was found (handle was valid).
+     */
+    bool erase(handle_type handle)
+    {
+        const typename TreeSlots::Slot* slot = findSlot(handle);
+        if (slot == nullptr)
+            return false;
+
+        TreeNode* node = slot->node;
+        size_t position = slot->index;
+        if (epochs != nullptr)
+        {
+            TreeNode* parent = &(node->parent());
+            uint32_t childNo = node->locationCode().quadrant(node->level());
+            TreeNode* copy = parent->cloneChild(childNo);
+            copy->erase(copy->begin() + position);
+            retire(parent->replaceChild(childNo, copy));
+            node = copy;
+        }
+        else
+        {
+            node = ownPath(node);
+            node->erase(node->begin() + position);
+        }
+        // Released only now, as copying a shared leaf updates slots of all its elements.
+        handles.slots.release(handle.slot);
+        indexSlots(node);
+        shrinkPath(node, &root);
+        return true;
+    }
+
+    /**
+     * Moves an element pointed by a given iterator to new coordinates without copying it. When the
+     * element stays in the same node, only its location is updated. Otherwise the element is moved
+     * out of its node and inserted again, but the search for its new node starts from the lowest
+     * common ancestor of both locations instead of the root, so short moves touch only the
+     * neighbourhood of the element. Range check of new coordinates is performed as in insert().
+     *
+     * Only iterators pointing to the moved element stay valid when it stays in the same node. When
+     * it's moved to another node, iterators pointing to elements of both nodes are invalidated.
+     *
+     * @param  it Iterator pointing to the element to be moved.
+     * @param  x  New X-axis coordinate of the element.
+     * @param  y  New Y-axis coordinate of the element.
+     * @return    Iterator pointing to the element at its new location or an empty iterator when new
+     *            coordinates are out of range (the element isn't moved then).
+     */
+    iterator relocate(iterator it, double x, double y)
+    {
+        if (!coordinatesAreOk(x, y))
+            return iterator();
+
+        TreeNode* node = it.treeNode();
+        size_t position = it.index();
+        LocationCode<maxLevels> code(tr.forward(Coordinates(x, y)));
+        bool sameNode = code.samePrefix(node->locationCode(), node->level());
+        if (epochs != nullptr)
+            return publishRelocate(node, position, code, Coordinates(x, y), sameNode);
+
+        node = ownPath(node);
+        if (sameNode)
+        {
+            node->relocate(position, code, Coordinates(x, y));
+            return iterator(node, position);
         }
+
+        TreeNode* ancestor = &(node->parent());
+        while (!code.samePrefix(ancestor->locationCode(), ancestor->level()))
+            ancestor = &(ancestor->parent());
+
+        uint32_t slot = handles.enabled ? node->slot(position) : TreeSlots::noSlot;
+        StoredObject toStore(std::move(code), Coordinates(x, y), std::move((*node)[position]));
+        node->erase(node->begin() + position);
+        if (handles.enabled)
+            indexSlots(node);
+        iterator moved = insertBelow(ancestor, std::move(toStore), slot);
+        shrinkPath(node, ancestor);
+        return moved;
+    }
+
+    /**
+     * Moves an element with a given handle to new coordinates. The handle stays valid. @see
+     * relocate(iterator, double, double)
+     *
+     * @return Iterator pointing to the element at its new location or an empty iterator when the
+     *         handle is invalid or new coordinates are out of range.
+     */
+    iterator relocate(handle_type handle, double x, double y)
+    {
+        iterator it = find(handle);
+        if (!it)
+            return iterator();
+        return relocate(it, x, y);
     }
 
     /**
@@ -158,7 +670,7 @@ public:
         if (coordinatesAreOk(x, y))
         {
             return insert(StoredObject(
-                LocationCode<maxLevels>(tr.forward(Coordinates(x, y))), val));
+                LocationCode<maxLevels>(tr.forward(Coordinates(x, y))), Coordinates(x, y), val));
         }
         return iterator();
     }
@@ -170,16 +682,204 @@ public:
     {
         if (coordinatesAreOk(x, y))
         {
-            return insert(StoredObject(
-                LocationCode<maxLevels>(tr.forward(Coordinates(x, y))), std::move(val)));
+            return insert(StoredObject(LocationCode<maxLevels>(tr.forward(Coordinates(x, y))),
+                                       Coordinates(x, y), std::move(val)));
         }
         return iterator();
     }
 
-    // TODO: Implement const version of near(). This requires const_iterator, const getExistingNode
-    // implementation and const QuadNode::existingChild implementation. Also, getExistingNode must
-    // not call child(), so in near() const check if there is root.child(0,0) and if not, return
-    // empty iterators.
+    /**
+     * Insert all elements from a given range into QuadTree.
+     *
+     * Location codes of all elements are computed first and elements are sorted by them (i.e.
+     * along the Z-order curve). When the tree is empty, nodes are then built in a single pass over
+     * sorted elements: each node receives its final set of elements at once and no node is split
+     * more than once. Otherwise elements are inserted in the Z-order, so elements which fall into
+     * the same subtree descend it together (@see insertSorted()).
+     *
+     * Elements with coordinates outside of the QuadTree range are skipped.
+     *
+     * @param  first Beginning of the range. Dereferenced iterator must provide x, y and a value
+     *               via std::get<0>, std::get<1> and std::get<2> (e.g. it can point to
+     *               std::tuple<double, double, ElementType>). Values are moved from the range when
+     *               the iterator returns rvalues (e.g. std::move_iterator).
+     * @param  last  End of the range.
+     * @return       Number of inserted elements.
+     */
+    template <typename InputIterator>
+    size_t bulkLoad(InputIterator first, InputIterator last)
+    {
+        StoredObjectAllocator alloc(get_allocator());
+        StoredObjects objects(alloc);
+        for (; first != last; ++first)
+        {
+            double x = std::get<0>(*first);
+            double y = std::get<1>(*first);
+            if (coordinatesAreOk(x, y))
+            {
+                objects.push_back(StoredObject(LocationCode<maxLevels>(tr.forward(Coordinates(x, y))),
+                                               Coordinates(x, y), std::get<2>(*first)));
+            }
+        }
+
+        std::stable_sort(objects.begin(), objects.end(), locationLess);
+        loadSorted(objects.begin(), objects.end());
+        return objects.size();
+    }
+
+    /**
+     * Insert all elements from a given range into QuadTree using a given number of threads.
+     *
+     * Location codes are computed in parallel and elements are distributed into buckets which
+     * correspond to the nodes from a few top levels of the tree. Buckets are then sorted in
+     * parallel. When the tree is empty, top levels are created by the calling thread and subtrees
+     * of disjoint regions are built concurrently, each thread allocating nodes from its own pool.
+     * Finally all these pools are merged into the tree. Resulting tree is the same as the one
+     * created by bulkLoad(). When the tree isn't empty, elements are inserted one by one in the
+     * Z-order by the calling thread.
+     *
+     * Allocator used by the tree must be safe to use from many threads at once (std::allocator
+     * is; std::pmr resources usually aren't).
+     *
+     * @param  first   Beginning of the range. @see bulkLoad(). Each element is read exactly once,
+     *                 but not in order.
+     * @param  last    End of the range.
+     * @param  threads Maximum number of threads (including the calling one) used to build the
+     *                 tree. Default is the number of hardware threads.
+     * @return         Number of inserted elements.
+     */
+    template <typename RandomAccessIterator>
+    size_t parallelBulkLoad(RandomAccessIterator first, RandomAccessIterator last,
+                            unsigned threads = std::thread::hardware_concurrency())
+    {
+        if (threads == 0)
+            threads = 1;
+
+        size_t count = static_cast<size_t>(last - first);
+        size_t bucketLevels = 0;
+        while (bucketLevels < maxLevels - 1 && bucketLevels < 8 &&
+               (size_t(1) << (2 * bucketLevels)) < 8 * size_t(threads))
+            ++bucketLevels;
+
+        // The last bucket gathers elements with coordinates outside of the tree range.
+        size_t buckets = size_t(1) << (2 * bucketLevels);
+        size_t bucketShift = 2 * (maxLevels - 1 - bucketLevels);
+        size_t chunks = std::max<size_t>(1, std::min<size_t>(count, 4 * size_t(threads)));
+
+        std::vector<LocatedIndex> located(count);
+        std::vector<size_t> histograms(chunks * (buckets + 1), 0);
+        parallelFor(chunks, threads, [&](size_t chunk, unsigned) {
+            size_t* histogram = &histograms[chunk * (buckets + 1)];
+            const size_t blockSize = 256;
+            double xs[blockSize];
+            double ys[blockSize];
+            code_type codes[blockSize];
+
+            // Coordinates are gathered into blocks, so codes are computed by a batch encoder.
+            size_t chunkLast = count * (chunk + 1) / chunks;
+            for (size_t block = count * chunk / chunks; block < chunkLast; block += blockSize)
+            {
+                size_t blockCount = std::min(blockSize, chunkLast - block);
+                for (size_t i = 0; i < blockCount; ++i)
+                {
+                    xs[i] = std::get<0>(first[block + i]);
+                    ys[i] = std::get<1>(first[block + i]);
+                }
+                encode(xs, ys, blockCount, codes);
+
+                for (size_t i = 0; i < blockCount; ++i)
+                {
+                    LocatedIndex& l = located[block + i];
+                    l.location.key = codes[i];
+                    l.index = block + i;
+                    if (!coordinatesAreOk(xs[i], ys[i]))
+                        l.index = invalidIndex();
+                    ++histogram[l.index == invalidIndex() ?
+                        buckets : static_cast<size_t>(codes[i] >> bucketShift)];
+                }
+            }
+        });
+
+        // Offsets are assigned bucket by bucket and within a bucket chunk by chunk, so the order of
+        // elements from the input range is preserved inside buckets.
+        std::vector<size_t> bucketStarts(buckets + 2, 0);
+        size_t offset = 0;
+        for (size_t bucket = 0; bucket <= buckets; ++bucket)
+        {
+            bucketStarts[bucket] = offset;
+            for (size_t chunk = 0; chunk < chunks; ++chunk)
+            {
+                size_t chunkCount = histograms[chunk * (buckets + 1) + bucket];
+                histograms[chunk * (buckets + 1) + bucket] = offset;
+                offset += chunkCount;
+            }
+        }
+        bucketStarts[buckets + 1] = offset;
+
+        std::vector<LocatedIndex> sorted(count);
+        parallelFor(chunks, threads, [&](size_t chunk, unsigned) {
+            size_t* offsets = &histograms[chunk * (buckets + 1)];
+            for (size_t i = count * chunk / chunks; i < count * (chunk + 1) / chunks; ++i)
+            {
+                size_t bucket = located[i].index == invalidIndex() ?
+                    buckets : static_cast<size_t>(located[i].location.key >> bucketShift);
+                sorted[offsets[bucket]++] = located[i];
+            }
+        });
+        std::vector<LocatedIndex>().swap(located);
+
+        parallelFor(buckets, threads, [&](size_t bucket, unsigned) {
+            std::sort(sorted.begin() + bucketStarts[bucket],
+                      sorted.begin() + bucketStarts[bucket + 1], locatedLess);
+        });
+
+        typename std::vector<LocatedIndex>::iterator sortedFirst = sorted.begin();
+        typename std::vector<LocatedIndex>::iterator sortedLast = sortedFirst + bucketStarts[buckets];
+        MakeObject<RandomAccessIterator> make(first);
+
+        if (rootNode().count() != 0 || rootNode().hasChildren())
+        {
+            for (; sortedFirst != sortedLast; ++sortedFirst)
+                insert(make(*sortedFirst));
+            return bucketStarts[buckets];
+        }
+
+        TreeNode* target = buildRoot();
+        std::vector<BuildTask> tasks;
+        std::vector<TreeNode*> planned;
+        planBuild(target, 0, bucketLevels, sortedFirst, bucketStarts, 0, buckets, tasks,
+                  planned);
+
+        typedef typename TreeNode::pool_type Pool;
+        std::vector<std::unique_ptr<Pool> > pools;
+        for (unsigned i = 0; i < threads; ++i)
+            pools.push_back(std::unique_ptr<Pool>(new Pool(root.pool().get_allocator())));
+
+        // Nodes created by workers are already linked into the tree, so their pools must be merged
+        // into the tree's one and counts of nodes created by planBuild() must be computed even if
+        // some task fails. Nodes are planned top-down, so they're recounted in the reverse order.
+        std::exception_ptr error;
+        try
+        {
+            parallelFor(tasks.size(), threads, [&](size_t task, unsigned worker) {
+                build(tasks[task].node, tasks[task].first, tasks[task].last, *pools[worker], make);
+            });
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+        for (unsigned i = 0; i < threads; ++i)
+            root.pool().splice(*pools[i]);
+        for (size_t i = planned.size(); i-- > 0;)
+            planned[i]->recount();
+        target->recount();
+        publishRoot(target);
+        if (error)
+            std::rethrow_exception(error);
+
+        return bucketStarts[buckets];
+    }
 
     /**
      * Return the bounds of a range that includes all the elements that are near specified (x, y).
@@ -192,81 +892,1694 @@ public:
      */
     std::pair<iterator, iterator> near(double x, double y)
     {
-        if (coordinatesAreOk(x, y))
-        {
-            TreeNode* node = getExistingNode(
-                LocationCode<maxLevels>(tr.forward(Coordinates(x, y))));
-            return std::pair<iterator, iterator>(
-                iterator(node, 0), ++iterator(node, node->count()));
-        }
-        return std::pair<iterator, iterator>(end(), end());
+        return nearRange<iterator>(&root, x, y);
     }
 
     /**
-     * @return Total number of elements in QuadTree.
+     * Const version of near(). It doesn't modify the tree in any way (e.g. it doesn't create
+     * nodes), so it might be called concurrently by many threads, as long as no one modifies the
+     * tree at the same time. The same holds for other const methods.
      */
-    size_t size() const
+    std::pair<const_iterator, const_iterator> near(double x, double y) const
     {
-        return root.totalCount();
+        return nearRange<const_iterator>(&root, x, y);
     }
 
-private:
-    void checkRequirements()
+    /**
+     * Computes location codes (Morton keys) of many points at once. The work is done by SIMD
+     * kernels, if the processor supports them. @see morton::encode()
+     *
+     * @param xs    X-axis coordinates of points.
+     * @param ys    Y-axis coordinates of points.
+     * @param count Number of points.
+     * @param codes Array for count computed codes. Codes of points outside of the tree range are
+     *              the codes of the nearest smallest nodes inside the range.
+     */
+    void encode(const double* xs, const double* ys, size_t count, code_type* codes) const
     {
-        if (maxLevels < 1)
-            throw std::invalid_argument("maximum levels number is less than 1");
-        if (maxLevels > 32)
-            throw std::invalid_argument("maximum levels number is too big");
-        if (width < 1)
-            throw std::invalid_argument("size is less than 1");
-        if (((width - 1) & width) != 0)
-            throw std::invalid_argument("size is not power of 2");
+        morton::Quantizer quantizer = { static_cast<double>(startX), static_cast<double>(startY),
+            cellsPerSide() / static_cast<double>(width),
+            static_cast<uint32_t>(cellsPerSide() - 1) };
+        morton::encode(xs, ys, count, quantizer, codes);
     }
 
-    bool coordinatesAreOk(double x, double y) const
+    /**
+     * Calls a given visitor for each element inside an axis-aligned rectangle.
+     *
+     * Subtrees of nodes which don't intersect the rectangle are skipped and elements of nodes
+     * which lie completely inside it are visited without any further checks. Unless original
+     * coordinates are stored (@see storeCoordinates), element locations are known only with the
+     * precision of the smallest tree nodes (width / 2^(maxLevels - 1)), so an element is visited
+     * when that smallest area containing it intersects the rectangle. Elements are visited in the
+     * Z-order.
+     *
+     * @param  minX    Lower x-axis bound of the rectangle (inclusive).
+     * @param  minY    Lower y-axis bound of the rectangle (inclusive).
+     * @param  maxX    Upper x-axis bound of the rectangle (inclusive).
+     * @param  maxY    Upper y-axis bound of the rectangle (inclusive).
+     * @param  visitor Function object called with a reference to each found element.
+     * @return         The visitor, after it has been called for all found elements.
+     */
+    template <typename Visitor>
+    Visitor withinRect(double minX, double minY, double maxX, double maxY, Visitor visitor)
     {
-        if (x >= startX + width || y >= startY + width || x < startX || y < startY)
-            return false;
-        return true;
+        visitInRegion(&rootNode(), rectRegion(minX, minY, maxX, maxY), visitor);
+        return visitor;
     }
 
-    TreeNode* getExistingNode(const LocationCode<maxLevels>& code)
+    /**
+     * Const version of withinRect(). Visitor is called with const references.
+     */
+    template <typename Visitor>
+    Visitor withinRect(double minX, double minY, double maxX, double maxY, Visitor visitor) const
     {
-        int level = maxLevels;
+        visitInRegion(&rootNode(), rectRegion(minX, minY, maxX, maxY), visitor);
+        return visitor;
+    }
 
-        // FIXME: it's really important to start from root.child (as root is a header) and ALL TESTS
-        // PASS WHEN IT'S CHANGED TO: `node = &root;`
-        TreeNode* node = &(root.child(0, 0));
+    /**
+     * Counts elements inside an axis-aligned rectangle. Elements are matched the same way as by
+     * withinRect(), but counts of subtrees which lie completely inside the rectangle are taken
+     * from their roots, so such subtrees aren't traversed at all.
+     *
+     * @see withinRect()
+     */
+    size_t countInRect(double minX, double minY, double maxX, double maxY) const
+    {
+        return countInRegion(&rootNode(), rectRegion(minX, minY, maxX, maxY));
+    }
+
+    /**
+     * Calls a given visitor for each element inside a circle.
+     *
+     * Subtrees of nodes which don't intersect the circle are skipped and elements of nodes which
+     * lie completely inside it are visited without any further checks. Other elements are checked
+     * by their exact distance when original coordinates are stored (@see storeCoordinates).
+     * Otherwise, an element is visited when the smallest tree node area which contains it
+     * intersects the circle. Elements are visited in the Z-order.
+     *
+     * @param  x       X-axis coordinate of the circle center. It might be outside of the tree range.
+     * @param  y       Y-axis coordinate of the circle center. It might be outside of the tree range.
+     * @param  radius  Radius of the circle (points on the circle are inside it).
+     * @param  visitor Function object called with a reference to each found element.
+     * @return         The visitor, after it has been called for all found elements.
+     */
+    template <typename Visitor>
+    Visitor withinRadius(double x, double y, double radius, Visitor visitor)
+    {
+        if (radius >= 0)
+            visitInRegion(&rootNode(), circleRegion(x, y, radius), visitor);
+        return visitor;
+    }
+
+    /**
+     * Const version of withinRadius(). Visitor is called with const references.
+     */
+    template <typename Visitor>
+    Visitor withinRadius(double x, double y, double radius, Visitor visitor) const
+    {
+        if (radius >= 0)
+            visitInRegion(&rootNode(), circleRegion(x, y, radius), visitor);
+        return visitor;
+    }
+
+    /**
+     * Calls a given callback for each pair of elements which are at most a given distance apart
+     * (broad-phase collision detection).
+     *
+     * The tree is walked once. Elements of each non-empty node are tested against each other and
+     * against elements of nodes which follow it in the Z-order and lie within the distance from
+     * it, which are found by a single descent that skips subtrees either too far away or entirely
+     * before the node. Thus each pair is reported exactly once, regardless of node borders. Unless
+     * original coordinates are stored (@see storeCoordinates), distance between elements is the
+     * distance between centers of the smallest tree nodes which contain them, as in knn().
+     *
+     * @param  distance Maximum distance between elements of a pair.
+     * @param  callback Function object called with references to both elements of each pair.
+     * @return          The callback, after it has been called for all found pairs.
+     */
+    template <typename Callback>
+    Callback findPairs(double distance, Callback callback)
+    {
+        findPairsIn(&rootNode(), distance, callback);
+        return callback;
+    }
+
+    /**
+     * Const version of findPairs(). Callback is called with const references.
+     */
+    template <typename Callback>
+    Callback findPairs(double distance, Callback callback) const
+    {
+        findPairsIn(&rootNode(), distance, callback);
+        return callback;
+    }
+
+    /**
+     * Parallel version of findPairs(). Non-empty nodes are handed out to threads one by one, so
+     * pairs are reported in no particular order and the callback is called concurrently from
+     * many threads, so it must be thread-safe. The tree mustn't be modified meanwhile.
+     *
+     * @param distance Maximum distance between elements of a pair.
+     * @param callback Function object called with references to both elements of each pair.
+     * @param threads  Maximum number of threads (including the calling one). Default is the
+     *                 number of hardware threads.
+     */
+    template <typename Callback>
+    void parallelFindPairs(double distance, Callback callback,
+                           unsigned threads = std::thread::hardware_concurrency())
+    {
+        parallelFindPairsIn(&rootNode(), distance, callback, threads);
+    }
+
+    /**
+     * Const version of parallelFindPairs(). Callback is called with const references.
+     */
+    template <typename Callback>
+    void parallelFindPairs(double distance, Callback callback,
+                           unsigned threads = std::thread::hardware_concurrency()) const
+    {
+        parallelFindPairsIn(&rootNode(), distance, callback, threads);
+    }
+
+    /**
+     * Spatial join: calls a given callback for each pair of elements, one from this tree and one
+     * from another, which satisfy a given predicate.
+     *
+     * Both trees are descended together: pairs of nodes whose areas can't contain matching
+     * elements are skipped, otherwise the node on the higher level is split into its children.
+     * Only pairs of leaves which might match are tested element by element. Unless original
+     * coordinates are stored (@see storeCoordinates), element location is the center of the
+     * smallest tree node which contains it, as in knn().
+     *
+     * @param  other     Tree which covers the same area (the same width, startX and startY) and
+     *                   has the same number of levels. Its element type might be different.
+     * @param  predicate Object which tells whether elements might match: predicate.mayMatch(a, b)
+     *                   is called with areas (geo::Area) of two nodes and must return false only
+     *                   when no pair of points from them matches, predicate(a, b) is called with
+     *                   locations (geo::Coordinates) of two elements. @see SpatialJoin.hpp
+     * @param  callback  Function object called with references to an element of this tree and an
+     *                   element of the other tree of each matching pair.
+     * @return           The callback, after it has been called for all matching pairs.
+     */
+    template <typename OtherElement, typename OtherAllocator, bool otherCoordinates,
+              typename Predicate, typename Callback>
+    Callback join(QuadTree<OtherElement, maxLevels, OtherAllocator, otherCoordinates>& other,
+                  const Predicate& predicate, Callback callback)
+    {
+        checkSameArea(other);
+        joinNodes(&rootNode(), other, &other.rootNode(), predicate, callback);
+        return callback;
+    }
+
+    /**
+     * Const version of join(). Callback is called with const references.
+     */
+    template <typename OtherElement, typename OtherAllocator, bool otherCoordinates,
+              typename Predicate, typename Callback>
+    Callback join(const QuadTree<OtherElement, maxLevels, OtherAllocator, otherCoordinates>& other,
+                  const Predicate& predicate, Callback callback) const
+    {
+        checkSameArea(other);
+        joinNodes(&rootNode(), other, &other.rootNode(), predicate, callback);
+        return callback;
+    }
+
+    /**
+     * Finds k elements which are the closest to a given point.
+     *
+     * Nodes and elements are visited in the order of their distance to the point (best-first
+     * search): a priority queue holds nodes keyed by a lower bound of distance to any of their
+     * elements, computed from node's location code and level, and elements keyed by their own
+     * distance. Search stops as soon as k elements are taken from the queue, so only nodes which
+     * might contain one of the k closest elements are visited. Unless original coordinates are
+     * stored (@see storeCoordinates), element location is known only with the precision of the
+     * smallest tree nodes, so distance to an element is the distance to the center of the smallest
+     * node which contains it.
+     *
+     * @param  x X-axis coordinate of the point. It might be outside of the tree range.
+     * @param  y Y-axis coordinate of the point. It might be outside of the tree range.
+     * @param  k Maximum number of elements to find.
+     * @return   Iterators pointing to at most k found elements, ordered by ascending distance.
+     */
+    std::vector<iterator> knn(double x, double y, size_t k)
+    {
+        return nearest<iterator>(&rootNode(), x, y, k);
+    }
+
+    /**
+     * Const version of knn().
+     */
+    std::vector<const_iterator> knn(double x, double y, size_t k) const
+    {
+        return nearest<const_iterator>(&rootNode(), x, y, k);
+    }
+
+    /**
+     * Calls a given visitor for each element using many threads.
+     *
+     * The tree is split into subtree tasks which are balanced between threads with work stealing
+     * (@see parallelTasks()), so skewed trees are processed evenly as well. Subtrees with at most
+     * parallelGrain elements are visited by a single thread. Elements are visited in no particular
+     * order and the visitor is called concurrently from many threads, so it must be thread-safe.
+     * The tree mustn't be modified meanwhile.
+     *
+     * @param visitor Function object called with a reference to each element.
+     * @param threads Maximum number of threads (including the calling one). Default is the number
+     *                of hardware threads.
+     */
+    template <typename Visitor>
+    void parallelForEach(Visitor visitor, unsigned threads = std::thread::hardware_concurrency())
+    {
+        parallelVisit(&rootNode(), threads, WorkerVisitor<Visitor>(visitor));
+    }
+
+    /**
+     * Const version of parallelForEach(). Visitor is called with const references.
+     */
+    template <typename Visitor>
+    void parallelForEach(Visitor visitor,
+                         unsigned threads = std::thread::hardware_concurrency()) const
+    {
+        parallelVisit(&rootNode(), threads, WorkerVisitor<Visitor>(visitor));
+    }
+
+    /**
+     * Computes combine(...combine(combine(identity, map(e1)), map(e2))..., map(eN)) over all
+     * elements using many threads, the same way as parallelForEach(). Each thread reduces its own
+     * part of elements, then partial results are combined by the calling thread. Elements come in
+     * no particular order, so combine must be associative and commutative.
+     *
+     * @param  identity Initial value of each partial result. It must be the identity element of
+     *                  combine, i.e. combine(identity, v) == v.
+     * @param  map      Function object which maps a const reference to an element to T.
+     * @param  combine  Function object which combines two values of T.
+     * @param  threads  Maximum number of threads (including the calling one).
+     * @return          Combined value.
+     */
+    template <typename T, typename Map, typename Combine>
+    T parallelReduce(T identity, Map map, Combine combine,
+                     unsigned threads = std::thread::hardware_concurrency()) const
+    {
+        if (threads == 0)
+            threads = 1;
+
+        std::vector<T> partial(threads, identity);
+        parallelVisit(&rootNode(), threads, [&](const ElementType& element, unsigned worker) {
+            partial[worker] = combine(partial[worker], map(element));
+        });
+
+        T result = partial[0];
+        for (size_t i = 1; i < partial.size(); ++i)
+            result = combine(result, partial[i]);
+        return result;
+    }
+
+    /**
+     * Writes the tree to a given stream as a binary image, which might be queried in place (e.g.
+     * from a memory-mapped file) with MappedQuadTree or loaded back with load(). The image keeps
+     * non-empty leaves in the Z-order and elements in flat arrays, with offsets instead of
+     * pointers. @see image::Header
+     *
+     * Elements are written byte by byte, so ElementType must be trivially copyable.
+     *
+     * @throws std::runtime_error when the stream fails or the image wouldn't fit in 64-bit
+     *         offsets.
+     */
+    void save(std::ostream& out) const
+    {
+        static_assert(std::is_trivially_copyable<ElementType>::value,
+                      "only trivially copyable elements might be saved");
+        std::vector<const TreeNode*> nodes;
+        gatherNonEmpty(&rootNode(), nodes);
+
+        image::Header header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, image::magic, sizeof(header.magic));
+        header.version = image::version;
+        header.byteOrder = image::byteOrder;
+        header.maxLevels = static_cast<uint32_t>(maxLevels);
+        header.keySize = sizeof(code_type);
+        header.elementSize = sizeof(ElementType);
+        header.elementAlignment = alignof(ElementType);
+        header.coordinates = storeCoordinates ? 1 : 0;
+        header.width = width;
+        header.startX = static_cast<int>(startX);
+        header.startY = static_cast<int>(startY);
+        header.capacity = nodeCapacity;
+        header.leafCount = nodes.size();
+        for (size_t i = 0; i < nodes.size(); ++i)
+            header.elementCount += nodes[i]->count();
+        if (!image::layOut(header))
+            throw std::runtime_error("tree is too big for an image");
+
+        uint64_t written = sizeof(header);
+        image::write(out, &header, sizeof(header));
+        image::pad(out, written, header.leaves);
+        image::Leaf leaf = { 0, 0, 0, 0 };
+        for (size_t i = 0; i < nodes.size(); ++i)
+        {
+            leaf.key = nodes[i]->locationCode().key;
+            leaf.level = static_cast<uint32_t>(nodes[i]->level());
+            image::write(out, &leaf, sizeof(leaf));
+            leaf.first += nodes[i]->count();
+        }
+        // Sentinel closes the last leaf.
+        leaf.key = UINT64_MAX;
+        leaf.level = 0;
+        image::write(out, &leaf, sizeof(leaf));
+        written = header.codes;
+
+        for (size_t i = 0; i < nodes.size(); ++i)
+            image::write(out, nodes[i]->elements().codes(), nodes[i]->count() * sizeof(code_type));
+        written += header.elementCount * sizeof(code_type);
+        image::pad(out, written, header.objects);
+        for (size_t i = 0; i < nodes.size(); ++i)
+            image::write(out, &(*nodes[i])[0], nodes[i]->count() * sizeof(ElementType));
+        written += header.elementCount * sizeof(ElementType);
+        image::pad(out, written, header.xs);
+        saveCoordinates(out, nodes, StoresCoordinates());
+    }
+
+    /**
+     * Replaces elements of the tree with the ones of a given image (@see save()). Nodes are built
+     * as by bulkLoad() of an empty tree, using the capacity of this tree.
+     *
+     * @throws std::invalid_argument when the image covers a different area.
+     */
+    void load(const MappedQuadTree<ElementType, maxLevels, storeCoordinates>& image)
+    {
+        if (image.width() != width || image.startX() != static_cast<int>(startX) ||
+            image.startY() != static_cast<int>(startY))
+            throw std::invalid_argument("trees cover different areas");
+
+        StoredObjectAllocator alloc(get_allocator());
+        StoredObjects objects(alloc);
+        objects.reserve(image.size());
+        LocationCode<maxLevels> code;
+        for (size_t i = 0; i < image.size(); ++i)
+        {
+            code.key = image.code(i);
+            objects.push_back(StoredObject(code, imageCoordinates(image, i, StoresCoordinates()),
+                                           image.begin()[i]));
+        }
+        // Leaves are in the Z-order, but elements inside them aren't.
+        std::stable_sort(objects.begin(), objects.end(), locationLess);
+
+        clear();
+        buildTree(objects.begin(), objects.end());
+    }
+
+    /**
+     * Reads an image written by save() from a given stream. @see load()
+     *
+     * @throws std::invalid_argument when the stream doesn't contain an image of a tree with the
+     *         same parameters.
+     */
+    void load(std::istream& in)
+    {
+        std::vector<char> data((std::istreambuf_iterator<char>(in)),
+                               std::istreambuf_iterator<char>());
+        load(MappedQuadTree<ElementType, maxLevels, storeCoordinates>(data.data(), data.size()));
+    }
+
+    /**
+     * @return Total number of elements in QuadTree. It takes constant time.
+     */
+    size_t size() const
+    {
+        return root.totalCount();
+    }
+
+private:
+    void checkRequirements()
+    {
+        if (maxLevels < 1)
+            throw std::invalid_argument("maximum levels number is less than 1");
+        if (maxLevels > 32)
+            throw std::invalid_argument("maximum levels number is too big");
+        if (width < 1)
+            throw std::invalid_argument("size is less than 1");
+        if (((width - 1) & width) != 0)
+            throw std::invalid_argument("size is not power of 2");
+    }
+
+    bool coordinatesAreOk(double x, double y) const
+    {
+        if (x >= startX + width || y >= startY + width || x < startX || y < startY)
+            return false;
+        return true;
+    }
+
+    typedef region::Box Box;
+    typedef region::Rect RectRegion;
+    typedef region::Circle CircleRegion;
+
+    static double cellsPerSide()
+    {
+        return static_cast<double>(uint64_t(1) << (maxLevels - 1));
+    }
+
+    // Both conversions are computed the same way as location codes are.
+    double toCellsX(double x) const
+    {
+        return ((x - static_cast<double>(startX)) / static_cast<double>(width)) * cellsPerSide();
+    }
+
+    double toCellsY(double y) const
+    {
+        return ((y - static_cast<double>(startY)) / static_cast<double>(width)) * cellsPerSide();
+    }
+
+    /**
+     * @return Area covered by a given node. Its upper bounds are exclusive.
+     */
+    static Box nodeBox(const TreeNode* node)
+    {
+        double side = static_cast<double>(uint64_t(1) << node->level());
+        Box box = { static_cast<double>(node->locationCode().x()),
+                    static_cast<double>(node->locationCode().y()), 0, 0 };
+        box.maxX = box.minX + side;
+        box.maxY = box.minY + side;
+        return box;
+    }
+
+    /**
+     * @return The best known position of an element at a given position of a node, in cell units.
+     */
+    Coordinates elementCells(const TreeNode* node, size_t i, std::true_type) const
+    {
+        Coordinates c = node->elements().coordinates().coordinates(i);
+        return Coordinates(toCellsX(c.x()), toCellsY(c.y()));
+    }
+
+    Coordinates elementCells(const TreeNode* node, size_t i, std::false_type) const
+    {
+        LocationCode<maxLevels> code = node->location(i);
+        return Coordinates(code.x() + 0.5, code.y() + 0.5);
+    }
+
+    /**
+     * Marks elements from [first, first + count) of a given storage which are inside a region.
+     */
+    template <typename Region>
+    static void match(const Region& region, const typename TreeNode::storage_type& elements,
+                      size_t first, size_t count, uint64_t* mask, std::true_type)
+    {
+        region.match(elements.codes() + first, elements.coordinates().x() + first,
+                     elements.coordinates().y() + first, count, mask, std::true_type());
+    }
+
+    template <typename Region>
+    static void match(const Region& region, const typename TreeNode::storage_type& elements,
+                      size_t first, size_t count, uint64_t* mask, std::false_type)
+    {
+        region.match(elements.codes() + first, nullptr, nullptr, count, mask, std::false_type());
+    }
+
+    /**
+     * Element or node (when index is nodeIndex()) waiting in a knn() queue.
+     */
+    template <typename Node>
+    struct CandidateT
+    {
+        CandidateT(double distance, Node* node, size_t index)
+            : distance(distance), node(node), index(index) {}
+
+        static size_t nodeIndex()
+        {
+            return static_cast<size_t>(-1);
+        }
+
+        // Of equally distant candidates, elements are taken before nodes.
+        bool operator>(const CandidateT& rhs) const
+        {
+            if (distance != rhs.distance)
+                return distance > rhs.distance;
+            return index == nodeIndex() && rhs.index != nodeIndex();
+        }
+
+        double distance;
+        Node* node;
+        size_t index;
+    };
+
+    /**
+     * Best-first search of k closest elements in a subtree of a given node. @see knn()
+     */
+    template <typename Iterator, typename Node>
+    std::vector<Iterator> nearest(Node* start, double x, double y, size_t k) const
+    {
+        typedef CandidateT<Node> Candidate;
+
+        std::vector<Iterator> result;
+        if (k == 0)
+            return result;
+
+        double cellX = toCellsX(x);
+        double cellY = toCellsY(y);
+
+        std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate> > queue;
+        queue.push(Candidate(0, start, Candidate::nodeIndex()));
+        while (!queue.empty() && result.size() < k)
+        {
+            Candidate candidate = queue.top();
+            queue.pop();
+
+            Node* node = candidate.node;
+            if (candidate.index != Candidate::nodeIndex())
+            {
+                result.push_back(Iterator(node, candidate.index));
+                continue;
+            }
+
+            for (size_t i = 0; i < node->count(); ++i)
+            {
+                Coordinates position = elementCells(node, i, StoresCoordinates());
+                double dx = position.x() - cellX;
+                double dy = position.y() - cellY;
+                queue.push(Candidate(dx * dx + dy * dy, node, i));
+            }
+            for (uint32_t childNo = 0; childNo < 4; ++childNo)
+            {
+                if (node->childExists(childNo))
+                {
+                    Node* child = &(node->existingChild(childNo));
+                    double distance = region::squaredDistance(cellX, cellY, nodeBox(child));
+                    queue.push(Candidate(distance, child, Candidate::nodeIndex()));
+                }
+            }
+        }
+        return result;
+    }
+
+    /**
+     * @return Squared distance between the nearest points of two boxes.
+     */
+    static double squaredDistance(const Box& lhs, const Box& rhs)
+    {
+        double dx = std::max(0.0, std::max(lhs.minX - rhs.maxX, rhs.minX - lhs.maxX));
+        double dy = std::max(0.0, std::max(lhs.minY - rhs.maxY, rhs.minY - lhs.maxY));
+        return dx * dx + dy * dy;
+    }
+
+    /**
+     * Non-empty node whose elements are paired with elements of other nodes by findPairs(),
+     * together with positions of its elements in cell units.
+     */
+    template <typename Node>
+    struct PairSource
+    {
+        Node* node;
+        Box box;
+        uint64_t key;
+        std::vector<Coordinates> positions;
+        double limit;
+    };
+
+    /**
+     * Gathers non-empty nodes of a subtree in the Z-order.
+     */
+    template <typename Node>
+    static void gatherNonEmpty(Node* node, std::vector<Node*>& nodes)
+    {
+        if (node->count() > 0)
+            nodes.push_back(node);
+        for (uint32_t childNo = 0; childNo < 4; ++childNo)
+        {
+            if (node->childExists(childNo))
+                gatherNonEmpty(&(node->existingChild(childNo)), nodes);
+        }
+    }
+
+    template <typename Node, typename Callback>
+    void findPairsIn(Node* start, double distance, Callback& callback) const
+    {
+        if (!(distance >= 0))
+            return;
+        std::vector<Node*> nodes;
+        gatherNonEmpty(start, nodes);
+        for (size_t i = 0; i < nodes.size(); ++i)
+            pairsOf(start, nodes[i], distance, callback);
+    }
+
+    template <typename Node, typename Callback>
+    void parallelFindPairsIn(Node* start, double distance, Callback& callback,
+                             unsigned threads) const
+    {
+        if (!(distance >= 0))
+            return;
+        std::vector<Node*> nodes;
+        gatherNonEmpty(start, nodes);
+        parallelFor(nodes.size(), threads, [&](size_t i, unsigned) {
+            pairsOf(start, nodes[i], distance, callback);
+        });
+    }
+
+    /**
+     * Reports pairs of elements of a given node with each other and with elements of nodes which
+     * follow it in the Z-order. @see findPairs()
+     */
+    template <typename Node, typename Callback>
+    void pairsOf(Node* start, Node* node, double distance, Callback& callback) const
+    {
+        double cellDistance = distance / width * cellsPerSide();
+        PairSource<Node> source;
+        source.node = node;
+        source.box = nodeBox(node);
+        source.key = static_cast<uint64_t>(node->locationCode().key);
+        source.limit = cellDistance * cellDistance;
+        source.positions.reserve(node->count());
+        for (size_t i = 0; i < node->count(); ++i)
+            source.positions.push_back(elementCells(node, i, StoresCoordinates()));
+
+        for (size_t i = 0; i < node->count(); ++i)
+        {
+            for (size_t j = i + 1; j < node->count(); ++j)
+            {
+                if (squaredDistance(source.positions[i], source.positions[j]) <= source.limit)
+                    callback((*node)[i], (*node)[j]);
+            }
+        }
+        pairsWithSubtree(start, source, callback);
+    }
+
+    /**
+     * Pairs elements of a source node with elements of nodes from a given subtree which follow
+     * it in the Z-order, i.e. have greater codes or the same code and a lower level.
+     */
+    template <typename Node, typename Callback>
+    void pairsWithSubtree(Node* node, const PairSource<Node>& source, Callback& callback) const
+    {
+        uint64_t key = static_cast<uint64_t>(node->locationCode().key);
+        uint64_t lastKey = key | ((uint64_t(1) << (2 * node->level())) - 1);
+        Box box = nodeBox(node);
+        if (lastKey < source.key || squaredDistance(box, source.box) > source.limit)
+            return;
+
+        if (node->count() > 0 && node != source.node &&
+            (key > source.key || (key == source.key && node->level() < source.node->level())))
+        {
+            for (size_t j = 0; j < node->count(); ++j)
+            {
+                Coordinates position = elementCells(node, j, StoresCoordinates());
+                if (region::squaredDistance(position.x(), position.y(), source.box) > source.limit)
+                    continue;
+                for (size_t i = 0; i < source.positions.size(); ++i)
+                {
+                    if (squaredDistance(source.positions[i], position) <= source.limit)
+                        callback((*source.node)[i], (*node)[j]);
+                }
+            }
+        }
+
+        for (uint32_t childNo = 0; childNo < 4; ++childNo)
+        {
+            if (node->childExists(childNo))
+                pairsWithSubtree(&(node->existingChild(childNo)), source, callback);
+        }
+    }
+
+    static double squaredDistance(const Coordinates& lhs, const Coordinates& rhs)
+    {
+        double dx = lhs.x() - rhs.x();
+        double dy = lhs.y() - rhs.y();
+        return dx * dx + dy * dy;
+    }
+
+    template <typename OtherTree>
+    void checkSameArea(const OtherTree& other) const
+    {
+        if (width != other.width || startX != other.startX || startY != other.startY)
+            throw std::invalid_argument("joined trees cover different areas");
+    }
+
+    /**
+     * @return Area covered by a given node (of this or another tree covering the same area), in
+     *         original units.
+     */
+    template <typename Node>
+    Area nodeArea(const Node* node) const
+    {
+        double cellWidth = static_cast<double>(width) / cellsPerSide();
+        double side = static_cast<double>(uint64_t(1) << node->level()) * cellWidth;
+        Area area = { startX + node->locationCode().x() * cellWidth,
+                      startY + node->locationCode().y() * cellWidth, 0, 0 };
+        area.maxX = area.minX + side;
+        area.maxY = area.minY + side;
+        return area;
+    }
+
+    /**
+     * @return The best known location of an element at a given position of a node, in original
+     *         units. @see elementCells()
+     */
+    Coordinates elementLocation(const TreeNode* node, size_t i, std::true_type) const
+    {
+        return node->elements().coordinates().coordinates(i);
+    }
+
+    Coordinates elementLocation(const TreeNode* node, size_t i, std::false_type) const
+    {
+        LocationCode<maxLevels> code = node->location(i);
+        double cellWidth = static_cast<double>(width) / cellsPerSide();
+        return Coordinates(startX + (code.x() + 0.5) * cellWidth,
+                           startY + (code.y() + 0.5) * cellWidth);
+    }
+
+    /**
+     * Joins subtrees of a node of this tree and a node of another tree. @see join()
+     */
+    template <typename Node, typename OtherTree, typename OtherNode, typename Predicate,
+              typename Callback>
+    void joinNodes(Node* node, const OtherTree& other, OtherNode* otherNode,
+                   const Predicate& predicate, Callback& callback) const
+    {
+        if (node->totalCount() == 0 || otherNode->totalCount() == 0 ||
+            !predicate.mayMatch(nodeArea(node), nodeArea(otherNode)))
+            return;
+
+        // Elements are stored only in leaves.
+        bool leaf = !node->hasChildren();
+        bool otherLeaf = !otherNode->hasChildren();
+        if (leaf && otherLeaf)
+        {
+            std::vector<Coordinates> locations;
+            locations.reserve(otherNode->count());
+            for (size_t j = 0; j < otherNode->count(); ++j)
+                locations.push_back(other.elementLocation(otherNode, j,
+                                      typename OtherTree::StoresCoordinates()));
+            for (size_t i = 0; i < node->count(); ++i)
+            {
+                Coordinates location = elementLocation(node, i, StoresCoordinates());
+                for (size_t j = 0; j < locations.size(); ++j)
+                {
+                    if (predicate(location, locations[j]))
+                        callback((*node)[i], (*otherNode)[j]);
+                }
+            }
+        }
+        else if (otherLeaf || (!leaf && node->level() >= otherNode->level()))
+        {
+            for (uint32_t childNo = 0; childNo < 4; ++childNo)
+            {
+                if (node->childExists(childNo))
+                    joinNodes(&(node->existingChild(childNo)), other, otherNode, predicate,
+                              callback);
+            }
+        }
+        else
+        {
+            for (uint32_t childNo = 0; childNo < 4; ++childNo)
+            {
+                if (otherNode->childExists(childNo))
+                    joinNodes(node, other, &(otherNode->existingChild(childNo)), predicate,
+                              callback);
+            }
+        }
+    }
+
+    /**
+     * Number of elements tested at once by region filters. Elements of a node are scanned in
+     * blocks of this size, each producing a bitmask of matches.
+     */
+    static const size_t scanBlock = 256;
+
+    /**
+     * Visits all elements of a subtree of a given node. Node might be const, then the visitor gets
+     * const references. The same holds for visitInRegion().
+     */
+    template <typename Node, typename Visitor>
+    static void visitSubtree(Node* node, Visitor& visitor)
+    {
+        for (size_t i = 0; i < node->count(); ++i)
+            visitor((*node)[i]);
+        for (uint32_t childNo = 0; childNo < 4; ++childNo)
+        {
+            if (node->childExists(childNo))
+                visitSubtree(&(node->existingChild(childNo)), visitor);
+        }
+    }
+
+    /**
+     * Maximum number of elements of a subtree which is visited by a single thread of
+     * parallelVisit(). Bigger subtrees are split into tasks for their children.
+     */
+    static const size_t parallelGrain = 1024;
+
+    /**
+     * Adapts a visitor called with an element to the one called with an element and a worker.
+     */
+    template <typename Visitor>
+    struct WorkerVisitor
+    {
+        explicit WorkerVisitor(Visitor& visitor) : visitor(&visitor) {}
+
+        template <typename Element>
+        void operator()(Element& element, unsigned) const
+        {
+            (*visitor)(element);
+        }
+
+        Visitor* visitor;
+    };
+
+    /**
+     * Calls visitor(element, worker) for each element of a subtree of a given node, using many
+     * threads. @see parallelForEach()
+     */
+    template <typename Node, typename Visitor>
+    static void parallelVisit(Node* start, unsigned threads, const Visitor& visitor)
+    {
+        if (start->totalCount() == 0)
+            return;
+
+        parallelTasks(start, threads, [&visitor](Node* node, TaskSpawner<Node*>& spawner,
+                                                 unsigned worker) {
+            if (node->totalCount() <= parallelGrain || node->count() > 0)
+            {
+                BoundVisitor<Visitor> bound = { &visitor, worker };
+                visitSubtree(node, bound);
+                return;
+            }
+            for (uint32_t childNo = 0; childNo < 4; ++childNo)
+            {
+                if (node->childExists(childNo) && node->existingChild(childNo).totalCount() > 0)
+                    spawner.spawn(&(node->existingChild(childNo)));
+            }
+        });
+    }
+
+    /**
+     * Binds a worker number to a visitor of parallelVisit(), so it might be given to
+     * visitSubtree().
+     */
+    template <typename Visitor>
+    struct BoundVisitor
+    {
+        template <typename Element>
+        void operator()(Element& element)
+        {
+            (*visitor)(element, worker);
+        }
+
+        const Visitor* visitor;
+        unsigned worker;
+    };
+
+    /**
+     * Visits elements of a subtree of a given node which match a given region. Region tells
+     * whether a node area intersects it or is contained in it and whether an element matches it.
+     */
+    template <typename Node, typename Region, typename Visitor>
+    static void visitInRegion(Node* node, const Region& region, Visitor& visitor)
+    {
+        Box box = nodeBox(node);
+        if (!region.intersects(box))
+            return;
+
+        if (region.contains(box))
+        {
+            visitSubtree(node, visitor);
+            return;
+        }
+
+        uint64_t mask[scanBlock / 64];
+        const typename TreeNode::storage_type& elements = node->elements();
+        for (size_t first = 0; first < elements.size(); first += scanBlock)
+        {
+            size_t count = std::min(size_t(scanBlock), elements.size() - first);
+            match(region, elements, first, count, mask, StoresCoordinates());
+            for (size_t word = 0; word < scan::maskWords(count); ++word)
+            {
+                for (uint64_t bits = mask[word]; bits != 0; bits &= bits - 1)
+                    visitor((*node)[first + word * 64 + scan::lowestBit(bits)]);
+            }
+        }
+        for (uint32_t childNo = 0; childNo < 4; ++childNo)
+        {
+            if (node->childExists(childNo))
+                visitInRegion(&(node->existingChild(childNo)), region, visitor);
+        }
+    }
+
+    /**
+     * Counts elements of a subtree of a given node which match a given region.
+     *
+     * @see visitInRegion()
+     */
+    template <typename Region>
+    static size_t countInRegion(const TreeNode* node, const Region& region)
+    {
+        Box box = nodeBox(node);
+        if (!region.intersects(box))
+            return 0;
+        if (region.contains(box))
+            return node->totalCount();
+
+        size_t count = 0;
+        uint64_t mask[scanBlock / 64];
+        const typename TreeNode::storage_type& elements = node->elements();
+        for (size_t first = 0; first < elements.size(); first += scanBlock)
+        {
+            size_t blockCount = std::min(size_t(scanBlock), elements.size() - first);
+            match(region, elements, first, blockCount, mask, StoresCoordinates());
+            for (size_t word = 0; word < scan::maskWords(blockCount); ++word)
+                count += scan::bitCount(mask[word]);
+        }
+        for (uint32_t childNo = 0; childNo < 4; ++childNo)
+        {
+            if (node->childExists(childNo))
+                count += countInRegion(&(node->existingChild(childNo)), region);
+        }
+        return count;
+    }
+
+    /**
+     * @return Root of the tree (the only child of the header). It always exists.
+     */
+    TreeNode& rootNode()
+    {
+        return root.existingChild(false, false);
+    }
+
+    const TreeNode& rootNode() const
+    {
+        return root.existingChild(false, false);
+    }
+
+    RectRegion rectRegion(double minX, double minY, double maxX, double maxY) const
+    {
+        Box cells = { toCellsX(minX), toCellsY(minY), toCellsX(maxX), toCellsY(maxY) };
+        return RectRegion(cells, minX, minY, maxX, maxY);
+    }
+
+    CircleRegion circleRegion(double x, double y, double radius) const
+    {
+        double cellRadius = radius / width * cellsPerSide();
+        return CircleRegion(toCellsX(x), toCellsY(y), cellRadius * cellRadius, x, y,
+                            radius * radius);
+    }
+
+    /**
+     * Implementation of both versions of near(), given a (possibly const) header node.
+     */
+    template <typename Iterator, typename Node>
+    std::pair<Iterator, Iterator> nearRange(Node* header, double x, double y) const
+    {
+        Iterator end(header, 0);
+        if (coordinatesAreOk(x, y))
+        {
+            Node* node = getExistingNode(&(header->existingChild(false, false)),
+                                         LocationCode<maxLevels>(tr.forward(Coordinates(x, y))));
+            Iterator last = ++Iterator(node, node->count());
+            if (node->count() == 0)
+                return std::pair<Iterator, Iterator>(last, last);
+            return std::pair<Iterator, Iterator>(Iterator(node, 0), last);
+        }
+        return std::pair<Iterator, Iterator>(end, end);
+    }
+
+    TreeNode* getExistingNode(const LocationCode<maxLevels>& code)
+    {
+        return getExistingNode(&rootNode(), code);
+    }
+
+    /**
+     * Finds the deepest existing node on a path from a given node to a given location. It never
+     * creates nodes. Node might be const.
+     */
+    template <typename Node>
+    static Node* getExistingNode(Node* node, const LocationCode<maxLevels>& code)
+    {
+        int level = maxLevels;
 
         do
         {
-            if (!node->hasChildren() || node == &(node->existingChild(code)))
-                break;
-            node = &(node->existingChild(code));
-        } while (--level);
-        return node;
+            if (!node->hasChildren() || node == &(node->existingChild(code)))
+                break;
+            node = &(node->existingChild(code));
+        } while (--level);
+        return node;
+    }
+
+    TreeNode* getNode(const LocationCode<maxLevels>& code)
+    {
+        // FIXME: it's really important to start from root.child (as root is a header) and ALL TESTS
+        // PASS WHEN IT'S CHANGED TO: `node = &root;`
+        return getNode(code, &(root.child(0, 0)));
+    }
+
+    /**
+     * Descends from a given node to the deepest node whose area contains a given location code.
+     * Nodes on the way are created when needed.
+     */
+    TreeNode* getNode(const LocationCode<maxLevels>& code, TreeNode* node)
+    {
+        int level = node->level() + 1;
+
+        do
+        {
+            if (!node->hasChildren() || node == &(node->child(code)))
+                break;
+            node = ownChild(node, code.quadrant(node->level() - 1));
+        } while (--level);
+        return node;
+    }
+
+    /**
+     * Destroys a given node and then its ancestors as long as they don't store any elements and
+     * don't have any children. Root node is never destroyed.
+     *
+     * @return The first node which wasn't destroyed.
+     */
+    TreeNode* removeEmptyNodes(TreeNode* node)
+    {
+        TreeNode* rootNode = &(root.child(0, 0));
+        while (node != rootNode && node->count() == 0 && !node->hasChildren())
+        {
+            TreeNode* parent = &(node->parent());
+            uint32_t childNo = node->locationCode().quadrant(node->level());
+            if (epochs != nullptr)
+                retire(parent->replaceChild(childNo, nullptr));
+            else
+                parent->removeChild(childNo);
+            node = parent;
+        }
+        return node;
+    }
+
+    /**
+     * Shortens the path to a node from which elements were removed: empty nodes are destroyed
+     * (@see removeEmptyNodes()) and then the highest ancestor below a given stop node which stores
+     * no more than capacity elements is merged with its subtree, so these elements end up in a
+     * single leaf again. Nodes on the path must be owned by the tree (@see ownPath()).
+     */
+    void shrinkPath(TreeNode* node, const TreeNode* stop)
+    {
+        node = removeEmptyNodes(node);
+        TreeNode* merged = nullptr;
+        for (; node != stop && node != &root && node->totalCount() <= nodeCapacity;
+             node = &(node->parent()))
+            merged = node;
+        if (merged != nullptr && merged->hasChildren())
+            collapse(merged);
+    }
+
+    /**
+     * Merges a given node with its subtree (@see TreeNode::collapse()). In the concurrent reads
+     * mode the node is replaced by a merged copy instead.
+     *
+     * @return The merged node.
+     */
+    TreeNode* collapse(TreeNode* node)
+    {
+        if (epochs != nullptr)
+        {
+            TreeNode* parent = &(node->parent());
+            uint32_t childNo = node->locationCode().quadrant(node->level());
+            TreeNode* merged = parent->cloneCollapsedChild(childNo);
+            retire(parent->replaceChild(childNo, merged));
+            node = merged;
+        }
+        else
+        {
+            node->collapse();
+        }
+        if (handles.enabled)
+            indexSlots(node);
+        return node;
+    }
+
+    /**
+     * Compacts subtrees of children of a given node, which must be owned by the tree. The root is
+     * never removed, even if it's empty. @see compact()
+     *
+     * @return Number of removed nodes.
+     */
+    size_t compactChildren(TreeNode* node)
+    {
+        size_t removed = 0;
+        for (uint32_t childNo = 0; childNo < 4; ++childNo)
+        {
+            if (!node->childExists(childNo))
+                continue;
+            TreeNode* child = &(node->existingChild(childNo));
+            if (child->totalCount() == 0 && node != &root)
+            {
+                removed += countNodes(child);
+                if (epochs != nullptr)
+                    retire(node->replaceChild(childNo, nullptr));
+                else
+                    node->removeChild(childNo);
+            }
+            else if (child->hasChildren())
+            {
+                child = ownChild(node, childNo);
+                if (child->totalCount() <= nodeCapacity)
+                {
+                    removed += countNodes(child) - 1;
+                    child = collapse(child);
+                    shrinkLeaf(child);
+                }
+                else
+                {
+                    removed += compactChildren(child);
+                }
+            }
+            else
+            {
+                shrinkLeaf(child);
+            }
+        }
+        return removed;
+    }
+
+    /**
+     * Releases unused memory of a leaf unless it's shared with snapshots or might be read
+     * concurrently.
+     */
+    void shrinkLeaf(TreeNode* node)
+    {
+        if (epochs == nullptr && !node->isShared())
+            node->shrinkToFit();
+    }
+
+    static size_t countNodes(const TreeNode* node)
+    {
+        size_t nodes = 1;
+        for (uint32_t childNo = 0; childNo < 4; ++childNo)
+        {
+            if (node->childExists(childNo))
+                nodes += countNodes(&(node->existingChild(childNo)));
+        }
+        return nodes;
+    }
+
+    static bool locationLess(const StoredObject& lhs, const StoredObject& rhs)
+    {
+        return lhs.location < rhs.location;
+    }
+
+    /**
+     * Location code of an element from a range passed to parallelBulkLoad() and its position in
+     * that range.
+     */
+    struct LocatedIndex
+    {
+        LocationCode<maxLevels> location;
+        size_t index;
+    };
+
+    static size_t invalidIndex()
+    {
+        return static_cast<size_t>(-1);
+    }
+
+    static bool locatedLess(const LocatedIndex& lhs, const LocatedIndex& rhs)
+    {
+        if (lhs.location != rhs.location)
+            return lhs.location < rhs.location;
+        return lhs.index < rhs.index;
+    }
+
+    struct QuadrantLess
+    {
+        QuadrantLess(size_t level, uint32_t childNo) : level(level), childNo(childNo) {}
+
+        template <typename Located>
+        bool operator()(const Located& located) const
+        {
+            return located.location.quadrant(level) < childNo;
+        }
+
+        size_t level;
+        uint32_t childNo;
+    };
+
+    /**
+     * Factories of objects stored in nodes built by build().
+     */
+    struct MoveObject
+    {
+        StoredObject&& operator()(StoredObject& object) const
+        {
+            return std::move(object);
+        }
+    };
+
+    template <typename RandomAccessIterator>
+    struct MakeObject
+    {
+        explicit MakeObject(RandomAccessIterator first) : first(first) {}
+
+        StoredObject operator()(const LocatedIndex& located) const
+        {
+            return StoredObject(LocationCode<maxLevels>(located.location),
+                                Coordinates(std::get<0>(first[located.index]),
+                                            std::get<1>(first[located.index])),
+                                std::get<2>(first[located.index]));
+        }
+
+        RandomAccessIterator first;
+    };
+
+    /**
+     * Builds a subtree of a given (empty) node from a range sorted by location codes. Objects are
+     * created from range elements by a given factory and new nodes are allocated from a given
+     * pool. Resulting structure is the same as the one created by inserting objects one by one.
+     */
+    template <typename Iterator, typename Factory>
+    void build(TreeNode* node, Iterator first, Iterator last, typename TreeNode::pool_type& pool,
+               const Factory& make)
+    {
+        if (static_cast<size_t>(last - first) <= nodeCapacity || node->level() == 0)
+        {
+            node->fill(first, last, make);
+            return;
+        }
+
+        // All objects share a prefix of codes up to the node level, so objects which belong to
+        // the same child form a continuous subrange.
+        size_t childLevel = node->level() - 1;
+        for (uint32_t childNo = 0; childNo < 4 && first != last; ++childNo)
+        {
+            Iterator childLast =
+                std::partition_point(first, last, QuadrantLess(childLevel, childNo + 1));
+            if (childLast != first)
+                build(&(node->child(childNo, pool)), first, childLast, pool, make);
+            first = childLast;
+        }
+        node->recount();
     }
 
-    TreeNode* getNode(const LocationCode<maxLevels>& code)
+    /**
+     * Inserts objects which are sorted by location codes and lie inside the tree range. An empty
+     * tree is built at once, otherwise objects descend the tree together (@see insertSorted()),
+     * except in the concurrent reads mode, in which they're published one by one.
+     */
+    template <typename Iterator>
+    void loadSorted(Iterator first, Iterator last)
     {
-        int level = maxLevels;
+        if (rootNode().count() == 0 && !rootNode().hasChildren())
+        {
+            buildTree(first, last);
+        }
+        else if (epochs != nullptr)
+        {
+            for (; first != last; ++first)
+                publishInsert(std::move(*first));
+        }
+        else if (first != last)
+        {
+            insertSorted(ownPath(&rootNode()), first, last);
+        }
+    }
 
-        // FIXME: it's really important to start from root.child (as root is a header) and ALL TESTS
-        // PASS WHEN IT'S CHANGED TO: `node = &root;`
-        TreeNode* node = &(root.child(0, 0));
+    /**
+     * Inserts objects sorted by location codes into the subtree of a given node, which must be
+     * owned by the tree (@see ownPath()). Objects which belong to the same child form a continuous
+     * subrange, so they're passed down together and each node on their way is visited once. A
+     * leaf which would overflow is split before they're passed to its children. Resulting nodes
+     * and order of elements are the same as after inserting objects one by one.
+     */
+    template <typename Iterator>
+    void insertSorted(TreeNode* node, Iterator first, Iterator last)
+    {
+        if (!node->hasChildren())
+        {
+            if (node->count() + static_cast<size_t>(last - first) <= nodeCapacity ||
+                node->level() == 0)
+            {
+                for (; first != last; ++first)
+                {
+                    size_t position = node->insert(std::move(*first));
+                    if (handles.enabled)
+                        placeSlot(node, position, TreeSlots::noSlot, nullptr);
+                }
+                return;
+            }
+            node->split();
+            if (handles.enabled)
+                indexSlots(node);
+        }
 
-        do
+        size_t childLevel = node->level() - 1;
+        for (uint32_t childNo = 0; childNo < 4 && first != last; ++childNo)
         {
-            if (!node->hasChildren() || node == &(node->child(code)))
-                break;
-            node = &(node->child(code));
-        } while (--level);
-        return node;
+            Iterator childLast =
+                std::partition_point(first, last, QuadrantLess(childLevel, childNo + 1));
+            if (childLast != first)
+            {
+                TreeNode* child = node->childExists(childNo) ? ownChild(node, childNo) :
+                                                               &(node->child(childNo));
+                insertSorted(child, first, childLast);
+            }
+            first = childLast;
+        }
+    }
+
+    typedef typename std::vector<LocatedIndex>::iterator LocatedIterator;
+
+    /**
+     * Subtree which is built by a single thread in parallelBulkLoad().
+     */
+    struct BuildTask
+    {
+        BuildTask(TreeNode* node, LocatedIterator first, LocatedIterator last)
+            : node(node), first(first), last(last) {}
+
+        TreeNode* node;
+        LocatedIterator first;
+        LocatedIterator last;
+    };
+
+    /**
+     * Creates nodes of top tree levels, down to the level at which each node corresponds to a
+     * single bucket, and gathers subtrees below them as tasks. Nodes that shall become leaves are
+     * tasks too. Other created nodes are gathered in planned in the top-down order. Buckets
+     * [firstBucket, lastBucket) form a whole range of a given node.
+     */
+    void planBuild(TreeNode* node, size_t depth, size_t bucketLevels, LocatedIterator sorted,
+                   const std::vector<size_t>& bucketStarts, size_t firstBucket, size_t lastBucket,
+                   std::vector<BuildTask>& tasks, std::vector<TreeNode*>& planned)
+    {
+        size_t first = bucketStarts[firstBucket];
+        size_t last = bucketStarts[lastBucket];
+        if (first == last)
+            return;
+
+        if (last - first <= nodeCapacity || node->level() == 0 || depth == bucketLevels)
+        {
+            tasks.push_back(BuildTask(node, sorted + first, sorted + last));
+            return;
+        }
+
+        planned.push_back(node);
+        size_t childBuckets = (lastBucket - firstBucket) / 4;
+        for (uint32_t childNo = 0; childNo < 4; ++childNo)
+        {
+            size_t childFirst = firstBucket + childNo * childBuckets;
+            if (bucketStarts[childFirst] != bucketStarts[childFirst + childBuckets])
+            {
+                planBuild(&(node->child(childNo)), depth + 1, bucketLevels, sorted, bucketStarts,
+                          childFirst, childFirst + childBuckets, tasks, planned);
+            }
+        }
+    }
+
+    /**
+     * Number of replaced nodes after which modifications try to free them.
+     */
+    static const size_t reclaimBatch = 64;
+
+    void retire(TreeNode* node)
+    {
+        if (node == nullptr)
+            return;
+        retired.nodes.push_back(std::make_pair(node, epochs->epoch()));
+        epochs->advance();
+        if (retired.nodes.size() >= reclaimBatch)
+            reclaim();
+    }
+
+    void reclaimAll()
+    {
+        for (size_t i = 0; i < retired.nodes.size(); ++i)
+            TreeNode::destroyDetached(retired.nodes[i].first);
+        retired.nodes.clear();
+    }
+
+    /**
+     * Frees a node which was replaced in the tree: it's retired in the concurrent reads mode and
+     * otherwise the tree drops its reference, so it's kept as long as snapshots use it.
+     */
+    void discard(TreeNode* node)
+    {
+        if (epochs != nullptr)
+            retire(node);
+        else if (node != nullptr)
+            TreeNode::release(node);
+    }
+
+    /**
+     * Makes nodes on the path from the root to a given node referenced only by the tree, so they
+     * might be modified in place. Nodes shared with snapshots are copied (@see snapshot()).
+     *
+     * @return The node or its copy which has replaced it.
+     */
+    TreeNode* ownPath(TreeNode* node)
+    {
+        if (!snapshots.registry)
+            return node;
+        collectSnapshots();
+
+        LocationCode<maxLevels> code = node->locationCode();
+        size_t level = node->level();
+        TreeNode* owned = ownChild(&root, 0);
+        while (owned->level() > level)
+            owned = ownChild(owned, code.quadrant(owned->level() - 1));
+        return owned;
+    }
+
+    /**
+     * @see TreeNode::ownChild() The child must exist. Handle slots of elements of a copied node
+     *      are pointed to the copy.
+     */
+    TreeNode* ownChild(TreeNode* parent, uint32_t childNo)
+    {
+        TreeNode* child = &(parent->existingChild(childNo));
+        if (!snapshots.registry)
+            return child;
+
+        TreeNode* owned = parent->ownChild(childNo);
+        if (owned != child && handles.enabled && owned->hasSlots())
+        {
+            for (size_t i = 0; i < owned->count(); ++i)
+                handles.slots.update(owned->slot(i), owned, i);
+        }
+        return owned;
+    }
+
+    /**
+     * Drops the tree's references to roots of released snapshots, which frees nodes used only by
+     * them. Stops tracking snapshots when there are none left.
+     */
+    void collectSnapshots()
+    {
+        SnapshotRegistry& registry = *snapshots.registry;
+        bool last = registry.live.load(std::memory_order_acquire) == 0;
+        if (!last && !registry.pending.load(std::memory_order_relaxed))
+            return;
+
+        std::vector<TreeNode*> released;
+        {
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            released.swap(registry.released);
+            registry.pending.store(false, std::memory_order_relaxed);
+        }
+        for (size_t i = 0; i < released.size(); ++i)
+            TreeNode::release(released[i]);
+        // Snapshots are released before they're uncounted, so none of them is left behind.
+        if (last)
+            snapshots.registry.reset();
+    }
+
+    /**
+     * Builds an empty tree from given elements sorted by location codes.
+     */
+    template <typename Iterator>
+    void buildTree(Iterator first, Iterator last)
+    {
+        TreeNode* target = buildRoot();
+        try
+        {
+            build(target, first, last, root.pool(), MoveObject());
+        }
+        catch (...)
+        {
+            publishRoot(target);
+            throw;
+        }
+        publishRoot(target);
+    }
+
+    void saveCoordinates(std::ostream& out, const std::vector<const TreeNode*>& nodes,
+                         std::true_type) const
+    {
+        for (size_t i = 0; i < nodes.size(); ++i)
+        {
+            image::write(out, nodes[i]->elements().coordinates().x(),
+                         nodes[i]->count() * sizeof(double));
+        }
+        for (size_t i = 0; i < nodes.size(); ++i)
+        {
+            image::write(out, nodes[i]->elements().coordinates().y(),
+                         nodes[i]->count() * sizeof(double));
+        }
+    }
+
+    void saveCoordinates(std::ostream&, const std::vector<const TreeNode*>&, std::false_type) const
+    {}
+
+    template <typename Image>
+    static Coordinates imageCoordinates(const Image& image, size_t i, std::true_type)
+    {
+        return image.coordinates(i);
+    }
+
+    template <typename Image>
+    static Coordinates imageCoordinates(const Image&, size_t, std::false_type)
+    {
+        return Coordinates(0, 0);
+    }
+
+    /**
+     * @return Node in which bulk loads build an empty tree. In the concurrent reads mode it's a new
+     *         root, which is published by publishRoot() when it's complete.
+     */
+    TreeNode* buildRoot()
+    {
+        if (epochs != nullptr)
+            return root.createDetachedChild(0);
+        return ownPath(&rootNode());
+    }
+
+    /**
+     * Makes a node built by a bulk load the root. Built nodes aren't linked to each other (@see
+     * QuadNode::fill()), so the list of non-empty nodes is rebuilt.
+     */
+    void publishRoot(TreeNode* node)
+    {
+        if (node != &rootNode())
+            discard(root.replaceChild(0, node));
+        root.recount();
+        if (epochs == nullptr)
+            root.threadLeaves();
+        if (handles.enabled)
+            indexSlots(&rootNode());
+    }
+
+    /**
+     * Inserts an element in the concurrent reads mode. The node which receives the element is
+     * either created or copied from an existing leaf, then the element is inserted (splitting the
+     * node when needed) and finally the node replaces the old one. @see insertBelow() for the
+     * meaning of slot.
+     */
+    iterator publishInsert(StoredObject&& toStore, uint32_t slot = TreeSlots::noSlot)
+    {
+        TreeNode* node = getExistingNode(toStore.location);
+        TreeNode* parent;
+        uint32_t childNo;
+        TreeNode* fresh;
+        if (node->hasChildren())
+        {
+            parent = node;
+            childNo = toStore.location.quadrant(node->level() - 1);
+            fresh = parent->createDetachedChild(childNo);
+        }
+        else
+        {
+            parent = &(node->parent());
+            childNo = node->locationCode().quadrant(node->level());
+            fresh = parent->cloneChild(childNo);
+        }
+
+        TreeNode* target = fresh;
+        size_t position;
+        try
+        {
+            while (target->count() == nodeCapacity && target->level() > 0)
+            {
+                target->split();
+                target = &(target->child(toStore.location));
+            }
+            position = target->insert(std::move(toStore));
+        }
+        catch (...)
+        {
+            TreeNode::destroyDetached(fresh);
+            throw;
+        }
+        retire(parent->replaceChild(childNo, fresh));
+        if (handles.enabled)
+            placeSlot(target, position, slot, fresh);
+        return iterator(target, position);
+    }
+
+    /**
+     * Moves an element to a new location in the concurrent reads mode. The element's leaf is
+     * copied and the copy replaces it either with the element relocated in place or without the
+     * element, which is then inserted again with publishInsert().
+     */
+    iterator publishRelocate(TreeNode* node, size_t position, const LocationCode<maxLevels>& code,
+                             const Coordinates& coordinates, bool sameNode)
+    {
+        TreeNode* parent = &(node->parent());
+        uint32_t childNo = node->locationCode().quadrant(node->level());
+        TreeNode* copy = parent->cloneChild(childNo);
+        if (sameNode)
+        {
+            copy->relocate(position, code, coordinates);
+            retire(parent->replaceChild(childNo, copy));
+            if (handles.enabled)
+                indexSlots(copy);
+            return iterator(copy, position);
+        }
+
+        uint32_t slot = handles.enabled ? copy->slot(position) : TreeSlots::noSlot;
+        StoredObject toStore(LocationCode<maxLevels>(code), coordinates,
+                              std::move((*copy)[position]));
+        copy->erase(copy->begin() + position);
+        retire(parent->replaceChild(childNo, copy));
+        if (handles.enabled)
+            indexSlots(copy);
+        iterator moved = publishInsert(std::move(toStore), slot);
+        TreeNode* ancestor = &(copy->parent());
+        while (!code.samePrefix(ancestor->locationCode(), ancestor->level()))
+            ancestor = &(ancestor->parent());
+        shrinkPath(copy, ancestor);
+        return moved;
+    }
+
+    /**
+     * Erases elements with a given code from a leaf in the concurrent reads mode. @see
+     * publishInsert()
+     *
+     * @return Node which replaced the given one or the given one if nothing was erased.
+     */
+    TreeNode* publishErase(TreeNode* node, const LocationCode<maxLevels>& code)
+    {
+        const code_type* codes = node->elements().codes();
+        if (std::find(codes, codes + node->count(), code.key) == codes + node->count())
+            return node;
+
+        TreeNode* parent = &(node->parent());
+        uint32_t childNo = node->locationCode().quadrant(node->level());
+        TreeNode* copy = parent->cloneChild(childNo);
+        copy->erase(code);
+        retire(parent->replaceChild(childNo, copy));
+        return copy;
     }
 
     iterator insert(StoredObject&& toStore)
     {
-        TreeNode* node = getNode(toStore.location);
+        if (epochs != nullptr)
+            return publishInsert(std::move(toStore));
+
+        return insertBelow(ownPath(&rootNode()), std::move(toStore));
+    }
+
+    /**
+     * Inserts an element into the subtree of a given node, whose area must contain the element's
+     * location. When handles are enabled, the element gets a given handle slot (when it's moved
+     * from another node) or a new one (when noSlot is given).
+     */
+    iterator insertBelow(TreeNode* start, StoredObject&& toStore,
+                         uint32_t slot = TreeSlots::noSlot)
+    {
+        TreeNode* node = getNode(toStore.location, start);
+        TreeNode* splitFrom = node;
         if (node->level() > 0)
         {
             // We store one element at time so there will be a moment before node overflow when its
@@ -276,30 +2589,201 @@ private:
             // relocated to the another child node.
             while (node->count() == nodeCapacity && node->level() > 0)
             {
-                typename TreeNode::iterator it;
-                typename TreeNode::iterator itEnd = node->end();
-                for (it = node->begin(); it != itEnd; ++it)
-                {
-                    node->child(it->location).insert(std::move(*it));
-                }
-                node->clear();
+                node->split();
                 node = &(node->child(toStore.location));
             }
         }
-        return iterator(node, node->insert(std::move(toStore)));
+        size_t position = node->insert(std::move(toStore));
+        if (handles.enabled)
+            placeSlot(node, position, slot, splitFrom != node ? splitFrom : nullptr);
+        return iterator(node, position);
+    }
+
+    /**
+     * Points handle slots of all elements of a subtree to their current positions. Elements which
+     * don't have slots yet (i.e. the ones put into nodes built by bulk loads) get new ones.
+     */
+    void indexSlots(TreeNode* node)
+    {
+        if (node->hasSlots())
+        {
+            for (size_t i = 0; i < node->count(); ++i)
+                handles.slots.update(node->slot(i), node, i);
+        }
+        else
+        {
+            for (size_t i = 0; i < node->count(); ++i)
+                node->setSlot(i, handles.slots.acquire(node, i));
+        }
+        for (uint32_t childNo = 0; childNo < 4; ++childNo)
+        {
+            if (node->childExists(childNo))
+                indexSlots(&(node->existingChild(childNo)));
+        }
+    }
+
+    /**
+     * Gives a just inserted element a given handle slot or a new one and, when the element's node
+     * was split, points slots of all elements moved by splits to their new positions.
+     */
+    void placeSlot(TreeNode* node, size_t position, uint32_t slot, TreeNode* split)
+    {
+        if (slot == TreeSlots::noSlot)
+            slot = handles.slots.acquire(node, position);
+        else
+            handles.slots.update(slot, node, position);
+        node->setSlot(position, slot);
+        if (split != nullptr)
+            indexSlots(split);
+    }
+
+    /**
+     * Frees handle slots of all elements of a leaf which have a given code.
+     */
+    void releaseSlots(const TreeNode* node, const LocationCode<maxLevels>& code)
+    {
+        const code_type* codes = node->elements().codes();
+        for (size_t i = 0; i < node->count(); ++i)
+        {
+            if (codes[i] == code.key)
+                handles.slots.release(node->slot(i));
+        }
+    }
+
+    /**
+     * @return Slot of a given handle or nullptr when it's invalid. Slots copied together with
+     *         the tree are pointed to its nodes first.
+     */
+    const typename TreeSlots::Slot* findSlot(handle_type handle)
+    {
+        if (!handles.enabled)
+            return nullptr;
+        if (handles.stale)
+        {
+            handles.stale = false;
+            indexSlots(&rootNode());
+        }
+        return handles.slots.find(handle);
     }
 
 private:
+    // Trees with different element types are joined. @see join()
+    template <typename, size_t, typename, bool>
+    friend class QuadTree;
+    // Ingests hand over elements which they've already located and sorted. @see loadSorted()
+    template <typename, typename>
+    friend class IngestPipeline;
+
     size_t width;
     size_t startX;
     size_t startY;
     size_t nodeCapacity;
 
+    /**
+     * Nodes replaced in the concurrent reads mode together with epochs in which they were
+     * replaced. They belong to the tree's pool, so copies of the tree don't take them over.
+     */
+    struct RetiredNodes
+    {
+        typedef std::pair<TreeNode*, uint64_t> Retired;
+        typedef typename std::allocator_traits<Allocator>::template rebind_alloc<Retired>
+            RetiredAllocator;
+
+        explicit RetiredNodes(const Allocator& alloc) : nodes((RetiredAllocator(alloc))) {}
+        RetiredNodes(const RetiredNodes& that) : nodes(that.nodes.get_allocator()) {}
+
+        RetiredNodes& operator=(const RetiredNodes&)
+        {
+            // Nodes are destroyed together with the pool they belong to.
+            nodes.clear();
+            return *this;
+        }
+
+        std::vector<Retired, RetiredAllocator> nodes;
+    };
+
+    /**
+     * Table of handle slots (@see enableHandles()). Slots copied from another tree point to nodes
+     * of that tree, so they're marked as stale and pointed to the tree's own nodes when handles are
+     * resolved for the first time.
+     */
+    struct HandleSlots
+    {
+        explicit HandleSlots(const Allocator& alloc) : slots(alloc), enabled(false), stale(false) {}
+        HandleSlots(const HandleSlots& that)
+            : slots(that.slots), enabled(that.enabled), stale(that.enabled) {}
+
+        HandleSlots& operator=(const HandleSlots& that)
+        {
+            slots = that.slots;
+            enabled = that.enabled;
+            stale = that.enabled;
+            return *this;
+        }
+
+        TreeSlots slots;
+        bool enabled;
+        bool stale;
+    };
+
+    /**
+     * State shared by the tree with its snapshots. Roots of released snapshots are handed over
+     * to the tree, which frees their nodes. It's used by many threads, so it doesn't use the
+     * tree's allocator, which might not be thread-safe.
+     */
+    struct SnapshotRegistry
+    {
+        SnapshotRegistry() : live(0), pending(false) {}
+
+        std::mutex mutex;
+        std::vector<TreeNode*> released;
+        std::atomic<size_t> live;
+        std::atomic<bool> pending;
+    };
+
+    /**
+     * Registry of the tree's snapshots, which exists while any of them might share nodes with the
+     * tree. Copies of the tree don't share nodes with anyone, so they start without one.
+     */
+    struct Snapshots
+    {
+        Snapshots() {}
+        Snapshots(const Snapshots&) {}
+
+        Snapshots& operator=(const Snapshots&)
+        {
+            registry.reset();
+            return *this;
+        }
+
+        std::shared_ptr<SnapshotRegistry> registry;
+    };
+
     CoordTr<0, 0, 1, 1> tr;
-    TreeNode header;
     TreeNode root;
+    EpochDomain* epochs;
+    RetiredNodes retired;
+    HandleSlots handles;
+    Snapshots snapshots;
 };
 
+#if defined(__has_include) && __cplusplus >= 201703L
+#if __has_include(<memory_resource>)
+namespace pmr {
+
+/**
+ * QuadTree which uses a polymorphic allocator, so it can be placed on any std::pmr::memory_resource
+ * (e.g. std::pmr::monotonic_buffer_resource or std::pmr::unsynchronized_pool_resource). Memory
+ * resource is passed to the tree constructor.
+ */
+template <typename ElementType, size_t maxLevels = 10, bool storeCoordinates = false>
+using QuadTree = geo::QuadTree<ElementType, maxLevels,
+                               std::pmr::polymorphic_allocator<ElementType>, storeCoordinates>;
+
+} // namespace pmr
+#endif
+#endif
+
 } // namespace geo
 
 #endif
@@ -0,0 +1,84 @@
+#ifndef GEO_SPATIALJOIN_HPP_
+#define GEO_SPATIALJOIN_HPP_
+
+#include <algorithm>
+#include <cmath>
+
+#include "QuadTree.hpp"
+
+namespace geo {
+
+/**
+ * Join predicate which matches elements that are at most a given distance apart.
+ * @see QuadTree::join()
+ */
+class WithinDistance
+{
+public:
+    explicit WithinDistance(double distance) : distance2(distance * distance), valid(distance >= 0)
+    {}
+
+    bool mayMatch(const Area& lhs, const Area& rhs) const
+    {
+        double dx = std::max(0.0, std::max(lhs.minX - rhs.maxX, rhs.minX - lhs.maxX));
+        double dy = std::max(0.0, std::max(lhs.minY - rhs.maxY, rhs.minY - lhs.maxY));
+        return valid && dx * dx + dy * dy <= distance2;
+    }
+
+    bool operator()(const Coordinates& lhs, const Coordinates& rhs) const
+    {
+        double dx = lhs.x() - rhs.x();
+        double dy = lhs.y() - rhs.y();
+        return valid && dx * dx + dy * dy <= distance2;
+    }
+
+private:
+    double distance2;
+    bool valid;
+};
+
+/**
+ * Join predicate which matches elements whose rectangles overlap. Each element of the first tree
+ * is treated as a rectangle of a given size centered at its location and each element of the
+ * second tree as a rectangle of another size, e.g. a vehicle's surroundings and a building's
+ * outline. Rectangles touching each other overlap. @see QuadTree::join()
+ */
+class RectsOverlap
+{
+public:
+    RectsOverlap(double width, double height, double otherWidth, double otherHeight)
+        : maxDx((width + otherWidth) / 2), maxDy((height + otherHeight) / 2) {}
+
+    bool mayMatch(const Area& lhs, const Area& rhs) const
+    {
+        return lhs.minX - maxDx <= rhs.maxX && rhs.minX <= lhs.maxX + maxDx &&
+               lhs.minY - maxDy <= rhs.maxY && rhs.minY <= lhs.maxY + maxDy;
+    }
+
+    bool operator()(const Coordinates& lhs, const Coordinates& rhs) const
+    {
+        return std::abs(lhs.x() - rhs.x()) <= maxDx && std::abs(lhs.y() - rhs.y()) <= maxDy;
+    }
+
+private:
+    double maxDx;
+    double maxDy;
+};
+
+/**
+ * Calls a given callback for each pair of elements from two trees which satisfy a given predicate.
+ * Trees must cover the same area and have the same number of levels, but they might store
+ * different types of elements. When either tree is const, the callback is called with const
+ * references.
+ *
+ * @see QuadTree::join()
+ */
+template <typename TreeA, typename TreeB, typename Predicate, typename Callback>
+Callback join(TreeA& treeA, TreeB& treeB, const Predicate& predicate, Callback callback)
+{
+    return treeA.join(treeB, predicate, callback);
+}
+
+} // namespace geo
+
+#endif
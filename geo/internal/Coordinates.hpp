@@ -40,6 +40,17 @@ private:
     double y_;
 };
 
+/**
+ * Axis-aligned rectangle, e.g. an area covered by a tree node. Bounds are inclusive.
+ */
+struct Area
+{
+    double minX;
+    double minY;
+    double maxX;
+    double maxY;
+};
+
 /**
  * Transforms coordinates from one carthesian system to another.
  *
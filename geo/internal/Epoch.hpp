@@ -0,0 +1,151 @@
+#ifndef GEO_EPOCH_HPP_
+#define GEO_EPOCH_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+
+namespace geo {
+
+/**
+ * Epoch-based reclamation domain, which lets readers traverse a structure while a single writer
+ * modifies it.
+ *
+ * The writer never modifies data which readers might see. Instead, it builds new data aside,
+ * publishes it atomically and retires the old one with the current epoch(), then calls advance().
+ * Readers pin the current epoch for the duration of their reads (@see EpochGuard). Data retired
+ * with an epoch lower than oldestPinned() is no longer reachable by any reader and might be freed.
+ *
+ * Readers register in a fixed number of slots. Readers which don't find a free slot wait until one
+ * is released.
+ */
+class EpochDomain
+{
+private:
+    // Slots are padded to separate cache lines, so readers don't invalidate each other's ones.
+    struct Slot
+    {
+        std::atomic<uint64_t> epoch;
+        char padding[64 - sizeof(std::atomic<uint64_t>)];
+    };
+
+public:
+    /**
+     * @param readers Maximum number of readers which might pin epochs at the same time.
+     */
+    explicit EpochDomain(size_t readers = 64)
+        : globalEpoch(1), slots(new Slot[readers]), slotCount(readers)
+    {
+        if (readers == 0)
+            throw std::invalid_argument("epoch domain needs at least 1 reader slot");
+        for (size_t i = 0; i < slotCount; ++i)
+            slots[i].epoch.store(0, std::memory_order_relaxed);
+    }
+
+    EpochDomain(const EpochDomain&) = delete;
+    EpochDomain& operator=(const EpochDomain&) = delete;
+
+    /**
+     * Pins the current epoch in a free slot, waiting for one if necessary.
+     *
+     * @return Number of the taken slot, which must be given back to unpin().
+     */
+    size_t pin()
+    {
+        for (;;)
+        {
+            uint64_t epoch = globalEpoch.load(std::memory_order_acquire);
+            for (size_t i = 0; i < slotCount; ++i)
+            {
+                uint64_t free = 0;
+                if (slots[i].epoch.load(std::memory_order_relaxed) == 0 &&
+                    slots[i].epoch.compare_exchange_strong(free, epoch))
+                {
+                    // Pairs with the fence in oldestPinned(): either the writer sees this slot, or
+                    // this reader sees everything the writer had unlinked before checking slots.
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    return i;
+                }
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    void unpin(size_t slot)
+    {
+        slots[slot].epoch.store(0, std::memory_order_release);
+    }
+
+    uint64_t epoch() const
+    {
+        return globalEpoch.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Starts a new epoch. Readers which pin it can't see anything retired before.
+     *
+     * @return The new epoch.
+     */
+    uint64_t advance()
+    {
+        return globalEpoch.fetch_add(1, std::memory_order_acq_rel) + 1;
+    }
+
+    /**
+     * @return The oldest epoch pinned by any reader or the maximum value of uint64_t when there
+     *         are no readers.
+     */
+    uint64_t oldestPinned() const
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t oldest = std::numeric_limits<uint64_t>::max();
+        for (size_t i = 0; i < slotCount; ++i)
+        {
+            uint64_t epoch = slots[i].epoch.load(std::memory_order_acquire);
+            if (epoch != 0 && epoch < oldest)
+                oldest = epoch;
+        }
+        return oldest;
+    }
+
+private:
+    std::atomic<uint64_t> globalEpoch;
+    std::unique_ptr<Slot[]> slots;
+    size_t slotCount;
+};
+
+/**
+ * Pins the current epoch of a domain for its lifetime. Everything a reader reaches while holding
+ * a guard stays valid until the guard is destroyed.
+ */
+class EpochGuard
+{
+public:
+    explicit EpochGuard(EpochDomain& domain) : domain(&domain), slot(domain.pin()) {}
+
+    EpochGuard(EpochGuard&& that) : domain(that.domain), slot(that.slot)
+    {
+        that.domain = nullptr;
+    }
+
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator=(const EpochGuard&) = delete;
+
+    ~EpochGuard()
+    {
+        if (domain != nullptr)
+            domain->unpin(slot);
+    }
+
+private:
+    EpochDomain* domain;
+    size_t slot;
+};
+
+} // namespace geo
+
+#endif
@@ -0,0 +1,144 @@
+#ifndef GEO_LEAF_ITERATOR_HPP_
+#define GEO_LEAF_ITERATOR_HPP_
+
+#include <iterator>
+#include <cstddef>
+
+namespace geo {
+
+/**
+ * Bidirectional iterator over elements stored in a flat, ordered array of blocks of leaves (used by
+ * LinearQuadTree). Elements of all leaves of a block are kept in one container, so the iterator
+ * doesn't care about leaves. Empty blocks are skipped. Past-the-end iterator points to a position
+ * right after the last block.
+ *
+ * @param Blocks      Random access container of blocks. Each block must have an `objects` member
+ *                    which is a random access container of objects with an `object` member.
+ * @param ElementType Type of element returned on dereference.
+ */
+template <typename Blocks, typename ElementType>
+class LeafIterator : public std::iterator<std::bidirectional_iterator_tag, ElementType>
+{
+private:
+    typedef std::iterator<std::bidirectional_iterator_tag, ElementType> IteratorType;
+    typedef LeafIterator<Blocks, ElementType> LeafIteratorT;
+
+public:
+    typedef std::bidirectional_iterator_tag iterator_category;
+    typedef typename IteratorType::value_type value_type;
+    typedef typename IteratorType::difference_type difference_type;
+    typedef typename IteratorType::reference reference;
+    typedef typename IteratorType::pointer pointer;
+
+public:
+    LeafIterator() : blocks(nullptr), block(0), pos(0) {}
+    LeafIterator(Blocks* blocks, size_t block, size_t pos)
+        : blocks(blocks), block(block), pos(pos) {}
+
+    operator bool() const
+    {
+        return (blocks != nullptr);
+    }
+
+    bool operator==(const LeafIteratorT& rhs) const
+    {
+        return (blocks == rhs.blocks && block == rhs.block && pos == rhs.pos);
+    }
+
+    bool operator!=(const LeafIteratorT& rhs) const
+    {
+        return !(operator==(rhs));
+    }
+
+    ElementType& operator*() const
+    {
+        return (*blocks)[block].objects[pos].object;
+    }
+
+    ElementType* operator->() const
+    {
+        return &(operator*());
+    }
+
+    // preincrementation (++it)
+    LeafIteratorT& operator++()
+    {
+        if (block < blocks->size())
+            ++pos;
+        skipEmpty();
+        return *this;
+    }
+
+    // postincrementation (it++)
+    LeafIteratorT operator++(int)
+    {
+        LeafIteratorT ret(*this);
+        operator++();
+        return ret;
+    }
+
+    // predecrementation (--it)
+    LeafIteratorT& operator--()
+    {
+        if (pos > 0)
+        {
+            --pos;
+            return *this;
+        }
+
+        while (block > 0)
+        {
+            --block;
+            if (!(*blocks)[block].objects.empty())
+            {
+                pos = (*blocks)[block].objects.size() - 1;
+                return *this;
+            }
+        }
+
+        // Decrementing begin() is not allowed, we mark iterator as invalid in that case (the same
+        // way as TreeNodeIterator does).
+        blocks = nullptr;
+        pos = 0;
+        return *this;
+    }
+
+    // postdecrementation (it--)
+    LeafIteratorT operator--(int)
+    {
+        LeafIteratorT ret(*this);
+        operator--();
+        return ret;
+    }
+
+    /**
+     * Moves iterator forward until it points to an existing element or past-the-end position.
+     */
+    void skipEmpty()
+    {
+        while (block < blocks->size() && pos >= (*blocks)[block].objects.size())
+        {
+            ++block;
+            pos = 0;
+        }
+    }
+
+    size_t blockIndex() const
+    {
+        return block;
+    }
+
+    size_t position() const
+    {
+        return pos;
+    }
+
+private:
+    Blocks* blocks;
+    size_t block;
+    size_t pos;
+};
+
+} // namespace geo
+
+#endif
@@ -0,0 +1,443 @@
+#ifndef GEO_LEAFSCAN_HPP_
+#define GEO_LEAFSCAN_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+
+#include "Morton.hpp"
+#include "MortonBatch.hpp"
+
+namespace geo {
+
+/**
+ * Predicate kernels which test whole arrays of elements' location codes or coordinates (@see
+ * LeafStorage) against a rectangle or a circle. Results are returned as bitmasks: bit i % 64 of
+ * mask[i / 64] is set when element i matches. Masks must have room for (count + 63) / 64 words;
+ * all of them are overwritten.
+ *
+ * There are scalar kernels and AVX2 ones, chosen at runtime the same way as Morton batch encoders
+ * are (@see morton::batch::bestKernel()). Both give identical results.
+ */
+namespace scan {
+
+/**
+ * Inclusive bounds of cells (smallest tree nodes) which match a rectangle.
+ */
+struct CellRange
+{
+    int64_t minX;
+    int64_t minY;
+    int64_t maxX;
+    int64_t maxY;
+};
+
+inline size_t maskWords(size_t count)
+{
+    return (count + 63) / 64;
+}
+
+/**
+ * @return Position of the lowest set bit of a given (non-zero) mask word.
+ */
+inline unsigned lowestBit(uint64_t word)
+{
+#if defined(__GNUC__)
+    return static_cast<unsigned>(__builtin_ctzll(word));
+#else
+    unsigned bit = 0;
+    while ((word & 1) == 0)
+    {
+        word >>= 1;
+        ++bit;
+    }
+    return bit;
+#endif
+}
+
+/**
+ * @return Number of set bits in a given mask word.
+ */
+inline unsigned bitCount(uint64_t word)
+{
+#if defined(__GNUC__)
+    return static_cast<unsigned>(__builtin_popcountll(word));
+#else
+    unsigned bits = 0;
+    for (; word != 0; word &= word - 1)
+        ++bits;
+    return bits;
+#endif
+}
+
+namespace scalar {
+
+template <typename KeyType>
+void cellsInRect(const KeyType* codes, size_t count, const CellRange& r, uint64_t* mask)
+{
+    std::fill(mask, mask + maskWords(count), 0);
+    for (size_t i = 0; i < count; ++i)
+    {
+        int64_t x = morton::Codec<KeyType>::x(codes[i]);
+        int64_t y = morton::Codec<KeyType>::y(codes[i]);
+        if (x >= r.minX && x <= r.maxX && y >= r.minY && y <= r.maxY)
+            mask[i / 64] |= uint64_t(1) << (i % 64);
+    }
+}
+
+/**
+ * Cells are 1 wide boxes, which match when their distance to (x, y) isn't greater than the radius.
+ */
+template <typename KeyType>
+void cellsInCircle(const KeyType* codes, size_t count, double x, double y, double radius2,
+                   uint64_t* mask)
+{
+    std::fill(mask, mask + maskWords(count), 0);
+    for (size_t i = 0; i < count; ++i)
+    {
+        double cellX = morton::Codec<KeyType>::x(codes[i]);
+        double cellY = morton::Codec<KeyType>::y(codes[i]);
+        double dx = std::max(std::max(cellX - x, x - (cellX + 1)), 0.0);
+        double dy = std::max(std::max(cellY - y, y - (cellY + 1)), 0.0);
+        if (dx * dx + dy * dy <= radius2)
+            mask[i / 64] |= uint64_t(1) << (i % 64);
+    }
+}
+
+inline void pointsInRect(const double* xs, const double* ys, size_t count, double minX,
+                         double minY, double maxX, double maxY, uint64_t* mask)
+{
+    std::fill(mask, mask + maskWords(count), 0);
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (xs[i] >= minX && xs[i] <= maxX && ys[i] >= minY && ys[i] <= maxY)
+            mask[i / 64] |= uint64_t(1) << (i % 64);
+    }
+}
+
+inline void pointsInCircle(const double* xs, const double* ys, size_t count, double x, double y,
+                           double radius2, uint64_t* mask)
+{
+    std::fill(mask, mask + maskWords(count), 0);
+    for (size_t i = 0; i < count; ++i)
+    {
+        double dx = xs[i] - x;
+        double dy = ys[i] - y;
+        if (dx * dx + dy * dy <= radius2)
+            mask[i / 64] |= uint64_t(1) << (i % 64);
+    }
+}
+
+} // namespace scalar
+
+#ifdef GEO_MORTON_X86_DISPATCH
+
+namespace avx2 {
+
+__attribute__((target("avx2")))
+inline __m256i compact16(__m256i v)
+{
+    v = _mm256_and_si256(v, _mm256_set1_epi32(0x55555555));
+    v = _mm256_and_si256(_mm256_or_si256(v, _mm256_srli_epi32(v, 1)),
+                         _mm256_set1_epi32(0x33333333));
+    v = _mm256_and_si256(_mm256_or_si256(v, _mm256_srli_epi32(v, 2)),
+                         _mm256_set1_epi32(0x0F0F0F0F));
+    v = _mm256_and_si256(_mm256_or_si256(v, _mm256_srli_epi32(v, 4)),
+                         _mm256_set1_epi32(0x00FF00FF));
+    v = _mm256_and_si256(_mm256_or_si256(v, _mm256_srli_epi32(v, 8)),
+                         _mm256_set1_epi32(0x0000FFFF));
+    return v;
+}
+
+__attribute__((target("avx2")))
+inline __m256i compact(__m256i v)
+{
+    v = _mm256_and_si256(v, _mm256_set1_epi64x(0x5555555555555555LL));
+    v = _mm256_and_si256(_mm256_or_si256(v, _mm256_srli_epi64(v, 1)),
+                         _mm256_set1_epi64x(0x3333333333333333LL));
+    v = _mm256_and_si256(_mm256_or_si256(v, _mm256_srli_epi64(v, 2)),
+                         _mm256_set1_epi64x(0x0F0F0F0F0F0F0F0FLL));
+    v = _mm256_and_si256(_mm256_or_si256(v, _mm256_srli_epi64(v, 4)),
+                         _mm256_set1_epi64x(0x00FF00FF00FF00FFLL));
+    v = _mm256_and_si256(_mm256_or_si256(v, _mm256_srli_epi64(v, 8)),
+                         _mm256_set1_epi64x(0x0000FFFF0000FFFFLL));
+    v = _mm256_and_si256(_mm256_or_si256(v, _mm256_srli_epi64(v, 16)),
+                         _mm256_set1_epi64x(0x00000000FFFFFFFFLL));
+    return v;
+}
+
+/**
+ * Converts 4 64-bit lanes holding values smaller than 2^31 to doubles.
+ */
+__attribute__((target("avx2")))
+inline __m256d toDoubles(__m256i v)
+{
+    __m256i low = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6));
+    return _mm256_cvtepi32_pd(_mm256_castsi256_si128(low));
+}
+
+__attribute__((target("avx2")))
+inline __m256d distanceToCells(__m256d cells, __m256d point)
+{
+    __m256d d = _mm256_max_pd(_mm256_sub_pd(cells, point),
+                              _mm256_sub_pd(point, _mm256_add_pd(cells, _mm256_set1_pd(1))));
+    return _mm256_max_pd(d, _mm256_setzero_pd());
+}
+
+__attribute__((target("avx2")))
+inline unsigned inCircle(__m256d dx, __m256d dy, __m256d radius2)
+{
+    __m256d d2 = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+    return static_cast<unsigned>(_mm256_movemask_pd(_mm256_cmp_pd(d2, radius2, _CMP_LE_OQ)));
+}
+
+inline int32_t clamp32(int64_t value)
+{
+    return static_cast<int32_t>(std::min<int64_t>(std::max<int64_t>(value, -1), INT32_MAX));
+}
+
+/**
+ * Tests 8 codes per iteration.
+ */
+__attribute__((target("avx2")))
+inline void cellsInRect(const uint32_t* codes, size_t count, const CellRange& r, uint64_t* mask)
+{
+    std::fill(mask, mask + maskWords(count), 0);
+    __m256i minX = _mm256_set1_epi32(clamp32(r.minX));
+    __m256i minY = _mm256_set1_epi32(clamp32(r.minY));
+    __m256i maxX = _mm256_set1_epi32(clamp32(r.maxX));
+    __m256i maxY = _mm256_set1_epi32(clamp32(r.maxY));
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i key = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(codes + i));
+        __m256i x = compact16(_mm256_srli_epi32(key, 1));
+        __m256i y = compact16(key);
+        __m256i out = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpgt_epi32(minX, x), _mm256_cmpgt_epi32(x, maxX)),
+            _mm256_or_si256(_mm256_cmpgt_epi32(minY, y), _mm256_cmpgt_epi32(y, maxY)));
+        unsigned bits = ~static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(out))) & 0xFF;
+        mask[i / 64] |= uint64_t(bits) << (i % 64);
+    }
+    for (; i < count; ++i)
+    {
+        uint64_t word;
+        scalar::cellsInRect(codes + i, 1, r, &word);
+        mask[i / 64] |= word << (i % 64);
+    }
+}
+
+/**
+ * Tests 4 codes per iteration.
+ */
+__attribute__((target("avx2")))
+inline void cellsInRect(const uint64_t* codes, size_t count, const CellRange& r, uint64_t* mask)
+{
+    std::fill(mask, mask + maskWords(count), 0);
+    __m256i minX = _mm256_set1_epi64x(r.minX);
+    __m256i minY = _mm256_set1_epi64x(r.minY);
+    __m256i maxX = _mm256_set1_epi64x(r.maxX);
+    __m256i maxY = _mm256_set1_epi64x(r.maxY);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m256i key = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(codes + i));
+        __m256i x = compact(_mm256_srli_epi64(key, 1));
+        __m256i y = compact(key);
+        __m256i out = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpgt_epi64(minX, x), _mm256_cmpgt_epi64(x, maxX)),
+            _mm256_or_si256(_mm256_cmpgt_epi64(minY, y), _mm256_cmpgt_epi64(y, maxY)));
+        unsigned bits = ~static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(out))) & 0xF;
+        mask[i / 64] |= uint64_t(bits) << (i % 64);
+    }
+    for (; i < count; ++i)
+    {
+        uint64_t word;
+        scalar::cellsInRect(codes + i, 1, r, &word);
+        mask[i / 64] |= word << (i % 64);
+    }
+}
+
+/**
+ * Tests 8 codes per iteration.
+ */
+__attribute__((target("avx2")))
+inline void cellsInCircle(const uint32_t* codes, size_t count, double x, double y,
+                          double radius2, uint64_t* mask)
+{
+    std::fill(mask, mask + maskWords(count), 0);
+    __m256d pointX = _mm256_set1_pd(x);
+    __m256d pointY = _mm256_set1_pd(y);
+    __m256d r2 = _mm256_set1_pd(radius2);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i key = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(codes + i));
+        __m256i cellsX = compact16(_mm256_srli_epi32(key, 1));
+        __m256i cellsY = compact16(key);
+
+        unsigned low = inCircle(
+            distanceToCells(_mm256_cvtepi32_pd(_mm256_castsi256_si128(cellsX)), pointX),
+            distanceToCells(_mm256_cvtepi32_pd(_mm256_castsi256_si128(cellsY)), pointY), r2);
+        unsigned high = inCircle(
+            distanceToCells(_mm256_cvtepi32_pd(_mm256_extracti128_si256(cellsX, 1)), pointX),
+            distanceToCells(_mm256_cvtepi32_pd(_mm256_extracti128_si256(cellsY, 1)), pointY), r2);
+        mask[i / 64] |= uint64_t(low | (high << 4)) << (i % 64);
+    }
+    for (; i < count; ++i)
+    {
+        uint64_t word;
+        scalar::cellsInCircle(codes + i, 1, x, y, radius2, &word);
+        mask[i / 64] |= word << (i % 64);
+    }
+}
+
+/**
+ * Tests 4 codes per iteration.
+ */
+__attribute__((target("avx2")))
+inline void cellsInCircle(const uint64_t* codes, size_t count, double x, double y,
+                          double radius2, uint64_t* mask)
+{
+    std::fill(mask, mask + maskWords(count), 0);
+    __m256d pointX = _mm256_set1_pd(x);
+    __m256d pointY = _mm256_set1_pd(y);
+    __m256d r2 = _mm256_set1_pd(radius2);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m256i key = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(codes + i));
+        __m256d cellsX = toDoubles(compact(_mm256_srli_epi64(key, 1)));
+        __m256d cellsY = toDoubles(compact(key));
+        unsigned bits = inCircle(distanceToCells(cellsX, pointX), distanceToCells(cellsY, pointY),
+                                 r2);
+        mask[i / 64] |= uint64_t(bits) << (i % 64);
+    }
+    for (; i < count; ++i)
+    {
+        uint64_t word;
+        scalar::cellsInCircle(codes + i, 1, x, y, radius2, &word);
+        mask[i / 64] |= word << (i % 64);
+    }
+}
+
+/**
+ * Tests 4 points per iteration.
+ */
+__attribute__((target("avx2")))
+inline void pointsInRect(const double* xs, const double* ys, size_t count, double minX,
+                         double minY, double maxX, double maxY, uint64_t* mask)
+{
+    std::fill(mask, mask + maskWords(count), 0);
+    __m256d lowX = _mm256_set1_pd(minX);
+    __m256d lowY = _mm256_set1_pd(minY);
+    __m256d highX = _mm256_set1_pd(maxX);
+    __m256d highY = _mm256_set1_pd(maxY);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m256d x = _mm256_loadu_pd(xs + i);
+        __m256d y = _mm256_loadu_pd(ys + i);
+        __m256d in = _mm256_and_pd(
+            _mm256_and_pd(_mm256_cmp_pd(x, lowX, _CMP_GE_OQ), _mm256_cmp_pd(x, highX, _CMP_LE_OQ)),
+            _mm256_and_pd(_mm256_cmp_pd(y, lowY, _CMP_GE_OQ), _mm256_cmp_pd(y, highY, _CMP_LE_OQ)));
+        mask[i / 64] |= uint64_t(_mm256_movemask_pd(in)) << (i % 64);
+    }
+    for (; i < count; ++i)
+    {
+        uint64_t word;
+        scalar::pointsInRect(xs + i, ys + i, 1, minX, minY, maxX, maxY, &word);
+        mask[i / 64] |= word << (i % 64);
+    }
+}
+
+/**
+ * Tests 4 points per iteration.
+ */
+__attribute__((target("avx2")))
+inline void pointsInCircle(const double* xs, const double* ys, size_t count, double x, double y,
+                           double radius2, uint64_t* mask)
+{
+    std::fill(mask, mask + maskWords(count), 0);
+    __m256d pointX = _mm256_set1_pd(x);
+    __m256d pointY = _mm256_set1_pd(y);
+    __m256d r2 = _mm256_set1_pd(radius2);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(xs + i), pointX);
+        __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(ys + i), pointY);
+        mask[i / 64] |= uint64_t(inCircle(dx, dy, r2)) << (i % 64);
+    }
+    for (; i < count; ++i)
+    {
+        uint64_t word;
+        scalar::pointsInCircle(xs + i, ys + i, 1, x, y, radius2, &word);
+        mask[i / 64] |= word << (i % 64);
+    }
+}
+
+} // namespace avx2
+
+#endif // GEO_MORTON_X86_DISPATCH
+
+/**
+ * Dispatching versions of kernels. SSE2 is treated as scalar: 2 lanes don't pay off here.
+ */
+template <typename KeyType>
+void cellsInRect(morton::batch::Kernel kernel, const KeyType* codes, size_t count,
+                 const CellRange& r, uint64_t* mask)
+{
+#ifdef GEO_MORTON_X86_DISPATCH
+    if (kernel == morton::batch::AVX2)
+        return avx2::cellsInRect(codes, count, r, mask);
+#endif
+    (void)kernel;
+    scalar::cellsInRect(codes, count, r, mask);
+}
+
+template <typename KeyType>
+void cellsInCircle(morton::batch::Kernel kernel, const KeyType* codes, size_t count, double x,
+                   double y, double radius2, uint64_t* mask)
+{
+#ifdef GEO_MORTON_X86_DISPATCH
+    if (kernel == morton::batch::AVX2)
+        return avx2::cellsInCircle(codes, count, x, y, radius2, mask);
+#endif
+    (void)kernel;
+    scalar::cellsInCircle(codes, count, x, y, radius2, mask);
+}
+
+inline void pointsInRect(morton::batch::Kernel kernel, const double* xs, const double* ys,
+                         size_t count, double minX, double minY, double maxX, double maxY,
+                         uint64_t* mask)
+{
+#ifdef GEO_MORTON_X86_DISPATCH
+    if (kernel == morton::batch::AVX2)
+        return avx2::pointsInRect(xs, ys, count, minX, minY, maxX, maxY, mask);
+#endif
+    (void)kernel;
+    scalar::pointsInRect(xs, ys, count, minX, minY, maxX, maxY, mask);
+}
+
+inline void pointsInCircle(morton::batch::Kernel kernel, const double* xs, const double* ys,
+                           size_t count, double x, double y, double radius2, uint64_t* mask)
+{
+#ifdef GEO_MORTON_X86_DISPATCH
+    if (kernel == morton::batch::AVX2)
+        return avx2::pointsInCircle(xs, ys, count, x, y, radius2, mask);
+#endif
+    (void)kernel;
+    scalar::pointsInCircle(xs, ys, count, x, y, radius2, mask);
+}
+
+} // namespace scan
+} // namespace geo
+
+#endif
@@ -0,0 +1,417 @@
+#ifndef GEO_LEAFSTORAGE_HPP_
+#define GEO_LEAFSTORAGE_HPP_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "Coordinates.hpp"
+#include "LocationCode.hpp"
+
+namespace geo {
+
+/**
+ * Original coordinates of elements stored by LeafStorage. They're kept in two separate arrays (x
+ * and y) only when withCoordinates is true, otherwise the class is empty and all its operations do
+ * nothing.
+ */
+template <typename Allocator, bool withCoordinates>
+class LeafCoordinates
+{
+public:
+    explicit LeafCoordinates(const Allocator&) {}
+    LeafCoordinates(const LeafCoordinates&, const Allocator&) {}
+
+    void push_back(const StoredCoordinates<false>&) {}
+    void set(size_t, const Coordinates&) {}
+    void moveTo(size_t, LeafCoordinates&) {}
+    void copyTo(size_t, LeafCoordinates&) const {}
+    void move(size_t, size_t) {}
+    void erase(size_t, size_t) {}
+    void clear() {}
+    void reserve(size_t) {}
+    void shrinkToFit() {}
+    void swap(LeafCoordinates&) {}
+
+    size_t capacity() const
+    {
+        return std::numeric_limits<size_t>::max();
+    }
+};
+
+template <typename Allocator>
+class LeafCoordinates<Allocator, true>
+{
+private:
+    typedef typename std::allocator_traits<Allocator>::template rebind_alloc<double>
+        DoubleAllocator;
+    typedef std::vector<double, DoubleAllocator> Doubles;
+
+public:
+    explicit LeafCoordinates(const Allocator& alloc)
+        : xs((DoubleAllocator(alloc))), ys((DoubleAllocator(alloc))) {}
+
+    LeafCoordinates(const LeafCoordinates& that, const Allocator& alloc)
+        : xs(that.xs, DoubleAllocator(alloc)), ys(that.ys, DoubleAllocator(alloc)) {}
+
+    void push_back(const StoredCoordinates<true>& object)
+    {
+        xs.push_back(object.coordinates.x());
+        ys.push_back(object.coordinates.y());
+    }
+
+    void set(size_t i, const Coordinates& coordinates)
+    {
+        xs[i] = coordinates.x();
+        ys[i] = coordinates.y();
+    }
+
+    void moveTo(size_t i, LeafCoordinates& to)
+    {
+        copyTo(i, to);
+    }
+
+    void copyTo(size_t i, LeafCoordinates& to) const
+    {
+        to.xs.push_back(xs[i]);
+        to.ys.push_back(ys[i]);
+    }
+
+    void move(size_t from, size_t to)
+    {
+        xs[to] = xs[from];
+        ys[to] = ys[from];
+    }
+
+    void erase(size_t first, size_t last)
+    {
+        xs.erase(xs.begin() + first, xs.begin() + last);
+        ys.erase(ys.begin() + first, ys.begin() + last);
+    }
+
+    void clear()
+    {
+        xs.clear();
+        ys.clear();
+    }
+
+    void reserve(size_t capacity)
+    {
+        xs.reserve(capacity);
+        ys.reserve(capacity);
+    }
+
+    void shrinkToFit()
+    {
+        xs.shrink_to_fit();
+        ys.shrink_to_fit();
+    }
+
+    size_t capacity() const
+    {
+        return std::min(xs.capacity(), ys.capacity());
+    }
+
+    void swap(LeafCoordinates& that)
+    {
+        xs.swap(that.xs);
+        ys.swap(that.ys);
+    }
+
+    Coordinates coordinates(size_t i) const
+    {
+        return Coordinates(xs[i], ys[i]);
+    }
+
+    const double* x() const
+    {
+        return xs.data();
+    }
+
+    const double* y() const
+    {
+        return ys.data();
+    }
+
+private:
+    Doubles xs;
+    Doubles ys;
+};
+
+/**
+ * Elements of a single tree node, kept in a structure of arrays layout: location codes (Morton
+ * keys), stored objects and optionally original coordinates are kept in separate, parallel arrays.
+ * Thanks to that, filters which need only codes or coordinates (e.g. range queries) scan densely
+ * packed arrays and might process many elements at once with SIMD instructions.
+ *
+ * Elements are inserted as ObjectWithLocationCode, which is split among arrays. Trees which give
+ * out stable handles keep also handle slots of elements (@see QuadTree::enableHandles()). They
+ * follow elements when they're moved or erased, but they're set separately from insertion, so
+ * the array of slots is either empty or as long as the other ones.
+ */
+template <typename ObjectType, size_t totalLevels, typename Allocator, bool withCoordinates>
+class LeafStorage
+{
+public:
+    typedef LocationCode<totalLevels> Code;
+    typedef typename Code::KeyType KeyType;
+    typedef ObjectWithLocationCode<ObjectType, totalLevels, withCoordinates> StoredObject;
+
+private:
+    typedef std::allocator_traits<Allocator> AllocTraits;
+    typedef typename AllocTraits::template rebind_alloc<KeyType> KeyAllocator;
+    typedef typename AllocTraits::template rebind_alloc<ObjectType> ObjectAllocator;
+    typedef typename AllocTraits::template rebind_alloc<uint32_t> SlotAllocator;
+    typedef std::vector<KeyType, KeyAllocator> Keys;
+    typedef std::vector<ObjectType, ObjectAllocator> Objects;
+    typedef std::vector<uint32_t, SlotAllocator> Slots;
+    typedef LeafCoordinates<Allocator, withCoordinates> Coords;
+
+public:
+    typedef typename Objects::iterator iterator;
+    typedef typename Objects::const_iterator const_iterator;
+
+public:
+    explicit LeafStorage(const Allocator& alloc)
+        : keys((KeyAllocator(alloc))), objects((ObjectAllocator(alloc))), coords(alloc),
+        slots((SlotAllocator(alloc))) {}
+
+    LeafStorage(const LeafStorage& that, const Allocator& alloc)
+        : keys(that.keys, KeyAllocator(alloc)), objects(that.objects, ObjectAllocator(alloc)),
+        coords(that.coords, alloc), slots(that.slots, SlotAllocator(alloc)) {}
+
+    LeafStorage(LeafStorage&& that)
+        : keys(std::move(that.keys)), objects(std::move(that.objects)),
+        coords(Allocator(objects.get_allocator())), slots(std::move(that.slots))
+    {
+        coords.swap(that.coords);
+        that.clear();
+    }
+
+    LeafStorage& operator=(const LeafStorage&) = delete;
+
+    Allocator get_allocator() const
+    {
+        return Allocator(objects.get_allocator());
+    }
+
+    size_t size() const
+    {
+        return keys.size();
+    }
+
+    iterator begin()
+    {
+        return objects.begin();
+    }
+
+    const_iterator begin() const
+    {
+        return objects.begin();
+    }
+
+    iterator end()
+    {
+        return objects.end();
+    }
+
+    const_iterator end() const
+    {
+        return objects.end();
+    }
+
+    ObjectType& operator[](size_t i)
+    {
+        return objects[i];
+    }
+
+    const ObjectType& operator[](size_t i) const
+    {
+        return objects[i];
+    }
+
+    Code location(size_t i) const
+    {
+        Code code;
+        code.key = keys[i];
+        return code;
+    }
+
+    /**
+     * @return Array of location codes (Morton keys) of all elements.
+     */
+    const KeyType* codes() const
+    {
+        return keys.data();
+    }
+
+    /**
+     * @return Original coordinates of elements. Available only when they're stored.
+     */
+    const Coords& coordinates() const
+    {
+        return coords;
+    }
+
+    void push_back(StoredObject&& object)
+    {
+        reserveNext(false);
+        objects.push_back(std::move(object.object));
+        keys.push_back(object.location.key);
+        coords.push_back(object);
+    }
+
+    /**
+     * @return Whether handle slots are set for all elements.
+     */
+    bool hasSlots() const
+    {
+        return slots.size() == keys.size();
+    }
+
+    uint32_t slot(size_t i) const
+    {
+        return slots[i];
+    }
+
+    void setSlot(size_t i, uint32_t slot)
+    {
+        if (slots.size() < keys.size())
+            slots.resize(keys.size());
+        slots[i] = slot;
+    }
+
+    /**
+     * Changes location code and coordinates of an element at a given position.
+     */
+    void relocate(size_t i, const Code& code, const Coordinates& coordinates)
+    {
+        keys[i] = code.key;
+        coords.set(i, coordinates);
+    }
+
+    /**
+     * Moves an element at a given position to the end of another storage. The element is left in
+     * a moved-from state, so it should be removed afterwards.
+     */
+    void moveTo(size_t i, LeafStorage& to)
+    {
+        to.reserveNext(!slots.empty());
+        to.objects.push_back(std::move(objects[i]));
+        to.keys.push_back(keys[i]);
+        coords.moveTo(i, to.coords);
+        if (!slots.empty())
+            to.slots.push_back(slots[i]);
+    }
+
+    /**
+     * Copies an element at a given position to the end of another storage. @see moveTo()
+     */
+    void copyTo(size_t i, LeafStorage& to) const
+    {
+        to.reserveNext(!slots.empty());
+        to.objects.push_back(objects[i]);
+        to.keys.push_back(keys[i]);
+        coords.copyTo(i, to.coords);
+        if (!slots.empty())
+            to.slots.push_back(slots[i]);
+    }
+
+    void erase(size_t first, size_t last)
+    {
+        keys.erase(keys.begin() + first, keys.begin() + last);
+        objects.erase(objects.begin() + first, objects.begin() + last);
+        coords.erase(first, last);
+        if (!slots.empty())
+            slots.erase(slots.begin() + first, slots.begin() + last);
+    }
+
+    /**
+     * Removes all elements with a given code, preserving order of the remaining ones.
+     *
+     * @return Number of removed elements.
+     */
+    size_t erase(const Code& code)
+    {
+        size_t kept = 0;
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            if (keys[i] == code.key)
+                continue;
+            if (kept != i)
+            {
+                keys[kept] = keys[i];
+                objects[kept] = std::move(objects[i]);
+                coords.move(i, kept);
+                if (!slots.empty())
+                    slots[kept] = slots[i];
+            }
+            ++kept;
+        }
+        size_t removed = keys.size() - kept;
+        erase(kept, keys.size());
+        return removed;
+    }
+
+    void clear()
+    {
+        keys.clear();
+        objects.clear();
+        coords.clear();
+        slots.clear();
+    }
+
+    void reserve(size_t capacity)
+    {
+        keys.reserve(capacity);
+        objects.reserve(capacity);
+        coords.reserve(capacity);
+    }
+
+    /**
+     * Releases memory which isn't used by elements, e.g. after many of them were erased.
+     */
+    void shrinkToFit()
+    {
+        keys.shrink_to_fit();
+        objects.shrink_to_fit();
+        coords.shrinkToFit();
+        slots.shrink_to_fit();
+    }
+
+    void swap(LeafStorage& that)
+    {
+        keys.swap(that.keys);
+        objects.swap(that.objects);
+        coords.swap(that.coords);
+        slots.swap(that.slots);
+    }
+
+private:
+    /**
+     * Makes room for one more element in all arrays, so that appending it might throw only while
+     * the element itself is constructed, which is done first. Otherwise arrays would be left with
+     * different lengths.
+     */
+    void reserveNext(bool withSlot)
+    {
+        size_t needed = keys.size() + 1;
+        if (needed > keys.capacity() || needed > objects.capacity() || needed > coords.capacity())
+            reserve(std::max(needed, 2 * keys.size()));
+        if (withSlot && needed > slots.capacity())
+            slots.reserve(std::max(needed, 2 * slots.size()));
+    }
+
+    Keys keys;
+    Objects objects;
+    Coords coords;
+    Slots slots;
+};
+
+} // namespace geo
+
+#endif
@@ -1,26 +1,35 @@
 #ifndef GEO_LOCATIONCODE_HPP_
 #define GEO_LOCATIONCODE_HPP_
 
-#include <bitset>
+#include <cstdint>
 #include <utility>
 
 #include "Coordinates.hpp"
+#include "Morton.hpp"
 
 namespace geo {
 
 /**
  * Class that creates location codes from given coordinates.
  *
+ * Location code is stored as a single Morton key (x and y codes interleaved), which is packed into
+ * uint32_t when size <= 16 and into uint64_t otherwise. Thanks to that, a child number on a given
+ * tree level is obtained by a shift and a mask and comparison of codes is a single integer
+ * comparison.
+ *
  * @param size Number of bits which represent a local code. It is also the maximum number of
  * levels in a QuadTree.
  */
 template <size_t size>
 struct LocationCode
 {
+    typedef typename morton::KeyFor<size>::type KeyType;
+    typedef morton::Codec<KeyType> Codec;
+
     /**
      * Default Constructor. Location codes are set by default to 0.
      */
-    LocationCode()  : x(0), y(0) {}
+    LocationCode() : key(0) {}
 
     /**
      * Constructor.
@@ -29,21 +38,113 @@ struct LocationCode
      * @param coord Coordinate from which a location code is created.
      */
     explicit LocationCode(const Coordinates& coord) :
-        x(coord.x() * (2 << (size - 2))),
-        y(coord.y() * (2 << (size - 2)))
+        key(Codec::interleave(
+            static_cast<uint32_t>(coord.x() * (uint64_t(1) << (size - 1))),
+            static_cast<uint32_t>(coord.y() * (uint64_t(1) << (size - 1)))))
     { }
 
+    /**
+     * Constructor from already computed x-axis and y-axis codes.
+     */
+    LocationCode(uint32_t x, uint32_t y) : key(Codec::interleave(x, y)) { }
+
+    /**
+     * @return x-axis code.
+     */
+    uint32_t x() const
+    {
+        return Codec::x(key);
+    }
+
+    /**
+     * @return y-axis code.
+     */
+    uint32_t y() const
+    {
+        return Codec::y(key);
+    }
+
+    /**
+     * Returns a pair of bits from a given position of x-axis and y-axis codes (x bit is the more
+     * significant one), i.e. a number of a child which should be chosen by a node at level + 1.
+     * Positions beyond the code size are always 0.
+     */
+    uint32_t quadrant(size_t level) const
+    {
+        if (level >= size)
+            return 0;
+        return static_cast<uint32_t>(key >> (2 * level)) & 3;
+    }
+
+    /**
+     * Overwrites a pair of bits at a given position with a given child number.
+     *
+     * @see quadrant(size_t level)
+     */
+    void setQuadrant(size_t level, uint32_t childNo)
+    {
+        key = (key & ~(KeyType(3) << (2 * level))) | (KeyType(childNo & 3) << (2 * level));
+    }
+
+    /**
+     * Checks whether both codes are equal on positions from a given level upwards (i.e. if they
+     * belong to the same node at that level).
+     */
+    bool samePrefix(const LocationCode& rhs, size_t level) const
+    {
+        if (level >= size)
+            return true;
+        return ((key ^ rhs.key) >> (2 * level)) == 0;
+    }
+
     bool operator==(const LocationCode& rhs) const
     {
-        return (x == rhs.x && y == rhs.y);
+        return (key == rhs.key);
+    }
+
+    bool operator!=(const LocationCode& rhs) const
+    {
+        return (key != rhs.key);
     }
 
-    std::bitset<size> x;
-    std::bitset<size> y;
+    /**
+     * Orders location codes along the Z-order curve.
+     */
+    bool operator<(const LocationCode& rhs) const
+    {
+        return (key < rhs.key);
+    }
+
+    KeyType key;
+};
+
+/**
+ * Original coordinates of a stored object. They are kept only when withCoordinates is true,
+ * otherwise the class is empty and takes no space as a base class.
+ */
+template <bool withCoordinates>
+struct StoredCoordinates
+{
+    StoredCoordinates() {}
+    explicit StoredCoordinates(const Coordinates&) {}
 };
 
-template <typename ObjectType, size_t locCodeMaxSize>
-struct ObjectWithLocationCode {
+template <>
+struct StoredCoordinates<true>
+{
+    explicit StoredCoordinates(const Coordinates& coordinates) : coordinates(coordinates) {}
+
+    Coordinates coordinates;
+};
+
+/**
+ * Object stored in a tree together with its location code.
+ *
+ * @param withCoordinates Whether original coordinates of the object are stored as well (which
+ *                        allows precise, not only location code based, distance computations).
+ */
+template <typename ObjectType, size_t locCodeMaxSize, bool withCoordinates = false>
+struct ObjectWithLocationCode : StoredCoordinates<withCoordinates> {
     LocationCode<locCodeMaxSize> location;
     ObjectType object;
 
@@ -51,7 +152,16 @@ struct ObjectWithLocationCode {
         : location(location), object(object) { }
 
     ObjectWithLocationCode(LocationCode<locCodeMaxSize>&& location, ObjectType&& object)
-        : location(std::move(location)), object(object) { }
+        : location(std::move(location)), object(std::move(object)) { }
+
+    ObjectWithLocationCode(const LocationCode<locCodeMaxSize>& location,
+                           const Coordinates& coordinates, const ObjectType& object)
+        : StoredCoordinates<withCoordinates>(coordinates), location(location), object(object) { }
+
+    ObjectWithLocationCode(LocationCode<locCodeMaxSize>&& location,
+                           const Coordinates& coordinates, ObjectType&& object)
+        : StoredCoordinates<withCoordinates>(coordinates), location(std::move(location)),
+        object(std::move(object)) { }
 };
 
 } // namespace geo
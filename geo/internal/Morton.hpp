@@ -0,0 +1,180 @@
+#ifndef GEO_MORTON_HPP_
+#define GEO_MORTON_HPP_
+
+#include <cstdint>
+#include <cstddef>
+#include <type_traits>
+
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
+namespace geo {
+namespace morton {
+
+/**
+ * Selects the smallest unsigned integer able to hold a Morton key of a location code which has
+ * `levels` bits per axis.
+ */
+template <size_t levels>
+struct KeyFor
+{
+    typedef typename std::conditional<(levels <= 16), uint32_t, uint64_t>::type type;
+};
+
+/**
+ * Portable interleaving kernels ("magic bits" method). They're always available and are used when
+ * the code is not compiled with BMI2 support.
+ */
+namespace portable {
+
+/**
+ * Spreads the bits of a given value, so there is a single 0 bit inserted between each of them
+ * (i.e. bit n of v becomes bit 2n of a result).
+ */
+inline uint64_t spread(uint32_t v)
+{
+    uint64_t r = v;
+    r = (r | (r << 16)) & 0x0000FFFF0000FFFFULL;
+    r = (r | (r << 8))  & 0x00FF00FF00FF00FFULL;
+    r = (r | (r << 4))  & 0x0F0F0F0F0F0F0F0FULL;
+    r = (r | (r << 2))  & 0x3333333333333333ULL;
+    r = (r | (r << 1))  & 0x5555555555555555ULL;
+    return r;
+}
+
+/**
+ * 32-bit version of spread(). Only 16 lower bits of v are taken into account.
+ */
+inline uint32_t spread16(uint32_t v)
+{
+    v &= 0x0000FFFF;
+    v = (v | (v << 8)) & 0x00FF00FF;
+    v = (v | (v << 4)) & 0x0F0F0F0F;
+    v = (v | (v << 2)) & 0x33333333;
+    v = (v | (v << 1)) & 0x55555555;
+    return v;
+}
+
+/**
+ * Reverse of spread(): gathers every second bit of a given value (starting from the LSB).
+ */
+inline uint32_t compact(uint64_t v)
+{
+    v &= 0x5555555555555555ULL;
+    v = (v | (v >> 1))  & 0x3333333333333333ULL;
+    v = (v | (v >> 2))  & 0x0F0F0F0F0F0F0F0FULL;
+    v = (v | (v >> 4))  & 0x00FF00FF00FF00FFULL;
+    v = (v | (v >> 8))  & 0x0000FFFF0000FFFFULL;
+    v = (v | (v >> 16)) & 0x00000000FFFFFFFFULL;
+    return static_cast<uint32_t>(v);
+}
+
+/**
+ * 32-bit version of compact().
+ */
+inline uint32_t compact16(uint32_t v)
+{
+    v &= 0x55555555;
+    v = (v | (v >> 1)) & 0x33333333;
+    v = (v | (v >> 2)) & 0x0F0F0F0F;
+    v = (v | (v >> 4)) & 0x00FF00FF;
+    v = (v | (v >> 8)) & 0x0000FFFF;
+    return v;
+}
+
+inline uint64_t interleave(uint32_t x, uint32_t y)
+{
+    return (spread(x) << 1) | spread(y);
+}
+
+inline uint32_t interleave16(uint32_t x, uint32_t y)
+{
+    return (spread16(x) << 1) | spread16(y);
+}
+
+} // namespace portable
+
+#if defined(__BMI2__)
+/**
+ * Interleaving kernels which use parallel bit deposit/extract instructions.
+ */
+namespace bmi2 {
+
+inline uint64_t interleave(uint32_t x, uint32_t y)
+{
+    return _pdep_u64(x, 0xAAAAAAAAAAAAAAAAULL) | _pdep_u64(y, 0x5555555555555555ULL);
+}
+
+inline uint32_t interleave16(uint32_t x, uint32_t y)
+{
+    return _pdep_u32(x, 0xAAAAAAAA) | _pdep_u32(y, 0x55555555);
+}
+
+inline uint32_t compact(uint64_t v)
+{
+    return static_cast<uint32_t>(_pext_u64(v, 0x5555555555555555ULL));
+}
+
+inline uint32_t compact16(uint32_t v)
+{
+    return _pext_u32(v, 0x55555555);
+}
+
+} // namespace bmi2
+
+namespace kernels = bmi2;
+#else
+namespace kernels = portable;
+#endif
+
+/**
+ * Encodes and decodes Morton keys of a given width. Bits of x are placed on odd positions and bits
+ * of y on even positions, so each pair of bits is equal to a child number returned by
+ * QuadNode::locToInt() on the corresponding tree level.
+ */
+template <typename Key> struct Codec;
+
+template <>
+struct Codec<uint32_t>
+{
+    static uint32_t interleave(uint32_t x, uint32_t y) { return kernels::interleave16(x, y); }
+    static uint32_t x(uint32_t key) { return kernels::compact16(key >> 1); }
+    static uint32_t y(uint32_t key) { return kernels::compact16(key); }
+};
+
+template <>
+struct Codec<uint64_t>
+{
+    static uint64_t interleave(uint32_t x, uint32_t y) { return kernels::interleave(x, y); }
+    static uint32_t x(uint64_t key) { return kernels::compact(key >> 1); }
+    static uint32_t y(uint64_t key) { return kernels::compact(key); }
+};
+
+inline uint64_t interleave(uint32_t x, uint32_t y)
+{
+    return Codec<uint64_t>::interleave(x, y);
+}
+
+inline uint32_t deinterleaveX(uint64_t key)
+{
+    return Codec<uint64_t>::x(key);
+}
+
+inline uint32_t deinterleaveY(uint64_t key)
+{
+    return Codec<uint64_t>::y(key);
+}
+
+/**
+ * Returns a number of Morton keys covered by a single node on a given tree level.
+ */
+inline uint64_t span(size_t level)
+{
+    return (uint64_t(1) << (2 * level));
+}
+
+} // namespace morton
+} // namespace geo
+
+#endif
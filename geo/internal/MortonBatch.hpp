@@ -0,0 +1,302 @@
+#ifndef GEO_MORTONBATCH_HPP_
+#define GEO_MORTONBATCH_HPP_
+
+#include <cstdint>
+#include <cstddef>
+
+#include "Morton.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GEO_MORTON_X86_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+namespace geo {
+namespace morton {
+
+/**
+ * Linear transformation of coordinates to cells: cell = (coordinate - start) * scale, truncated
+ * towards 0 and clamped to [0, maxCell]. With scale = 2^(levels - 1) / width it gives the same
+ * cells as LocationCode(CoordTr::forward(coordinates)) does for coordinates inside a tree range.
+ */
+struct Quantizer
+{
+    double startX;
+    double startY;
+    double scale;
+    uint32_t maxCell;
+};
+
+/**
+ * Batch encoders which compute Morton keys of many points given as separate arrays of x and y
+ * coordinates. There is a scalar kernel, which is always available, and SSE2 and AVX2 ones for x86
+ * processors, compiled regardless of compiler flags and chosen at runtime. @see encode()
+ */
+namespace batch {
+
+namespace scalar {
+
+inline uint32_t quantize(double coordinate, double start, double scale, uint32_t maxCell)
+{
+    double cell = (coordinate - start) * scale;
+    // Written this way, so NaN goes to 0 as in SIMD kernels.
+    if (!(cell > 0))
+        return 0;
+    if (cell > maxCell)
+        return maxCell;
+    return static_cast<uint32_t>(cell);
+}
+
+template <typename KeyType>
+void encode(const double* xs, const double* ys, size_t count, const Quantizer& q, KeyType* keys)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        keys[i] = Codec<KeyType>::interleave(quantize(xs[i], q.startX, q.scale, q.maxCell),
+                                             quantize(ys[i], q.startY, q.scale, q.maxCell));
+    }
+}
+
+} // namespace scalar
+
+#ifdef GEO_MORTON_X86_DISPATCH
+
+namespace sse2 {
+
+__attribute__((target("sse2")))
+inline __m128i quantize(const double* values, __m128d start, __m128d scale, __m128d maxCell)
+{
+    __m128d cells = _mm_mul_pd(_mm_sub_pd(_mm_loadu_pd(values), start), scale);
+    cells = _mm_min_pd(_mm_max_pd(cells, _mm_setzero_pd()), maxCell);
+    return _mm_cvttpd_epi32(cells);
+}
+
+__attribute__((target("sse2")))
+inline __m128i spread16(__m128i v)
+{
+    v = _mm_and_si128(_mm_or_si128(v, _mm_slli_epi32(v, 8)), _mm_set1_epi32(0x00FF00FF));
+    v = _mm_and_si128(_mm_or_si128(v, _mm_slli_epi32(v, 4)), _mm_set1_epi32(0x0F0F0F0F));
+    v = _mm_and_si128(_mm_or_si128(v, _mm_slli_epi32(v, 2)), _mm_set1_epi32(0x33333333));
+    v = _mm_and_si128(_mm_or_si128(v, _mm_slli_epi32(v, 1)), _mm_set1_epi32(0x55555555));
+    return v;
+}
+
+__attribute__((target("sse2")))
+inline __m128i spread(__m128i v)
+{
+    v = _mm_and_si128(_mm_or_si128(v, _mm_slli_epi64(v, 16)),
+                      _mm_set1_epi64x(0x0000FFFF0000FFFFLL));
+    v = _mm_and_si128(_mm_or_si128(v, _mm_slli_epi64(v, 8)),
+                      _mm_set1_epi64x(0x00FF00FF00FF00FFLL));
+    v = _mm_and_si128(_mm_or_si128(v, _mm_slli_epi64(v, 4)),
+                      _mm_set1_epi64x(0x0F0F0F0F0F0F0F0FLL));
+    v = _mm_and_si128(_mm_or_si128(v, _mm_slli_epi64(v, 2)),
+                      _mm_set1_epi64x(0x3333333333333333LL));
+    v = _mm_and_si128(_mm_or_si128(v, _mm_slli_epi64(v, 1)),
+                      _mm_set1_epi64x(0x5555555555555555LL));
+    return v;
+}
+
+/**
+ * Encodes 2 points per iteration.
+ */
+__attribute__((target("sse2")))
+inline void encode(const double* xs, const double* ys, size_t count, const Quantizer& q,
+                   uint32_t* keys)
+{
+    __m128d startX = _mm_set1_pd(q.startX);
+    __m128d startY = _mm_set1_pd(q.startY);
+    __m128d scale = _mm_set1_pd(q.scale);
+    __m128d maxCell = _mm_set1_pd(q.maxCell);
+
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2)
+    {
+        __m128i x = spread16(quantize(xs + i, startX, scale, maxCell));
+        __m128i y = spread16(quantize(ys + i, startY, scale, maxCell));
+        __m128i key = _mm_or_si128(_mm_slli_epi32(x, 1), y);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(keys + i), key);
+    }
+    scalar::encode(xs + i, ys + i, count - i, q, keys + i);
+}
+
+__attribute__((target("sse2")))
+inline void encode(const double* xs, const double* ys, size_t count, const Quantizer& q,
+                   uint64_t* keys)
+{
+    __m128d startX = _mm_set1_pd(q.startX);
+    __m128d startY = _mm_set1_pd(q.startY);
+    __m128d scale = _mm_set1_pd(q.scale);
+    __m128d maxCell = _mm_set1_pd(q.maxCell);
+
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2)
+    {
+        __m128i x = _mm_unpacklo_epi32(quantize(xs + i, startX, scale, maxCell),
+                                       _mm_setzero_si128());
+        __m128i y = _mm_unpacklo_epi32(quantize(ys + i, startY, scale, maxCell),
+                                       _mm_setzero_si128());
+        __m128i key = _mm_or_si128(_mm_slli_epi64(spread(x), 1), spread(y));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(keys + i), key);
+    }
+    scalar::encode(xs + i, ys + i, count - i, q, keys + i);
+}
+
+} // namespace sse2
+
+namespace avx2 {
+
+__attribute__((target("avx2")))
+inline __m128i quantize(const double* values, __m256d start, __m256d scale, __m256d maxCell)
+{
+    __m256d cells = _mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(values), start), scale);
+    cells = _mm256_min_pd(_mm256_max_pd(cells, _mm256_setzero_pd()), maxCell);
+    return _mm256_cvttpd_epi32(cells);
+}
+
+__attribute__((target("avx2")))
+inline __m256i spread16(__m256i v)
+{
+    v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi32(v, 8)),
+                         _mm256_set1_epi32(0x00FF00FF));
+    v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi32(v, 4)),
+                         _mm256_set1_epi32(0x0F0F0F0F));
+    v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi32(v, 2)),
+                         _mm256_set1_epi32(0x33333333));
+    v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi32(v, 1)),
+                         _mm256_set1_epi32(0x55555555));
+    return v;
+}
+
+__attribute__((target("avx2")))
+inline __m256i spread(__m256i v)
+{
+    v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi64(v, 16)),
+                         _mm256_set1_epi64x(0x0000FFFF0000FFFFLL));
+    v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi64(v, 8)),
+                         _mm256_set1_epi64x(0x00FF00FF00FF00FFLL));
+    v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi64(v, 4)),
+                         _mm256_set1_epi64x(0x0F0F0F0F0F0F0F0FLL));
+    v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi64(v, 2)),
+                         _mm256_set1_epi64x(0x3333333333333333LL));
+    v = _mm256_and_si256(_mm256_or_si256(v, _mm256_slli_epi64(v, 1)),
+                         _mm256_set1_epi64x(0x5555555555555555LL));
+    return v;
+}
+
+/**
+ * Encodes 8 points per iteration.
+ */
+__attribute__((target("avx2")))
+inline void encode(const double* xs, const double* ys, size_t count, const Quantizer& q,
+                   uint32_t* keys)
+{
+    __m256d startX = _mm256_set1_pd(q.startX);
+    __m256d startY = _mm256_set1_pd(q.startY);
+    __m256d scale = _mm256_set1_pd(q.scale);
+    __m256d maxCell = _mm256_set1_pd(q.maxCell);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i x = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(quantize(xs + i, startX, scale, maxCell)),
+            quantize(xs + i + 4, startX, scale, maxCell), 1);
+        __m256i y = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(quantize(ys + i, startY, scale, maxCell)),
+            quantize(ys + i + 4, startY, scale, maxCell), 1);
+        __m256i key = _mm256_or_si256(_mm256_slli_epi32(spread16(x), 1), spread16(y));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(keys + i), key);
+    }
+    sse2::encode(xs + i, ys + i, count - i, q, keys + i);
+}
+
+/**
+ * Encodes 4 points per iteration.
+ */
+__attribute__((target("avx2")))
+inline void encode(const double* xs, const double* ys, size_t count, const Quantizer& q,
+                   uint64_t* keys)
+{
+    __m256d startX = _mm256_set1_pd(q.startX);
+    __m256d startY = _mm256_set1_pd(q.startY);
+    __m256d scale = _mm256_set1_pd(q.scale);
+    __m256d maxCell = _mm256_set1_pd(q.maxCell);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m256i x = _mm256_cvtepu32_epi64(quantize(xs + i, startX, scale, maxCell));
+        __m256i y = _mm256_cvtepu32_epi64(quantize(ys + i, startY, scale, maxCell));
+        __m256i key = _mm256_or_si256(_mm256_slli_epi64(spread(x), 1), spread(y));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(keys + i), key);
+    }
+    sse2::encode(xs + i, ys + i, count - i, q, keys + i);
+}
+
+} // namespace avx2
+
+#endif // GEO_MORTON_X86_DISPATCH
+
+enum Kernel
+{
+    SCALAR,
+    SSE2,
+    AVX2
+};
+
+/**
+ * @return The best kernel supported by the processor. It's checked only once.
+ */
+inline Kernel bestKernel()
+{
+#ifdef GEO_MORTON_X86_DISPATCH
+    static const Kernel kernel = []() {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return AVX2;
+        if (__builtin_cpu_supports("sse2"))
+            return SSE2;
+        return SCALAR;
+    }();
+    return kernel;
+#else
+    return SCALAR;
+#endif
+}
+
+/**
+ * Encodes points using a given kernel, which must be supported by the processor.
+ */
+template <typename KeyType>
+void encode(Kernel kernel, const double* xs, const double* ys, size_t count, const Quantizer& q,
+            KeyType* keys)
+{
+#ifdef GEO_MORTON_X86_DISPATCH
+    if (kernel == AVX2)
+        return avx2::encode(xs, ys, count, q, keys);
+    if (kernel == SSE2)
+        return sse2::encode(xs, ys, count, q, keys);
+#endif
+    (void)kernel;
+    scalar::encode(xs, ys, count, q, keys);
+}
+
+} // namespace batch
+
+/**
+ * Computes Morton keys of count points, whose coordinates are given in xs and ys arrays, with the
+ * fastest kernel supported by the processor.
+ *
+ * @param KeyType Either uint32_t (then cells must fit in 16 bits) or uint64_t.
+ */
+template <typename KeyType>
+void encode(const double* xs, const double* ys, size_t count, const Quantizer& q, KeyType* keys)
+{
+    batch::encode(batch::bestKernel(), xs, ys, count, q, keys);
+}
+
+} // namespace morton
+} // namespace geo
+
+#endif
@@ -0,0 +1,199 @@
+#ifndef GEO_NODEPOOL_HPP_
+#define GEO_NODEPOOL_HPP_
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <memory>
+
+namespace geo {
+
+/**
+ * Slab allocator for tree nodes.
+ *
+ * Nodes are constructed in slots of big, fixed size slabs. Destroyed nodes' slots are kept on a
+ * free list and reused by subsequent create() calls. clear() destroys all nodes at once by a linear
+ * walk over slabs (no recursion, no calls to the global allocator) and keeps slabs for reuse.
+ * Memory is returned to the allocator only when the pool is destroyed.
+ *
+ * @param Node      Type of objects created by the pool.
+ * @param Allocator Allocator used to obtain slabs. It's rebound to the slab type.
+ * @param slabSize  Number of nodes stored in a single slab.
+ */
+template <typename Node, typename Allocator = std::allocator<Node>, size_t slabSize = 256>
+class NodePool
+{
+public:
+    typedef Allocator allocator_type;
+
+private:
+    struct Slot
+    {
+        // Storage must be the first member: nodes' addresses are casted back to slots.
+        union
+        {
+            typename std::aligned_storage<sizeof(Node), alignof(Node)>::type storage;
+            Slot* next;
+        };
+        bool used;
+    };
+
+    struct Slab
+    {
+        Slot slots[slabSize];
+        Slab* next;
+    };
+
+    typedef typename std::allocator_traits<Allocator>::template rebind_alloc<Slab> SlabAllocator;
+    typedef std::allocator_traits<SlabAllocator> SlabTraits;
+
+public:
+    explicit NodePool(const Allocator& alloc = Allocator())
+        : slabAlloc(alloc), slabs(nullptr), freeSlots(nullptr), liveNodes(0) {}
+
+    NodePool(const NodePool&) = delete;
+    NodePool& operator=(const NodePool&) = delete;
+
+    ~NodePool()
+    {
+        clear();
+        while (slabs != nullptr)
+        {
+            Slab* next = slabs->next;
+            SlabTraits::deallocate(slabAlloc, slabs, 1);
+            slabs = next;
+        }
+    }
+
+    /**
+     * Constructs a new node from given arguments in a free slot.
+     */
+    template <typename... Args>
+    Node* create(Args&&... args)
+    {
+        if (freeSlots == nullptr)
+            grow();
+
+        Slot* slot = freeSlots;
+        freeSlots = slot->next;
+
+        Node* node;
+        try
+        {
+            node = new (&slot->storage) Node(std::forward<Args>(args)...);
+        }
+        catch (...)
+        {
+            slot->next = freeSlots;
+            freeSlots = slot;
+            throw;
+        }
+        slot->used = true;
+        ++liveNodes;
+        return node;
+    }
+
+    /**
+     * Destroys a given node (which must have been created by this pool) and puts its slot on the
+     * free list.
+     */
+    void destroy(Node* node)
+    {
+        node->~Node();
+        Slot* slot = reinterpret_cast<Slot*>(node);
+        slot->used = false;
+        slot->next = freeSlots;
+        freeSlots = slot;
+        --liveNodes;
+    }
+
+    /**
+     * Destroys all nodes created by the pool. Memory is kept for further reuse.
+     */
+    void clear()
+    {
+        freeSlots = nullptr;
+        for (Slab* slab = slabs; slab != nullptr; slab = slab->next)
+        {
+            for (size_t i = slabSize; i-- > 0;)
+            {
+                if (slab->slots[i].used)
+                {
+                    reinterpret_cast<Node*>(&slab->slots[i].storage)->~Node();
+                    slab->slots[i].used = false;
+                }
+                slab->slots[i].next = freeSlots;
+                freeSlots = &slab->slots[i];
+            }
+        }
+        liveNodes = 0;
+    }
+
+    /**
+     * Takes over all slabs of another pool, so nodes created by that pool become owned by this
+     * one. Both pools must use equal allocators. The other pool is left empty.
+     */
+    void splice(NodePool& other)
+    {
+        if (other.slabs != nullptr)
+        {
+            Slab* lastSlab = other.slabs;
+            while (lastSlab->next != nullptr)
+                lastSlab = lastSlab->next;
+            lastSlab->next = slabs;
+            slabs = other.slabs;
+        }
+
+        if (other.freeSlots != nullptr)
+        {
+            Slot* lastSlot = other.freeSlots;
+            while (lastSlot->next != nullptr)
+                lastSlot = lastSlot->next;
+            lastSlot->next = freeSlots;
+            freeSlots = other.freeSlots;
+        }
+
+        liveNodes += other.liveNodes;
+        other.slabs = nullptr;
+        other.freeSlots = nullptr;
+        other.liveNodes = 0;
+    }
+
+    /**
+     * @return Number of nodes currently created by the pool.
+     */
+    size_t size() const
+    {
+        return liveNodes;
+    }
+
+    allocator_type get_allocator() const
+    {
+        return allocator_type(slabAlloc);
+    }
+
+private:
+    void grow()
+    {
+        Slab* slab = ::new (static_cast<void*>(SlabTraits::allocate(slabAlloc, 1))) Slab;
+        slab->next = slabs;
+        slabs = slab;
+        for (size_t i = slabSize; i-- > 0;)
+        {
+            slab->slots[i].used = false;
+            slab->slots[i].next = freeSlots;
+            freeSlots = &slab->slots[i];
+        }
+    }
+
+private:
+    SlabAllocator slabAlloc;
+    Slab* slabs;
+    Slot* freeSlots;
+    size_t liveNodes;
+};
+
+} // namespace geo
+
+#endif
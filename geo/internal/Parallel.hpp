@@ -0,0 +1,204 @@
+#ifndef GEO_PARALLEL_HPP_
+#define GEO_PARALLEL_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <exception>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace geo {
+
+/**
+ * Runs work(worker) on at most a given number of threads, with worker numbers from [0, threads).
+ * The calling thread runs worker 0. If a thread can't be started, work is run on fewer threads, so
+ * work must not depend on all of them running.
+ */
+template <typename Work>
+void runWorkers(unsigned threads, Work& work)
+{
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    for (unsigned i = 1; i < threads; ++i)
+    {
+        try
+        {
+            workers.push_back(std::thread(std::ref(work), i));
+        }
+        catch (const std::system_error&)
+        {
+            break;
+        }
+    }
+    work(0);
+    for (size_t i = 0; i < workers.size(); ++i)
+        workers[i].join();
+}
+
+/**
+ * Calls f(index, worker) for each index from [0, count) using at most a given number of threads.
+ * The calling thread is one of the workers. Indices are handed out dynamically, one by one, so
+ * workers which finish early take more of them. Worker numbers are from [0, threads) and are
+ * unique among concurrently running workers, so they might be used to index per-thread data.
+ *
+ * If any call throws, no further indices are handed out and the first exception is rethrown after
+ * all workers finish.
+ */
+template <typename Function>
+void parallelFor(size_t count, unsigned threads, Function f)
+{
+    if (threads == 0)
+        threads = 1;
+    if (threads > count)
+        threads = static_cast<unsigned>(count);
+    if (threads == 0)
+        return;
+
+    std::atomic<size_t> next(0);
+    std::exception_ptr error;
+    std::mutex errorMutex;
+
+    auto work = [&](unsigned worker) {
+        size_t index;
+        while ((index = next.fetch_add(1)) < count)
+        {
+            try
+            {
+                f(index, worker);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error)
+                    error = std::current_exception();
+                next = count;
+            }
+        }
+    };
+
+    runWorkers(threads, work);
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+/**
+ * Deque of tasks owned by a single worker of parallelTasks().
+ */
+template <typename Task>
+struct TaskQueue
+{
+    std::mutex mutex;
+    std::deque<Task> tasks;
+};
+
+/**
+ * Lets a task of parallelTasks() add new tasks. They're added to the queue of the worker which runs
+ * the spawning task.
+ */
+template <typename Task>
+class TaskSpawner
+{
+public:
+    TaskSpawner(TaskQueue<Task>& queue, std::atomic<size_t>& pending)
+        : queue(&queue), pending(&pending) {}
+
+    void spawn(const Task& task)
+    {
+        pending->fetch_add(1);
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        queue->tasks.push_back(task);
+    }
+
+private:
+    TaskQueue<Task>* queue;
+    std::atomic<size_t>* pending;
+};
+
+/**
+ * Processes a dynamically growing set of tasks using at most a given number of threads, balancing
+ * them with work stealing. f(task, spawner, worker) is called once for each task; it might add new
+ * tasks with spawner.spawn(task). Each worker keeps its own deque of tasks: it takes the most
+ * recently spawned ones first, so a worker descends depth-first into its part of the work, and
+ * idle workers steal the oldest (usually the biggest) tasks of other workers. The calling thread
+ * is one of the workers and worker numbers are from [0, threads), as in parallelFor().
+ *
+ * If any call throws, remaining tasks are dropped and the first exception is rethrown after all
+ * workers finish.
+ */
+template <typename Task, typename Function>
+void parallelTasks(const Task& first, unsigned threads, Function f)
+{
+    if (threads == 0)
+        threads = 1;
+
+    std::vector<TaskQueue<Task> > queues(threads);
+    // Tasks spawned, but not finished yet. Workers end when there are none.
+    std::atomic<size_t> pending(1);
+    std::atomic<bool> failed(false);
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    queues[0].tasks.push_back(first);
+
+    auto take = [&](unsigned worker, Task& task) {
+        {
+            std::lock_guard<std::mutex> lock(queues[worker].mutex);
+            if (!queues[worker].tasks.empty())
+            {
+                task = queues[worker].tasks.back();
+                queues[worker].tasks.pop_back();
+                return true;
+            }
+        }
+        for (unsigned i = 1; i < threads; ++i)
+        {
+            TaskQueue<Task>& victim = queues[(worker + i) % threads];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty())
+            {
+                task = victim.tasks.front();
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    };
+
+    auto work = [&](unsigned worker) {
+        TaskSpawner<Task> spawner(queues[worker], pending);
+        Task task;
+        while (pending.load() > 0 && !failed.load())
+        {
+            if (!take(worker, task))
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            try
+            {
+                f(task, spawner, worker);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error)
+                    error = std::current_exception();
+                failed = true;
+            }
+            pending.fetch_sub(1);
+        }
+    };
+
+    runWorkers(threads, work);
+
+    if (error)
+        std::rethrow_exception(error);
+}
+
+} // namespace geo
+
+#endif
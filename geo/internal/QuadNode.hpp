@@ -2,104 +2,247 @@
 #define GEO_QUADNODE_HPP_
 
 #include <array>
+#include <atomic>
+#include <cstddef>
 #include <vector>
 #include <utility>
 #include <stdexcept>
+#include <memory>
 
 #include "LocationCode.hpp"
+#include "LeafStorage.hpp"
+#include "NodePool.hpp"
 
 namespace geo {
 
-template <typename ObjectType, size_t totalLevels>
+/**
+ * Single node of a QuadTree.
+ *
+ * @param ObjectType  Type of stored elements.
+ * @param totalLevels Maximum number of tree levels.
+ * @param Allocator   Allocator used for both nodes' element storage and for nodes themselves (via
+ *                    NodePool). It's rebound to the appropriate types.
+ * @param withCoordinates Whether original coordinates are stored next to elements.
+ */
+template <typename ObjectType, size_t totalLevels, typename Allocator = std::allocator<ObjectType>,
+          bool withCoordinates = false>
 class QuadNode {
 private:
-    typedef ObjectWithLocationCode<ObjectType, totalLevels> StoredObject;
-    typedef std::vector<StoredObject> Objects;
-    typedef std::array<QuadNode<ObjectType, totalLevels>*, 4> Nodes;
-    typedef QuadNode<ObjectType, totalLevels> QuadNodeT;
+    typedef QuadNode<ObjectType, totalLevels, Allocator, withCoordinates> QuadNodeT;
+    typedef ObjectWithLocationCode<ObjectType, totalLevels, withCoordinates> StoredObject;
+    typedef std::allocator_traits<Allocator> AllocTraits;
+    typedef LeafStorage<ObjectType, totalLevels, Allocator, withCoordinates> Storage;
+    typedef std::array<std::atomic<QuadNodeT*>, 4> Nodes;
+    typedef NodePool<QuadNodeT, Allocator> Pool;
+    typedef typename AllocTraits::template rebind_alloc<Pool> PoolAllocator;
+    typedef std::allocator_traits<PoolAllocator> PoolTraits;
+
+    struct PoolDeleter
+    {
+        void operator()(Pool* pool) const
+        {
+            destroyPool(pool);
+        }
+    };
+
+    // Owns a pool until the node which is to own it is completely constructed.
+    typedef std::unique_ptr<Pool, PoolDeleter> PoolGuard;
+
+    friend class NodePool<QuadNodeT, Allocator>;
 
 public:
     typedef LocationCode<totalLevels> NodeCode;
     typedef ObjectType ElementType;
-    typedef typename Objects::iterator iterator;
-    typedef typename Objects::const_iterator const_iterator;
+    typedef Allocator allocator_type;
+    typedef Pool pool_type;
+    typedef Storage storage_type;
+    typedef typename Storage::iterator iterator;
+    typedef typename Storage::const_iterator const_iterator;
 
 private:
     /**
      * Constructor with LocationCode set. User is not allowed to explicitly set node code. It's
      * calculated by node's parent instead.
      */
-    QuadNode(size_t level, NodeCode&& nodeCode, QuadNode* nodeParent)
-        : nodeLevel(level), nodeParent(nodeParent), nodeCode(nodeCode)
+    QuadNode(size_t level, NodeCode&& nodeCode, QuadNode* nodeParent, Pool* pool)
+        : nodeLevel(level), storage(pool->get_allocator()), subtreeElements(0),
+        references(1), nodeParent(nodeParent), nextLink(nullptr), prevLink(nullptr), nodePool(pool),
+        ownsPool(false), nodeCode(nodeCode)
     {
-        childNodes.fill(nullptr);
+        clearChildren();
+    }
+
+    /**
+     * Copy constructor used for copying subnodes into a given pool.
+     */
+    QuadNode(const QuadNode& that, QuadNode* nodeParent, Pool* pool)
+        : nodeLevel(that.nodeLevel), storage(that.storage, pool->get_allocator()),
+        subtreeElements(that.totalCount()), references(1), nodeParent(nodeParent),
+        nextLink(nullptr), prevLink(nullptr), nodePool(pool), ownsPool(false),
+        nodeCode(that.nodeCode)
+    {
+        copyChildren(that);
+    }
+
+    struct ShareChildren {};
+
+    /**
+     * Copy constructor used by ownChild(). Subnodes aren't copied, they're shared with the
+     * original instead.
+     */
+    QuadNode(const QuadNode& that, QuadNode* nodeParent, Pool* pool, ShareChildren)
+        : nodeLevel(that.nodeLevel), storage(that.storage, pool->get_allocator()),
+        subtreeElements(that.totalCount()), references(1), nodeParent(nodeParent),
+        nextLink(nullptr), prevLink(nullptr), nodePool(pool), ownsPool(false),
+        nodeCode(that.nodeCode)
+    {
+        for (uint32_t i = 0; i < 4; ++i)
+        {
+            QuadNode* child = that.childAt(i);
+            if (child != nullptr)
+                child->addReference();
+            setChild(i, child);
+        }
     }
 
 public:
     /**
      * Default constructor. Always creates a root node.
+     *
+     * Created node owns a pool from which all of its subnodes are allocated. Subnodes are destroyed
+     * all at once together with their owner.
+     *
+     * @param alloc Allocator used by the node and all of its subnodes.
      */
-    QuadNode()
-        : nodeLevel(totalLevels), nodeParent(nullptr)
+    explicit QuadNode(const Allocator& alloc = Allocator())
+        : nodeLevel(totalLevels), storage(alloc), subtreeElements(0), references(1),
+        nodeParent(nullptr), nextLink(this), prevLink(this), nodePool(nullptr), ownsPool(false)
     {
         if (totalLevels < 1)
             throw std::invalid_argument("total levels number is less than 1");
-        childNodes.fill(nullptr);
+        clearChildren();
+        PoolGuard pool(createPool(alloc));
+        nodePool = pool.get();
 
         // Only the super-root (header) is created via default constructor. It's created for
         // bidirectional iteration purposes. Header is a node that is pointed by a tree end()
         // function. User must be able to perform `--end()` operation which should return a proper,
-        // rightmost node.
-        NodeCode newNodeCode(nodeCode);
-        childNodes[0] = new QuadNode(totalLevels - 1, std::move(newNodeCode), this);
+        // rightmost node. Header is also the sentinel of the list of non-empty nodes (@see
+        // nextLeaf()), which is empty at first.
+        createRoot();
+        pool.release();
+        ownsPool = true;
     }
 
     QuadNode(QuadNode&& that)
+        : nodeLevel(that.nodeLevel), storage(std::move(that.storage)),
+        subtreeElements(that.totalCount()), references(1), nodeParent(that.nodeParent),
+        nextLink(that.nextLink), prevLink(that.prevLink), nodePool(that.nodePool),
+        ownsPool(that.ownsPool), nodeCode(that.nodeCode)
     {
-        childNodes.fill(nullptr);
-        nodeParent = nullptr;
-        swap(*this, that);
+        for (uint32_t i = 0; i < 4; ++i)
+            setChild(i, that.childAt(i));
+        that.storage.clear();
+        that.subtreeElements.store(0, std::memory_order_relaxed);
+        that.clearChildren();
+        that.nextLink = nullptr;
+        that.prevLink = nullptr;
+        that.ownsPool = false;
+        adoptChildren();
+        adoptLinks(&that);
     }
 
+    /**
+     * Copies a node with all of its subnodes. The copy owns a new pool.
+     */
     QuadNode(const QuadNode& that)
-        : nodeLevel(that.nodeLevel), storage(that.storage), nodeParent(that.nodeParent),
+        : QuadNode(that, AllocTraits::select_on_container_copy_construction(that.get_allocator()))
+    {
+    }
+
+    /**
+     * Copies a node with all of its subnodes. The copy owns a new pool which uses a given
+     * allocator.
+     */
+    QuadNode(const QuadNode& that, const Allocator& alloc)
+        : nodeLevel(that.nodeLevel), storage(that.storage, alloc),
+        subtreeElements(that.totalCount()), references(1), nodeParent(that.nodeParent),
+        nextLink(nullptr), prevLink(nullptr), nodePool(nullptr), ownsPool(false),
         nodeCode(that.nodeCode)
     {
-        for (int i = 0; i < 4; ++i)
+        // Subnodes which were already copied are destroyed together with the pool when copying
+        // of the others throws.
+        PoolGuard pool(createPool(alloc));
+        nodePool = pool.get();
+        copyChildren(that);
+        if (that.nodeParent == nullptr && that.isThreaded())
+            threadLeaves();
+        pool.release();
+        ownsPool = true;
+    }
+
+    QuadNode& operator=(const QuadNode& rhs)
+    {
+        if (this != &rhs)
         {
-            if (that.childNodes[i] != nullptr)
-                childNodes[i] = new QuadNode(*that.childNodes[i]);
-            else
-                childNodes[i] = nullptr;
+            QuadNode copy(rhs, get_allocator());
+            swap(*this, copy);
         }
+        return *this;
     }
 
-    QuadNode& operator=(QuadNode rhs)
+    QuadNode& operator=(QuadNode&& rhs)
     {
-        swap(*this, rhs);
+        // Nodes which use different allocators cannot exchange their storage.
+        if (get_allocator() == rhs.get_allocator())
+            swap(*this, rhs);
+        else
+            operator=(static_cast<const QuadNode&>(rhs));
         return *this;
     }
 
+    /**
+     * Exchanges contents of two nodes. Both nodes must use equal allocators. It's meant for whole
+     * trees (headers), so lists of non-empty nodes are exchanged as well.
+     */
     friend void swap(QuadNode& first, QuadNode& second)
     {
         using std::swap;
         swap(first.nodeLevel, second.nodeLevel);
         swap(first.nodeParent, second.nodeParent);
         first.storage.swap(second.storage);
-        first.childNodes.swap(second.childNodes);
+        size_t firstCount = first.totalCount();
+        first.subtreeElements.store(second.totalCount(), std::memory_order_relaxed);
+        second.subtreeElements.store(firstCount, std::memory_order_relaxed);
+        for (uint32_t i = 0; i < 4; ++i)
+        {
+            QuadNode* firstChild = first.childAt(i);
+            first.setChild(i, second.childAt(i));
+            second.setChild(i, firstChild);
+        }
+        swap(first.nodePool, second.nodePool);
+        swap(first.ownsPool, second.ownsPool);
         swap(first.nodeCode, second.nodeCode);
+        swap(first.nextLink, second.nextLink);
+        swap(first.prevLink, second.prevLink);
+        first.adoptChildren();
+        second.adoptChildren();
+        first.adoptLinks(&second);
+        second.adoptLinks(&first);
     }
 
+    /**
+     * Subnodes are not destroyed recursively: they're destroyed by the pool owner.
+     */
     ~QuadNode()
     {
-        delete childNodes[0];
-        childNodes[0] = nullptr;
-        delete childNodes[1];
-        childNodes[1] = nullptr;
-        delete childNodes[2];
-        childNodes[2] = nullptr;
-        delete childNodes[3];
-        childNodes[3] = nullptr;
+        if (ownsPool)
+            destroyPool(nodePool);
+    }
+
+    allocator_type get_allocator() const
+    {
+        return storage.get_allocator();
     }
 
     iterator begin()
@@ -117,39 +260,216 @@ public:
     {
         // TODO: check if a given loc is valid from a current QuadNode POV, i.e. first
         // "currentlevelNo - 1" bits of (loc ^ nodeCode) are equal to 0.
-        bool childLocX = loc.x[nodeLevel - 1];
-        bool childLocY = loc.y[nodeLevel - 1];
-        return child(childLocX, childLocY);
+        return child(loc.quadrant(nodeLevel - 1));
     }
 
     QuadNode& existingChild(const NodeCode& loc)
+    {
+        return const_cast<QuadNode&>(static_cast<const QuadNode&>(*this).existingChild(loc));
+    }
+
+    const QuadNode& existingChild(const NodeCode& loc) const
     {
         // TODO: check if a given loc is valid from a current QuadNode POV, i.e. first
         // "currentlevelNo - 1" bits of (loc ^ nodeCode) are equal to 0.
-        bool childLocX = loc.x[nodeLevel - 1];
-        bool childLocY = loc.y[nodeLevel - 1];
-        return existingChild(childLocX, childLocY);
+        return existingChild(loc.quadrant(nodeLevel - 1));
     }
 
     /**
      * Return a child with a given location. A new child is created if it doesn't exist.
      */
     QuadNode& child(bool locX, bool locY)
+    {
+        return child(locToInt(locX, locY));
+    }
+
+    /**
+     * Return a child with a given number (@see locToInt()). A new child is created if it doesn't
+     * exist.
+     */
+    QuadNode& child(uint32_t childNo)
+    {
+        return child(childNo, *nodePool);
+    }
+
+    /**
+     * Return a child with a given number. If a child doesn't exist, it's created in a given pool.
+     * That pool must be spliced into node's pool later (@see pool()). It allows creating nodes
+     * in several threads at once, each of them using its own pool.
+     */
+    QuadNode& child(uint32_t childNo, pool_type& pool)
     {
         if (0 == nodeLevel)
             return *this;
 
-        uint32_t childNo = locToInt(locX, locY);
-        if (childNodes[childNo] == nullptr && nodeLevel > 0)
+        if (childAt(childNo) == nullptr)
+            setChild(childNo, createChild(childNo, pool));
+        return *childAt(childNo);
+    }
+
+    /**
+     * @return Pool from which node's children are allocated.
+     */
+    pool_type& pool()
+    {
+        return *nodePool;
+    }
+
+    /**
+     * Destroys a child with a given number together with all of its subnodes. Slots of destroyed
+     * nodes are reused by the pool. Subnodes which are shared with snapshots are only unlinked.
+     */
+    void removeChild(uint32_t childNo)
+    {
+        QuadNode* node = childAt(childNo);
+        if (node != nullptr)
         {
-            NodeCode newNodeCode(nodeCode);
-            // Bitset position is counted from right (LSB), but LocationCode is checked from
-            // left (MSB)
-            newNodeCode.x[nodeLevel - 1] = locX;
-            newNodeCode.y[nodeLevel - 1] = locY;
-            childNodes[childNo] = new QuadNode(nodeLevel - 1, std::move(newNodeCode), this);
+            updateCounts(-static_cast<ptrdiff_t>(node->totalCount()));
+            node->unlinkSubtree();
+            setChild(childNo, nullptr);
+            release(node);
+        }
+    }
+
+    /**
+     * Destroys all subnodes.
+     */
+    void removeChildren()
+    {
+        for (uint32_t i = 0; i < 4; ++i)
+            removeChild(i);
+    }
+
+    /**
+     * Creates an empty node which might become a child with a given number, but doesn't link it.
+     * It's linked by replaceChild(). Until then, the node is only reachable by its creator.
+     */
+    QuadNode* createDetachedChild(uint32_t childNo)
+    {
+        return createChild(childNo, *nodePool);
+    }
+
+    /**
+     * Creates a copy of an existing child with a given number together with all of its subnodes,
+     * but doesn't link it. @see createDetachedChild()
+     */
+    QuadNode* cloneChild(uint32_t childNo)
+    {
+        return nodePool->create(*childAt(childNo), this, nodePool);
+    }
+
+    /**
+     * Atomically replaces a child with a given number by a given, completely built node (or
+     * nullptr). Readers which are concurrently traversing the tree see either the old subtree or
+     * the new one. Total counts aren't updated.
+     *
+     * @return The old child. It's no longer reachable from this node, but it's kept intact (and
+     *         its parent is still this node), so readers which have already entered it might
+     *         continue. It must be destroyed with destroyDetached() when they're done.
+     */
+    QuadNode* replaceChild(uint32_t childNo, QuadNode* node)
+    {
+        QuadNode* old = childAt(childNo);
+        setChild(childNo, node);
+        return old;
+    }
+
+    /**
+     * Destroys a node, which is no longer linked to its parent, with all of its subnodes.
+     */
+    static void destroyDetached(QuadNode* node)
+    {
+        node->nodeParent = nullptr;
+        release(node);
+    }
+
+    /**
+     * Adds a reference to the node. Nodes are referenced by their parents and by snapshots of
+     * trees (which keep old roots), so a node is shared when it's reachable from a snapshot as
+     * well as from the tree. Shared nodes are never modified: they're copied by ownChild() first.
+     * References might be added by any thread, but they're dropped only by the modifying one.
+     */
+    void addReference()
+    {
+        references.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * @return Whether the node is referenced more than once. @see addReference()
+     */
+    bool isShared() const
+    {
+        return references.load(std::memory_order_acquire) > 1;
+    }
+
+    /**
+     * Drops a reference to a node. The last one destroys the node and drops its references to
+     * its children. Destroyed nodes aren't unlinked from the list of non-empty nodes, so they
+     * must be unlinked before or the list must be rebuilt.
+     */
+    static void release(QuadNode* node)
+    {
+        if (node->references.fetch_sub(1, std::memory_order_acq_rel) != 1)
+            return;
+        for (uint32_t i = 0; i < 4; ++i)
+        {
+            if (node->childExists(i))
+                release(node->childAt(i));
+        }
+        node->clearChildren();
+        node->nodePool->destroy(node);
+    }
+
+    /**
+     * Makes a child with a given number referenced only by this node, which mustn't be shared
+     * itself. A shared child (@see addReference()) is replaced by its copy, which shares the
+     * child's subnodes instead of copying them and takes the child's place in the list of
+     * non-empty nodes. The child is left intact for the snapshots which use it, apart from its
+     * list links, which snapshots don't use.
+     *
+     * @return The child, its copy or nullptr when there's no such child.
+     */
+    QuadNode* ownChild(uint32_t childNo)
+    {
+        QuadNode* node = childAt(childNo);
+        if (node == nullptr || !node->isShared())
+            return node;
+
+        QuadNode* copy = nodePool->create(*node, this, nodePool, ShareChildren());
+        copy->adoptChildren();
+        copy->nextLink = node->nextLink;
+        copy->prevLink = node->prevLink;
+        node->nextLink = nullptr;
+        node->prevLink = nullptr;
+        copy->adoptLinks(node);
+        setChild(childNo, copy);
+        release(node);
+        return copy;
+    }
+
+    /**
+     * Removes all elements and subnodes. When called on a pool owner (e.g. a header), all subnodes
+     * are destroyed at once, without traversing them, and a new root is created.
+     */
+    void reset()
+    {
+        clear();
+        if (ownsPool)
+        {
+            updateCounts(-static_cast<ptrdiff_t>(totalCount()));
+            clearChildren();
+            nodePool->clear();
+            if (nodeParent == nullptr)
+            {
+                createRoot();
+                if (isThreaded())
+                    nextLink = prevLink = this;
+            }
+        }
+        else
+        {
+            removeChildren();
         }
-        return *childNodes[childNo];
     }
 
     /**
@@ -158,19 +478,50 @@ public:
      */
     QuadNode& existingChild(bool locX, bool locY)
     {
-        if (childExists(locX, locY) && nodeLevel > 0)
-            return *childNodes[locToInt(locX, locY)];
+        return existingChild(locToInt(locX, locY));
+    }
+
+    const QuadNode& existingChild(bool locX, bool locY) const
+    {
+        return existingChild(locToInt(locX, locY));
+    }
+
+    /**
+     * Return a child with a given number (@see locToInt()). If a child doesn't exist, current node
+     * is returned instead.
+     */
+    QuadNode& existingChild(uint32_t childNo)
+    {
+        return const_cast<QuadNode&>(static_cast<const QuadNode&>(*this).existingChild(childNo));
+    }
+
+    /**
+     * Const version of existingChild(). It never creates nodes, so it's safe to call concurrently
+     * by many readers.
+     */
+    const QuadNode& existingChild(uint32_t childNo) const
+    {
+        QuadNode* node = childAt(childNo);
+        if (node != nullptr && nodeLevel > 0)
+            return *node;
         return *this;
     }
 
     bool childExists(bool locX, bool locY) const
     {
-        return (childNodes[locToInt(locX, locY)] != nullptr);
+        return childExists(locToInt(locX, locY));
+    }
+
+    bool childExists(uint32_t childNo) const
+    {
+        return (childAt(childNo) != nullptr);
     }
 
     void clear()
     {
+        updateCounts(-static_cast<ptrdiff_t>(storage.size()));
         storage.clear();
+        unlinkLeaf();
     }
 
     /**
@@ -191,14 +542,50 @@ public:
         return storage.end();
     }
 
+    /**
+     * @return Whether handle slots are set for all elements of the node. @see LeafStorage
+     */
+    bool hasSlots() const
+    {
+        return storage.hasSlots();
+    }
+
+    /**
+     * @return Handle slot of an element at a given position.
+     */
+    uint32_t slot(size_t element) const
+    {
+        return storage.slot(element);
+    }
+
+    void setSlot(size_t element, uint32_t slot)
+    {
+        storage.setSlot(element, slot);
+    }
+
+    /**
+     * Changes location of an element at a given position, which stays in this node. The new
+     * location code must belong to the node area.
+     */
+    void relocate(size_t element, const NodeCode& loc, const Coordinates& coordinates)
+    {
+        storage.relocate(element, loc, coordinates);
+    }
+
     void erase(const iterator& it)
     {
-        storage.erase(it);
+        size_t position = static_cast<size_t>(it - storage.begin());
+        storage.erase(position, position + 1);
+        updateCounts(-1);
+        unlinkIfEmpty();
     }
 
     void erase(const iterator& itStart, const iterator& itEnd)
     {
-        storage.erase(itStart, itEnd);
+        updateCounts(-(itEnd - itStart));
+        storage.erase(static_cast<size_t>(itStart - storage.begin()),
+                      static_cast<size_t>(itEnd - storage.begin()));
+        unlinkIfEmpty();
     }
 
     /**
@@ -206,47 +593,50 @@ public:
      */
     void erase(const NodeCode& loc)
     {
-        for (iterator it = storage.begin(); it != storage.end();)
-        {
-            if (loc == (it->location))
-                it = storage.erase(it);
-            else
-                ++it;
-        }
+        updateCounts(-static_cast<ptrdiff_t>(storage.erase(loc)));
+        unlinkIfEmpty();
     }
 
     bool hasChildren() const
     {
-        if (childNodes[0] != nullptr || childNodes[1] != nullptr ||
-            childNodes[2] != nullptr || childNodes[3] != nullptr)
+        if (childAt(0) != nullptr || childAt(1) != nullptr ||
+            childAt(2) != nullptr || childAt(3) != nullptr)
             return true;
         return false;
     }
 
-    // TODO: method should be const somehow
     QuadNode& leftMostNode()
     {
-        QuadNodeT* retNode = this;
+        return const_cast<QuadNode&>(static_cast<const QuadNode&>(*this).leftMostNode());
+    }
+
+    const QuadNode& leftMostNode() const
+    {
+        const QuadNodeT* retNode = this;
         while (retNode->hasChildren())
         {
-            if (retNode->childNodes[0] != nullptr) retNode = retNode->childNodes[0];
-            else if (retNode->childNodes[1] != nullptr) retNode = retNode->childNodes[1];
-            else if (retNode->childNodes[2] != nullptr) retNode = retNode->childNodes[2];
-            else retNode = retNode->childNodes[3];
+            if (retNode->childExists(0u)) retNode = retNode->childAt(0);
+            else if (retNode->childExists(1u)) retNode = retNode->childAt(1);
+            else if (retNode->childExists(2u)) retNode = retNode->childAt(2);
+            else retNode = retNode->childAt(3);
         }
         return *retNode;
     }
 
-    // TODO: method should be const somehow
     QuadNode& rightMostNode()
     {
-        QuadNodeT* retNode = this;
+        return const_cast<QuadNode&>(static_cast<const QuadNode&>(*this).rightMostNode());
+    }
+
+    const QuadNode& rightMostNode() const
+    {
+        const QuadNodeT* retNode = this;
         while (retNode->hasChildren())
         {
-            if (retNode->childNodes[3] != nullptr) retNode = retNode->childNodes[3];
-            else if (retNode->childNodes[2] != nullptr) retNode = retNode->childNodes[2];
-            else if (retNode->childNodes[1] != nullptr) retNode = retNode->childNodes[1];
-            else retNode = retNode->childNodes[0];
+            if (retNode->childExists(3u)) retNode = retNode->childAt(3);
+            else if (retNode->childExists(2u)) retNode = retNode->childAt(2);
+            else if (retNode->childExists(1u)) retNode = retNode->childAt(1);
+            else retNode = retNode->childAt(0);
         }
         return *retNode;
     }
@@ -254,26 +644,135 @@ public:
     bool isChildOf(const QuadNode& node) const
     {
         if (level() < node.level())
-        {
-            for (size_t i = totalLevels - 1; i >= node.level(); --i)
-            {
-                if (nodeCode.x[i] != node.locationCode().x[i] ||
-                    nodeCode.y[i] != node.locationCode().y[i])
-                {
-                    return false;
-                }
-            }
-            return true;
-        }
+            return nodeCode.samePrefix(node.locationCode(), node.level());
         return false;
     }
 
     size_t insert(StoredObject&& object)
     {
         storage.push_back(std::move(object));
+        updateCounts(1);
+        if (count() == 1)
+            linkLeaf();
         return (count() - 1);
     }
 
+    /**
+     * Moves all elements to children chosen by their location codes. Children are created when
+     * needed. Total count of the node doesn't change, so its ancestors aren't touched. Children
+     * take the place of the node in the list of non-empty nodes.
+     */
+    void split()
+    {
+        if (0 == nodeLevel)
+            return;
+
+        for (size_t i = 0; i < storage.size(); ++i)
+        {
+            QuadNode& node = child(storage.location(i));
+            storage.moveTo(i, node.storage);
+            node.subtreeElements.store(node.totalCount() + 1, std::memory_order_relaxed);
+        }
+        storage.clear();
+        if (unlinkLeaf())
+        {
+            // Each child is linked in front of its next non-empty node, so they're linked from
+            // the last one.
+            for (uint32_t i = 4; i-- > 0;)
+            {
+                if (childExists(i) && childAt(i)->count() > 0)
+                    childAt(i)->linkLeaf();
+            }
+        }
+    }
+
+    /**
+     * Moves all elements of subnodes into this node and destroys subnodes, which is the reverse
+     * of split(). Elements are gathered in the Z-order, so the order of iteration doesn't change.
+     * Elements of subnodes shared with snapshots are copied instead (@see addReference()). Total
+     * count of the node doesn't change and it takes the place of subnodes in the list of
+     * non-empty nodes.
+     */
+    void collapse()
+    {
+        storage.reserve(totalCount());
+        for (uint32_t i = 0; i < 4; ++i)
+        {
+            QuadNode* node = childAt(i);
+            if (node != nullptr)
+            {
+                node->unlinkSubtree();
+                node->gatherElements(storage, false);
+                setChild(i, nullptr);
+                release(node);
+            }
+        }
+        if (count() > 0)
+            linkLeaf();
+    }
+
+    /**
+     * Creates a leaf which might replace a child with a given number, with copies of all elements
+     * of the child's subtree in the Z-order, but doesn't link it. @see collapse(),
+     * createDetachedChild()
+     */
+    QuadNode* cloneCollapsedChild(uint32_t childNo)
+    {
+        QuadNode* child = childAt(childNo);
+        QuadNode* node = createDetachedChild(childNo);
+        try
+        {
+            node->storage.reserve(child->totalCount());
+            child->gatherElements(node->storage, true);
+        }
+        catch (...)
+        {
+            destroyDetached(node);
+            throw;
+        }
+        node->subtreeElements.store(node->count(), std::memory_order_relaxed);
+        return node;
+    }
+
+    /**
+     * Releases memory of the node which isn't used by its elements.
+     */
+    void shrinkToFit()
+    {
+        storage.shrinkToFit();
+    }
+
+    /**
+     * Stores objects created by a given factory from each element of a range. Unlike insert(),
+     * only the count of this node is updated and the node isn't linked to the list of non-empty
+     * nodes, so it's safe to fill nodes of disjoint subtrees concurrently. Ancestors must be
+     * updated afterwards (@see recount()) and the list must be rebuilt (@see threadLeaves()).
+     */
+    template <typename Iterator, typename Factory>
+    void fill(Iterator first, Iterator last, const Factory& make)
+    {
+        size_t count = static_cast<size_t>(last - first);
+        storage.reserve(storage.size() + count);
+        for (; first != last; ++first)
+            storage.push_back(make(*first));
+        subtreeElements.store(totalCount() + count, std::memory_order_relaxed);
+    }
+
+    /**
+     * Recomputes the total count of the node from its own elements and total counts of its
+     * children.
+     */
+    void recount()
+    {
+        size_t count = storage.size();
+        for (uint32_t i = 0; i < 4; ++i)
+        {
+            if (childExists(i))
+                count += childAt(i)->totalCount();
+        }
+        subtreeElements.store(count, std::memory_order_relaxed);
+    }
+
     size_t level() const
     {
         return nodeLevel;
@@ -296,26 +795,112 @@ public:
         return *nodeParent;
     }
 
+    const QuadNode& parent() const
+    {
+        if (nodeParent == nullptr)
+            return *this;
+        return *nodeParent;
+    }
+
     /**
-     * Returns a number of objects stored in a current node and all subnodes.
+     * Returns a number of objects stored in a current node and all subnodes. Counts are cached in
+     * nodes and kept up to date by all modifications, so it takes constant time.
      */
     size_t totalCount() const
     {
-        size_t tc = storage.size();
-        if (hasChildren())
+        return subtreeElements.load(std::memory_order_relaxed);
+    }
+
+    ElementType& operator[](size_t element)
+    {
+        return storage[element];
+    }
+
+    const ElementType& operator[](size_t element) const
+    {
+        return storage[element];
+    }
+
+    /**
+     * @return Location code of an element at a given position.
+     */
+    NodeCode location(size_t element) const
+    {
+        return storage.location(element);
+    }
+
+    /**
+     * @return Elements stored in the node, which give access to separate arrays of their codes and
+     *         coordinates. @see LeafStorage
+     */
+    const Storage& elements() const
+    {
+        return storage;
+    }
+
+    /**
+     * Non-empty nodes of a tree are threaded into a doubly linked list in the Z-order (the order
+     * of iteration), so iterators go from one node straight to the next one, without climbing
+     * the tree and visiting interior and empty nodes. The header is the sentinel of the list: its
+     * next node is the first non-empty node and its previous node is the last one. The list is
+     * updated by modifications of nodes which are linked into a tree; nodes of trees which aren't
+     * threaded (@see unthreadLeaves()) aren't linked.
+     *
+     * @return Next non-empty node, the header after the last one or nullptr when the node isn't
+     *         linked (it's empty or the tree isn't threaded).
+     */
+    QuadNode* nextLeaf() const
+    {
+        return nextLink;
+    }
+
+    /**
+     * @return Previous non-empty node. @see nextLeaf()
+     */
+    QuadNode* previousLeaf() const
+    {
+        return prevLink;
+    }
+
+    /**
+     * @return Whether the tree which the node belongs to maintains the list of non-empty nodes.
+     */
+    bool isThreaded() const
+    {
+        const QuadNode* header = this;
+        while (header->nodeParent != nullptr)
+            header = header->nodeParent;
+        return header->nextLink != nullptr;
+    }
+
+    /**
+     * Rebuilds the list of non-empty nodes of the whole tree. Must be called on a header.
+     */
+    void threadLeaves()
+    {
+        QuadNode* last = this;
+        for (uint32_t i = 0; i < 4; ++i)
         {
-            for (int i = 0; i < 4; ++i)
-            {
-                if (childNodes[i] != nullptr)
-                    tc += childNodes[i]->totalCount();
-            }
+            if (childExists(i))
+                last = childAt(i)->threadSubtree(last);
         }
-        return tc;
+        last->nextLink = this;
+        prevLink = last;
     }
 
-    ElementType& operator[](size_t element)
+    /**
+     * Stops maintaining the list of non-empty nodes. Must be called on a header. Iterators
+     * continue to work, but they find next nodes by traversing the tree.
+     */
+    void unthreadLeaves()
     {
-        return storage[element].object;
+        for (uint32_t i = 0; i < 4; ++i)
+        {
+            if (childExists(i))
+                childAt(i)->unthreadSubtree();
+        }
+        nextLink = nullptr;
+        prevLink = nullptr;
     }
 
     bool operator==(const QuadNodeT& rhs) const
@@ -328,50 +913,303 @@ public:
         return !(operator==(rhs));
     }
 
+private:
+    static Pool* createPool(const Allocator& alloc)
+    {
+        PoolAllocator poolAlloc(alloc);
+        Pool* pool = PoolTraits::allocate(poolAlloc, 1);
+        ::new (static_cast<void*>(pool)) Pool(alloc);
+        return pool;
+    }
+
+    static void destroyPool(Pool* pool)
+    {
+        PoolAllocator poolAlloc(pool->get_allocator());
+        pool->~Pool();
+        PoolTraits::deallocate(poolAlloc, pool, 1);
+    }
+
+    /**
+     * Child pointers are loaded with acquire and stored with release semantics, so a reader which
+     * finds a node also sees it completely constructed. @see replaceChild()
+     */
+    QuadNode* childAt(uint32_t childNo) const
+    {
+        return childNodes[childNo].load(std::memory_order_acquire);
+    }
+
+    void setChild(uint32_t childNo, QuadNode* node)
+    {
+        childNodes[childNo].store(node, std::memory_order_release);
+    }
+
+    void clearChildren()
+    {
+        for (uint32_t i = 0; i < 4; ++i)
+            setChild(i, nullptr);
+    }
+
+    QuadNode* createChild(uint32_t childNo, pool_type& pool)
+    {
+        NodeCode newNodeCode(nodeCode);
+        // Header's only child (the root) has the same code as the header.
+        if (nodeParent != nullptr)
+            newNodeCode.setQuadrant(nodeLevel - 1, childNo);
+        return pool.create(nodeLevel - 1, std::move(newNodeCode), this, nodePool);
+    }
+
+    void createRoot()
+    {
+        setChild(0, createChild(0, *nodePool));
+    }
+
+    void copyChildren(const QuadNode& that)
+    {
+        for (uint32_t i = 0; i < 4; ++i)
+        {
+            if (that.childExists(i))
+                setChild(i, nodePool->create(*that.childAt(i), this, nodePool));
+            else
+                setChild(i, nullptr);
+        }
+    }
+
+    /**
+     * Links nodes of the subtree with elements after a given node, in the Z-order. All nodes of
+     * the subtree are relinked, so it doesn't matter whether they were linked before.
+     *
+     * @return The last linked node.
+     */
+    QuadNode* threadSubtree(QuadNode* last)
+    {
+        nextLink = nullptr;
+        prevLink = nullptr;
+        if (count() > 0)
+        {
+            last->nextLink = this;
+            prevLink = last;
+            last = this;
+        }
+        for (uint32_t i = 0; i < 4; ++i)
+        {
+            if (childExists(i))
+                last = childAt(i)->threadSubtree(last);
+        }
+        return last;
+    }
+
+    /**
+     * Appends elements of the subtree to a given storage in the Z-order. They're moved unless
+     * they're to be copied or the node is shared.
+     */
+    void gatherElements(Storage& to, bool copy)
+    {
+        copy = copy || isShared();
+        for (size_t i = 0; i < storage.size(); ++i)
+        {
+            if (copy)
+                storage.copyTo(i, to);
+            else
+                storage.moveTo(i, to);
+        }
+        for (uint32_t i = 0; i < 4; ++i)
+        {
+            if (childExists(i))
+                childAt(i)->gatherElements(to, copy);
+        }
+    }
+
+    /**
+     * Removes all nodes of the subtree from the list of non-empty nodes.
+     */
+    void unlinkSubtree()
+    {
+        unlinkLeaf();
+        for (uint32_t i = 0; i < 4; ++i)
+        {
+            if (childExists(i))
+                childAt(i)->unlinkSubtree();
+        }
+    }
+
+    void unthreadSubtree()
+    {
+        nextLink = nullptr;
+        prevLink = nullptr;
+        for (uint32_t i = 0; i < 4; ++i)
+        {
+            if (childExists(i))
+                childAt(i)->unthreadSubtree();
+        }
+    }
+
+    /**
+     * @return The first node of the subtree in the Z-order which stores elements. The subtree
+     *         mustn't be empty.
+     */
+    const QuadNode* firstNonEmpty() const
+    {
+        const QuadNode* node = this;
+        while (node->count() == 0)
+        {
+            uint32_t i = 0;
+            while (!node->childExists(i) || node->childAt(i)->totalCount() == 0)
+                ++i;
+            node = node->childAt(i);
+        }
+        return node;
+    }
+
+    /**
+     * @return The next node in the Z-order which stores elements or the header if there's none.
+     *         Subtrees are skipped by their total counts, so it takes time proportional to the
+     *         tree height.
+     */
+    const QuadNode* nextNonEmpty() const
+    {
+        for (uint32_t i = 0; i < 4; ++i)
+        {
+            if (childExists(i) && childAt(i)->totalCount() > 0)
+                return childAt(i)->firstNonEmpty();
+        }
+
+        const QuadNode* node = this;
+        for (; node->nodeParent != nullptr; node = node->nodeParent)
+        {
+            const QuadNode* parent = node->nodeParent;
+            uint32_t childNo = 0;
+            while (parent->childAt(childNo) != node)
+                ++childNo;
+            for (uint32_t i = childNo + 1; i < 4; ++i)
+            {
+                if (parent->childExists(i) && parent->childAt(i)->totalCount() > 0)
+                    return parent->childAt(i)->firstNonEmpty();
+            }
+        }
+        return node;
+    }
+
+    /**
+     * Links a node, which has just received its first elements, into the list of non-empty nodes,
+     * unless it's already linked or the tree isn't threaded.
+     */
+    void linkLeaf()
+    {
+        if (nextLink != nullptr || nodeParent == nullptr || !isThreaded())
+            return;
+        QuadNode* next = const_cast<QuadNode*>(nextNonEmpty());
+        nextLink = next;
+        prevLink = next->prevLink;
+        prevLink->nextLink = this;
+        next->prevLink = this;
+    }
+
+    /**
+     * Removes a node from the list of non-empty nodes.
+     *
+     * @return Whether the node was linked.
+     */
+    bool unlinkLeaf()
+    {
+        if (nextLink == nullptr || nodeParent == nullptr)
+            return false;
+        prevLink->nextLink = nextLink;
+        nextLink->prevLink = prevLink;
+        nextLink = nullptr;
+        prevLink = nullptr;
+        return true;
+    }
+
+    void unlinkIfEmpty()
+    {
+        if (count() == 0)
+            unlinkLeaf();
+    }
+
+    /**
+     * Points neighbours in the list of non-empty nodes to this node after it has taken over the
+     * links of a given one (when it's moved or swapped).
+     */
+    void adoptLinks(QuadNode* old)
+    {
+        if (nextLink == nullptr)
+            return;
+        if (nextLink == old)
+            nextLink = this;
+        if (prevLink == old)
+            prevLink = this;
+        nextLink->prevLink = this;
+        prevLink->nextLink = this;
+    }
+
+    /**
+     * Adds a given difference to total counts of the node and all of its ancestors.
+     */
+    void updateCounts(ptrdiff_t difference)
+    {
+        // Counts are modified by a single writer, but they might be read concurrently.
+        for (QuadNode* node = this; node != nullptr; node = node->nodeParent)
+            node->subtreeElements.store(node->totalCount() + difference,
+                                        std::memory_order_relaxed);
+    }
+
+    void adoptChildren()
+    {
+        for (uint32_t i = 0; i < 4; ++i)
+        {
+            if (childExists(i))
+                childAt(i)->nodeParent = this;
+        }
+    }
+
 private:
     size_t nodeLevel;
-    Objects storage;
+    Storage storage;
+    std::atomic<size_t> subtreeElements;
+    // Number of parents and snapshots which point to the node. @see addReference()
+    std::atomic<uint32_t> references;
 
     QuadNode* nodeParent;
+    // Neighbours in the list of non-empty nodes. @see nextLeaf()
+    QuadNode* nextLink;
+    QuadNode* prevLink;
     Nodes childNodes;
+    Pool* nodePool;
+    bool ownsPool;
     NodeCode nodeCode;
 };
 
-template <typename T, size_t lev>
-QuadNode<T, lev>& nextNode(QuadNode<T, lev>& node)
+template <typename T, size_t lev, typename A, bool c>
+const QuadNode<T, lev, A, c>& nextNode(const QuadNode<T, lev, A, c>& node)
 {
     if (node.hasChildren())
     {
-        if (node.childExists(0, 0)) return node.child(0, 0);
-        else if (node.childExists(0, 1)) return node.child(0, 1);
-        else if (node.childExists(1, 0)) return node.child(1, 0);
-        else return node.child(1, 1);
+        if (node.childExists(0, 0)) return node.existingChild(0, 0);
+        else if (node.childExists(0, 1)) return node.existingChild(0, 1);
+        else if (node.childExists(1, 0)) return node.existingChild(1, 0);
+        else return node.existingChild(1, 1);
     }
     else
     {
-        QuadNode<T, lev>* refNode = &node;
+        const QuadNode<T, lev, A, c>* refNode = &node;
 
         // initial prepare for the first check of parent node
-        bool x = refNode->locationCode().x[refNode->level()];
-        bool y = refNode->locationCode().y[refNode->level()];
+        uint32_t childNo = refNode->locationCode().quadrant(refNode->level());
         while (*refNode != refNode->parent())
         {
             refNode = &(refNode->parent());
             // evaluate node number in node->parent() child list and check only children with
             // higher index.
-            for (uint32_t i = QuadNode<T, lev>::locToInt(x, y) + 1; i < 4; ++i)
+            for (uint32_t i = childNo + 1; i < 4; ++i)
             {
-                bool cx = (i & 2) >> 1;
-                bool cy = i & 1;
-                if (refNode->childExists(cx, cy))
+                if (refNode->childExists(i))
                 {
-                    return refNode->child(cx, cy);
+                    return refNode->existingChild(i);
                 }
             }
 
             // prepare the next (parent) node to check
-            x = refNode->locationCode().x[refNode->level()];
-            y = refNode->locationCode().y[refNode->level()];
+            childNo = refNode->locationCode().quadrant(refNode->level());
         }
 
         // At this point refNode == refNode.parent(), so it's a header. We'll return it as
@@ -380,32 +1218,29 @@ QuadNode<T, lev>& nextNode(QuadNode<T, lev>& node)
     }
 }
 
-template <typename T, size_t lev>
-QuadNode<T, lev>& previousNode(QuadNode<T, lev>& node)
+template <typename T, size_t lev, typename A, bool c>
+const QuadNode<T, lev, A, c>& previousNode(const QuadNode<T, lev, A, c>& node)
 {
     // If header node is given, then its previousNode is the rightmost one.
     // requirement: --end()
     if (node.parent() == node)
         return node.rightMostNode();
 
-    QuadNode<T, lev>* refNode = &node;
+    const QuadNode<T, lev, A, c>* refNode = &node;
 
-    bool x = refNode->locationCode().x[refNode->level()];
-    bool y = refNode->locationCode().y[refNode->level()];
+    int childNo = refNode->locationCode().quadrant(refNode->level());
     refNode = &(refNode->parent());
-    for (int i = QuadNode<T, lev>::locToInt(x, y) - 1; i >= 0; --i)
+    for (int i = childNo - 1; i >= 0; --i)
     {
-        bool cx = (i & 2) >> 1;
-        bool cy = i & 1;
-        if (refNode->childExists(cx, cy))
+        if (refNode->childExists(i))
         {
-            refNode = &(refNode->child(cx, cy));
+            refNode = &(refNode->existingChild(i));
             while (refNode->hasChildren())
             {
-                if (refNode->childExists(1, 1)) refNode = &(refNode->child(1, 1));
-                else if (refNode->childExists(1, 0)) refNode = &(refNode->child(1, 0));
-                else if (refNode->childExists(0, 1)) refNode = &(refNode->child(0, 1));
-                else refNode = &(refNode->child(0, 0));
+                if (refNode->childExists(1, 1)) refNode = &(refNode->existingChild(1, 1));
+                else if (refNode->childExists(1, 0)) refNode = &(refNode->existingChild(1, 0));
+                else if (refNode->childExists(0, 1)) refNode = &(refNode->existingChild(0, 1));
+                else refNode = &(refNode->existingChild(0, 0));
             }
             return *refNode;
         }
@@ -418,6 +1253,20 @@ QuadNode<T, lev>& previousNode(QuadNode<T, lev>& node)
     return *refNode;
 }
 
+template <typename T, size_t lev, typename A, bool c>
+QuadNode<T, lev, A, c>& nextNode(QuadNode<T, lev, A, c>& node)
+{
+    return const_cast<QuadNode<T, lev, A, c>&>(
+        nextNode(static_cast<const QuadNode<T, lev, A, c>&>(node)));
+}
+
+template <typename T, size_t lev, typename A, bool c>
+QuadNode<T, lev, A, c>& previousNode(QuadNode<T, lev, A, c>& node)
+{
+    return const_cast<QuadNode<T, lev, A, c>&>(
+        previousNode(static_cast<const QuadNode<T, lev, A, c>&>(node)));
+}
+
 } // namespace geo
 
 #endif
@@ -0,0 +1,153 @@
+#ifndef GEO_REGIONS_HPP_
+#define GEO_REGIONS_HPP_
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#include "MortonBatch.hpp"
+#include "LeafScan.hpp"
+
+namespace geo {
+
+/**
+ * Regions searched by range queries of QuadTree and MappedQuadTree. A query descends into nodes
+ * whose boxes intersect its region, takes whole nodes which the region contains and tests
+ * elements of the remaining leaves with match().
+ */
+namespace region {
+
+/**
+ * Axis-aligned box in cell units, i.e. the whole tree range is [0, 2^(maxLevels - 1)) in both
+ * axes and the smallest tree node (cell) is 1 wide.
+ */
+struct Box
+{
+    double minX;
+    double minY;
+    double maxX;
+    double maxY;
+};
+
+/**
+ * @return Squared distance from a given point to the nearest point of a given box.
+ */
+inline double squaredDistance(double x, double y, const Box& box)
+{
+    double dx = x < box.minX ? box.minX - x : (x > box.maxX ? x - box.maxX : 0);
+    double dy = y < box.minY ? box.minY - y : (y > box.maxY ? y - box.maxY : 0);
+    return dx * dx + dy * dy;
+}
+
+/**
+ * Region searched by withinRect(). Bounds are inclusive.
+ */
+struct Rect
+{
+    Rect(const Box& cells, double minX, double minY, double maxX, double maxY)
+        : cells(cells), minX(minX), minY(minY), maxX(maxX), maxY(maxY) {}
+
+    bool intersects(const Box& box) const
+    {
+        return box.minX <= cells.maxX && box.maxX > cells.minX &&
+               box.minY <= cells.maxY && box.maxY > cells.minY;
+    }
+
+    bool contains(const Box& box) const
+    {
+        return box.minX >= cells.minX && box.maxX <= cells.maxX &&
+               box.minY >= cells.minY && box.maxY <= cells.maxY;
+    }
+
+    /**
+     * Marks elements, given by their location codes and coordinates, which are inside the region.
+     * Without coordinates (xs and ys are unused then), an element matches when its cell
+     * intersects the region.
+     */
+    template <typename KeyType>
+    void match(const KeyType*, const double* xs, const double* ys, size_t count, uint64_t* mask,
+               std::true_type) const
+    {
+        scan::pointsInRect(kernel, xs, ys, count, minX, minY, maxX, maxY, mask);
+    }
+
+    template <typename KeyType>
+    void match(const KeyType* codes, const double*, const double*, size_t count, uint64_t* mask,
+               std::false_type) const
+    {
+        // Cell c intersects [a, b] when c <= b and c + 1 > a, i.e. floor(a) <= c <= floor(b).
+        scan::CellRange range = { cellBound(cells.minX), cellBound(cells.minY),
+                                  cellBound(cells.maxX), cellBound(cells.maxY) };
+        scan::cellsInRect(kernel, codes, count, range, mask);
+    }
+
+    static int64_t cellBound(double cells)
+    {
+        if (!(cells >= -1))
+            return -1;
+        if (cells > static_cast<double>(uint64_t(1) << 32))
+            return int64_t(1) << 32;
+        return static_cast<int64_t>(std::floor(cells));
+    }
+
+    morton::batch::Kernel kernel = morton::batch::bestKernel();
+    Box cells;
+    double minX;
+    double minY;
+    double maxX;
+    double maxY;
+};
+
+/**
+ * Region searched by withinRadius(). Squared radii are given both in cell units and in original
+ * units.
+ */
+struct Circle
+{
+    Circle(double cellX, double cellY, double cellRadius2, double x, double y, double radius2)
+        : cellX(cellX), cellY(cellY), cellRadius2(cellRadius2), x(x), y(y), radius2(radius2) {}
+
+    bool intersects(const Box& box) const
+    {
+        return squaredDistance(cellX, cellY, box) <= cellRadius2;
+    }
+
+    bool contains(const Box& box) const
+    {
+        double dx = std::max(cellX - box.minX, box.maxX - cellX);
+        double dy = std::max(cellY - box.minY, box.maxY - cellY);
+        return dx * dx + dy * dy <= cellRadius2;
+    }
+
+    /**
+     * @see Rect::match()
+     */
+    template <typename KeyType>
+    void match(const KeyType*, const double* xs, const double* ys, size_t count, uint64_t* mask,
+               std::true_type) const
+    {
+        scan::pointsInCircle(kernel, xs, ys, count, x, y, radius2, mask);
+    }
+
+    template <typename KeyType>
+    void match(const KeyType* codes, const double*, const double*, size_t count, uint64_t* mask,
+               std::false_type) const
+    {
+        scan::cellsInCircle(kernel, codes, count, cellX, cellY, cellRadius2, mask);
+    }
+
+    morton::batch::Kernel kernel = morton::batch::bestKernel();
+    double cellX;
+    double cellY;
+    double cellRadius2;
+    double x;
+    double y;
+    double radius2;
+};
+
+} // namespace region
+} // namespace geo
+
+#endif
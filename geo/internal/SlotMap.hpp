@@ -0,0 +1,135 @@
+#ifndef GEO_SLOTMAP_HPP_
+#define GEO_SLOTMAP_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace geo {
+
+/**
+ * Stable identifier of an element stored in a tree. It stays valid when the element is moved
+ * between nodes (e.g. by splits or relocations) and becomes invalid when the element is erased.
+ * Slots of erased elements are reused, but with a different generation, so old handles never
+ * resolve to new elements.
+ */
+struct ElementHandle
+{
+    uint32_t slot;
+    uint32_t generation;
+
+    bool operator==(const ElementHandle& rhs) const
+    {
+        return slot == rhs.slot && generation == rhs.generation;
+    }
+
+    bool operator!=(const ElementHandle& rhs) const
+    {
+        return !(*this == rhs);
+    }
+};
+
+/**
+ * Maps slots (indices stored next to elements in nodes) to the current positions of elements,
+ * i.e. nodes and indices within them. Free slots form a list threaded through their index fields.
+ */
+template <typename Node, typename Allocator>
+class SlotMap
+{
+public:
+    struct Slot
+    {
+        Node* node;
+        uint32_t index;
+        uint32_t generation;
+    };
+
+    static const uint32_t noSlot = UINT32_MAX;
+
+private:
+    typedef typename std::allocator_traits<Allocator>::template rebind_alloc<Slot> SlotAllocator;
+
+public:
+    explicit SlotMap(const Allocator& alloc) : slots((SlotAllocator(alloc))), freeHead(noSlot) {}
+
+    /**
+     * @return New slot pointing to a given position.
+     */
+    uint32_t acquire(Node* node, size_t index)
+    {
+        uint32_t slot = freeHead;
+        if (slot == noSlot)
+        {
+            Slot fresh = { nullptr, 0, 0 };
+            slot = static_cast<uint32_t>(slots.size());
+            slots.push_back(fresh);
+        }
+        else
+        {
+            freeHead = slots[slot].index;
+        }
+        update(slot, node, index);
+        return slot;
+    }
+
+    /**
+     * Frees a slot, invalidating all its handles.
+     */
+    void release(uint32_t slot)
+    {
+        slots[slot].node = nullptr;
+        slots[slot].index = freeHead;
+        ++slots[slot].generation;
+        freeHead = slot;
+    }
+
+    /**
+     * Frees all used slots.
+     */
+    void releaseAll()
+    {
+        for (size_t i = 0; i < slots.size(); ++i)
+        {
+            if (slots[i].node != nullptr)
+                release(static_cast<uint32_t>(i));
+        }
+    }
+
+    void update(uint32_t slot, Node* node, size_t index)
+    {
+        slots[slot].node = node;
+        slots[slot].index = static_cast<uint32_t>(index);
+    }
+
+    ElementHandle handle(uint32_t slot) const
+    {
+        ElementHandle result = { slot, slots[slot].generation };
+        return result;
+    }
+
+    /**
+     * @return Slot of a given handle or nullptr when the handle is invalid (e.g. its element was
+     *         erased).
+     */
+    const Slot* find(const ElementHandle& handle) const
+    {
+        if (handle.slot >= slots.size())
+            return nullptr;
+        const Slot& slot = slots[handle.slot];
+        if (slot.node == nullptr || slot.generation != handle.generation)
+            return nullptr;
+        return &slot;
+    }
+
+private:
+    std::vector<Slot, SlotAllocator> slots;
+    uint32_t freeHead;
+};
+
+template <typename Node, typename Allocator>
+const uint32_t SlotMap<Node, Allocator>::noSlot;
+
+} // namespace geo
+
+#endif
@@ -0,0 +1,170 @@
+#ifndef GEO_TREEIMAGE_HPP_
+#define GEO_TREEIMAGE_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <stdexcept>
+
+namespace geo {
+
+/**
+ * Binary image of a tree, written by QuadTree::save() and read by MappedQuadTree. It contains no
+ * pointers, only offsets from its beginning, so it might be mapped into memory at any address and
+ * queried in place.
+ *
+ * Layout (all sections start at multiples of 8 bytes, or of the element alignment when it's
+ * bigger):
+ * - Header,
+ * - leaves: non-empty leaves in the Z-order, followed by a sentinel whose first == elementCount,
+ * - codes: location codes (Morton keys) of all elements,
+ * - objects: elements themselves, copied byte by byte,
+ * - xs and ys: original coordinates of elements (only when the tree stores them).
+ *
+ * Elements of each leaf occupy [leaf.first, next leaf.first) of every element section. Numbers are
+ * stored in the native byte order; the header records it, so images written on machines with a
+ * different one are rejected.
+ */
+namespace image {
+
+static const char magic[8] = { 'G', 'E', 'O', 'Q', 'T', 'R', 'E', 'E' };
+static const uint32_t version = 1;
+static const uint32_t byteOrder = 0x01020304;
+
+struct Header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t maxLevels;
+    uint32_t keySize;
+    uint32_t elementSize;
+    uint32_t elementAlignment;
+    uint32_t coordinates;
+    uint32_t reserved;
+    uint64_t width;
+    int64_t startX;
+    int64_t startY;
+    uint64_t capacity;
+    uint64_t leafCount;
+    uint64_t elementCount;
+    uint64_t leaves;
+    uint64_t codes;
+    uint64_t objects;
+    uint64_t xs;
+    uint64_t ys;
+    uint64_t size;
+};
+
+struct Leaf
+{
+    uint64_t key;
+    uint32_t level;
+    uint32_t reserved;
+    uint64_t first;
+};
+
+/**
+ * Sizes are computed from counts which might be read from a corrupted image, so they're checked
+ * for wrapping around instead of silently giving small offsets.
+ *
+ * @return Whether the result fits in 64 bits.
+ */
+inline bool add(uint64_t a, uint64_t b, uint64_t& sum)
+{
+    sum = a + b;
+    return sum >= a;
+}
+
+inline bool multiply(uint64_t a, uint64_t b, uint64_t& product)
+{
+    product = a * b;
+    return a == 0 || product / a == b;
+}
+
+inline bool alignUp(uint64_t offset, uint64_t alignment, uint64_t& aligned)
+{
+    if (!add(offset, alignment - 1, aligned))
+        return false;
+    aligned = aligned / alignment * alignment;
+    return true;
+}
+
+/**
+ * Appends a section of given number of items to an image which ends at a given offset.
+ *
+ * @return Whether the end of the section fits in 64 bits. @see add()
+ */
+inline bool append(uint64_t& end, uint64_t count, uint64_t itemSize)
+{
+    uint64_t bytes;
+    return multiply(count, itemSize, bytes) && add(end, bytes, end);
+}
+
+/**
+ * Fills offsets of all sections and the total size of a header whose counts and sizes are set.
+ * Element alignment must be non-zero.
+ *
+ * @return Whether offsets fit in 64 bits, i.e. whether counts and sizes might be valid at all.
+ */
+inline bool layOut(Header& header)
+{
+    uint64_t objectAlignment = header.elementAlignment > 8 ? header.elementAlignment : 8;
+    uint64_t leafSlots;
+    uint64_t end;
+    if (!alignUp(sizeof(Header), 8, header.leaves) || !add(header.leafCount, 1, leafSlots))
+        return false;
+    end = header.leaves;
+    if (!append(end, leafSlots, sizeof(Leaf)))
+        return false;
+    header.codes = end;
+    if (!append(end, header.elementCount, header.keySize) ||
+        !alignUp(end, objectAlignment, header.objects))
+        return false;
+    end = header.objects;
+    if (!append(end, header.elementCount, header.elementSize) || !alignUp(end, 8, header.xs))
+        return false;
+    header.ys = header.xs;
+    header.size = header.xs;
+    if (header.coordinates != 0)
+    {
+        end = header.xs;
+        if (!append(end, header.elementCount, sizeof(double)))
+            return false;
+        header.ys = end;
+        if (!append(end, header.elementCount, sizeof(double)))
+            return false;
+        header.size = end;
+    }
+    return true;
+}
+
+/**
+ * Writes raw bytes to a stream, throwing when it fails.
+ */
+inline void write(std::ostream& out, const void* data, uint64_t size)
+{
+    out.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+    if (!out)
+        throw std::runtime_error("cannot write tree image");
+}
+
+/**
+ * Writes zeros up to a given offset of the image. @see write()
+ */
+inline void pad(std::ostream& out, uint64_t& written, uint64_t offset)
+{
+    static const char zeros[64] = {};
+    while (written < offset)
+    {
+        uint64_t chunk = offset - written < sizeof(zeros) ? offset - written : sizeof(zeros);
+        write(out, zeros, chunk);
+        written += chunk;
+    }
+}
+
+} // namespace image
+} // namespace geo
+
+#endif
@@ -10,8 +10,14 @@
 
 namespace geo {
 
-template <typename ObjectType, size_t totalLevels> class QuadNode;
-
+template <typename ObjectType, size_t totalLevels, typename Allocator, bool withCoordinates>
+class QuadNode;
+
+/**
+ * Bidirectional iterator over elements of tree nodes. When TreeNode is a const type, it's a
+ * constant iterator: it gives read-only access to elements and never modifies nodes, so many
+ * threads might iterate over the same tree at once (as long as no one modifies it).
+ */
 template <typename TreeNode>
 class TreeNodeIterator : public std::iterator<std::bidirectional_iterator_tag, TreeNode >
 {
@@ -25,11 +31,22 @@ public:
     typedef typename IteratorType::difference_type difference_type;
     typedef typename IteratorType::reference reference;
     typedef typename IteratorType::pointer pointer;
+    typedef typename std::conditional<std::is_const<TreeNode>::value,
+                                      const typename TreeNode::ElementType,
+                                      typename TreeNode::ElementType>::type ElementType;
 
 public:
     TreeNodeIterator() : node(nullptr), pos(0) {}
     TreeNodeIterator(TreeNode* node, size_t pos) : node(node), pos(pos) {}
     TreeNodeIterator(const TreeNodeIterator& that) : node(that.node), pos(that.pos) {}
+
+    /**
+     * Converts a mutable iterator to a constant one.
+     */
+    template <typename OtherNode, typename = typename std::enable_if<
+        std::is_same<const OtherNode, TreeNode>::value &&
+        !std::is_same<OtherNode, TreeNode>::value>::type>
+    TreeNodeIterator(const TreeNodeIterator<OtherNode>& that) : node(that.node), pos(that.pos) {}
     ~TreeNodeIterator() {}
 
     TreeNodeIterator& operator=(TreeNodeIterator rhs)
@@ -45,6 +62,22 @@ public:
     }
 #endif
 
+    /**
+     * @return Node which stores the pointed element.
+     */
+    TreeNode* treeNode() const
+    {
+        return node;
+    }
+
+    /**
+     * @return Position of the pointed element in its node.
+     */
+    size_t index() const
+    {
+        return pos;
+    }
+
     operator bool() const
     {
         return (node != nullptr);
@@ -60,12 +93,12 @@ public:
         return !(operator==(rhs));
     }
 
-    typename TreeNode::ElementType& operator*() const
+    ElementType& operator*() const
     {
         return (*node)[pos];
     }
 
-    typename TreeNode::ElementType* operator->() const
+    ElementType* operator->() const
     {
         return &(operator*());
     }
@@ -79,7 +112,11 @@ public:
         }
         while (*node != node->parent() && pos >= node->count())
         {
-            node = &(nextNode(*node));
+            // Non-empty nodes are linked, unless the tree isn't threaded (@see QuadNode::nextLeaf())
+            if (node->nextLeaf() != nullptr)
+                node = node->nextLeaf();
+            else
+                node = &(nextNode(*node));
             pos = 0;
         }
         return *this;
@@ -100,6 +137,15 @@ public:
         {
             --pos;
         }
+        else if (node->previousLeaf() != nullptr)
+        {
+            node = node->previousLeaf();
+            pos = node->count();
+            if (pos > 0)
+                --pos;
+            if (*node == node->parent())
+                node = nullptr;
+        }
         else
         {
             do
@@ -135,6 +181,9 @@ public:
     }
 
 private:
+    template <typename OtherNode>
+    friend class TreeNodeIterator;
+
     TreeNode* node;
     size_t pos;
 
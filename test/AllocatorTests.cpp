@@ -0,0 +1,110 @@
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "QuadTree.hpp"
+
+using namespace testing;
+using namespace geo;
+
+// Minimal allocator which counts bytes that are currently allocated through it.
+template <typename T>
+struct CountingAllocator {
+    typedef T value_type;
+
+    explicit CountingAllocator(size_t* allocated) : allocated(allocated) {}
+
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U>& that) : allocated(that.allocated) {}
+
+    T* allocate(size_t n)
+    {
+        *allocated += n * sizeof(T);
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        *allocated -= n * sizeof(T);
+        ::operator delete(p);
+    }
+
+    size_t* allocated;
+};
+
+template <typename T, typename U>
+bool operator==(const CountingAllocator<T>& lhs, const CountingAllocator<U>& rhs)
+{
+    return lhs.allocated == rhs.allocated;
+}
+
+template <typename T, typename U>
+bool operator!=(const CountingAllocator<T>& lhs, const CountingAllocator<U>& rhs)
+{
+    return !(lhs == rhs);
+}
+
+class AllocatorTests : public Test
+{
+protected:
+    AllocatorTests() : allocated(0) {}
+
+    size_t allocated;
+};
+
+TEST_F(AllocatorTests, TreeAllocatesNodesThroughAllocator)
+{
+    QuadTree<int, 10, CountingAllocator<int> > tree(4, 1, CountingAllocator<int>(&allocated));
+    ASSERT_LT((size_t)0, allocated);
+}
+
+TEST_F(AllocatorTests, TreeAllocatesElementsThroughAllocator)
+{
+    QuadTree<int, 10, CountingAllocator<int> > tree(4, 1, CountingAllocator<int>(&allocated));
+    size_t emptyTree = allocated;
+
+    tree.insert(1, 1, 42);
+    ASSERT_LT(emptyTree, allocated);
+}
+
+TEST_F(AllocatorTests, TreeReleasesAllMemoryThroughAllocator)
+{
+    {
+        QuadTree<int, 10, CountingAllocator<int> > tree(16, 2, CountingAllocator<int>(&allocated));
+        for (int i = 0; i < 100; ++i)
+            tree.insert(i % 16, (i * 7) % 16, i);
+        tree.erase(3, 5);
+    }
+    ASSERT_EQ((size_t)0, allocated);
+}
+
+TEST_F(AllocatorTests, CopiedTreeUsesTheSameAllocator)
+{
+    QuadTree<int, 10, CountingAllocator<int> > tree(4, 1, CountingAllocator<int>(&allocated));
+    tree.insert(1, 1, 42);
+    size_t single = allocated;
+
+    QuadTree<int, 10, CountingAllocator<int> > copy(tree);
+    EXPECT_EQ(2 * single, allocated);
+    ASSERT_EQ(&allocated, copy.get_allocator().allocated);
+}
+
+#if defined(__has_include) && __cplusplus >= 201703L
+#if __has_include(<memory_resource>)
+TEST_F(AllocatorTests, PmrTreeUsesGivenMemoryResource)
+{
+    char buffer[1 << 16];
+    std::pmr::monotonic_buffer_resource resource(buffer, sizeof(buffer),
+                                                 std::pmr::null_memory_resource());
+
+    pmr::QuadTree<int> tree(16, 2, &resource);
+    for (int i = 0; i < 100; ++i)
+        tree.insert(i % 16, (i * 7) % 16, i);
+
+    std::vector<int> result(tree.begin(), tree.end());
+    ASSERT_EQ((size_t)100, result.size());
+}
+#endif
+#endif
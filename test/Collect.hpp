@@ -0,0 +1,22 @@
+#ifndef COLLECT_HPP_
+#define COLLECT_HPP_
+
+#include <vector>
+
+namespace geo {
+namespace helpers {
+
+/**
+ * Visitor which appends visited values to a vector.
+ */
+struct Collect
+{
+    explicit Collect(std::vector<int>* values) : values(values) {}
+    void operator()(int value) { values->push_back(value); }
+    std::vector<int>* values;
+};
+
+} // namespace helpers
+} // namespace geo
+
+#endif
@@ -0,0 +1,215 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "ConcurrentQuadTree.hpp"
+#include "Collect.hpp"
+
+using namespace testing;
+using namespace geo;
+using namespace geo::helpers;
+
+class ConcurrentQuadTreeTests : public Test
+{
+protected:
+    ConcurrentQuadTreeTests() : tree(64, 4) {}
+
+    static std::vector<int> sorted(std::vector<int> values)
+    {
+        std::sort(values.begin(), values.end());
+        return values;
+    }
+
+    ConcurrentQuadTree<int> tree;
+};
+
+TEST_F(ConcurrentQuadTreeTests, ConstructorThrowsWhenFieldIsSmallerThanShards)
+{
+    ASSERT_THROW(ConcurrentQuadTree<int>(2, 4), std::invalid_argument);
+    ASSERT_THROW(ConcurrentQuadTree<int>(48, 4), std::invalid_argument);
+    ASSERT_NO_THROW(ConcurrentQuadTree<int>(4, 4));
+}
+
+TEST_F(ConcurrentQuadTreeTests, ShardsSplitFieldInZOrder)
+{
+    ASSERT_EQ((size_t)16, tree.shardCount());
+    tree.insert(20, 1, 1);  // col 1, row 0
+    tree.insert(1, 20, 2);  // col 0, row 1
+    tree.insert(63, 63, 3); // col 3, row 3
+
+    ASSERT_EQ((size_t)1, tree.shard(2).size());
+    ASSERT_EQ((size_t)1, tree.shard(1).size());
+    ASSERT_EQ((size_t)1, tree.shard(15).size());
+}
+
+TEST_F(ConcurrentQuadTreeTests, PointsOnShardBoundariesGoToUpperShard)
+{
+    tree.insert(16, 16, 1);
+    tree.insert(15.999999, 16, 2);
+
+    ASSERT_EQ((size_t)1, tree.shard(3).size());
+    ASSERT_EQ((size_t)1, tree.shard(1).size());
+}
+
+TEST_F(ConcurrentQuadTreeTests, InsertOutsideOfFieldFails)
+{
+    EXPECT_FALSE(tree.insert(64, 1, 1));
+    EXPECT_FALSE(tree.insert(1, -0.5, 1));
+    EXPECT_FALSE(tree.insert(16, 64, 1));
+    EXPECT_FALSE(tree.insert(-1e-9, 16, 1));
+    EXPECT_FALSE(tree.insert(std::nan(""), 1, 1));
+    EXPECT_FALSE(tree.insert(1, std::numeric_limits<double>::infinity(), 1));
+    ASSERT_TRUE(tree.insert(63.5, 0, 1));
+    ASSERT_EQ((size_t)1, tree.size());
+}
+
+TEST_F(ConcurrentQuadTreeTests, FieldMightBeShifted)
+{
+    ConcurrentQuadTree<int> shifted(64, 32, 100, 4);
+    ASSERT_TRUE(shifted.insert(32, 100, 1));
+    ASSERT_TRUE(shifted.insert(95.5, 163.5, 2));
+    ASSERT_FALSE(shifted.insert(0, 0, 3));
+
+    ASSERT_EQ((size_t)1, shifted.shard(0).size());
+    ASSERT_EQ((size_t)1, shifted.shard(15).size());
+}
+
+TEST_F(ConcurrentQuadTreeTests, IterationOrderIsTheSameAsInQuadTree)
+{
+    ConcurrentQuadTree<int> sharded(64, 1);
+    QuadTree<int> single(64, 1);
+    for (int i = 0; i < 500; ++i)
+    {
+        double x = (i * 37) % 64;
+        double y = (i * 11 + i / 64) % 64;
+        sharded.insert(x, y, i);
+        single.insert(x, y, i);
+    }
+
+    ASSERT_EQ(single.size(), sharded.size());
+    ASSERT_EQ(std::vector<int>(single.begin(), single.end()),
+              std::vector<int>(sharded.begin(), sharded.end()));
+}
+
+TEST_F(ConcurrentQuadTreeTests, IterationSkipsEmptyShards)
+{
+    ASSERT_TRUE(tree.begin() == tree.end());
+    tree.insert(40, 40, 7);
+    ASSERT_EQ(std::vector<int>(1, 7), std::vector<int>(tree.begin(), tree.end()));
+}
+
+TEST_F(ConcurrentQuadTreeTests, EraseRemovesOnlyGivenPoint)
+{
+    tree.insert(10, 10, 1);
+    tree.insert(10, 10, 2);
+    tree.insert(50, 10, 3);
+
+    tree.erase(10, 10);
+    ASSERT_EQ((size_t)1, tree.size());
+    ASSERT_EQ(std::vector<int>(1, 3), std::vector<int>(tree.begin(), tree.end()));
+}
+
+TEST_F(ConcurrentQuadTreeTests, NearVisitsElementsOfOwningShard)
+{
+    tree.insert(10, 10, 1);
+    tree.insert(10.5, 10.5, 2);
+    tree.insert(50, 50, 3);
+
+    std::vector<int> found;
+    tree.near(10, 10, Collect(&found));
+    ASSERT_EQ(sorted(found), (std::vector<int>{1, 2}));
+}
+
+TEST_F(ConcurrentQuadTreeTests, WithinRectCrossesShards)
+{
+    for (int i = 0; i < 64; ++i)
+        tree.insert(i, i, i);
+
+    std::vector<int> found;
+    tree.withinRect(10, 10, 40, 40, Collect(&found));
+
+    std::vector<int> expected;
+    for (int i = 10; i <= 40; ++i)
+        expected.push_back(i);
+    ASSERT_EQ(expected, sorted(found));
+}
+
+TEST_F(ConcurrentQuadTreeTests, BulkLoadGroupsElementsByShards)
+{
+    std::vector<std::tuple<double, double, int> > points;
+    for (int i = 0; i < 100; ++i)
+        points.push_back(std::make_tuple(i % 64, (i * 7) % 64, i));
+    points.push_back(std::make_tuple(100.0, 1.0, -1));
+
+    ASSERT_EQ((size_t)100, tree.bulkLoad(points.begin(), points.end()));
+    ASSERT_EQ((size_t)100, tree.size());
+
+    std::vector<int> all;
+    tree.forEach(Collect(&all));
+    ASSERT_EQ((size_t)100, all.size());
+    ASSERT_EQ(0, sorted(all).front());
+    ASSERT_EQ(99, sorted(all).back());
+}
+
+TEST_F(ConcurrentQuadTreeTests, ClearRemovesAllElements)
+{
+    tree.insert(1, 1, 1);
+    tree.insert(60, 60, 2);
+    tree.clear();
+
+    ASSERT_EQ((size_t)0, tree.size());
+    ASSERT_TRUE(tree.begin() == tree.end());
+}
+
+TEST_F(ConcurrentQuadTreeTests, ThreadsMightInsertAndEraseConcurrently)
+{
+    const int threads = 4;
+    const int perThread = 2000;
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t)
+    {
+        workers.push_back(std::thread([this, t, perThread]() {
+            for (int i = 0; i < perThread; ++i)
+            {
+                double x = (i * 13 + t) % 64 + 0.25 * t;
+                double y = (i * 29) % 64;
+                tree.insert(x, y, t * perThread + i);
+                if (i % 10 == 0)
+                    tree.size();
+            }
+        }));
+    }
+    for (size_t t = 0; t < workers.size(); ++t)
+        workers[t].join();
+
+    ASSERT_EQ((size_t)(threads * perThread), tree.size());
+    std::vector<int> all(tree.begin(), tree.end());
+    all = sorted(all);
+    for (int i = 0; i < threads * perThread; ++i)
+        ASSERT_EQ(i, all[i]);
+
+    workers.clear();
+    for (int t = 0; t < threads; ++t)
+    {
+        workers.push_back(std::thread([this, t]() {
+            for (int x = t * 16; x < (t + 1) * 16; ++x)
+            {
+                for (int y = 0; y < 64; ++y)
+                    tree.erase(x + 0.25 * t, y);
+            }
+        }));
+    }
+    for (size_t t = 0; t < workers.size(); ++t)
+        workers[t].join();
+
+    size_t remaining = 0;
+    tree.forEach([&remaining](int) { ++remaining; });
+    ASSERT_EQ(tree.size(), remaining);
+    ASSERT_LT(remaining, (size_t)(threads * perThread));
+}
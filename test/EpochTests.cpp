@@ -0,0 +1,84 @@
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+
+#include "internal/Epoch.hpp"
+
+using namespace testing;
+using namespace geo;
+
+class EpochTests : public Test
+{
+protected:
+    EpochTests() : domain(2) {}
+
+    static uint64_t noReaders()
+    {
+        return std::numeric_limits<uint64_t>::max();
+    }
+
+    EpochDomain domain;
+};
+
+TEST_F(EpochTests, DomainWithoutSlotsIsRejected)
+{
+    ASSERT_THROW(EpochDomain(0), std::invalid_argument);
+}
+
+TEST_F(EpochTests, NothingIsPinnedWithoutReaders)
+{
+    ASSERT_EQ(noReaders(), domain.oldestPinned());
+}
+
+TEST_F(EpochTests, AdvanceStartsANewEpoch)
+{
+    uint64_t epoch = domain.epoch();
+    EXPECT_EQ(epoch + 1, domain.advance());
+    ASSERT_EQ(epoch + 1, domain.epoch());
+}
+
+TEST_F(EpochTests, OldestPinnedIsTheMinimumOfReaders)
+{
+    uint64_t first = domain.epoch();
+    size_t firstSlot = domain.pin();
+    domain.advance();
+    size_t secondSlot = domain.pin();
+    EXPECT_NE(firstSlot, secondSlot);
+    EXPECT_EQ(first, domain.oldestPinned());
+
+    domain.unpin(firstSlot);
+    EXPECT_EQ(first + 1, domain.oldestPinned());
+    domain.unpin(secondSlot);
+    ASSERT_EQ(noReaders(), domain.oldestPinned());
+}
+
+TEST_F(EpochTests, GuardPinsEpochForItsLifetime)
+{
+    {
+        EpochGuard guard(domain);
+        EpochGuard moved(std::move(guard));
+        EXPECT_EQ(domain.epoch(), domain.oldestPinned());
+    }
+    ASSERT_EQ(noReaders(), domain.oldestPinned());
+}
+
+TEST_F(EpochTests, ReaderWaitsForAFreeSlot)
+{
+    size_t first = domain.pin();
+    size_t second = domain.pin();
+    std::atomic<bool> pinned(false);
+    std::thread reader([&]() {
+        EpochGuard guard(domain);
+        pinned = true;
+    });
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_FALSE(pinned);
+    domain.unpin(first);
+    reader.join();
+    EXPECT_TRUE(pinned);
+    domain.unpin(second);
+}
@@ -0,0 +1,285 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "QuadTree.hpp"
+#include "Ingest.hpp"
+
+using namespace testing;
+using namespace geo;
+
+class IngestTests : public Test
+{
+protected:
+    // Points are scattered over the whole field, a few of them are outside of it.
+    IngestTests() : expected(64, 4)
+    {
+        std::ostringstream text;
+        for (int i = 0; i < 2000; ++i)
+        {
+            double x = (i * 37) % 131 * 0.5;
+            double y = (i * 91) % 127 * 0.5;
+            text << x << ',' << y << ',' << i << '\n';
+            expected.insert(x, y, i);
+            points.push_back(std::make_tuple(x, y, i));
+        }
+        csv = text.str();
+    }
+
+    static std::vector<int> sorted(const QuadTree<int>& tree)
+    {
+        std::vector<int> result(tree.begin(), tree.end());
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+    static IngestOptions options(size_t chunkSize, unsigned threads, size_t chunksInFlight = 0)
+    {
+        IngestOptions result;
+        result.chunkSize = chunkSize;
+        result.threads = threads;
+        result.chunksInFlight = chunksInFlight;
+        return result;
+    }
+
+    std::string binary() const
+    {
+        std::string result;
+        for (size_t i = 0; i < points.size(); ++i)
+        {
+            char record[BinaryFormat<int>::recordSize];
+            double x = std::get<0>(points[i]);
+            double y = std::get<1>(points[i]);
+            std::memcpy(record, &x, sizeof(double));
+            std::memcpy(record + sizeof(double), &y, sizeof(double));
+            std::memcpy(record + 2 * sizeof(double), &std::get<2>(points[i]), sizeof(int));
+            result.append(record, sizeof(record));
+        }
+        return result;
+    }
+
+    struct Throwing
+    {
+        bool operator()(const char* first, const char*, int& value) const
+        {
+            if (std::strncmp(first, "throw", 5) == 0)
+                throw std::runtime_error("cannot parse");
+            value = std::atoi(first);
+            return true;
+        }
+    };
+
+    QuadTree<int> expected;
+    std::vector<std::tuple<double, double, int> > points;
+    std::string csv;
+};
+
+TEST_F(IngestTests, CsvGivesTheSameElementsAsInserts)
+{
+    std::istringstream in(csv);
+    QuadTree<int> tree(64, 4);
+    IngestProgress progress;
+
+    size_t inserted = ingest(in, tree, CsvFormat<int>(), options(100, 4), &progress);
+
+    ASSERT_EQ(expected.size(), inserted);
+    EXPECT_EQ(sorted(expected), sorted(tree));
+    EXPECT_EQ(csv.size(), progress.bytes.load());
+    EXPECT_EQ(points.size(), progress.records.load());
+    EXPECT_EQ(inserted, progress.inserted.load());
+    EXPECT_EQ(0u, progress.rejected.load());
+    EXPECT_EQ(expected.countInRect(3, 7, 41, 29), tree.countInRect(3, 7, 41, 29));
+}
+
+TEST_F(IngestTests, ResultDoesNotDependOnThreads)
+{
+    std::vector<int> orders[4];
+    IngestOptions variants[4] = { options(64, 1), options(64, 2), options(64, 8, 1),
+                                  options(64, 3, 50) };
+    for (int i = 0; i < 4; ++i)
+    {
+        std::istringstream in(csv);
+        QuadTree<int> tree(64, 4);
+        ASSERT_EQ(expected.size(), ingest(in, tree, CsvFormat<int>(), variants[i]));
+        orders[i].assign(tree.begin(), tree.end());
+    }
+
+    EXPECT_EQ(orders[0], orders[1]);
+    EXPECT_EQ(orders[0], orders[2]);
+    ASSERT_EQ(orders[0], orders[3]);
+}
+
+TEST_F(IngestTests, MalformedLinesAreRejected)
+{
+    std::istringstream in("x,y,id\r\n1,2,3\r\n\r\n4;5;6\n7,8\n9,10,eleven\n12 , 13 ,14\n"
+                          "nan,1,15\n100,1,16\n16,17,18");
+    QuadTree<int> tree(64, 4);
+    IngestProgress progress;
+
+    ASSERT_EQ(3u, ingest(in, tree, CsvFormat<int>(), options(8, 2), &progress));
+    EXPECT_EQ(4u, progress.records.load());
+    EXPECT_EQ(5u, progress.rejected.load());
+    std::vector<int> values = sorted(tree);
+    ASSERT_EQ(3u, values.size());
+    EXPECT_EQ(3, values[0]);
+    EXPECT_EQ(14, values[1]);
+    ASSERT_EQ(18, values[2]);
+}
+
+TEST_F(IngestTests, CsvValuesMightBeStrings)
+{
+    std::istringstream in("1.5;2.5;first\n10;20;second, with a comma\n");
+    QuadTree<std::string> tree(64, 4);
+
+    ASSERT_EQ(2u, ingest(in, tree, CsvFormat<std::string>(';')));
+    std::vector<std::string> values(tree.begin(), tree.end());
+    std::sort(values.begin(), values.end());
+    ASSERT_EQ(2u, values.size());
+    EXPECT_EQ("first", values[0]);
+    ASSERT_EQ("second, with a comma", values[1]);
+}
+
+TEST_F(IngestTests, BinaryRecordsAreReadAcrossChunks)
+{
+    std::string data = binary();
+    data.append("tail");
+    std::istringstream in(data);
+    QuadTree<int> tree(64, 4);
+    IngestProgress progress;
+
+    ASSERT_EQ(expected.size(), ingest(in, tree, BinaryFormat<int>(), options(50, 3), &progress));
+    EXPECT_EQ(sorted(expected), sorted(tree));
+    EXPECT_EQ(points.size(), progress.records.load());
+    ASSERT_EQ(1u, progress.rejected.load());
+}
+
+TEST_F(IngestTests, IngestAddsToNonEmptyTree)
+{
+    std::istringstream in(binary());
+    QuadTree<int> tree(64, 4);
+    tree.insert(1, 1, -1);
+
+    ASSERT_EQ(expected.size(), ingest(in, tree, BinaryFormat<int>(), options(1000, 2)));
+    expected.insert(1, 1, -1);
+    ASSERT_EQ(sorted(expected), sorted(tree));
+}
+
+TEST_F(IngestTests, ExceptionsAreRethrown)
+{
+    std::string text = csv + "1,1,throw\n" + csv;
+    std::istringstream in(text);
+    QuadTree<int> tree(64, 4);
+
+    EXPECT_THROW(ingest(in, tree, CsvFormat<int, Throwing>(), options(100, 4)),
+                 std::runtime_error);
+    EXPECT_LE(tree.size(), 2 * expected.size());
+    ASSERT_THROW(ingest(in, tree, CsvFormat<int>(), options(0, 1)), std::invalid_argument);
+}
+
+namespace {
+
+/**
+ * Element which is slow to move on the thread which inserts batches into the tree.
+ */
+struct Slow
+{
+    static std::thread::id consumer;
+
+    explicit Slow(int value = 0) : value(value) {}
+    Slow(const Slow&) = default;
+    Slow& operator=(const Slow&) = default;
+
+    Slow(Slow&& other) : value(other.value)
+    {
+        if (std::this_thread::get_id() == consumer)
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+
+    int value;
+};
+
+std::thread::id Slow::consumer;
+
+/**
+ * Binary format of Slow elements which checks, whenever a chunk is parsed, how many chunks were
+ * read but not inserted into the tree yet. All records must be inside of the tree range, so that
+ * each full chunk of recordsPerChunk records is inserted whole.
+ */
+class InFlightFormat
+{
+public:
+    typedef Slow element_type;
+
+    InFlightFormat(const IngestProgress& progress, size_t recordsPerChunk)
+        : progress(progress), recordsPerChunk(recordsPerChunk), parsed(0), mostInFlight(0) {}
+
+    size_t split(const char* first, size_t size) const
+    {
+        return binary.split(first, size);
+    }
+
+    template <typename Batch>
+    size_t parse(const char* first, const char* last, Batch& batch) const
+    {
+        size_t chunks = ++parsed;
+        size_t inserted = static_cast<size_t>(progress.inserted) / recordsPerChunk;
+        size_t inFlight = chunks - std::min(chunks, inserted);
+        size_t most = mostInFlight;
+        while (inFlight > most && !mostInFlight.compare_exchange_weak(most, inFlight)) {}
+
+        std::vector<std::tuple<double, double, int> > records;
+        size_t rejected = binary.parse(first, last, records);
+        for (size_t i = 0; i < records.size(); ++i)
+        {
+            batch.push_back(std::make_tuple(std::get<0>(records[i]), std::get<1>(records[i]),
+                                            Slow(std::get<2>(records[i]))));
+        }
+        return rejected;
+    }
+
+    size_t most() const
+    {
+        return mostInFlight;
+    }
+
+private:
+    BinaryFormat<int> binary;
+    const IngestProgress& progress;
+    size_t recordsPerChunk;
+    mutable std::atomic<size_t> parsed;
+    mutable std::atomic<size_t> mostInFlight;
+};
+
+} // namespace
+
+TEST_F(IngestTests, SlowTreeLimitsChunksInFlight)
+{
+    points.erase(std::remove_if(points.begin(), points.end(),
+                                [](const std::tuple<double, double, int>& point) {
+                                    return std::get<0>(point) >= 64 || std::get<1>(point) >= 64;
+                                }),
+                 points.end());
+    std::istringstream in(binary());
+    QuadTree<Slow> tree(64, 4);
+    IngestProgress progress;
+    const size_t recordsPerChunk = 50;
+    InFlightFormat format(progress, recordsPerChunk);
+    Slow::consumer = std::this_thread::get_id();
+
+    size_t inserted = ingest(in, tree, format,
+                             options(recordsPerChunk * BinaryFormat<int>::recordSize, 4, 3),
+                             &progress);
+    Slow::consumer = std::thread::id();
+
+    EXPECT_EQ(points.size(), inserted);
+    EXPECT_EQ(points.size(), tree.size());
+    EXPECT_LE(format.most(), 3u);
+}
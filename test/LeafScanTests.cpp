@@ -0,0 +1,155 @@
+#include "gtest/gtest.h"
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "internal/LeafScan.hpp"
+
+using namespace testing;
+using namespace geo;
+
+class LeafScanTests : public Test
+{
+protected:
+    LeafScanTests()
+    {
+        morton::Quantizer q = { 0, 0, 1, 63 };
+        for (int i = 0; i < 1003; ++i)
+        {
+            xs.push_back(std::fmod(i * 7.31, 64.0));
+            ys.push_back(std::fmod(i * 13.17 + 0.03, 64.0));
+        }
+        xs.push_back(std::numeric_limits<double>::quiet_NaN());
+        ys.push_back(1);
+
+        codes32.resize(xs.size());
+        codes64.resize(xs.size());
+        morton::batch::scalar::encode(&xs[0], &ys[0], xs.size(), q, &codes32[0]);
+        morton::batch::scalar::encode(&xs[0], &ys[0], xs.size(), q, &codes64[0]);
+    }
+
+    static bool isSet(const std::vector<uint64_t>& mask, size_t i)
+    {
+        return (mask[i / 64] >> (i % 64)) & 1;
+    }
+
+    // Masks are filled with garbage to check that kernels overwrite them.
+    std::vector<uint64_t> newMask() const
+    {
+        return std::vector<uint64_t>(scan::maskWords(xs.size()), ~uint64_t(0));
+    }
+
+    std::vector<double> xs;
+    std::vector<double> ys;
+    std::vector<uint32_t> codes32;
+    std::vector<uint64_t> codes64;
+};
+
+TEST_F(LeafScanTests, ScalarCellsInRectMatchesDecodedCells)
+{
+    scan::CellRange range = { 10, 20, 30, 40 };
+    std::vector<uint64_t> mask = newMask();
+    scan::scalar::cellsInRect(&codes64[0], codes64.size(), range, &mask[0]);
+
+    for (size_t i = 0; i < codes64.size(); ++i)
+    {
+        uint32_t x = morton::Codec<uint64_t>::x(codes64[i]);
+        uint32_t y = morton::Codec<uint64_t>::y(codes64[i]);
+        ASSERT_EQ(x >= 10 && x <= 30 && y >= 20 && y <= 40, isSet(mask, i));
+    }
+}
+
+TEST_F(LeafScanTests, ScalarCellsInCircleMeasuresDistanceToCells)
+{
+    uint32_t codes[] = { morton::Codec<uint32_t>::interleave(5, 5),
+                         morton::Codec<uint32_t>::interleave(7, 5),
+                         morton::Codec<uint32_t>::interleave(8, 5),
+                         morton::Codec<uint32_t>::interleave(7, 7) };
+    uint64_t mask;
+    // Center inside cell (5, 5); cell (7, 5) is 1.5 away, (7, 7) is sqrt(4.5) away.
+    scan::scalar::cellsInCircle(codes, 4, 5.5, 5.5, 2.25, &mask);
+    ASSERT_EQ(uint64_t(0x3), mask);
+}
+
+TEST_F(LeafScanTests, SupportedKernelsMatchScalarOne)
+{
+    scan::CellRange ranges[] = { { 10, 20, 30, 40 }, { -1, -1, 64, 64 }, { 5, 5, 5, 5 },
+                                 { 40, 40, 30, 50 } };
+    double circles[][3] = { { 32, 32, 100 }, { 0, 0, 25 }, { 10.5, 60.2, 0.3 }, { 1, 1, 0 } };
+    morton::batch::Kernel best = morton::batch::bestKernel();
+    for (int k = morton::batch::SCALAR; k <= best; ++k)
+    {
+        morton::batch::Kernel kernel = morton::batch::Kernel(k);
+        // Odd counts exercise tails of SIMD loops.
+        for (size_t count = xs.size() - 9; count <= xs.size(); ++count)
+        {
+            for (size_t r = 0; r < 4; ++r)
+            {
+                std::vector<uint64_t> expected = newMask();
+                std::vector<uint64_t> mask = newMask();
+                scan::scalar::cellsInRect(&codes32[0], count, ranges[r], &expected[0]);
+                scan::cellsInRect(kernel, &codes32[0], count, ranges[r], &mask[0]);
+                ASSERT_EQ(expected, mask);
+
+                mask = newMask();
+                scan::cellsInRect(kernel, &codes64[0], count, ranges[r], &mask[0]);
+                ASSERT_EQ(expected, mask);
+
+                const scan::CellRange& p = ranges[r];
+                scan::scalar::pointsInRect(&xs[0], &ys[0], count, p.minX + 0.5, p.minY, p.maxX,
+                                           p.maxY + 0.25, &expected[0]);
+                scan::pointsInRect(kernel, &xs[0], &ys[0], count, p.minX + 0.5, p.minY, p.maxX,
+                                   p.maxY + 0.25, &mask[0]);
+                ASSERT_EQ(expected, mask);
+            }
+            for (size_t c = 0; c < 4; ++c)
+            {
+                const double* circle = circles[c];
+                std::vector<uint64_t> expected = newMask();
+                std::vector<uint64_t> mask = newMask();
+                scan::scalar::cellsInCircle(&codes32[0], count, circle[0], circle[1], circle[2],
+                                            &expected[0]);
+                scan::cellsInCircle(kernel, &codes32[0], count, circle[0], circle[1], circle[2],
+                                    &mask[0]);
+                ASSERT_EQ(expected, mask);
+
+                mask = newMask();
+                scan::cellsInCircle(kernel, &codes64[0], count, circle[0], circle[1], circle[2],
+                                    &mask[0]);
+                ASSERT_EQ(expected, mask);
+
+                scan::scalar::pointsInCircle(&xs[0], &ys[0], count, circle[0], circle[1],
+                                             circle[2], &expected[0]);
+                scan::pointsInCircle(kernel, &xs[0], &ys[0], count, circle[0], circle[1],
+                                     circle[2], &mask[0]);
+                ASSERT_EQ(expected, mask);
+            }
+        }
+    }
+}
+
+TEST_F(LeafScanTests, PointsWithNaNNeverMatch)
+{
+    morton::batch::Kernel best = morton::batch::bestKernel();
+    for (int k = morton::batch::SCALAR; k <= best; ++k)
+    {
+        std::vector<uint64_t> mask = newMask();
+        scan::pointsInRect(morton::batch::Kernel(k), &xs[0], &ys[0], xs.size(), -1000, -1000,
+                           1000, 1000, &mask[0]);
+        EXPECT_TRUE(isSet(mask, xs.size() - 2));
+        EXPECT_FALSE(isSet(mask, xs.size() - 1));
+    }
+}
+
+TEST_F(LeafScanTests, BitHelpers)
+{
+    EXPECT_EQ(0u, scan::lowestBit(1));
+    EXPECT_EQ(63u, scan::lowestBit(uint64_t(1) << 63));
+    EXPECT_EQ(4u, scan::lowestBit(0x30));
+    EXPECT_EQ(0u, scan::bitCount(0));
+    EXPECT_EQ(64u, scan::bitCount(~uint64_t(0)));
+    EXPECT_EQ(0u, scan::maskWords(0));
+    EXPECT_EQ(1u, scan::maskWords(64));
+    ASSERT_EQ(2u, scan::maskWords(65));
+}
@@ -0,0 +1,131 @@
+#include "gtest/gtest.h"
+
+#include <memory>
+#include <stdexcept>
+
+#include "internal/LeafStorage.hpp"
+
+using namespace testing;
+using namespace geo;
+
+class LeafStorageTests : public Test
+{
+protected:
+    typedef LeafStorage<int, 10, std::allocator<int>, true> Storage;
+
+    LeafStorageTests() : storage(std::allocator<int>())
+    {
+        for (int i = 0; i < 6; ++i)
+            storage.push_back(Storage::StoredObject(code(i % 3), Coordinates(i, -i), i));
+    }
+
+    static LocationCode<10> code(uint32_t x)
+    {
+        return LocationCode<10>(Coordinates(x, 1));
+    }
+
+    Storage storage;
+};
+
+TEST_F(LeafStorageTests, ArraysAreParallel)
+{
+    ASSERT_EQ(6u, storage.size());
+    for (size_t i = 0; i < storage.size(); ++i)
+    {
+        EXPECT_EQ(static_cast<int>(i), storage[i]);
+        EXPECT_EQ(code(i % 3), storage.location(i));
+        EXPECT_EQ(code(i % 3).key, storage.codes()[i]);
+        EXPECT_EQ(static_cast<double>(i), storage.coordinates().x()[i]);
+        EXPECT_EQ(-static_cast<double>(i), storage.coordinates().y()[i]);
+    }
+}
+
+TEST_F(LeafStorageTests, EraseCodeKeepsOrderOfRemainingElements)
+{
+    ASSERT_EQ(2u, storage.erase(code(1)));
+    ASSERT_EQ(4u, storage.size());
+
+    int expected[] = { 0, 2, 3, 5 };
+    for (size_t i = 0; i < 4; ++i)
+    {
+        EXPECT_EQ(expected[i], storage[i]);
+        EXPECT_EQ(code(expected[i] % 3), storage.location(i));
+        EXPECT_EQ(static_cast<double>(expected[i]), storage.coordinates().coordinates(i).x());
+    }
+}
+
+TEST_F(LeafStorageTests, MoveToAppendsElement)
+{
+    Storage other((std::allocator<int>()));
+    storage.moveTo(4, other);
+
+    ASSERT_EQ(1u, other.size());
+    EXPECT_EQ(4, other[0]);
+    EXPECT_EQ(code(1), other.location(0));
+    EXPECT_EQ(4.0, other.coordinates().x()[0]);
+    ASSERT_EQ(-4.0, other.coordinates().y()[0]);
+}
+
+TEST_F(LeafStorageTests, EraseRange)
+{
+    storage.erase(1, 5);
+    ASSERT_EQ(2u, storage.size());
+    EXPECT_EQ(0, storage[0]);
+    EXPECT_EQ(5, storage[1]);
+    ASSERT_EQ(5.0, storage.coordinates().x()[1]);
+}
+
+// Copies and moves of Fragile throw when it's requested.
+struct Fragile
+{
+    explicit Fragile(int value) : value(value) {}
+    Fragile(const Fragile& that) : value(that.value)
+    {
+        if (failing)
+            throw std::runtime_error("copy failed");
+    }
+    Fragile(Fragile&& that) : Fragile(static_cast<const Fragile&>(that)) {}
+    Fragile& operator=(const Fragile&) = default;
+
+    int value;
+    static bool failing;
+};
+
+bool Fragile::failing = false;
+
+TEST_F(LeafStorageTests, ArraysStayParallelWhenElementThrows)
+{
+    typedef LeafStorage<Fragile, 10, std::allocator<Fragile>, true> FragileStorage;
+    FragileStorage first((std::allocator<Fragile>()));
+    FragileStorage second((std::allocator<Fragile>()));
+    for (int i = 0; i < 5; ++i)
+    {
+        first.push_back(FragileStorage::StoredObject(code(i), Coordinates(i, i), Fragile(i)));
+        first.setSlot(static_cast<size_t>(i), static_cast<uint32_t>(i));
+    }
+
+    // Some of the failures happen when arrays are full, so all of them would have to grow.
+    FragileStorage::StoredObject extra(code(1), Coordinates(1, 1), Fragile(1));
+    Fragile::failing = true;
+    for (int i = 0; i < 9; ++i)
+    {
+        EXPECT_THROW(first.copyTo(0, second), std::runtime_error);
+        EXPECT_THROW(first.push_back(std::move(extra)), std::runtime_error);
+        Fragile::failing = false;
+        first.copyTo(static_cast<size_t>(i % 5), second);
+        Fragile::failing = true;
+    }
+    Fragile::failing = false;
+
+    ASSERT_EQ(5u, first.size());
+    ASSERT_TRUE(first.hasSlots());
+    ASSERT_EQ(9u, second.size());
+    ASSERT_TRUE(second.hasSlots());
+    for (size_t i = 0; i < second.size(); ++i)
+    {
+        EXPECT_EQ(static_cast<int>(i % 5), second[i].value);
+        EXPECT_EQ(code(i % 5).key, second.codes()[i]);
+        EXPECT_EQ(static_cast<double>(i % 5), second.coordinates().y()[i]);
+        EXPECT_EQ(static_cast<uint32_t>(i % 5), second.slot(i));
+    }
+}
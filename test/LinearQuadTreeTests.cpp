@@ -0,0 +1,273 @@
+#include "gtest/gtest.h"
+
+#include "LinearQuadTree.hpp"
+#include "QuadTree.hpp"
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+using namespace testing;
+using namespace geo;
+
+class LinearQuadTreeTests : public Test
+{
+};
+
+TEST_F(LinearQuadTreeTests, InitOkCase)
+{
+    ASSERT_NO_THROW((LinearQuadTree<int>(1)));
+}
+
+TEST_F(LinearQuadTreeTests, InitThrowsExceptionWhenSizeIsNotAPowerOf2)
+{
+    ASSERT_THROW((LinearQuadTree<int>(3)), std::invalid_argument);
+}
+
+TEST_F(LinearQuadTreeTests, InsertValueFromWithinRange)
+{
+    LinearQuadTree<std::string> tree(4, 2, 2);
+    ASSERT_TRUE(tree.insert(2, 2, "fake"));
+    ASSERT_TRUE(tree.insert(5.99, 5.99, "fake"));
+}
+
+TEST_F(LinearQuadTreeTests, InsertValueFromBeyondRange)
+{
+    LinearQuadTree<std::string> tree(4, 2, 2);
+    ASSERT_FALSE(tree.insert(6.001, 6.001, "fake"));
+    ASSERT_FALSE(tree.insert(1.9999, 1.9999, "fake"));
+}
+
+TEST_F(LinearQuadTreeTests, InsertReturnsProperIterator)
+{
+    LinearQuadTree<std::string> tree(4);
+    tree.insert(0, 0, "");
+    LinearQuadTree<std::string>::iterator it = tree.insert(0, 0, "fake");
+
+    ASSERT_EQ((size_t)4, it->size());
+    ASSERT_EQ((size_t)4, (*it).size());
+}
+
+TEST_F(LinearQuadTreeTests, InsertSplitsFullLeaves)
+{
+    LinearQuadTree<int> tree(4, 1);
+    tree.insert(0, 0, 1);
+    EXPECT_EQ((size_t)1, tree.leafCount());
+
+    tree.insert(3, 3, 2);
+    ASSERT_EQ((size_t)4, tree.leafCount());
+}
+
+TEST_F(LinearQuadTreeTests, ClearLeavesNoElementsInATree)
+{
+    LinearQuadTree<std::string> tree(4);
+    EXPECT_TRUE(tree.insert(1, 1, "fake"));
+
+    tree.clear();
+    EXPECT_EQ((size_t)0, tree.size());
+    ASSERT_EQ(tree.end(), tree.begin());
+}
+
+TEST_F(LinearQuadTreeTests, EraseOnlyRemovesMatchingElements)
+{
+    LinearQuadTree<std::string> tree(4);
+    EXPECT_TRUE(tree.insert(1, 1, "fake"));
+    EXPECT_TRUE(tree.insert(2, 1, "fake"));
+    EXPECT_TRUE(tree.insert(1, 1, "fake"));
+    EXPECT_TRUE(tree.insert(1, 3, "fake"));
+    EXPECT_TRUE(tree.insert(1, 1, "fake"));
+
+    tree.erase(1, 1);
+    ASSERT_EQ((size_t)2, tree.size());
+}
+
+TEST_F(LinearQuadTreeTests, EraseRemovesNothingWhenCoordinatesAreOutOfBoundaries)
+{
+    LinearQuadTree<std::string> tree(4);
+    EXPECT_TRUE(tree.insert(3, 3, "fake"));
+
+    tree.erase(10, 8);
+    ASSERT_EQ((size_t)1, tree.size());
+}
+
+TEST_F(LinearQuadTreeTests, BeginIsEqualToEndWhenTreeIsEmpty)
+{
+    LinearQuadTree<std::string> tree(4, 4);
+    ASSERT_EQ(tree.end(), tree.begin());
+}
+
+TEST_F(LinearQuadTreeTests, IteratingThroughAllElements)
+{
+    LinearQuadTree<int> tree(4, 2);
+    tree.insert(0, 0, 10);
+    tree.insert(0, 0, 11);
+    tree.insert(0, 1, 12);
+    tree.insert(0, 3, 13);
+    tree.insert(2, 4, 14);
+
+    int n = 10;
+    LinearQuadTree<int>::iterator it;
+    for (it = tree.begin(); it != tree.end(); ++it)
+    {
+        EXPECT_EQ(n, *it);
+        ++n;
+    }
+    ASSERT_EQ(14, n);
+}
+
+TEST_F(LinearQuadTreeTests, IteratingBackwards)
+{
+    LinearQuadTree<int> tree(4, 1);
+    tree.insert(0, 0, 10);
+    tree.insert(3, 0, 11);
+    tree.insert(3, 3, 12);
+
+    LinearQuadTree<int>::iterator it = tree.end();
+    EXPECT_EQ(12, *(--it));
+    EXPECT_EQ(11, *(--it));
+    EXPECT_EQ(10, *(--it));
+    ASSERT_FALSE(--it);
+}
+
+TEST_F(LinearQuadTreeTests, IterationOrderIsTheSameAsInQuadTree)
+{
+    QuadTree<int> tree(64, 3);
+    LinearQuadTree<int> linear(64, 3);
+    for (int i = 0; i < 200; ++i)
+    {
+        double x = (i * 37) % 64 + 0.5;
+        double y = (i * 11) % 64 + 0.25;
+        tree.insert(x, y, i);
+        linear.insert(x, y, i);
+    }
+
+    std::vector<int> expected(tree.begin(), tree.end());
+    std::vector<int> result(linear.begin(), linear.end());
+    ASSERT_EQ(expected, result);
+}
+
+TEST_F(LinearQuadTreeTests, NearReturnsProperBoundaries)
+{
+    LinearQuadTree<int> tree(4, 2);
+    tree.insert(0, 0, 10);
+    tree.insert(0, 1, 11);
+    std::pair<LinearQuadTree<int>::iterator, LinearQuadTree<int>::iterator> range =
+        tree.near(0.5, 0.5);
+
+    LinearQuadTree<int>::iterator it = range.first;
+    ASSERT_EQ(10, *it);
+    ++it;
+    ASSERT_EQ(11, *it);
+    ++it;
+    ASSERT_EQ(range.second, it);
+}
+
+TEST_F(LinearQuadTreeTests, NearReturnsOnlyElementsFromTheSameLeaf)
+{
+    LinearQuadTree<int> tree(4, 1);
+    tree.insert(0, 0, 10);
+    tree.insert(3, 3, 11);
+    std::pair<LinearQuadTree<int>::iterator, LinearQuadTree<int>::iterator> range =
+        tree.near(3.5, 3.5);
+
+    ASSERT_EQ(11, *range.first);
+    ASSERT_EQ(tree.end(), ++range.first);
+}
+
+TEST_F(LinearQuadTreeTests, NearReturnsEmptyRangeForEmptyLeaf)
+{
+    LinearQuadTree<int> tree(4, 1);
+    tree.insert(0, 0, 10);
+    tree.insert(3, 3, 11);
+    std::pair<LinearQuadTree<int>::iterator, LinearQuadTree<int>::iterator> range =
+        tree.near(3.5, 0.5);
+
+    ASSERT_EQ(range.first, range.second);
+}
+
+TEST_F(LinearQuadTreeTests, NearReturnsEndIteratorsWhenOutOfRange)
+{
+    LinearQuadTree<int> tree(2, 2);
+    std::pair<LinearQuadTree<int>::iterator, LinearQuadTree<int>::iterator> range =
+        tree.near(3, 0);
+    ASSERT_EQ(tree.end(), range.first);
+    ASSERT_EQ(tree.end(), range.second);
+}
+
+TEST_F(LinearQuadTreeTests, EraseMergesLeaves)
+{
+    LinearQuadTree<int> tree(4, 1);
+    tree.insert(0, 0, 10);
+    tree.insert(3, 3, 11);
+    tree.insert(3.5, 3.5, 12);
+    EXPECT_LT((size_t)4, tree.leafCount());
+
+    tree.erase(3.5, 3.5);
+    EXPECT_EQ((size_t)4, tree.leafCount());
+    tree.erase(3, 3);
+    ASSERT_EQ((size_t)1, tree.leafCount());
+    ASSERT_EQ(10, *tree.begin());
+}
+
+TEST_F(LinearQuadTreeTests, LeavesAreTheSameAsInQuadTreeAfterErases)
+{
+    // Enough points for many blocks of leaves, and erases merge leaves across them.
+    QuadTree<int> tree(64, 3);
+    LinearQuadTree<int> linear(64, 3);
+    std::vector<std::pair<double, double> > points;
+    for (int i = 0; i < 3000; ++i)
+    {
+        double x = (i * 37) % 128 * 0.5 + 0.125;
+        double y = (i * 91) % 127 * 0.5 + 0.125;
+        tree.insert(x, y, i);
+        linear.insert(x, y, i);
+        points.push_back(std::make_pair(x, y));
+    }
+    for (size_t i = 0; i < points.size(); i += 3)
+    {
+        tree.erase(points[i].first, points[i].second);
+        linear.erase(points[i].first, points[i].second);
+    }
+
+    std::vector<int> expected(tree.begin(), tree.end());
+    std::vector<int> result(linear.begin(), linear.end());
+    ASSERT_EQ(expected, result);
+    ASSERT_EQ(tree.size(), linear.size());
+    for (size_t i = 1; i < points.size(); i += 7)
+    {
+        std::pair<QuadTree<int>::iterator, QuadTree<int>::iterator> near =
+            tree.near(points[i].first, points[i].second);
+        std::pair<LinearQuadTree<int>::iterator, LinearQuadTree<int>::iterator> linearNear =
+            linear.near(points[i].first, points[i].second);
+        ASSERT_EQ(std::vector<int>(near.first, near.second),
+                  std::vector<int>(linearNear.first, linearNear.second));
+    }
+}
+
+namespace {
+
+double secondsToBuild(size_t count)
+{
+    double best = 0;
+    for (int run = 0; run < 3; ++run)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        LinearQuadTree<int, 16> tree(65536, 8);
+        for (size_t i = 0; i < count; ++i)
+            tree.insert(double(i * 2654435761u % 65536), double(i * 40503u % 65521), int(i));
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+            .count();
+        best = run == 0 ? seconds : std::min(best, seconds);
+    }
+    return best;
+}
+
+} // namespace
+
+TEST_F(LinearQuadTreeTests, SplitCostScalesLinearly)
+{
+    // Splits used to shift all the following leaves, which made building quadratic.
+    double small = secondsToBuild(20000);
+    double big = secondsToBuild(160000);
+    ASSERT_LT(big, 32 * small);
+}
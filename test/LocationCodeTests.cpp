@@ -1,3 +1,5 @@
+#include <bitset>
+
 #include "gtest/gtest.h"
 
 #include "internal/LocationCode.hpp"
@@ -12,13 +14,57 @@ class LocationCodeTests : public Test
 TEST_F(LocationCodeTests, ProperRepresentationOf_0)
 {
     LocationCode<6> loc(Coordinates(0, 0));
-    EXPECT_EQ("000000", loc.x.to_string());
-    EXPECT_EQ("000000", loc.y.to_string());
+    EXPECT_EQ("000000", std::bitset<6>(loc.x()).to_string());
+    EXPECT_EQ("000000", std::bitset<6>(loc.y()).to_string());
 }
 
 TEST_F(LocationCodeTests, ProperRepresentationOf_1)
 {
     LocationCode<6> loc(Coordinates(0.99, 0.99));
-    EXPECT_EQ("011111", loc.x.to_string());
-    EXPECT_EQ("011111", loc.y.to_string());
+    EXPECT_EQ("011111", std::bitset<6>(loc.x()).to_string());
+    EXPECT_EQ("011111", std::bitset<6>(loc.y()).to_string());
+}
+
+TEST_F(LocationCodeTests, KeyTypeDependsOnSize)
+{
+    EXPECT_EQ(sizeof(uint32_t), sizeof(LocationCode<16>::KeyType));
+    EXPECT_EQ(sizeof(uint64_t), sizeof(LocationCode<17>::KeyType));
+}
+
+TEST_F(LocationCodeTests, KeyPairsMatchChildNumbers)
+{
+    // x = 10b, y = 01b: on the upper level child (1, 0) is chosen and on the lower one (0, 1).
+    LocationCode<3> loc(Coordinates(0.5, 0.25));
+    EXPECT_EQ((LocationCode<3>::KeyType)0x9, loc.key);
+    EXPECT_EQ((uint32_t)2, loc.quadrant(1));
+    EXPECT_EQ((uint32_t)1, loc.quadrant(0));
+}
+
+TEST_F(LocationCodeTests, QuadrantBeyondSizeIsZero)
+{
+    LocationCode<3> loc(0x7, 0x7);
+    ASSERT_EQ((uint32_t)0, loc.quadrant(3));
+}
+
+TEST_F(LocationCodeTests, SetQuadrantChangesOnlyGivenLevel)
+{
+    LocationCode<6> loc(Coordinates(0.99, 0.99));
+    loc.setQuadrant(2, 0);
+    EXPECT_EQ("011011", std::bitset<6>(loc.x()).to_string());
+    EXPECT_EQ("011011", std::bitset<6>(loc.y()).to_string());
+}
+
+TEST_F(LocationCodeTests, SamePrefix)
+{
+    LocationCode<6> a(0x2C, 0x11);
+    LocationCode<6> b(0x2F, 0x13);
+    EXPECT_TRUE(a.samePrefix(b, 2));
+    EXPECT_FALSE(a.samePrefix(b, 1));
+    EXPECT_TRUE(a.samePrefix(b, 6));
+}
+
+TEST_F(LocationCodeTests, EqualCodes)
+{
+    EXPECT_EQ(LocationCode<20>(Coordinates(0.3, 0.7)), LocationCode<20>(Coordinates(0.3, 0.7)));
+    EXPECT_NE(LocationCode<20>(Coordinates(0.3, 0.7)), LocationCode<20>(Coordinates(0.7, 0.3)));
 }
@@ -0,0 +1,256 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "QuadTree.hpp"
+#include "Collect.hpp"
+
+using namespace testing;
+using namespace geo;
+using namespace geo::helpers;
+
+class MappedQuadTreeTests : public Test
+{
+protected:
+    typedef QuadTree<int, 10, std::allocator<int>, true> ExactTree;
+
+    // Points are scattered over the whole field and some of them share the smallest nodes.
+    MappedQuadTreeTests() : tree(64, 4), exact(64, 4)
+    {
+        for (int i = 0; i < 700; ++i)
+        {
+            tree.insert((i * 37) % 128 * 0.5, (i * 91) % 128 * 0.5, i);
+            exact.insert(std::fmod(i * 7.31, 64.0), std::fmod(i * 13.17 + 0.03, 64.0), i);
+        }
+    }
+
+    // Images are kept in 8-byte words, so they're aligned as mapped files are.
+    template <typename Tree>
+    static std::vector<uint64_t> save(const Tree& tree)
+    {
+        std::ostringstream out;
+        tree.save(out);
+        std::string bytes = out.str();
+        std::vector<uint64_t> words((bytes.size() + 7) / 8);
+        std::memcpy(words.data(), bytes.data(), bytes.size());
+        return words;
+    }
+
+    template <typename Tree>
+    static std::vector<int> rect(const Tree& tree, double minX, double minY, double maxX,
+                                 double maxY)
+    {
+        std::vector<int> ids;
+        tree.withinRect(minX, minY, maxX, maxY, Collect(&ids));
+        std::sort(ids.begin(), ids.end());
+        return ids;
+    }
+
+    template <typename Tree>
+    static std::vector<int> radius(const Tree& tree, double x, double y, double r)
+    {
+        std::vector<int> ids;
+        tree.withinRadius(x, y, r, Collect(&ids));
+        std::sort(ids.begin(), ids.end());
+        return ids;
+    }
+
+    QuadTree<int> tree;
+    ExactTree exact;
+};
+
+TEST_F(MappedQuadTreeTests, IterationOrderIsTheSameAsInSavedTree)
+{
+    std::vector<uint64_t> image = save(tree);
+    MappedQuadTree<int> mapped(image.data(), image.size() * 8);
+
+    ASSERT_EQ(tree.size(), mapped.size());
+    ASSERT_EQ(std::vector<int>(tree.begin(), tree.end()),
+              std::vector<int>(mapped.begin(), mapped.end()));
+}
+
+TEST_F(MappedQuadTreeTests, NearFindsElementsOfTheSameLeaf)
+{
+    std::vector<uint64_t> image = save(tree);
+    MappedQuadTree<int> mapped(image.data(), image.size() * 8);
+    const QuadTree<int>& saved = tree;
+
+    for (double x = -1.3; x < 66; x += 0.7)
+    {
+        for (double y = -0.9; y < 66; y += 1.1)
+        {
+            std::pair<QuadTree<int>::const_iterator, QuadTree<int>::const_iterator> expected =
+                saved.near(x, y);
+            std::pair<const int*, const int*> found = mapped.near(x, y);
+            ASSERT_EQ(std::vector<int>(expected.first, expected.second),
+                      std::vector<int>(found.first, found.second));
+        }
+    }
+}
+
+TEST_F(MappedQuadTreeTests, RangeQueriesGiveTheSameResultsAsSavedTree)
+{
+    std::vector<uint64_t> image = save(tree);
+    MappedQuadTree<int> mapped(image.data(), image.size() * 8);
+    std::vector<uint64_t> exactImage = save(exact);
+    MappedQuadTree<int, 10, true> mappedExact(exactImage.data(), exactImage.size() * 8);
+
+    for (double x = -5.3; x < 70; x += 7.1)
+    {
+        for (double y = -3.7; y < 70; y += 9.3)
+        {
+            EXPECT_EQ(rect(tree, x, y, x + 13.3, y + 6.2),
+                      rect(mapped, x, y, x + 13.3, y + 6.2));
+            EXPECT_EQ(rect(exact, x, y, x + 5.1, y + 21),
+                      rect(mappedExact, x, y, x + 5.1, y + 21));
+            for (double r = 0.1; r < 30; r *= 3)
+            {
+                EXPECT_EQ(radius(tree, x, y, r), radius(mapped, x, y, r));
+                EXPECT_EQ(radius(exact, x, y, r), radius(mappedExact, x, y, r));
+            }
+        }
+    }
+    ASSERT_EQ(tree.size(), rect(mapped, 0, 0, 64, 64).size());
+}
+
+TEST_F(MappedQuadTreeTests, LoadRebuildsTreeWithItsOwnCapacity)
+{
+    std::stringstream stream;
+    exact.save(stream);
+    ExactTree loaded(64, 16);
+    loaded.insert(1, 1, -1);
+    loaded.load(stream);
+
+    ASSERT_EQ(exact.size(), loaded.size());
+    std::vector<int> expected(exact.begin(), exact.end());
+    std::vector<int> found(loaded.begin(), loaded.end());
+    std::sort(expected.begin(), expected.end());
+    std::sort(found.begin(), found.end());
+    EXPECT_EQ(expected, found);
+    EXPECT_EQ(radius(exact, 20, 30, 7.5), radius(loaded, 20, 30, 7.5));
+    ASSERT_EQ(rect(exact, 3, 9, 41, 17), rect(loaded, 3, 9, 41, 17));
+}
+
+TEST_F(MappedQuadTreeTests, EmptyTreeMightBeSavedAndLoaded)
+{
+    QuadTree<int> empty(64, 4);
+    std::vector<uint64_t> image = save(empty);
+    MappedQuadTree<int> mapped(image.data(), image.size() * 8);
+
+    EXPECT_EQ(0u, mapped.size());
+    EXPECT_EQ(mapped.end(), mapped.begin());
+    EXPECT_EQ(mapped.near(1, 1).first, mapped.near(1, 1).second);
+    EXPECT_TRUE(rect(mapped, 0, 0, 64, 64).empty());
+    tree.load(MappedQuadTree<int>(image.data(), image.size() * 8));
+    ASSERT_EQ(0u, tree.size());
+}
+
+TEST_F(MappedQuadTreeTests, ImagesOfOtherTreesAreRejected)
+{
+    std::vector<uint64_t> image = save(tree);
+    size_t size = image.size() * 8;
+
+    EXPECT_THROW((MappedQuadTree<int, 12>(image.data(), size)), std::invalid_argument);
+    EXPECT_THROW((MappedQuadTree<double>(image.data(), size)), std::invalid_argument);
+    EXPECT_THROW((MappedQuadTree<int, 10, true>(image.data(), size)), std::invalid_argument);
+    EXPECT_THROW((MappedQuadTree<int>(image.data(), size / 2)), std::invalid_argument);
+    EXPECT_THROW((QuadTree<int>(128, 4).load(MappedQuadTree<int>(image.data(), size))),
+                 std::invalid_argument);
+
+    image[0] ^= 1;
+    ASSERT_THROW((MappedQuadTree<int>(image.data(), size)), std::invalid_argument);
+}
+
+TEST_F(MappedQuadTreeTests, CorruptedImagesAreRejected)
+{
+    const std::vector<uint64_t> valid = save(tree);
+    size_t size = valid.size() * 8;
+    image::Header header;
+    std::memcpy(&header, valid.data(), sizeof(header));
+    ASSERT_LT(3u, header.leafCount);
+
+    // Each corruption is made in a fresh copy of the valid image.
+    struct Corruption
+    {
+        size_t leaf;
+        uint64_t image::Leaf::*field;
+        uint64_t value;
+    };
+    Corruption leafCorruptions[] = {
+        { 1, &image::Leaf::first, 1000000 },
+        { 3, &image::Leaf::first, 0 },
+        { 2, &image::Leaf::key, 0 },
+        { 1, &image::Leaf::key, UINT64_MAX - 1 },
+    };
+    for (size_t i = 0; i < sizeof(leafCorruptions) / sizeof(leafCorruptions[0]); ++i)
+    {
+        std::vector<uint64_t> image = valid;
+        image::Leaf* leaves = reinterpret_cast<image::Leaf*>(
+            reinterpret_cast<char*>(image.data()) + header.leaves);
+        leaves[leafCorruptions[i].leaf].*leafCorruptions[i].field = leafCorruptions[i].value;
+        EXPECT_THROW((MappedQuadTree<int>(image.data(), size)), std::invalid_argument) << i;
+    }
+
+    uint32_t levels[] = { 10, 200 };
+    for (size_t i = 0; i < 2; ++i)
+    {
+        std::vector<uint64_t> image = valid;
+        image::Leaf* leaves = reinterpret_cast<image::Leaf*>(
+            reinterpret_cast<char*>(image.data()) + header.leaves);
+        leaves[header.leafCount - 1].level = levels[i];
+        EXPECT_THROW((MappedQuadTree<int>(image.data(), size)), std::invalid_argument);
+    }
+
+    // Sizes of sections grown by these counts wrap around to the same offsets, so only
+    // overflow checks tell forged headers from the valid one.
+    uint64_t image::Header::*counts[] = { &image::Header::elementCount, &image::Header::leafCount };
+    uint64_t wrapping[] = { uint64_t(1) << 62, uint64_t(1) << 61 };
+    for (size_t i = 0; i < 2; ++i)
+    {
+        std::vector<uint64_t> image = valid;
+        image::Header forged = header;
+        forged.*counts[i] += wrapping[i];
+        std::memcpy(image.data(), &forged, sizeof(forged));
+        image::Leaf* leaves = reinterpret_cast<image::Leaf*>(
+            reinterpret_cast<char*>(image.data()) + header.leaves);
+        leaves[header.leafCount].first = forged.elementCount;
+        EXPECT_THROW((MappedQuadTree<int>(image.data(), size)), std::invalid_argument);
+    }
+
+    std::string bytes(reinterpret_cast<const char*>(valid.data()), size);
+    bytes[header.leaves + sizeof(image::Leaf) + offsetof(image::Leaf, first) + 2] = 0x7f;
+    std::istringstream in(bytes);
+    EXPECT_THROW(tree.load(in), std::invalid_argument);
+    ASSERT_EQ(700u, tree.size());
+}
+
+#ifdef GEO_HAS_MMAP
+TEST_F(MappedQuadTreeTests, SavedFileMightBeMapped)
+{
+    std::string path = TempDir() + "mapped_quad_tree_test.bin";
+    {
+        std::ofstream out(path.c_str(), std::ios::binary);
+        tree.save(out);
+    }
+
+    {
+        MappedFile file(path);
+        MappedQuadTree<int> mapped(file.data(), file.size());
+        EXPECT_EQ(std::vector<int>(tree.begin(), tree.end()),
+                  std::vector<int>(mapped.begin(), mapped.end()));
+        EXPECT_EQ(rect(tree, 10, 10, 30, 20), rect(mapped, 10, 10, 30, 20));
+    }
+    std::remove(path.c_str());
+    ASSERT_THROW(MappedFile file(path), std::system_error);
+}
+#endif
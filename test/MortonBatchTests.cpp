@@ -0,0 +1,119 @@
+#include "gtest/gtest.h"
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "internal/MortonBatch.hpp"
+#include "internal/Coordinates.hpp"
+#include "internal/LocationCode.hpp"
+#include "QuadTree.hpp"
+
+using namespace testing;
+using namespace geo;
+
+class MortonBatchTests : public Test
+{
+protected:
+    MortonBatchTests()
+    {
+        for (int i = 0; i < 1003; ++i)
+        {
+            xs.push_back(std::fmod(i * 7.31, 64.0));
+            ys.push_back(std::fmod(i * 13.17 + 0.03, 64.0));
+        }
+        // Borders, points out of range and NaN.
+        double special[] = { 0.0, 63.999, 64.0, -0.001, -100, 1000,
+                             std::numeric_limits<double>::quiet_NaN() };
+        for (size_t i = 0; i < sizeof(special) / sizeof(special[0]); ++i)
+        {
+            for (size_t j = 0; j < sizeof(special) / sizeof(special[0]); ++j)
+            {
+                xs.push_back(special[i]);
+                ys.push_back(special[j]);
+            }
+        }
+    }
+
+    static morton::Quantizer quantizer(size_t levels)
+    {
+        double cells = static_cast<double>(uint64_t(1) << (levels - 1));
+        morton::Quantizer q = { 0, 0, cells / 64, static_cast<uint32_t>(cells - 1) };
+        return q;
+    }
+
+    template <typename KeyType>
+    void expectKernelMatchesScalar(morton::batch::Kernel kernel, size_t levels)
+    {
+        std::vector<KeyType> expected(xs.size());
+        std::vector<KeyType> keys(xs.size());
+        morton::batch::scalar::encode(&xs[0], &ys[0], xs.size(), quantizer(levels), &expected[0]);
+        morton::batch::encode(kernel, &xs[0], &ys[0], xs.size(), quantizer(levels), &keys[0]);
+        ASSERT_EQ(expected, keys);
+    }
+
+    std::vector<double> xs;
+    std::vector<double> ys;
+};
+
+TEST_F(MortonBatchTests, ScalarKernelMatchesLocationCode)
+{
+    std::vector<uint32_t> keys(xs.size());
+    morton::batch::scalar::encode(&xs[0], &ys[0], xs.size(), quantizer(10), &keys[0]);
+
+    CoordTr<0, 0, 1, 1> tr(0, 0, 64, 64);
+    for (size_t i = 0; i < 1003; ++i)
+        ASSERT_EQ(LocationCode<10>(tr.forward(Coordinates(xs[i], ys[i]))).key, keys[i]);
+}
+
+TEST_F(MortonBatchTests, ScalarKernelClampsPointsOutOfRange)
+{
+    double x[] = { -1, 100, std::numeric_limits<double>::quiet_NaN() };
+    double y[] = { 100, -1, 1 };
+    uint32_t keys[3];
+    morton::batch::scalar::encode(x, y, 3, quantizer(4), keys);
+
+    EXPECT_EQ(morton::Codec<uint32_t>::interleave(0, 7), keys[0]);
+    EXPECT_EQ(morton::Codec<uint32_t>::interleave(7, 0), keys[1]);
+    ASSERT_EQ(morton::Codec<uint32_t>::interleave(0, 0), keys[2]);
+}
+
+TEST_F(MortonBatchTests, SupportedKernelsMatchScalarOne)
+{
+    morton::batch::Kernel best = morton::batch::bestKernel();
+    for (int kernel = morton::batch::SCALAR; kernel <= best; ++kernel)
+    {
+        expectKernelMatchesScalar<uint32_t>(morton::batch::Kernel(kernel), 10);
+        expectKernelMatchesScalar<uint32_t>(morton::batch::Kernel(kernel), 16);
+        expectKernelMatchesScalar<uint64_t>(morton::batch::Kernel(kernel), 20);
+        expectKernelMatchesScalar<uint64_t>(morton::batch::Kernel(kernel), 32);
+    }
+}
+
+TEST_F(MortonBatchTests, KernelsHandleShortArrays)
+{
+    morton::batch::Kernel best = morton::batch::bestKernel();
+    for (int kernel = morton::batch::SCALAR; kernel <= best; ++kernel)
+    {
+        for (size_t count = 0; count < 10; ++count)
+        {
+            std::vector<uint64_t> expected(count + 1, 42);
+            std::vector<uint64_t> keys(count + 1, 42);
+            morton::batch::scalar::encode(&xs[0], &ys[0], count, quantizer(20), &expected[0]);
+            morton::batch::encode(morton::batch::Kernel(kernel), &xs[0], &ys[0], count,
+                                  quantizer(20), &keys[0]);
+            ASSERT_EQ(expected, keys);
+        }
+    }
+}
+
+TEST_F(MortonBatchTests, QuadTreeEncodeMatchesLocationCodes)
+{
+    QuadTree<int, 20> tree(64, 0, 0, 4);
+    std::vector<QuadTree<int, 20>::code_type> codes(xs.size());
+    tree.encode(&xs[0], &ys[0], xs.size(), &codes[0]);
+
+    CoordTr<0, 0, 1, 1> tr(0, 0, 64, 64);
+    for (size_t i = 0; i < 1003; ++i)
+        ASSERT_EQ(LocationCode<20>(tr.forward(Coordinates(xs[i], ys[i]))).key, codes[i]);
+}
@@ -0,0 +1,73 @@
+#include "gtest/gtest.h"
+
+#include "internal/Morton.hpp"
+
+using namespace testing;
+using namespace geo;
+
+class MortonTests : public Test
+{
+};
+
+TEST_F(MortonTests, InterleaveOf_0)
+{
+    ASSERT_EQ((uint64_t)0, morton::interleave(0, 0));
+}
+
+TEST_F(MortonTests, InterleavePlacesXOnOddBits)
+{
+    ASSERT_EQ((uint64_t)0x2A, morton::interleave(0x7, 0));
+}
+
+TEST_F(MortonTests, InterleavePlacesYOnEvenBits)
+{
+    ASSERT_EQ((uint64_t)0x15, morton::interleave(0, 0x7));
+}
+
+TEST_F(MortonTests, InterleaveOfMaximumValues)
+{
+    ASSERT_EQ((uint64_t)0xFFFFFFFFFFFFFFFFULL, morton::interleave(0xFFFFFFFF, 0xFFFFFFFF));
+}
+
+TEST_F(MortonTests, DeinterleaveIsReverseOfInterleave)
+{
+    uint64_t key = morton::interleave(0x12345678, 0x9ABCDEF0);
+    EXPECT_EQ((uint32_t)0x12345678, morton::deinterleaveX(key));
+    EXPECT_EQ((uint32_t)0x9ABCDEF0, morton::deinterleaveY(key));
+}
+
+TEST_F(MortonTests, Codec32InterleavesTheSameWayAsCodec64)
+{
+    EXPECT_EQ((uint32_t)0xAAAAAAAA, morton::Codec<uint32_t>::interleave(0xFFFF, 0));
+    EXPECT_EQ((uint32_t)0x55555555, morton::Codec<uint32_t>::interleave(0, 0xFFFF));
+    ASSERT_EQ(morton::interleave(0x1234, 0xABCD),
+        (uint64_t)morton::Codec<uint32_t>::interleave(0x1234, 0xABCD));
+}
+
+TEST_F(MortonTests, Codec32DeinterleaveIsReverseOfInterleave)
+{
+    uint32_t key = morton::Codec<uint32_t>::interleave(0x1234, 0xABCD);
+    EXPECT_EQ((uint32_t)0x1234, morton::Codec<uint32_t>::x(key));
+    EXPECT_EQ((uint32_t)0xABCD, morton::Codec<uint32_t>::y(key));
+}
+
+TEST_F(MortonTests, SelectedKernelsMatchPortableOnes)
+{
+    for (uint32_t i = 0; i < 1000; ++i)
+    {
+        uint32_t x = i * 2654435761u;
+        uint32_t y = ~x ^ (i << 7);
+        uint64_t key = morton::interleave(x, y);
+        ASSERT_EQ(morton::portable::interleave(x, y), key);
+        ASSERT_EQ(morton::portable::compact(key >> 1), morton::deinterleaveX(key));
+        ASSERT_EQ(morton::portable::interleave16(x, y),
+            morton::Codec<uint32_t>::interleave(x & 0xFFFF, y & 0xFFFF));
+    }
+}
+
+TEST_F(MortonTests, SpanOfLevels)
+{
+    EXPECT_EQ((uint64_t)1, morton::span(0));
+    EXPECT_EQ((uint64_t)4, morton::span(1));
+    EXPECT_EQ((uint64_t)16, morton::span(2));
+}
@@ -12,6 +12,8 @@ public:
     typedef unsigned ElementType;
 
 public:
+    NodeMock() : nextLink(nullptr), prevLink(nullptr) {}
+
     MOCK_CONST_METHOD0(count, size_t());
     MOCK_METHOD0(parent, NodeMock&());
 
@@ -38,6 +40,21 @@ public:
         return At(element);
     }
 
+    // Links to neighbouring non-empty nodes are plain fields: they're unset (as in trees which
+    // aren't threaded) unless a test sets them.
+    NodeMock* nextLeaf() const
+    {
+        return nextLink;
+    }
+
+    NodeMock* previousLeaf() const
+    {
+        return prevLink;
+    }
+
+    NodeMock* nextLink;
+    NodeMock* prevLink;
+
     friend NodeMock& nextNode(NodeMock& node)
     {
         return node.NextNode();
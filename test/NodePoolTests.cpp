@@ -0,0 +1,127 @@
+#include "gtest/gtest.h"
+
+#include "internal/NodePool.hpp"
+
+using namespace testing;
+using namespace geo;
+
+// Counts living instances.
+struct Counted {
+    static int instances;
+    int value;
+
+    explicit Counted(int value) : value(value) { ++instances; }
+    ~Counted() { --instances; }
+};
+
+int Counted::instances = 0;
+
+class NodePoolTests : public Test
+{
+protected:
+    NodePoolTests() { Counted::instances = 0; }
+};
+
+TEST_F(NodePoolTests, CreateConstructsNode)
+{
+    NodePool<Counted, std::allocator<Counted>, 4> pool;
+    Counted* c = pool.create(42);
+
+    EXPECT_EQ(42, c->value);
+    EXPECT_EQ(1, Counted::instances);
+    ASSERT_EQ((size_t)1, pool.size());
+}
+
+TEST_F(NodePoolTests, DestroyDestructsNode)
+{
+    NodePool<Counted, std::allocator<Counted>, 4> pool;
+    pool.destroy(pool.create(1));
+
+    EXPECT_EQ(0, Counted::instances);
+    ASSERT_EQ((size_t)0, pool.size());
+}
+
+TEST_F(NodePoolTests, DestroyedSlotIsReused)
+{
+    NodePool<Counted, std::allocator<Counted>, 4> pool;
+    pool.create(1);
+    Counted* c = pool.create(2);
+    pool.destroy(c);
+
+    ASSERT_EQ(c, pool.create(3));
+}
+
+TEST_F(NodePoolTests, CreateMoreNodesThanSlabSize)
+{
+    NodePool<Counted, std::allocator<Counted>, 4> pool;
+    for (int i = 0; i < 10; ++i)
+        pool.create(i);
+
+    EXPECT_EQ(10, Counted::instances);
+    ASSERT_EQ((size_t)10, pool.size());
+}
+
+TEST_F(NodePoolTests, ClearDestroysAllNodes)
+{
+    NodePool<Counted, std::allocator<Counted>, 4> pool;
+    for (int i = 0; i < 10; ++i)
+        pool.create(i);
+    pool.destroy(pool.create(11));
+
+    pool.clear();
+    EXPECT_EQ(0, Counted::instances);
+    ASSERT_EQ((size_t)0, pool.size());
+}
+
+TEST_F(NodePoolTests, PoolIsUsableAfterClear)
+{
+    NodePool<Counted, std::allocator<Counted>, 4> pool;
+    for (int i = 0; i < 10; ++i)
+        pool.create(i);
+    pool.clear();
+
+    for (int i = 0; i < 10; ++i)
+        EXPECT_EQ(i, pool.create(i)->value);
+    ASSERT_EQ(10, Counted::instances);
+}
+
+TEST_F(NodePoolTests, DestructorDestroysAllNodes)
+{
+    {
+        NodePool<Counted, std::allocator<Counted>, 4> pool;
+        for (int i = 0; i < 10; ++i)
+            pool.create(i);
+    }
+    ASSERT_EQ(0, Counted::instances);
+}
+
+TEST_F(NodePoolTests, SpliceTakesOverNodes)
+{
+    {
+        NodePool<Counted, std::allocator<Counted>, 4> pool;
+        {
+            NodePool<Counted, std::allocator<Counted>, 4> other;
+            for (int i = 0; i < 10; ++i)
+                other.create(i);
+            pool.create(10);
+            pool.splice(other);
+            EXPECT_EQ((size_t)0, other.size());
+        }
+        EXPECT_EQ(11, Counted::instances);
+        EXPECT_EQ((size_t)11, pool.size());
+    }
+    ASSERT_EQ(0, Counted::instances);
+}
+
+TEST_F(NodePoolTests, SplicedFreeSlotsAreReused)
+{
+    NodePool<Counted, std::allocator<Counted>, 4> pool;
+    NodePool<Counted, std::allocator<Counted>, 4> other;
+    Counted* c = other.create(1);
+    other.destroy(c);
+    pool.splice(other);
+
+    for (int i = 0; i < 4; ++i)
+        pool.create(i);
+    ASSERT_EQ((size_t)4, pool.size());
+}
@@ -0,0 +1,107 @@
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <stdexcept>
+#include <vector>
+
+#include "internal/Parallel.hpp"
+
+using namespace testing;
+using namespace geo;
+
+class ParallelTests : public Test
+{
+};
+
+TEST_F(ParallelTests, ParallelForVisitsEachIndexOnce)
+{
+    std::vector<std::atomic<int> > visits(1000);
+    for (size_t i = 0; i < visits.size(); ++i)
+        visits[i] = 0;
+
+    parallelFor(visits.size(), 4, [&](size_t index, unsigned) { ++visits[index]; });
+
+    for (size_t i = 0; i < visits.size(); ++i)
+        ASSERT_EQ(1, visits[i]);
+}
+
+TEST_F(ParallelTests, ParallelForWorkerNumbersAreInRange)
+{
+    std::atomic<bool> outOfRange(false);
+    parallelFor(100, 3, [&](size_t, unsigned worker) {
+        if (worker >= 3)
+            outOfRange = true;
+    });
+    ASSERT_FALSE(outOfRange);
+}
+
+TEST_F(ParallelTests, ParallelForWithZeroThreadsUsesCallingThread)
+{
+    size_t calls = 0;
+    parallelFor(10, 0, [&](size_t, unsigned) { ++calls; });
+    ASSERT_EQ((size_t)10, calls);
+}
+
+TEST_F(ParallelTests, ParallelForRethrowsException)
+{
+    ASSERT_THROW(parallelFor(100, 4, [](size_t index, unsigned) {
+        if (index == 42)
+            throw std::runtime_error("fake");
+    }), std::runtime_error);
+}
+
+TEST_F(ParallelTests, ParallelTasksProcessesSpawnedTasks)
+{
+    // Each task n spawns tasks 2n + 1 and 2n + 2, so tasks form a binary tree.
+    std::vector<std::atomic<int> > visits(1023);
+    for (size_t i = 0; i < visits.size(); ++i)
+        visits[i] = 0;
+
+    parallelTasks(size_t(0), 4, [&](size_t task, TaskSpawner<size_t>& spawner, unsigned) {
+        ++visits[task];
+        if (2 * task + 2 < visits.size())
+        {
+            spawner.spawn(2 * task + 1);
+            spawner.spawn(2 * task + 2);
+        }
+    });
+
+    for (size_t i = 0; i < visits.size(); ++i)
+        ASSERT_EQ(1, visits[i]);
+}
+
+TEST_F(ParallelTests, ParallelTasksSpreadsWorkFromSingleTask)
+{
+    std::vector<std::atomic<int> > perWorker(4);
+    for (size_t i = 0; i < perWorker.size(); ++i)
+        perWorker[i] = 0;
+
+    parallelTasks(0, 4, [&](int task, TaskSpawner<int>& spawner, unsigned worker) {
+        if (task == 0)
+        {
+            for (int i = 1; i <= 64; ++i)
+                spawner.spawn(i);
+        }
+        else
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        ++perWorker[worker];
+    });
+
+    int total = 0;
+    for (size_t i = 0; i < perWorker.size(); ++i)
+        total += perWorker[i];
+    ASSERT_EQ(65, total);
+}
+
+TEST_F(ParallelTests, ParallelTasksRethrowsException)
+{
+    ASSERT_THROW(parallelTasks(0, 3, [](int task, TaskSpawner<int>& spawner, unsigned) {
+        if (task == 10)
+            throw std::runtime_error("fake");
+        spawner.spawn(task + 1);
+    }), std::runtime_error);
+}
@@ -1,3 +1,5 @@
+#include <bitset>
+
 #include "gtest/gtest.h"
 
 #include "internal/QuadNode.hpp"
@@ -40,80 +42,80 @@ protected:
 
 TEST_F(QuadNodeTests, LocationCodeIsProperForRoot)
 {
-    ASSERT_EQ("0000000000", root.locationCode().x.to_string());
-    ASSERT_EQ("0000000000", root.locationCode().y.to_string());
+    ASSERT_EQ("0000000000", std::bitset<10>(root.locationCode().x()).to_string());
+    ASSERT_EQ("0000000000", std::bitset<10>(root.locationCode().y()).to_string());
 }
 
 TEST_F(QuadNodeTests, LocationCodeIsProperForFirstChild)
 {
     QuadNode<int, 10>& child = root.child(0, 0);
 
-    ASSERT_EQ("0000000000", child.locationCode().x.to_string());
-    ASSERT_EQ("0000000000", child.locationCode().y.to_string());
+    ASSERT_EQ("0000000000", std::bitset<10>(child.locationCode().x()).to_string());
+    ASSERT_EQ("0000000000", std::bitset<10>(child.locationCode().y()).to_string());
 }
 
 TEST_F(QuadNodeTests, LocationCodeIsProperForSecondChild)
 {
     QuadNode<int, 10>& child = root.child(0, 1);
 
-    ASSERT_EQ("0000000000", child.locationCode().x.to_string());
-    ASSERT_EQ("0100000000", child.locationCode().y.to_string());
+    ASSERT_EQ("0000000000", std::bitset<10>(child.locationCode().x()).to_string());
+    ASSERT_EQ("0100000000", std::bitset<10>(child.locationCode().y()).to_string());
 }
 
 TEST_F(QuadNodeTests, LocationCodeIsProperForThirdChild)
 {
     QuadNode<int, 10>& child = root.child(1, 0);
 
-    ASSERT_EQ("0100000000", child.locationCode().x.to_string());
-    ASSERT_EQ("0000000000", child.locationCode().y.to_string());
+    ASSERT_EQ("0100000000", std::bitset<10>(child.locationCode().x()).to_string());
+    ASSERT_EQ("0000000000", std::bitset<10>(child.locationCode().y()).to_string());
 }
 
 TEST_F(QuadNodeTests, LocationCodeIsProperForFourthChild)
 {
     QuadNode<int, 10>& child = root.child(1, 1);
 
-    ASSERT_EQ("0100000000", child.locationCode().x.to_string());
-    ASSERT_EQ("0100000000", child.locationCode().y.to_string());
+    ASSERT_EQ("0100000000", std::bitset<10>(child.locationCode().x()).to_string());
+    ASSERT_EQ("0100000000", std::bitset<10>(child.locationCode().y()).to_string());
 }
 
 TEST_F(QuadNodeTests, LocationCodeIsProperForFirstGrandchild)
 {
     QuadNode<int, 10>& child = root.child(0, 0).child(0, 0);
 
-    ASSERT_EQ("0000000000", child.locationCode().x.to_string());
-    ASSERT_EQ("0000000000", child.locationCode().y.to_string());
+    ASSERT_EQ("0000000000", std::bitset<10>(child.locationCode().x()).to_string());
+    ASSERT_EQ("0000000000", std::bitset<10>(child.locationCode().y()).to_string());
 }
 
 TEST_F(QuadNodeTests, LocationCodeIsProperForSecondGrandchild)
 {
     QuadNode<int, 10>& child = root.child(1, 0).child(0, 1);
 
-    ASSERT_EQ("0100000000", child.locationCode().x.to_string());
-    ASSERT_EQ("0010000000", child.locationCode().y.to_string());
+    ASSERT_EQ("0100000000", std::bitset<10>(child.locationCode().x()).to_string());
+    ASSERT_EQ("0010000000", std::bitset<10>(child.locationCode().y()).to_string());
 }
 
 TEST_F(QuadNodeTests, LocationCodeIsProperForThirdGrandchild)
 {
     QuadNode<int, 10>& child = root.child(0, 1).child(1, 0);
 
-    ASSERT_EQ("0010000000", child.locationCode().x.to_string());
-    ASSERT_EQ("0100000000", child.locationCode().y.to_string());
+    ASSERT_EQ("0010000000", std::bitset<10>(child.locationCode().x()).to_string());
+    ASSERT_EQ("0100000000", std::bitset<10>(child.locationCode().y()).to_string());
 }
 
 TEST_F(QuadNodeTests, LocationCodeIsProperForFourthGrandchild)
 {
     QuadNode<int, 10>& child = root.child(1, 1).child(1, 1);
 
-    ASSERT_EQ("0110000000", child.locationCode().x.to_string());
-    ASSERT_EQ("0110000000", child.locationCode().y.to_string());
+    ASSERT_EQ("0110000000", std::bitset<10>(child.locationCode().x()).to_string());
+    ASSERT_EQ("0110000000", std::bitset<10>(child.locationCode().y()).to_string());
 }
 
 TEST_F(QuadNodeTests, LocationCodeIsProperForGrandgrandchild)
 {
     QuadNode<int, 10>& child = root.child(1, 1).child(0, 1).child(1, 1);
 
-    ASSERT_EQ("0101000000", child.locationCode().x.to_string());
-    ASSERT_EQ("0111000000", child.locationCode().y.to_string());
+    ASSERT_EQ("0101000000", std::bitset<10>(child.locationCode().x()).to_string());
+    ASSERT_EQ("0111000000", std::bitset<10>(child.locationCode().y()).to_string());
 }
 
 TEST_F(QuadNodeTests, NextNodeReturnsCorrectChild)
@@ -299,3 +301,181 @@ TEST_F(QuadNodeTests, ExistingChildReturnsCurrentNodeWhenChildDoesntExist)
     const QuadNode<int, 10>& child = root.existingChild(1, 0);
     ASSERT_EQ(root, child);
 }
+
+TEST_F(QuadNodeTests, RemoveChildDestroysWholeSubtree)
+{
+    createTree();
+    root.removeChild(QuadNode<int, 10>::locToInt(0, 0));
+
+    EXPECT_FALSE(root.childExists(0, 0));
+    ASSERT_EQ(root.child(0,1).child(1,0), root.leftMostNode());
+}
+
+TEST_F(QuadNodeTests, ResetOfHeaderCreatesNewRoot)
+{
+    createTree();
+    header.reset();
+
+    QuadNode<int, 10>& newRoot = header.child(0, 0);
+    EXPECT_FALSE(newRoot.hasChildren());
+    ASSERT_EQ(header, newRoot.parent());
+}
+
+TEST_F(QuadNodeTests, CopiedHeaderHasItsOwnNodes)
+{
+    createTree();
+    QuadNode<int, 10> copy(header);
+
+    EXPECT_NE(&(header.child(0, 0)), &(copy.child(0, 0)));
+    EXPECT_EQ(copy, copy.child(0, 0).parent());
+    ASSERT_EQ(copy.child(0, 0).child(1, 1).child(1, 0), copy.rightMostNode());
+}
+
+TEST_F(QuadNodeTests, InsertUpdatesTotalCountsOfAncestors)
+{
+    createTree();
+    QuadNode<int, 10>& leaf = root.child(0,1).child(1,0);
+    leaf.insert(ObjectWithLocationCode<int, 10>(leaf.locationCode(), 1));
+    leaf.insert(ObjectWithLocationCode<int, 10>(leaf.locationCode(), 2));
+
+    EXPECT_EQ((size_t)2, leaf.totalCount());
+    EXPECT_EQ((size_t)2, root.child(0,1).totalCount());
+    EXPECT_EQ((size_t)2, root.totalCount());
+    EXPECT_EQ((size_t)2, header.totalCount());
+    ASSERT_EQ((size_t)0, root.child(1,1).totalCount());
+}
+
+TEST_F(QuadNodeTests, EraseAndRemoveChildUpdateTotalCounts)
+{
+    createTree();
+    QuadNode<int, 10>& leaf = root.child(0,1).child(1,0);
+    leaf.insert(ObjectWithLocationCode<int, 10>(leaf.locationCode(), 1));
+    root.child(1,1).insert(ObjectWithLocationCode<int, 10>(root.child(1,1).locationCode(), 2));
+    root.child(1,1).insert(ObjectWithLocationCode<int, 10>(root.child(1,1).locationCode(), 3));
+
+    leaf.erase(leaf.locationCode());
+    EXPECT_EQ((size_t)2, header.totalCount());
+    root.removeChild(QuadNode<int, 10>::locToInt(1, 1));
+    EXPECT_EQ((size_t)0, header.totalCount());
+}
+
+TEST_F(QuadNodeTests, SplitMovesElementsToChildrenAndKeepsTotalCount)
+{
+    LocationCode<10> first(0, 0);
+    LocationCode<10> second(0, 0);
+    second.setQuadrant(root.level() - 1, QuadNode<int, 10>::locToInt(1, 0));
+    root.insert(ObjectWithLocationCode<int, 10>(first, 1));
+    root.insert(ObjectWithLocationCode<int, 10>(second, 2));
+    root.split();
+
+    EXPECT_EQ((size_t)0, root.count());
+    EXPECT_EQ((size_t)2, root.totalCount());
+    EXPECT_EQ((size_t)1, root.child(0,0).totalCount());
+    EXPECT_EQ(2, root.child(1,0)[0]);
+    ASSERT_EQ((size_t)2, header.totalCount());
+}
+
+TEST_F(QuadNodeTests, ResetOfHeaderClearsTotalCount)
+{
+    root.insert(ObjectWithLocationCode<int, 10>(root.locationCode(), 1));
+    header.reset();
+
+    EXPECT_EQ((size_t)0, header.totalCount());
+    ASSERT_EQ((size_t)0, header.child(0,0).totalCount());
+}
+
+TEST_F(QuadNodeTests, ConstNavigationReturnsTheSameNodes)
+{
+    createTree();
+    const QuadNode<int, 10>& constRoot = root;
+
+    EXPECT_EQ(&root.leftMostNode(), &constRoot.leftMostNode());
+    EXPECT_EQ(&root.rightMostNode(), &constRoot.rightMostNode());
+    EXPECT_EQ(&nextNode(root.child(0, 1)), &nextNode(constRoot.existingChild(0, 1)));
+    EXPECT_EQ(&previousNode(root.child(1, 1)), &previousNode(constRoot.existingChild(1, 1)));
+    ASSERT_EQ(&header, &constRoot.parent());
+}
+
+TEST_F(QuadNodeTests, ConstExistingChildDoesntCreateNodes)
+{
+    const QuadNode<int, 10>& constRoot = root;
+    EXPECT_EQ(&constRoot, &constRoot.existingChild(1, 0));
+    ASSERT_FALSE(root.hasChildren());
+}
+
+TEST_F(QuadNodeTests, NonEmptyNodesAreLinkedInZOrder)
+{
+    createTree();
+    QuadNode<int, 10>& last = root.child(1,1).child(1,0);
+    QuadNode<int, 10>& first = root.child(0,0).child(0,1);
+    QuadNode<int, 10>& middle = root.child(0,1).child(1,0);
+    last.insert(ObjectWithLocationCode<int, 10>(last.locationCode(), 1));
+    first.insert(ObjectWithLocationCode<int, 10>(first.locationCode(), 2));
+    middle.insert(ObjectWithLocationCode<int, 10>(middle.locationCode(), 3));
+    middle.insert(ObjectWithLocationCode<int, 10>(middle.locationCode(), 4));
+
+    EXPECT_EQ(&first, header.nextLeaf());
+    EXPECT_EQ(&middle, first.nextLeaf());
+    EXPECT_EQ(&last, middle.nextLeaf());
+    EXPECT_EQ(&header, last.nextLeaf());
+    EXPECT_EQ(&last, header.previousLeaf());
+    EXPECT_EQ(&first, middle.previousLeaf());
+    ASSERT_EQ(nullptr, root.child(0,0).child(0,0).nextLeaf());
+}
+
+TEST_F(QuadNodeTests, EmptiedAndRemovedNodesAreUnlinked)
+{
+    createTree();
+    QuadNode<int, 10>& first = root.child(0,0).child(1,1);
+    QuadNode<int, 10>& second = root.child(0,1).child(1,0);
+    first.insert(ObjectWithLocationCode<int, 10>(first.locationCode(), 1));
+    second.insert(ObjectWithLocationCode<int, 10>(second.locationCode(), 2));
+
+    first.erase(first.locationCode());
+    EXPECT_EQ(nullptr, first.nextLeaf());
+    EXPECT_EQ(&second, header.nextLeaf());
+    EXPECT_EQ(&header, second.previousLeaf());
+
+    root.removeChild(QuadNode<int, 10>::locToInt(0, 1));
+    EXPECT_EQ(&header, header.nextLeaf());
+    ASSERT_EQ(&header, header.previousLeaf());
+}
+
+TEST_F(QuadNodeTests, SplitLinksChildrenInPlaceOfNode)
+{
+    LocationCode<10> first(0, 0);
+    LocationCode<10> second(0, 0);
+    second.setQuadrant(root.level() - 1, QuadNode<int, 10>::locToInt(1, 0));
+    root.insert(ObjectWithLocationCode<int, 10>(second, 2));
+    root.insert(ObjectWithLocationCode<int, 10>(first, 1));
+    root.split();
+
+    EXPECT_EQ(nullptr, root.nextLeaf());
+    EXPECT_EQ(&root.child(0,0), header.nextLeaf());
+    EXPECT_EQ(&root.child(1,0), root.child(0,0).nextLeaf());
+    ASSERT_EQ(&header, root.child(1,0).nextLeaf());
+}
+
+TEST_F(QuadNodeTests, CopiesAndUnthreadedTreesHaveTheirOwnLinks)
+{
+    createTree();
+    QuadNode<int, 10>& leaf = root.child(0,1).child(1,0);
+    leaf.insert(ObjectWithLocationCode<int, 10>(leaf.locationCode(), 1));
+
+    QuadNode<int, 10> copy(header);
+    ASSERT_NE(nullptr, copy.nextLeaf());
+    EXPECT_NE(&leaf, copy.nextLeaf());
+    EXPECT_EQ(1, (*copy.nextLeaf())[0]);
+    EXPECT_EQ(&copy, copy.nextLeaf()->nextLeaf());
+
+    header.unthreadLeaves();
+    EXPECT_FALSE(leaf.isThreaded());
+    EXPECT_EQ(nullptr, leaf.nextLeaf());
+    root.child(1,1).insert(ObjectWithLocationCode<int, 10>(root.child(1,1).locationCode(), 2));
+    EXPECT_EQ(nullptr, root.child(1,1).nextLeaf());
+
+    header.threadLeaves();
+    EXPECT_EQ(&leaf, header.nextLeaf());
+    EXPECT_EQ(&root.child(1,1), leaf.nextLeaf());
+    ASSERT_EQ(&header, root.child(1,1).nextLeaf());
+}
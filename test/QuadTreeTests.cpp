@@ -1,10 +1,20 @@
 #include "gtest/gtest.h"
 
 #include "QuadTree.hpp"
+#include "Collect.hpp"
 #include <string>
+#include <vector>
+#include <tuple>
+#include <algorithm>
+#include <cmath>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <stdexcept>
 
 using namespace testing;
 using namespace geo;
+using namespace geo::helpers;
 
 // Note that we have to place QuadTree constructors in additional parentheses because GTest macros
 // are sensitive to semicolons in template parameters definitions.
@@ -350,3 +360,1680 @@ TEST_F(QuadTreeTests, NearReturnsEndIteratorsWhen_Y_IsOutOfRange)
     ASSERT_EQ(tree.end(), range.first);
     ASSERT_EQ(tree.end(), range.second);
 }
+
+TEST_F(QuadTreeTests, ConstNearReturnsTheSameRangeAsNear)
+{
+    QuadTree<int> tree(4, 2);
+    tree.insert(0, 0, 10);
+    tree.insert(0, 1, 11);
+    tree.insert(3, 3, 12);
+    const QuadTree<int>& constTree = tree;
+
+    std::pair<QuadTree<int>::const_iterator, QuadTree<int>::const_iterator> range =
+        constTree.near(0.5, 0.5);
+    std::pair<QuadTree<int>::iterator, QuadTree<int>::iterator> expected = tree.near(0.5, 0.5);
+    EXPECT_EQ(QuadTree<int>::const_iterator(expected.first), range.first);
+    ASSERT_EQ(QuadTree<int>::const_iterator(expected.second), range.second);
+}
+
+TEST_F(QuadTreeTests, ConstNearReturnsEndIteratorsWhenCoordinatesAreOutOfRange)
+{
+    const QuadTree<int> tree(2, 2);
+    std::pair<QuadTree<int>::const_iterator, QuadTree<int>::const_iterator> range =
+        tree.near(3, 0);
+    EXPECT_EQ(tree.end(), range.first);
+    ASSERT_EQ(tree.end(), range.second);
+}
+
+TEST_F(QuadTreeTests, ConstIteratorVisitsTheSameElementsAsIterator)
+{
+    QuadTree<int> tree(8, 1);
+    for (int i = 0; i < 20; ++i)
+        tree.insert((i * 3) % 8, (i * 5) % 8, i);
+
+    std::vector<int> expected(tree.begin(), tree.end());
+    std::vector<int> forward(tree.cbegin(), tree.cend());
+    EXPECT_EQ(expected, forward);
+
+    std::vector<int> backward;
+    for (QuadTree<int>::const_iterator it = tree.cend(); it != tree.cbegin();)
+        backward.push_back(*--it);
+    std::reverse(backward.begin(), backward.end());
+    ASSERT_EQ(expected, backward);
+}
+
+TEST_F(QuadTreeTests, ConstBeginIsEqualToEndWhenTreeIsEmpty)
+{
+    const QuadTree<int> tree(4, 4);
+    ASSERT_EQ(tree.end(), tree.begin());
+}
+
+TEST_F(QuadTreeTests, TreeIsUsableAfterClear)
+{
+    QuadTree<int> tree(4, 1);
+    tree.insert(0, 0, 1);
+    tree.insert(3, 3, 2);
+    tree.clear();
+
+    tree.insert(1, 1, 10);
+    tree.insert(2, 2, 11);
+    std::vector<int> result(tree.begin(), tree.end());
+    ASSERT_EQ(std::vector<int>({10, 11}), result);
+}
+
+TEST_F(QuadTreeTests, EraseOfTheLastElementInANodeLeavesOtherNodesIterable)
+{
+    QuadTree<int> tree(4, 1);
+    tree.insert(0, 0, 1);
+    tree.insert(3, 3, 2);
+    tree.insert(3, 0, 3);
+
+    tree.erase(3, 0);
+    std::vector<int> result(tree.begin(), tree.end());
+    EXPECT_EQ(std::vector<int>({1, 2}), result);
+
+    tree.erase(0, 0);
+    tree.erase(3, 3);
+    ASSERT_EQ(tree.end(), tree.begin());
+}
+
+TEST_F(QuadTreeTests, NearReturnsEmptyRangeWhenThereAreNoElementsNearby)
+{
+    QuadTree<int> tree(4, 1);
+    tree.insert(0, 0, 1);
+    tree.insert(3, 3, 2);
+    std::pair<QuadTree<int>::iterator, QuadTree<int>::iterator> range = tree.near(0.5, 3.5);
+
+    ASSERT_EQ(range.first, range.second);
+}
+
+TEST_F(QuadTreeTests, CopiedTreeIsIndependent)
+{
+    QuadTree<int> tree(4, 1);
+    tree.insert(0, 0, 1);
+    tree.insert(3, 3, 2);
+
+    QuadTree<int> copy(tree);
+    tree.clear();
+
+    std::vector<int> result(copy.begin(), copy.end());
+    ASSERT_EQ(std::vector<int>({1, 2}), result);
+}
+
+// Copies of ThrowingCopy throw once a given number of them were made.
+struct ThrowingCopy
+{
+    explicit ThrowingCopy(int value) : value(value) {}
+    ThrowingCopy(const ThrowingCopy& that) : value(that.value)
+    {
+        if (copiesLeft-- == 0)
+            throw std::runtime_error("copy failed");
+    }
+    ThrowingCopy& operator=(const ThrowingCopy&) = default;
+
+    int value;
+    static int copiesLeft;
+};
+
+int ThrowingCopy::copiesLeft = -1;
+
+TEST_F(QuadTreeTests, FailedCopyOfTreeLeavesNothingBehind)
+{
+    QuadTree<ThrowingCopy> tree(64, 1);
+    for (int i = 0; i < 20; ++i)
+        tree.insert(i * 3, 60 - i * 3, ThrowingCopy(i));
+
+    // Memory of subnodes copied before the failure is checked by the sanitized build.
+    ThrowingCopy::copiesLeft = 10;
+    EXPECT_THROW(QuadTree<ThrowingCopy> copy(tree), std::runtime_error);
+    ThrowingCopy::copiesLeft = -1;
+    QuadTree<ThrowingCopy> copy(tree);
+    ASSERT_EQ(tree.size(), copy.size());
+}
+
+class QuadTreeBulkLoadTests : public Test
+{
+protected:
+    typedef std::tuple<double, double, int> Point;
+
+    QuadTreeBulkLoadTests()
+    {
+        for (int i = 0; i < 500; ++i)
+            points.push_back(Point((i * 37) % 64 + 0.5, (i * 11) % 64 + 0.25, i));
+    }
+
+    // Elements near given point, sorted (order inside a node is not specified).
+    static std::vector<int> nearSorted(QuadTree<int>& tree, double x, double y)
+    {
+        std::pair<QuadTree<int>::iterator, QuadTree<int>::iterator> range = tree.near(x, y);
+        std::vector<int> result(range.first, range.second);
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+    std::vector<Point> points;
+};
+
+TEST_F(QuadTreeBulkLoadTests, BulkLoadInsertsAllElements)
+{
+    QuadTree<int> tree(64, 4);
+    EXPECT_EQ(points.size(), tree.bulkLoad(points.begin(), points.end()));
+    ASSERT_EQ(points.size(), tree.size());
+}
+
+TEST_F(QuadTreeBulkLoadTests, BulkLoadSkipsElementsOutOfRange)
+{
+    QuadTree<int> tree(4, 4);
+    points.clear();
+    points.push_back(Point(1, 1, 1));
+    points.push_back(Point(5, 1, 2));
+    points.push_back(Point(1, -1, 3));
+
+    EXPECT_EQ((size_t)1, tree.bulkLoad(points.begin(), points.end()));
+    ASSERT_EQ((size_t)1, tree.size());
+}
+
+TEST_F(QuadTreeBulkLoadTests, BulkLoadedTreeHasTheSameNodesAsInsertedOneByOne)
+{
+    QuadTree<int> bulk(64, 4);
+    QuadTree<int> inserted(64, 4);
+
+    bulk.bulkLoad(points.begin(), points.end());
+    for (size_t i = 0; i < points.size(); ++i)
+        inserted.insert(std::get<0>(points[i]), std::get<1>(points[i]), std::get<2>(points[i]));
+
+    for (double x = 0; x < 64; x += 0.5)
+    {
+        for (double y = 0; y < 64; y += 3.5)
+            ASSERT_EQ(nearSorted(inserted, x, y), nearSorted(bulk, x, y));
+    }
+}
+
+TEST_F(QuadTreeBulkLoadTests, BulkLoadIntoNonEmptyTree)
+{
+    QuadTree<int> tree(64, 4);
+    tree.insert(1, 1, -1);
+    tree.bulkLoad(points.begin(), points.end());
+
+    ASSERT_EQ(points.size() + 1, tree.size());
+}
+
+TEST_F(QuadTreeBulkLoadTests, BulkLoadIntoNonEmptyTreeIsTheSameAsInsertsInZOrder)
+{
+    QuadTree<int> bulk(64, 4);
+    QuadTree<int> inserted(64, 4);
+    bulk.enableHandles();
+    std::vector<Point> first(points.begin(), points.begin() + 200);
+    std::vector<Point> second(points.begin() + 200, points.end());
+    bulk.bulkLoad(first.begin(), first.end());
+    inserted.bulkLoad(first.begin(), first.end());
+
+    std::vector<std::pair<QuadTree<int>::code_type, size_t> > order;
+    for (size_t i = 0; i < second.size(); ++i)
+    {
+        QuadTree<int>::code_type code;
+        inserted.encode(&std::get<0>(second[i]), &std::get<1>(second[i]), 1, &code);
+        order.push_back(std::make_pair(code, i));
+    }
+    std::sort(order.begin(), order.end());
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        const Point& point = second[order[i].second];
+        inserted.insert(std::get<0>(point), std::get<1>(point), std::get<2>(point));
+    }
+    bulk.bulkLoad(second.begin(), second.end());
+
+    ASSERT_EQ(std::vector<int>(inserted.begin(), inserted.end()),
+              std::vector<int>(bulk.begin(), bulk.end()));
+    for (QuadTree<int>::iterator it = bulk.begin(); it != bulk.end(); ++it)
+        ASSERT_EQ(it, bulk.find(bulk.handle(it)));
+    for (double x = 0; x < 64; x += 0.5)
+    {
+        for (double y = 0; y < 64; y += 3.5)
+            ASSERT_EQ(nearSorted(inserted, x, y), nearSorted(bulk, x, y));
+    }
+}
+
+TEST_F(QuadTreeBulkLoadTests, BulkLoadMovesValues)
+{
+    std::vector<std::tuple<double, double, std::string> > values;
+    values.push_back(std::make_tuple(1.0, 1.0, std::string("fake")));
+
+    QuadTree<std::string> tree(4, 4);
+    tree.bulkLoad(std::make_move_iterator(values.begin()), std::make_move_iterator(values.end()));
+
+    EXPECT_EQ("fake", *tree.begin());
+    ASSERT_TRUE(std::get<2>(values[0]).empty());
+}
+
+TEST_F(QuadTreeBulkLoadTests, ParallelBulkLoadInsertsAllElements)
+{
+    QuadTree<int> tree(64, 4);
+    EXPECT_EQ(points.size(), tree.parallelBulkLoad(points.begin(), points.end(), 4));
+    ASSERT_EQ(points.size(), tree.size());
+}
+
+TEST_F(QuadTreeBulkLoadTests, ParallelBulkLoadSkipsElementsOutOfRange)
+{
+    QuadTree<int> tree(4, 4);
+    points.clear();
+    points.push_back(Point(1, 1, 1));
+    points.push_back(Point(5, 1, 2));
+    points.push_back(Point(1, -1, 3));
+
+    EXPECT_EQ((size_t)1, tree.parallelBulkLoad(points.begin(), points.end(), 4));
+    ASSERT_EQ((size_t)1, tree.size());
+}
+
+TEST_F(QuadTreeBulkLoadTests, ParallelBulkLoadedTreeIsTheSameAsBulkLoadedOne)
+{
+    for (unsigned threads = 1; threads <= 8; threads *= 2)
+    {
+        QuadTree<int> bulk(64, 4);
+        QuadTree<int> parallel(64, 4);
+
+        bulk.bulkLoad(points.begin(), points.end());
+        parallel.parallelBulkLoad(points.begin(), points.end(), threads);
+
+        EXPECT_EQ(bulk.size(), parallel.size());
+        EXPECT_EQ(bulk.countInRect(10, 10, 40, 40), parallel.countInRect(10, 10, 40, 40));
+
+        ASSERT_EQ(std::vector<int>(bulk.begin(), bulk.end()),
+                  std::vector<int>(parallel.begin(), parallel.end()));
+        for (double x = 0; x < 64; x += 0.5)
+        {
+            for (double y = 0; y < 64; y += 3.5)
+                ASSERT_EQ(nearSorted(bulk, x, y), nearSorted(parallel, x, y));
+        }
+    }
+}
+
+TEST_F(QuadTreeBulkLoadTests, ParallelBulkLoadIntoNonEmptyTree)
+{
+    QuadTree<int> tree(64, 4);
+    tree.insert(1, 1, -1);
+    tree.parallelBulkLoad(points.begin(), points.end(), 4);
+
+    ASSERT_EQ(points.size() + 1, tree.size());
+}
+
+TEST_F(QuadTreeBulkLoadTests, ParallelBulkLoadedTreeCanBeModified)
+{
+    QuadTree<int> tree(64, 4);
+    tree.parallelBulkLoad(points.begin(), points.end(), 4);
+    for (size_t i = 0; i < points.size(); ++i)
+        tree.erase(std::get<0>(points[i]), std::get<1>(points[i]));
+    EXPECT_EQ((size_t)0, tree.size());
+
+    tree.parallelBulkLoad(points.begin(), points.end(), 4);
+    tree.clear();
+    ASSERT_EQ((size_t)0, tree.size());
+}
+
+TEST_F(QuadTreeBulkLoadTests, ParallelBulkLoadOfShallowTree)
+{
+    QuadTree<int, 2> tree(64, 1);
+    EXPECT_EQ(points.size(), tree.parallelBulkLoad(points.begin(), points.end(), 8));
+    ASSERT_EQ(points.size(), tree.size());
+}
+
+//
+// Query tests
+//
+
+class QuadTreeQueryTests : public Test
+{
+protected:
+    struct Point
+    {
+        double x;
+        double y;
+        int id;
+    };
+
+    // Points lie on multiples of 0.5, which are borders of the smallest tree nodes (1/8 wide), so
+    // queries with bounds in between them give exact results.
+    QuadTreeQueryTests() : tree(64, 4)
+    {
+        for (int i = 0; i < 700; ++i)
+        {
+            Point point = { ((i * 37) % 128) * 0.5, ((i * 91) % 128) * 0.5, i };
+            points.push_back(point);
+            tree.insert(point.x, point.y, point.id);
+        }
+    }
+
+    std::vector<int> rect(double minX, double minY, double maxX, double maxY)
+    {
+        std::vector<int> result;
+        tree.withinRect(minX, minY, maxX, maxY, Collect(&result));
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+    std::vector<int> bruteRect(double minX, double minY, double maxX, double maxY) const
+    {
+        std::vector<int> result;
+        for (size_t i = 0; i < points.size(); ++i)
+        {
+            if (points[i].x >= minX && points[i].x <= maxX &&
+                points[i].y >= minY && points[i].y <= maxY)
+                result.push_back(points[i].id);
+        }
+        return result;
+    }
+
+    std::vector<int> radius(double x, double y, double r)
+    {
+        std::vector<int> result;
+        tree.withinRadius(x, y, r, Collect(&result));
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+    // Points are found when their smallest nodes (1/8 wide) intersect the circle.
+    std::vector<int> bruteRadius(double x, double y, double r) const
+    {
+        std::vector<int> result;
+        for (size_t i = 0; i < points.size(); ++i)
+        {
+            double dx = std::max(0.0, std::max(points[i].x - x, x - (points[i].x + 0.125)));
+            double dy = std::max(0.0, std::max(points[i].y - y, y - (points[i].y + 0.125)));
+            if (dx * dx + dy * dy <= r * r)
+                result.push_back(points[i].id);
+        }
+        return result;
+    }
+
+    static double distance(const Point& point, double x, double y)
+    {
+        return (point.x - x) * (point.x - x) + (point.y - y) * (point.y - y);
+    }
+
+    QuadTree<int> tree;
+    std::vector<Point> points;
+};
+
+TEST_F(QuadTreeQueryTests, WithinRectFindsTheSameElementsAsFullScan)
+{
+    for (double minX = -4.25; minX < 64; minX += 7.5)
+    {
+        for (double minY = -2.25; minY < 64; minY += 9.5)
+        {
+            ASSERT_EQ(bruteRect(minX, minY, minX + 12, minY + 5),
+                      rect(minX, minY, minX + 12, minY + 5));
+            ASSERT_EQ(bruteRect(minX, minY, minX + 40, minY + 30),
+                      rect(minX, minY, minX + 40, minY + 30));
+        }
+    }
+}
+
+TEST_F(QuadTreeQueryTests, WithinRectCoveringTheWholeTreeFindsAllElements)
+{
+    ASSERT_EQ(points.size(), rect(-100, -100, 100, 100).size());
+}
+
+TEST_F(QuadTreeQueryTests, WithinRectOutsideOfTheTreeFindsNothing)
+{
+    EXPECT_TRUE(rect(64, 0, 100, 100).empty());
+    EXPECT_TRUE(rect(-10, -10, -1, -1).empty());
+    ASSERT_TRUE(rect(10, 10, 5, 5).empty());
+}
+
+TEST_F(QuadTreeQueryTests, WithinRectIncludesBounds)
+{
+    const Point& p = points[3];
+    std::vector<int> found = rect(p.x, p.y, p.x, p.y);
+
+    EXPECT_NE(found.end(), std::find(found.begin(), found.end(), p.id));
+    ASSERT_EQ(bruteRect(p.x, p.y, p.x, p.y), found);
+}
+
+TEST_F(QuadTreeQueryTests, WithinRectOfEmptyTreeFindsNothing)
+{
+    tree.clear();
+    ASSERT_TRUE(rect(0, 0, 64, 64).empty());
+}
+
+TEST_F(QuadTreeQueryTests, WithinRectAllowsModifyingElements)
+{
+    struct Increment
+    {
+        void operator()(int& id) { ++id; }
+    };
+    tree.withinRect(0, 0, 64, 64, Increment());
+
+    std::vector<int> expected;
+    for (size_t i = 0; i < points.size(); ++i)
+        expected.push_back(points[i].id + 1);
+    ASSERT_EQ(expected, rect(0, 0, 64, 64));
+}
+
+TEST_F(QuadTreeQueryTests, KnnFindsTheClosestElementsInOrder)
+{
+    // Distances are measured to centers of the smallest nodes, i.e. points shifted by 1/16.
+    const double shift = 1.0 / 16;
+    for (double x = -3.3; x < 70; x += 6.1)
+    {
+        for (double y = -1.7; y < 70; y += 8.3)
+        {
+            std::vector<double> expected;
+            for (size_t i = 0; i < points.size(); ++i)
+                expected.push_back(distance(points[i], x - shift, y - shift));
+            std::sort(expected.begin(), expected.end());
+            expected.resize(10);
+
+            std::vector<QuadTree<int>::iterator> found = tree.knn(x, y, 10);
+            std::vector<double> distances;
+            for (size_t i = 0; i < found.size(); ++i)
+                distances.push_back(distance(points[*found[i]], x - shift, y - shift));
+            ASSERT_EQ(expected, distances);
+        }
+    }
+}
+
+TEST_F(QuadTreeQueryTests, KnnReturnsAllElementsWhenThereAreLessThanK)
+{
+    ASSERT_EQ(points.size(), tree.knn(10, 10, 1000).size());
+}
+
+TEST_F(QuadTreeQueryTests, KnnOfZeroElementsReturnsNothing)
+{
+    ASSERT_TRUE(tree.knn(10, 10, 0).empty());
+}
+
+TEST_F(QuadTreeQueryTests, KnnOfEmptyTreeReturnsNothing)
+{
+    tree.clear();
+    ASSERT_TRUE(tree.knn(10, 10, 3).empty());
+}
+
+TEST_F(QuadTreeQueryTests, KnnFindsElementInANeighbouringNode)
+{
+    QuadTree<int> small(64, 1);
+    small.insert(31.5, 10, 1);
+    small.insert(0, 10, 2);
+    small.insert(32.5, 10, 3);
+
+    std::vector<QuadTree<int>::iterator> found = small.knn(32.2, 10, 1);
+    ASSERT_EQ((size_t)1, found.size());
+    ASSERT_EQ(3, *found[0]);
+    found = small.knn(31.9, 10, 1);
+    ASSERT_EQ(1, *found[0]);
+}
+
+TEST_F(QuadTreeQueryTests, WithinRadiusFindsTheSameElementsAsFullScan)
+{
+    for (double x = -5.3; x < 70; x += 7.1)
+    {
+        for (double y = -3.7; y < 70; y += 9.3)
+        {
+            ASSERT_EQ(bruteRadius(x, y, 3.3), radius(x, y, 3.3));
+            ASSERT_EQ(bruteRadius(x, y, 21.7), radius(x, y, 21.7));
+        }
+    }
+}
+
+TEST_F(QuadTreeQueryTests, WithinRadiusCoveringTheWholeTreeFindsAllElements)
+{
+    ASSERT_EQ(points.size(), radius(32, 32, 46).size());
+}
+
+TEST_F(QuadTreeQueryTests, WithinNegativeRadiusFindsNothing)
+{
+    ASSERT_TRUE(radius(32, 32, -1).empty());
+}
+
+//
+// Tests of trees which store original coordinates
+//
+
+class QuadTreeWithCoordinatesTests : public Test
+{
+protected:
+    typedef QuadTree<int, 10, std::allocator<int>, true> Tree;
+
+    QuadTreeWithCoordinatesTests() : tree(64, 4)
+    {
+        for (int i = 0; i < 700; ++i)
+        {
+            xs.push_back(std::fmod(i * 7.31, 64.0));
+            ys.push_back(std::fmod(i * 13.17 + 0.03, 64.0));
+            tree.insert(xs.back(), ys.back(), i);
+        }
+    }
+
+    double distance(int id, double x, double y) const
+    {
+        return (xs[id] - x) * (xs[id] - x) + (ys[id] - y) * (ys[id] - y);
+    }
+
+    Tree tree;
+    std::vector<double> xs;
+    std::vector<double> ys;
+};
+
+TEST_F(QuadTreeWithCoordinatesTests, WithinRadiusIsExact)
+{
+    for (double x = -5.3; x < 70; x += 7.1)
+    {
+        for (double y = -3.7; y < 70; y += 9.3)
+        {
+            for (double r = 0.1; r < 30; r *= 3)
+            {
+                std::vector<int> expected;
+                for (size_t i = 0; i < xs.size(); ++i)
+                {
+                    if (distance(i, x, y) <= r * r)
+                        expected.push_back(i);
+                }
+
+                std::vector<int> found;
+                tree.withinRadius(x, y, r, Collect(&found));
+                std::sort(found.begin(), found.end());
+                ASSERT_EQ(expected, found);
+            }
+        }
+    }
+}
+
+TEST_F(QuadTreeWithCoordinatesTests, WithinRectIsExact)
+{
+    for (double x = -5.3; x < 70; x += 7.1)
+    {
+        for (double y = -3.7; y < 70; y += 9.3)
+        {
+            std::vector<int> expected;
+            for (size_t i = 0; i < xs.size(); ++i)
+            {
+                if (xs[i] >= x && xs[i] <= x + 10.01 && ys[i] >= y && ys[i] <= y + 3.01)
+                    expected.push_back(i);
+            }
+
+            std::vector<int> found;
+            tree.withinRect(x, y, x + 10.01, y + 3.01, Collect(&found));
+            std::sort(found.begin(), found.end());
+            ASSERT_EQ(expected, found);
+        }
+    }
+}
+
+TEST_F(QuadTreeWithCoordinatesTests, KnnIsExact)
+{
+    for (double x = -3.3; x < 70; x += 6.1)
+    {
+        for (double y = -1.7; y < 70; y += 8.3)
+        {
+            std::vector<double> expected;
+            for (size_t i = 0; i < xs.size(); ++i)
+                expected.push_back(distance(i, x, y));
+            std::sort(expected.begin(), expected.end());
+            expected.resize(7);
+
+            std::vector<Tree::iterator> found = tree.knn(x, y, 7);
+            std::vector<double> distances;
+            for (size_t i = 0; i < found.size(); ++i)
+                distances.push_back(distance(*found[i], x, y));
+            ASSERT_EQ(expected, distances);
+        }
+    }
+}
+
+TEST_F(QuadTreeWithCoordinatesTests, BulkLoadsStoreCoordinates)
+{
+    std::vector<std::tuple<double, double, int> > values;
+    for (size_t i = 0; i < xs.size(); ++i)
+        values.push_back(std::make_tuple(xs[i], ys[i], static_cast<int>(i)));
+
+    Tree bulk(64, 4);
+    bulk.bulkLoad(values.begin(), values.end());
+    Tree parallel(64, 4);
+    parallel.parallelBulkLoad(values.begin(), values.end(), 2);
+
+    std::vector<int> expected;
+    tree.withinRadius(20, 20, 9.9, Collect(&expected));
+    std::sort(expected.begin(), expected.end());
+    std::vector<int> found;
+    bulk.withinRadius(20, 20, 9.9, Collect(&found));
+    std::sort(found.begin(), found.end());
+    EXPECT_EQ(expected, found);
+    found.clear();
+    parallel.withinRadius(20, 20, 9.9, Collect(&found));
+    std::sort(found.begin(), found.end());
+    ASSERT_EQ(expected, found);
+}
+
+TEST_F(QuadTreeWithCoordinatesTests, FindPairsUsesExactDistances)
+{
+    std::vector<std::pair<int, int> > expected;
+    for (int i = 0; i < 700; ++i)
+    {
+        for (int j = i + 1; j < 700; ++j)
+        {
+            if (distance(i, xs[j], ys[j]) <= 1.7 * 1.7)
+                expected.push_back(std::make_pair(i, j));
+        }
+    }
+
+    std::vector<std::pair<int, int> > found;
+    tree.findPairs(1.7, [&](int a, int b) {
+        found.push_back(std::make_pair(std::min(a, b), std::max(a, b)));
+    });
+    std::sort(found.begin(), found.end());
+    ASSERT_EQ(expected, found);
+}
+
+TEST_F(QuadTreeWithCoordinatesTests, RelocateUpdatesStoredCoordinates)
+{
+    for (int i = 0; i < 700; i += 5)
+    {
+        Tree::iterator it = tree.near(xs[i], ys[i]).first;
+        while (*it != i)
+            ++it;
+        xs[i] = std::fmod(xs[i] + 0.01 * i, 64.0);
+        ys[i] = std::fmod(ys[i] + 0.003 * i, 64.0);
+        tree.relocate(it, xs[i], ys[i]);
+    }
+
+    std::vector<int> expected;
+    for (int i = 0; i < 700; ++i)
+    {
+        if (distance(i, 31.3, 28.8) <= 7.7 * 7.7)
+            expected.push_back(i);
+    }
+    std::vector<int> found;
+    tree.withinRadius(31.3, 28.8, 7.7, Collect(&found));
+    std::sort(found.begin(), found.end());
+    ASSERT_EQ(expected, found);
+}
+
+TEST_F(QuadTreeQueryTests, CountInRectCountsTheSameElementsAsWithinRect)
+{
+    for (double minX = -4.25; minX < 64; minX += 7.5)
+    {
+        for (double minY = -2.25; minY < 64; minY += 9.5)
+        {
+            ASSERT_EQ(bruteRect(minX, minY, minX + 12, minY + 5).size(),
+                      tree.countInRect(minX, minY, minX + 12, minY + 5));
+            ASSERT_EQ(bruteRect(minX, minY, minX + 40, minY + 30).size(),
+                      tree.countInRect(minX, minY, minX + 40, minY + 30));
+        }
+    }
+}
+
+TEST_F(QuadTreeQueryTests, CountInRectCoveringTheWholeTreeCountsAllElements)
+{
+    ASSERT_EQ(points.size(), tree.countInRect(0, 0, 64, 64));
+}
+
+TEST_F(QuadTreeQueryTests, ConstQueriesGiveTheSameResults)
+{
+    const QuadTree<int>& constTree = tree;
+
+    std::vector<int> found;
+    constTree.withinRect(3.3, 7.1, 40.2, 22.9, Collect(&found));
+    std::sort(found.begin(), found.end());
+    EXPECT_EQ(rect(3.3, 7.1, 40.2, 22.9), found);
+    EXPECT_EQ(found.size(), constTree.countInRect(3.3, 7.1, 40.2, 22.9));
+
+    found.clear();
+    constTree.withinRadius(20.1, 30.2, 9.7, Collect(&found));
+    std::sort(found.begin(), found.end());
+    EXPECT_EQ(radius(20.1, 30.2, 9.7), found);
+
+    std::vector<QuadTree<int>::iterator> nearest = tree.knn(11.1, 12.2, 15);
+    std::vector<QuadTree<int>::const_iterator> constNearest = constTree.knn(11.1, 12.2, 15);
+    ASSERT_EQ(nearest.size(), constNearest.size());
+    for (size_t i = 0; i < nearest.size(); ++i)
+        ASSERT_EQ(QuadTree<int>::const_iterator(nearest[i]), constNearest[i]);
+}
+
+TEST_F(QuadTreeQueryTests, ConstQueriesMightBeRunConcurrently)
+{
+    const QuadTree<int>& constTree = tree;
+    std::vector<std::vector<int> > expected(64);
+    for (size_t i = 0; i < expected.size(); ++i)
+        expected[i] = radius(i % 8 * 8.1, i / 8 * 7.9, 6.5);
+
+    std::vector<std::vector<int> > found(expected.size());
+    parallelFor(found.size(), 4, [&](size_t i, unsigned) {
+        constTree.withinRadius(i % 8 * 8.1, i / 8 * 7.9, 6.5, Collect(&found[i]));
+        std::sort(found[i].begin(), found[i].end());
+        constTree.knn(i % 8 * 8.1, i / 8 * 7.9, 5);
+        constTree.near(i % 8 * 8.1, i / 8 * 7.9);
+    });
+    ASSERT_EQ(expected, found);
+}
+
+TEST_F(QuadTreeQueryTests, ParallelForEachVisitsEachElementOnce)
+{
+    // Most of elements are in a single corner, so the tree is deep there and shallow elsewhere.
+    QuadTree<int> skewed(64, 4);
+    for (int i = 0; i < 20000; ++i)
+    {
+        if (i % 10 == 0)
+            skewed.insert((i * 37) % 64, (i * 91) % 64, i);
+        else
+            skewed.insert((i * 37) % 128 / 64.0, (i * 91) % 128 / 64.0, i);
+    }
+
+    std::vector<std::atomic<int> > visits(20000);
+    for (size_t i = 0; i < visits.size(); ++i)
+        visits[i] = 0;
+    skewed.parallelForEach([&](int& id) { ++visits[id]; }, 4);
+    for (size_t i = 0; i < visits.size(); ++i)
+        ASSERT_EQ(1, visits[i]);
+
+    const QuadTree<int>& constTree = skewed;
+    std::atomic<long> sum(0);
+    constTree.parallelForEach([&](const int& id) { sum += id; }, 3);
+    ASSERT_EQ(20000L * 19999 / 2, sum);
+}
+
+TEST_F(QuadTreeQueryTests, ParallelReduceCombinesAllElements)
+{
+    long expected = 0;
+    for (size_t i = 0; i < points.size(); ++i)
+        expected += points[i].id;
+
+    for (unsigned threads = 0; threads <= 4; ++threads)
+    {
+        ASSERT_EQ(expected, tree.parallelReduce(0L, [](const int& id) { return long(id); },
+                                                [](long a, long b) { return a + b; }, threads));
+    }
+    ASSERT_EQ(699, tree.parallelReduce(-1, [](const int& id) { return id; },
+                                       [](int a, int b) { return std::max(a, b); }, 2));
+
+    tree.clear();
+    ASSERT_EQ(0L, tree.parallelReduce(0L, [](const int& id) { return long(id); },
+                                      [](long a, long b) { return a + b; }));
+}
+
+TEST_F(QuadTreeQueryTests, IterationOverLeafLinksMatchesTreeTraversal)
+{
+    for (size_t i = 0; i < points.size(); i += 3)
+        tree.erase(points[i].x, points[i].y);
+    for (int i = 0; i < 300; ++i)
+        tree.insert((i * 13) % 128 * 0.5, (i * 7) % 128 * 0.5, 1000 + i);
+
+    std::vector<int> threaded(tree.begin(), tree.end());
+    std::vector<int> backwards;
+    for (QuadTree<int>::iterator it = tree.end(); it != tree.begin();)
+        backwards.push_back(*--it);
+    std::reverse(backwards.begin(), backwards.end());
+    EXPECT_EQ(threaded, backwards);
+    EXPECT_EQ(tree.size(), threaded.size());
+
+    // Trees aren't threaded in the concurrent reads mode, so iterators traverse nodes.
+    EpochDomain domain;
+    tree.enableConcurrentReads(domain);
+    std::vector<int> traversed(tree.begin(), tree.end());
+    tree.disableConcurrentReads();
+    EXPECT_EQ(threaded, traversed);
+
+    QuadTree<int> loaded(64, 4);
+    std::vector<std::tuple<double, double, int> > elements;
+    for (size_t i = 0; i < points.size(); ++i)
+        elements.push_back(std::make_tuple(points[i].x, points[i].y, points[i].id));
+    loaded.bulkLoad(elements.begin(), elements.end());
+    loaded.insert(0.25, 0.25, -1);
+    ASSERT_EQ(loaded.size(), (size_t)std::distance(loaded.begin(), loaded.end()));
+}
+
+TEST_F(QuadTreeQueryTests, FindPairsReportsEachCloseEnoughPairOnce)
+{
+    // Centers of the smallest nodes are shifted from points by the same offset, so distances
+    // between them are the same as between points.
+    std::vector<std::pair<int, int> > expected;
+    for (size_t i = 0; i < points.size(); ++i)
+    {
+        for (size_t j = i + 1; j < points.size(); ++j)
+        {
+            if (distance(points[i], points[j].x, points[j].y) <= 2.6 * 2.6)
+                expected.push_back(std::make_pair(points[i].id, points[j].id));
+        }
+    }
+
+    std::vector<std::pair<int, int> > found;
+    tree.findPairs(2.6, [&](int a, int b) {
+        found.push_back(std::make_pair(std::min(a, b), std::max(a, b)));
+    });
+    std::sort(found.begin(), found.end());
+    EXPECT_EQ(expected, found);
+
+    std::mutex mutex;
+    std::vector<std::pair<int, int> > parallel;
+    const QuadTree<int>& constTree = tree;
+    constTree.parallelFindPairs(2.6, [&](const int& a, const int& b) {
+        std::lock_guard<std::mutex> lock(mutex);
+        parallel.push_back(std::make_pair(std::min(a, b), std::max(a, b)));
+    }, 4);
+    std::sort(parallel.begin(), parallel.end());
+    EXPECT_EQ(expected, parallel);
+
+    size_t none = 0;
+    tree.findPairs(-1, [&](int, int) { ++none; });
+    ASSERT_EQ((size_t)0, none);
+}
+
+TEST_F(QuadTreeQueryTests, SizeIsUpdatedByAllModifications)
+{
+    EXPECT_EQ(points.size(), tree.size());
+    for (size_t i = 0; i < points.size(); i += 2)
+        tree.erase(points[i].x, points[i].y);
+    EXPECT_EQ(rect(0, 0, 64, 64).size(), tree.size());
+
+    QuadTree<int> copy(tree);
+    EXPECT_EQ(tree.size(), copy.size());
+
+    tree.clear();
+    EXPECT_EQ((size_t)0, tree.size());
+    ASSERT_EQ(copy.countInRect(0, 0, 64, 64), copy.size());
+}
+
+TEST_F(QuadTreeQueryTests, RelocateMovesElementsToNewCoordinates)
+{
+    // Every third point is moved: some of them a little (mostly within their nodes), others across
+    // the whole tree.
+    for (size_t i = 0; i < points.size(); i += 3)
+    {
+        QuadTree<int>::iterator it = tree.near(points[i].x, points[i].y).first;
+        while (*it != points[i].id)
+            ++it;
+        double x = i % 2 ? std::fmod(points[i].x + 0.5, 64.0) : 63.5 - points[i].x;
+        double y = i % 2 ? points[i].y : std::fmod(points[i].y + 17.0, 64.0);
+        QuadTree<int>::iterator moved = tree.relocate(it, x, y);
+        ASSERT_EQ(points[i].id, *moved);
+        points[i].x = x;
+        points[i].y = y;
+    }
+
+    EXPECT_EQ(points.size(), tree.size());
+    EXPECT_EQ(points.size(), (size_t)std::distance(tree.begin(), tree.end()));
+    EXPECT_EQ(bruteRect(0, 0, 64, 64), rect(0, 0, 64, 64));
+    EXPECT_EQ(bruteRect(3.2, 7.7, 20.1, 41.3), rect(3.2, 7.7, 20.1, 41.3));
+    ASSERT_EQ(bruteRect(31.9, 0.3, 60.4, 12.2), rect(31.9, 0.3, 60.4, 12.2));
+}
+
+TEST_F(QuadTreeQueryTests, RelocateWithinNodeKeepsIterator)
+{
+    QuadTree<int> small(64, 4);
+    small.insert(1, 1, 1);
+    QuadTree<int>::iterator it = small.insert(2, 2, 2);
+
+    QuadTree<int>::iterator moved = small.relocate(it, 60, 60);
+    EXPECT_EQ(it, moved);
+    EXPECT_EQ(0u, small.countInRect(1.5, 1.5, 2.5, 2.5));
+    EXPECT_EQ(1u, small.countInRect(59.5, 59.5, 60.5, 60.5));
+    ASSERT_EQ(2u, small.size());
+}
+
+TEST_F(QuadTreeQueryTests, RelocateOutOfRangeDoesNotMoveElement)
+{
+    QuadTree<int>::iterator it = tree.near(points[0].x, points[0].y).first;
+    int id = *it;
+
+    EXPECT_EQ(QuadTree<int>::iterator(), tree.relocate(it, 64, 1));
+    EXPECT_EQ(QuadTree<int>::iterator(), tree.relocate(it, 1, -0.5));
+    EXPECT_EQ(points.size(), tree.size());
+    ASSERT_EQ(id, *tree.near(points[0].x, points[0].y).first);
+}
+
+class QuadTreeHandlesTests : public Test
+{
+protected:
+    // Points are inserted one by one, so nodes are split many times.
+    QuadTreeHandlesTests() : tree(64, 4)
+    {
+        tree.enableHandles();
+        for (int i = 0; i < 500; ++i)
+            handles.push_back(tree.handle(tree.insert(x(i), y(i), i)));
+    }
+
+    static double x(int i)
+    {
+        return (i * 37) % 128 * 0.5;
+    }
+
+    static double y(int i)
+    {
+        return (i * 91) % 128 * 0.5;
+    }
+
+    void expectResolved(bool oddErased = false)
+    {
+        for (size_t i = 0; i < handles.size(); ++i)
+        {
+            if (oddErased && i % 2 == 1)
+                continue;
+            QuadTree<int>::iterator it = tree.find(handles[i]);
+            ASSERT_TRUE(it);
+            ASSERT_EQ(static_cast<int>(i), *it);
+        }
+    }
+
+    QuadTree<int> tree;
+    std::vector<QuadTree<int>::handle_type> handles;
+};
+
+TEST_F(QuadTreeHandlesTests, HandleThrowsWhenHandlesAreDisabled)
+{
+    QuadTree<int> plain(64, 4);
+    QuadTree<int>::iterator it = plain.insert(1, 1, 1);
+
+    EXPECT_FALSE(plain.handlesEnabled());
+    ASSERT_THROW(plain.handle(it), std::logic_error);
+}
+
+TEST_F(QuadTreeHandlesTests, HandlesSurviveSplits)
+{
+    expectResolved();
+}
+
+TEST_F(QuadTreeHandlesTests, EraseByHandleInvalidatesOnlyThatHandle)
+{
+    for (size_t i = 1; i < handles.size(); i += 2)
+        ASSERT_TRUE(tree.erase(handles[i]));
+
+    EXPECT_EQ(handles.size() / 2, tree.size());
+    EXPECT_FALSE(tree.erase(handles[1]));
+    EXPECT_FALSE(tree.find(handles[1]));
+    expectResolved(true);
+}
+
+TEST_F(QuadTreeHandlesTests, ReusedSlotsDontResolveOldHandles)
+{
+    tree.erase(x(7), y(7));
+    QuadTree<int>::handle_type fresh = tree.handle(tree.insert(1.5, 1.5, 1000));
+
+    EXPECT_FALSE(tree.find(handles[7]));
+    EXPECT_EQ(1000, *tree.find(fresh));
+    ASSERT_NE(handles[7], fresh);
+}
+
+TEST_F(QuadTreeHandlesTests, RelocateKeepsHandles)
+{
+    for (int i = 0; i < 500; i += 3)
+    {
+        QuadTree<int>::iterator it = tree.relocate(handles[i], 63.5 - x(i), y(i));
+        ASSERT_EQ(i, *it);
+    }
+
+    expectResolved();
+    EXPECT_EQ(500u, tree.size());
+    ASSERT_FALSE(tree.relocate(handles[0], 64, 1));
+}
+
+TEST_F(QuadTreeHandlesTests, ElementsOfBulkLoadsGetHandles)
+{
+    std::vector<std::tuple<double, double, int> > points;
+    for (int i = 0; i < 300; ++i)
+        points.push_back(std::make_tuple(x(i), y(i), i));
+    QuadTree<int> loaded(64, 4);
+    loaded.enableHandles();
+    loaded.bulkLoad(points.begin(), points.end());
+    QuadTree<int> enabledLater(64, 4);
+    enabledLater.parallelBulkLoad(points.begin(), points.end(), 2);
+    enabledLater.enableHandles();
+
+    for (QuadTree<int>::iterator it = loaded.begin(); it != loaded.end(); ++it)
+        ASSERT_EQ(*it, *loaded.find(loaded.handle(it)));
+    for (QuadTree<int>::iterator it = enabledLater.begin(); it != enabledLater.end(); ++it)
+        ASSERT_EQ(*it, *enabledLater.find(enabledLater.handle(it)));
+}
+
+TEST_F(QuadTreeHandlesTests, CopiesResolveHandlesToTheirOwnElements)
+{
+    QuadTree<int> copy(tree);
+    *copy.find(handles[5]) = -5;
+
+    EXPECT_EQ(5, *tree.find(handles[5]));
+    EXPECT_EQ(-5, *copy.find(handles[5]));
+    copy.relocate(handles[5], 3, 3);
+    ASSERT_EQ(-5, *copy.near(3, 3).first);
+}
+
+TEST_F(QuadTreeHandlesTests, ClearInvalidatesAllHandles)
+{
+    tree.clear();
+    for (size_t i = 0; i < handles.size(); ++i)
+        ASSERT_FALSE(tree.find(handles[i]));
+}
+
+TEST_F(QuadTreeHandlesTests, HandlesSurviveModificationsInConcurrentReadsMode)
+{
+    EpochDomain domain;
+    tree.enableConcurrentReads(domain);
+    for (int i = 500; i < 700; ++i)
+        handles.push_back(tree.handle(tree.insert(x(i) + 0.25, y(i), i)));
+    for (size_t i = 1; i < handles.size(); i += 2)
+        ASSERT_TRUE(tree.erase(handles[i]));
+    for (int i = 0; i < 700; i += 4)
+        tree.relocate(handles[i], y(i), x(i));
+
+    expectResolved(true);
+    tree.disableConcurrentReads();
+    ASSERT_EQ(350u, tree.size());
+}
+
+class QuadTreeConcurrentReadsTests : public Test
+{
+protected:
+    QuadTreeConcurrentReadsTests() : tree(64, 4), expected(64, 4) {}
+
+    static std::vector<int> contents(const QuadTree<int>& tree)
+    {
+        std::vector<int> result(tree.begin(), tree.end());
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+    // The same modifications are made to both trees.
+    void insert(double x, double y, int value)
+    {
+        tree.insert(x, y, value);
+        expected.insert(x, y, value);
+    }
+
+    void erase(double x, double y)
+    {
+        tree.erase(x, y);
+        expected.erase(x, y);
+    }
+
+    EpochDomain domain;
+    QuadTree<int> tree;
+    QuadTree<int> expected;
+};
+
+TEST_F(QuadTreeConcurrentReadsTests, ReadThrowsWhenModeIsDisabled)
+{
+    ASSERT_THROW(tree.read(), std::logic_error);
+}
+
+TEST_F(QuadTreeConcurrentReadsTests, ModificationsGiveTheSameTreeAsInDefaultMode)
+{
+    tree.enableConcurrentReads(domain);
+    for (int i = 0; i < 500; ++i)
+        insert((i * 37) % 128 * 0.5, (i * 91) % 128 * 0.5, i);
+    for (int i = 0; i < 500; i += 3)
+        erase((i * 37) % 128 * 0.5, (i * 91) % 128 * 0.5);
+    insert(1, 1, 1000);
+
+    EXPECT_EQ(contents(expected), contents(tree));
+    EXPECT_EQ(expected.size(), tree.size());
+    EXPECT_EQ(expected.countInRect(3, 5, 40, 33), tree.countInRect(3, 5, 40, 33));
+    EXPECT_EQ(1000, *tree.near(1, 1).first);
+
+    tree.clear();
+    EXPECT_EQ(0u, tree.size());
+    ASSERT_EQ(tree.end(), tree.begin());
+}
+
+TEST_F(QuadTreeConcurrentReadsTests, RelocateGivesTheSameTreeAsInDefaultMode)
+{
+    for (int i = 0; i < 300; ++i)
+        insert((i * 37) % 128 * 0.5, (i * 91) % 128 * 0.5, i);
+    tree.enableConcurrentReads(domain);
+
+    for (int i = 0; i < 300; i += 7)
+    {
+        double x = (i * 37) % 128 * 0.5;
+        double y = (i * 91) % 128 * 0.5;
+        double newX = i % 2 ? x : 63.5 - x;
+        double newY = i % 2 ? std::fmod(y + 0.5, 64.0) : y;
+        QuadTree<int>::iterator it = tree.near(x, y).first;
+        while (*it != i)
+            ++it;
+        ASSERT_EQ(i, *tree.relocate(it, newX, newY));
+        it = expected.near(x, y).first;
+        while (*it != i)
+            ++it;
+        expected.relocate(it, newX, newY);
+    }
+
+    EXPECT_EQ(contents(expected), contents(tree));
+    EXPECT_EQ(expected.size(), tree.size());
+    ASSERT_EQ(expected.countInRect(3, 5, 40, 33), tree.countInRect(3, 5, 40, 33));
+}
+
+TEST_F(QuadTreeConcurrentReadsTests, BulkLoadsPublishNewRoot)
+{
+    std::vector<std::tuple<double, double, int> > points;
+    for (int i = 0; i < 300; ++i)
+        points.push_back(std::make_tuple((i * 37) % 128 * 0.5, (i * 91) % 128 * 0.5, i));
+    expected.bulkLoad(points.begin(), points.end());
+
+    tree.enableConcurrentReads(domain);
+    tree.bulkLoad(points.begin(), points.end());
+    EXPECT_EQ(contents(expected), contents(tree));
+
+    tree.clear();
+    tree.parallelBulkLoad(points.begin(), points.end(), 3);
+    EXPECT_EQ(contents(expected), contents(tree));
+    ASSERT_EQ(expected.size(), tree.size());
+}
+
+TEST_F(QuadTreeConcurrentReadsTests, ReplacedNodesAreFreedAfterReadersFinish)
+{
+    tree.enableConcurrentReads(domain);
+    tree.insert(1, 1, 1);
+    tree.reclaim();
+    {
+        EpochGuard guard = tree.read();
+        std::pair<QuadTree<int>::const_iterator, QuadTree<int>::const_iterator> range =
+            static_cast<const QuadTree<int>&>(tree).near(1, 1);
+        for (int i = 0; i < 10; ++i)
+            tree.insert(1, 1, i + 2);
+        EXPECT_LT(0u, tree.reclaim());
+        // The old node is still readable.
+        EXPECT_EQ(1, *range.first);
+    }
+    ASSERT_EQ(0u, tree.reclaim());
+}
+
+TEST_F(QuadTreeConcurrentReadsTests, ReadersSeeEveryStableElementWhileTreeIsModified)
+{
+    // Stable elements are never erased, other ones are inserted and erased all the time. Stable
+    // ones don't share the smallest nodes (1/8 wide) with the other ones.
+    tree.enableConcurrentReads(domain);
+    for (int i = 0; i < 100; ++i)
+        tree.insert(i % 10 * 6 + 0.2, i / 10 * 6 + 0.2, i);
+
+    std::atomic<bool> done(false);
+    std::atomic<bool> failed(false);
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 3; ++r)
+    {
+        readers.push_back(std::thread([&]() {
+            const QuadTree<int>& constTree = tree;
+            while (!done)
+            {
+                EpochGuard guard = tree.read();
+                std::vector<int> found;
+                constTree.withinRect(0, 0, 64, 64, Collect(&found));
+                std::sort(found.begin(), found.end());
+                for (int i = 0; i < 100; ++i)
+                {
+                    if (!std::binary_search(found.begin(), found.end(), i))
+                        failed = true;
+                }
+                constTree.knn(32, 32, 5);
+            }
+        }));
+    }
+
+    for (int round = 0; round < 20; ++round)
+    {
+        for (int i = 0; i < 200; ++i)
+            tree.insert((i * 37) % 128 * 0.5, (i * 91) % 128 * 0.5, 1000 + i);
+        for (int i = 0; i < 200; ++i)
+            tree.erase((i * 37) % 128 * 0.5, (i * 91) % 128 * 0.5);
+    }
+    done = true;
+    for (size_t r = 0; r < readers.size(); ++r)
+        readers[r].join();
+
+    EXPECT_FALSE(failed);
+    EXPECT_EQ(0u, tree.reclaim());
+    ASSERT_EQ(100u, tree.size());
+}
+
+class QuadTreeSnapshotTests : public Test
+{
+protected:
+    // Points are inserted one by one, so nodes are split many times.
+    QuadTreeSnapshotTests() : tree(64, 4), expected(64, 4)
+    {
+        for (int i = 0; i < 500; ++i)
+            insert(x(i), y(i), i);
+    }
+
+    static double x(int i)
+    {
+        return (i * 37) % 128 * 0.5;
+    }
+
+    static double y(int i)
+    {
+        return (i * 91) % 128 * 0.5;
+    }
+
+    // The same modifications are made to both trees, only the tested one has snapshots.
+    void insert(double x, double y, int value)
+    {
+        tree.insert(x, y, value);
+        expected.insert(x, y, value);
+    }
+
+    void erase(double x, double y)
+    {
+        tree.erase(x, y);
+        expected.erase(x, y);
+    }
+
+    void modify()
+    {
+        for (int i = 0; i < 300; ++i)
+            insert(x(i) + 0.25, y(i), 1000 + i);
+        for (int i = 0; i < 200; i += 3)
+            erase(x(i), y(i));
+    }
+
+    void expectSameAsExpected()
+    {
+        ASSERT_EQ(expected.size(), tree.size());
+        ASSERT_EQ(std::vector<int>(expected.begin(), expected.end()),
+                  std::vector<int>(tree.begin(), tree.end()));
+        std::vector<int> reversed;
+        for (QuadTree<int>::iterator it = tree.end(); it != tree.begin();)
+            reversed.push_back(*--it);
+        std::reverse(reversed.begin(), reversed.end());
+        ASSERT_EQ(std::vector<int>(expected.begin(), expected.end()), reversed);
+    }
+
+    static std::vector<int> visited(const QuadTree<int>::Snapshot& snapshot)
+    {
+        std::vector<int> values;
+        snapshot.forEach(Collect(&values));
+        return values;
+    }
+
+    QuadTree<int> tree;
+    QuadTree<int> expected;
+};
+
+// Element which counts its copies.
+struct CountedCopies
+{
+    explicit CountedCopies(int value) : value(value) {}
+    CountedCopies(const CountedCopies& that) : value(that.value) { ++copies; }
+    CountedCopies(CountedCopies&& that) : value(that.value) {}
+    CountedCopies& operator=(const CountedCopies& that)
+    {
+        value = that.value;
+        ++copies;
+        return *this;
+    }
+    CountedCopies& operator=(CountedCopies&& that)
+    {
+        value = that.value;
+        return *this;
+    }
+
+    int value;
+    static int copies;
+};
+
+int CountedCopies::copies = 0;
+
+TEST_F(QuadTreeSnapshotTests, SnapshotDoesNotSeeLaterModifications)
+{
+    std::vector<int> before(tree.begin(), tree.end());
+    QuadTree<int>::Snapshot snapshot = tree.snapshot();
+    ASSERT_EQ(before, visited(snapshot));
+
+    modify();
+    for (int value = 1; value < 500; value += 7)
+    {
+        QuadTree<int>::iterator it = std::find(tree.begin(), tree.end(), value);
+        if (it == tree.end())
+            continue;
+        tree.relocate(it, x(value) + 0.5, 63.5 - y(value));
+        expected.relocate(std::find(expected.begin(), expected.end(), value), x(value) + 0.5,
+                          63.5 - y(value));
+    }
+
+    EXPECT_EQ(before.size(), snapshot.size());
+    EXPECT_EQ(before, visited(snapshot));
+    expectSameAsExpected();
+}
+
+TEST_F(QuadTreeSnapshotTests, SnapshotQueriesGiveResultsOfItsVersion)
+{
+    QuadTree<int> copy(tree);
+    QuadTree<int>::Snapshot snapshot = tree.snapshot();
+    modify();
+
+    for (double x = -5.3; x < 70; x += 7.1)
+    {
+        for (double y = -3.7; y < 70; y += 9.3)
+        {
+            std::vector<int> found;
+            std::vector<int> fromCopy;
+            snapshot.withinRect(x, y, x + 13.3, y + 6.2, Collect(&found));
+            copy.withinRect(x, y, x + 13.3, y + 6.2, Collect(&fromCopy));
+            EXPECT_EQ(fromCopy, found);
+            EXPECT_EQ(copy.countInRect(x, y, x + 5.1, y + 21),
+                      snapshot.countInRect(x, y, x + 5.1, y + 21));
+
+            found.clear();
+            fromCopy.clear();
+            snapshot.withinRadius(x, y, 9.5, Collect(&found));
+            copy.withinRadius(x, y, 9.5, Collect(&fromCopy));
+            EXPECT_EQ(fromCopy, found);
+        }
+    }
+
+    std::atomic<long> sum(0);
+    snapshot.parallelForEach([&sum](int value) { sum += value; }, 4);
+    ASSERT_EQ(499 * 500 / 2, sum);
+}
+
+TEST_F(QuadTreeSnapshotTests, ModificationsCopyOnlyNodesOnTheirPath)
+{
+    QuadTree<CountedCopies> counted(64, 4);
+    for (int i = 0; i < 2000; ++i)
+        counted.insert(i % 64 + 0.5, i / 64 * 2 + 0.5, CountedCopies(i));
+    QuadTree<CountedCopies>::Snapshot snapshot = counted.snapshot();
+
+    CountedCopies::copies = 0;
+    counted.insert(10.25, 10.25, CountedCopies(-1));
+    counted.erase(40.5, 20.5);
+    counted.relocate(counted.near(1.5, 1.5).first, 50.25, 50.25);
+    // Each modification copies at most a single leaf, which stores at most 4 elements.
+    EXPECT_LE(CountedCopies::copies, 12);
+    EXPECT_EQ(2000u, snapshot.size());
+    ASSERT_EQ(2000u, counted.size());
+}
+
+TEST_F(QuadTreeSnapshotTests, SnapshotSurvivesClearAndRebuild)
+{
+    std::vector<int> before(tree.begin(), tree.end());
+    QuadTree<int>::Snapshot snapshot = tree.snapshot();
+    tree.clear();
+    expected.clear();
+    EXPECT_EQ(0u, tree.size());
+    EXPECT_EQ(before, visited(snapshot));
+
+    std::vector<std::tuple<double, double, int> > points;
+    for (int i = 0; i < 300; ++i)
+        points.push_back(std::make_tuple(x(i), y(i), 2000 + i));
+    tree.bulkLoad(points.begin(), points.end());
+    expected.bulkLoad(points.begin(), points.end());
+    QuadTree<int>::Snapshot loaded = tree.snapshot();
+    modify();
+
+    EXPECT_EQ(before, visited(snapshot));
+    EXPECT_EQ(300u, loaded.size());
+    expectSameAsExpected();
+}
+
+TEST_F(QuadTreeSnapshotTests, CopiesOfSnapshotsOutliveOriginals)
+{
+    QuadTree<int>::Snapshot copy;
+    std::vector<int> before(tree.begin(), tree.end());
+    {
+        QuadTree<int>::Snapshot snapshot = tree.snapshot();
+        modify();
+        copy = snapshot;
+    }
+    modify();
+    EXPECT_EQ(before, visited(copy));
+
+    QuadTree<int>::Snapshot moved(std::move(copy));
+    EXPECT_EQ(0u, copy.size());
+    EXPECT_EQ(before, visited(moved));
+    moved.reset();
+    EXPECT_EQ(0u, moved.size());
+    modify();
+    expectSameAsExpected();
+}
+
+TEST_F(QuadTreeSnapshotTests, SnapshotsAreNotSupportedInConcurrentReadsMode)
+{
+    EpochDomain domain;
+    {
+        QuadTree<int>::Snapshot snapshot = tree.snapshot();
+        EXPECT_THROW(tree.enableConcurrentReads(domain), std::logic_error);
+    }
+    tree.enableConcurrentReads(domain);
+    EXPECT_THROW(tree.snapshot(), std::logic_error);
+    tree.disableConcurrentReads();
+    ASSERT_EQ(500u, tree.snapshot().size());
+}
+
+TEST_F(QuadTreeSnapshotTests, HandlesResolveToCopiedNodes)
+{
+    tree.enableHandles();
+    std::vector<QuadTree<int>::handle_type> handles;
+    for (QuadTree<int>::iterator it = tree.begin(); it != tree.end(); ++it)
+        handles.push_back(tree.handle(it));
+
+    std::vector<int> before(tree.begin(), tree.end());
+    QuadTree<int>::Snapshot snapshot = tree.snapshot();
+    for (size_t i = 0; i < handles.size(); i += 2)
+        ASSERT_TRUE(tree.erase(handles[i]));
+    QuadTree<int>::Snapshot second = tree.snapshot();
+    for (size_t i = 1; i < handles.size(); i += 4)
+        ASSERT_TRUE(tree.relocate(handles[i], 63.5 - i % 64, 0.5 + i % 64));
+    // New elements take slots freed by the erases, which must not be taken twice.
+    std::vector<QuadTree<int>::handle_type> added;
+    for (int i = 0; i < 300; ++i)
+        added.push_back(tree.handle(tree.insert(x(i) + 0.25, y(i), 1000 + i)));
+
+    for (size_t i = 0; i < handles.size(); ++i)
+    {
+        QuadTree<int>::iterator it = tree.find(handles[i]);
+        ASSERT_EQ(i % 2 == 1, static_cast<bool>(it));
+        if (it)
+        {
+            ASSERT_EQ(before[i], *it);
+        }
+    }
+    for (size_t i = 0; i < added.size(); ++i)
+    {
+        QuadTree<int>::iterator it = tree.find(added[i]);
+        ASSERT_TRUE(static_cast<bool>(it));
+        ASSERT_EQ(static_cast<int>(1000 + i), *it);
+    }
+    EXPECT_EQ(before, visited(snapshot));
+    ASSERT_EQ(handles.size() / 2, second.size());
+}
+
+TEST_F(QuadTreeSnapshotTests, SnapshotsMightBeReadWhileTreeIsModified)
+{
+    QuadTree<int>::Snapshot snapshot = tree.snapshot();
+    std::atomic<bool> done(false);
+    std::atomic<bool> failed(false);
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 3; ++r)
+    {
+        readers.push_back(std::thread([&]() {
+            while (!done)
+            {
+                // Readers also copy and release snapshots.
+                QuadTree<int>::Snapshot copy = snapshot;
+                std::vector<int> found;
+                copy.withinRect(0, 0, 64, 64, Collect(&found));
+                if (found.size() != 500 || copy.countInRect(0, 0, 64, 64) != 500)
+                    failed = true;
+            }
+        }));
+    }
+
+    std::vector<QuadTree<int>::Snapshot> taken;
+    for (int round = 0; round < 20; ++round)
+    {
+        for (int i = 0; i < 200; ++i)
+            insert(x(i) + 0.25, y(i) + 0.25, 1000 + i);
+        taken.push_back(tree.snapshot());
+        for (int i = 0; i < 200; ++i)
+            erase(x(i) + 0.25, y(i) + 0.25);
+        if (round % 3 == 0)
+            taken.clear();
+    }
+    done = true;
+    for (size_t r = 0; r < readers.size(); ++r)
+        readers[r].join();
+
+    EXPECT_FALSE(failed);
+    for (size_t i = 0; i < taken.size(); ++i)
+        EXPECT_EQ(700u, taken[i].size());
+    expectSameAsExpected();
+}
+
+class QuadTreeCollapseTests : public Test
+{
+protected:
+    // Points are inserted one by one, so nodes are split many times.
+    QuadTreeCollapseTests() : tree(64, 4)
+    {
+        for (int i = 0; i < 500; ++i)
+            tree.insert(x(i), y(i), i);
+    }
+
+    static double x(int i)
+    {
+        return (i * 37) % 128 * 0.5;
+    }
+
+    static double y(int i)
+    {
+        return (i * 91) % 128 * 0.5;
+    }
+
+    // Elements of leaves which contain points of a grid finer than the smallest nodes, so trees
+    // with the same leaves give the same results.
+    static std::vector<std::vector<int> > leaves(const QuadTree<int>& tree)
+    {
+        std::vector<std::vector<int> > result;
+        for (double x = 0.05; x < 64; x += 0.5)
+        {
+            for (double y = 0.05; y < 64; y += 0.5)
+            {
+                std::pair<QuadTree<int>::const_iterator, QuadTree<int>::const_iterator> range =
+                    tree.near(x, y);
+                result.push_back(std::vector<int>(range.first, range.second));
+                std::sort(result.back().begin(), result.back().end());
+            }
+        }
+        return result;
+    }
+
+    // Tree with elements which are left in the tested one, inserted one by one.
+    QuadTree<int> rebuilt() const
+    {
+        QuadTree<int> result(64, 4);
+        for (QuadTree<int>::const_iterator it = tree.begin(); it != tree.end(); ++it)
+            result.insert(x(*it), y(*it), *it);
+        return result;
+    }
+
+    QuadTree<int> tree;
+};
+
+TEST_F(QuadTreeCollapseTests, EraseMergesSiblingsIntoTheirParent)
+{
+    QuadTree<int> small(64, 4);
+    for (int i = 0; i < 5; ++i)
+        small.insert(8 + 12 * i, 60 - 12 * i, i);
+    std::vector<int> order(small.begin(), small.end());
+
+    small.erase(32, 36);
+    order.erase(std::find(order.begin(), order.end(), 2));
+    EXPECT_EQ(order, std::vector<int>(small.begin(), small.end()));
+    std::pair<QuadTree<int>::iterator, QuadTree<int>::iterator> range = small.near(63, 1);
+    ASSERT_EQ(order, std::vector<int>(range.first, range.second));
+}
+
+TEST_F(QuadTreeCollapseTests, EraseRemovesChainsOfNodes)
+{
+    QuadTree<int> small(64, 1);
+    small.insert(1, 1, 1);
+    small.insert(1.5, 1.5, 2);
+    small.insert(60, 60, 3);
+
+    small.erase(1.5, 1.5);
+    EXPECT_EQ(2u, small.size());
+    std::pair<QuadTree<int>::iterator, QuadTree<int>::iterator> range = small.near(30, 30);
+    ASSERT_EQ(1, std::distance(range.first, range.second));
+    ASSERT_EQ(1, *range.first);
+}
+
+TEST_F(QuadTreeCollapseTests, ErasedTreeHasTheSameNodesAsRebuiltOne)
+{
+    for (int i = 0; i < 500; i += 3)
+        tree.erase(x(i), y(i));
+    for (int i = 1; i < 500; i += 7)
+        tree.erase(x(i), y(i));
+
+    EXPECT_EQ(leaves(rebuilt()), leaves(tree));
+    for (int i = 0; i < 500; ++i)
+        tree.erase(x(i), y(i));
+    EXPECT_EQ(0u, tree.size());
+    ASSERT_EQ(tree.end(), tree.near(1, 1).first);
+}
+
+TEST_F(QuadTreeCollapseTests, RelocatedTreeHasTheSameNodesAsRebuiltOne)
+{
+    for (int i = 0; i < 500; i += 2)
+    {
+        QuadTree<int>::iterator it = tree.near(x(i), y(i)).first;
+        while (*it != i)
+            ++it;
+        // Even points are gathered in a small corner, so nodes they've left become sparse.
+        tree.relocate(it, x(i) / 8, y(i) / 8);
+    }
+
+    QuadTree<int> expected(64, 4);
+    for (QuadTree<int>::iterator it = tree.begin(); it != tree.end(); ++it)
+        expected.insert(*it % 2 ? x(*it) : x(*it) / 8, *it % 2 ? y(*it) : y(*it) / 8, *it);
+    ASSERT_EQ(leaves(expected), leaves(tree));
+}
+
+TEST_F(QuadTreeCollapseTests, HandlesResolveToMergedNodes)
+{
+    std::vector<QuadTree<int>::handle_type> handles;
+    tree.enableHandles();
+    for (QuadTree<int>::iterator it = tree.begin(); it != tree.end(); ++it)
+        handles.push_back(tree.handle(it));
+
+    for (size_t i = 0; i < handles.size(); i += 3)
+        ASSERT_TRUE(tree.erase(handles[i]));
+    for (size_t i = 0; i < handles.size(); ++i)
+    {
+        QuadTree<int>::iterator it = tree.find(handles[i]);
+        ASSERT_EQ(i % 3 != 0, static_cast<bool>(it));
+    }
+    ASSERT_EQ(leaves(rebuilt()), leaves(tree));
+}
+
+TEST_F(QuadTreeCollapseTests, NodesAreMergedInConcurrentReadsMode)
+{
+    EpochDomain domain;
+    tree.enableConcurrentReads(domain);
+    for (int i = 0; i < 500; i += 2)
+        tree.erase(x(i), y(i));
+
+    EXPECT_EQ(leaves(rebuilt()), leaves(tree));
+    tree.disableConcurrentReads();
+    ASSERT_EQ(leaves(rebuilt()), leaves(tree));
+}
+
+TEST_F(QuadTreeCollapseTests, SnapshotsKeepNodesWhichWereMerged)
+{
+    std::vector<int> before(tree.begin(), tree.end());
+    QuadTree<int>::Snapshot snapshot = tree.snapshot();
+
+    for (int i = 0; i < 500; i += 2)
+        tree.erase(x(i), y(i));
+    std::vector<int> found;
+    snapshot.forEach([&found](int value) { found.push_back(value); });
+    EXPECT_EQ(before, found);
+    ASSERT_EQ(leaves(rebuilt()), leaves(tree));
+}
+
+TEST_F(QuadTreeCollapseTests, CompactKeepsOrderOfIteration)
+{
+    for (int i = 0; i < 500; i += 2)
+        tree.erase(x(i), y(i));
+    std::vector<int> before(tree.begin(), tree.end());
+
+    EXPECT_EQ(0u, tree.compact());
+    EXPECT_EQ(before, std::vector<int>(tree.begin(), tree.end()));
+    EXPECT_EQ(leaves(rebuilt()), leaves(tree));
+    tree.clear();
+    EXPECT_EQ(0u, tree.compact());
+    ASSERT_EQ(tree.end(), tree.begin());
+}
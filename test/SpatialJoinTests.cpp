@@ -0,0 +1,153 @@
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "SpatialJoin.hpp"
+
+using namespace testing;
+using namespace geo;
+
+class SpatialJoinTests : public Test
+{
+protected:
+    typedef QuadTree<int, 10, std::allocator<int>, true> Vehicles;
+    typedef QuadTree<std::string, 10> Places;
+    typedef std::pair<int, std::string> Match;
+
+    // Places lie on multiples of 0.5, so their locations (centers of the smallest nodes, 1/8
+    // wide) are shifted by 1/16.
+    SpatialJoinTests() : vehicles(64, 4), places(64, 3)
+    {
+        for (int i = 0; i < 600; ++i)
+        {
+            vehicleXs.push_back(std::fmod(i * 7.31, 64.0));
+            vehicleYs.push_back(std::fmod(i * 13.17 + 0.03, 64.0));
+            vehicles.insert(vehicleXs.back(), vehicleYs.back(), i);
+        }
+        for (int i = 0; i < 400; ++i)
+        {
+            placeXs.push_back((i * 37) % 128 * 0.5 + 0.0625);
+            placeYs.push_back((i * 91) % 128 * 0.5 + 0.0625);
+            places.insert(placeXs.back(), placeYs.back(), std::to_string(i));
+        }
+    }
+
+    template <typename Predicate>
+    std::vector<Match> brute(const Predicate& predicate) const
+    {
+        std::vector<Match> result;
+        for (size_t i = 0; i < vehicleXs.size(); ++i)
+        {
+            for (size_t j = 0; j < placeXs.size(); ++j)
+            {
+                if (predicate(Coordinates(vehicleXs[i], vehicleYs[i]),
+                              Coordinates(placeXs[j], placeYs[j])))
+                    result.push_back(Match(static_cast<int>(i), std::to_string(j)));
+            }
+        }
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+    struct Collect
+    {
+        explicit Collect(std::vector<Match>* matches) : matches(matches) {}
+        void operator()(const int& vehicle, const std::string& place)
+        {
+            matches->push_back(Match(vehicle, place));
+        }
+        std::vector<Match>* matches;
+    };
+
+    static std::vector<Match> sorted(std::vector<Match> matches)
+    {
+        std::sort(matches.begin(), matches.end());
+        return matches;
+    }
+
+    Vehicles vehicles;
+    Places places;
+    std::vector<double> vehicleXs;
+    std::vector<double> vehicleYs;
+    std::vector<double> placeXs;
+    std::vector<double> placeYs;
+};
+
+TEST_F(SpatialJoinTests, WithinDistanceMatchesFullScan)
+{
+    std::vector<Match> found;
+    join(vehicles, places, WithinDistance(1.3), Collect(&found));
+
+    std::vector<Match> expected = brute(WithinDistance(1.3));
+    EXPECT_FALSE(expected.empty());
+    ASSERT_EQ(expected, sorted(found));
+}
+
+TEST_F(SpatialJoinTests, RectsOverlapMatchesFullScan)
+{
+    RectsOverlap overlap(2, 1, 0.5, 3);
+    std::vector<Match> found;
+    join(vehicles, places, overlap, Collect(&found));
+
+    std::vector<Match> expected = brute(overlap);
+    EXPECT_FALSE(expected.empty());
+    ASSERT_EQ(expected, sorted(found));
+}
+
+TEST_F(SpatialJoinTests, JoinWorksInBothDirectionsAndWithConstTrees)
+{
+    std::vector<Match> found;
+    const Places& constPlaces = places;
+    join(vehicles, constPlaces, WithinDistance(2), Collect(&found));
+
+    std::vector<Match> reversed;
+    const Vehicles& constVehicles = vehicles;
+    join(constPlaces, constVehicles, WithinDistance(2),
+         [&](const std::string& place, const int& vehicle) {
+             reversed.push_back(Match(vehicle, place));
+         });
+
+    EXPECT_EQ(brute(WithinDistance(2)), sorted(found));
+    ASSERT_EQ(sorted(found), sorted(reversed));
+}
+
+TEST_F(SpatialJoinTests, CallbackGetsMutableReferences)
+{
+    join(vehicles, places, WithinDistance(0.5), [](int& vehicle, std::string&) {
+        vehicle = -1;
+    });
+
+    size_t marked = static_cast<size_t>(std::count(vehicles.begin(), vehicles.end(), -1));
+    std::vector<Match> expected = brute(WithinDistance(0.5));
+    std::vector<int> expectedVehicles;
+    for (size_t i = 0; i < expected.size(); ++i)
+        expectedVehicles.push_back(expected[i].first);
+    expectedVehicles.erase(std::unique(expectedVehicles.begin(), expectedVehicles.end()),
+                           expectedVehicles.end());
+    ASSERT_EQ(expectedVehicles.size(), marked);
+}
+
+TEST_F(SpatialJoinTests, EmptyTreesAndNegativeDistanceGiveNoPairs)
+{
+    std::vector<Match> found;
+    join(vehicles, places, WithinDistance(-1), Collect(&found));
+    Places empty(64, 3);
+    join(vehicles, empty, WithinDistance(100), Collect(&found));
+    ASSERT_TRUE(found.empty());
+}
+
+TEST_F(SpatialJoinTests, TreesMustCoverTheSameArea)
+{
+    Places shifted(64, 1, 0, 3);
+    Places smaller(32, 3);
+    std::vector<Match> found;
+    ASSERT_THROW(join(vehicles, shifted, WithinDistance(1), Collect(&found)),
+                 std::invalid_argument);
+    ASSERT_THROW(join(vehicles, smaller, WithinDistance(1), Collect(&found)),
+                 std::invalid_argument);
+}
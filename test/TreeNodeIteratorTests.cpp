@@ -477,3 +477,57 @@ TEST_F(TreeNodeIteratorTests, DecrementingIteratorDoesntResultInHeaderOrRoot)
     EXPECT_NE(headerIt, testIt);
     EXPECT_NE(rootIt, testIt);
 }
+
+TEST_F(TreeNodeIteratorTests, IteratorIncrementationFollowsLeafLinks)
+{
+    NodeMock header;
+    NodeMock node;
+    NodeMock next;
+
+    configureNodeParent(node, header);
+    configureNodeParent(next, header);
+    configureHeaderNode(header);
+    node.nextLink = &next;
+
+    EXPECT_CALL(node, count())
+        .WillRepeatedly(Return(1));
+    EXPECT_CALL(next, count())
+        .WillRepeatedly(Return(2));
+    EXPECT_CALL(node, NextNode())
+        .Times(0);
+
+    NodeMock::ElementType toRet = 7;
+    EXPECT_CALL(next, At(0))
+        .WillOnce(ReturnRef(toRet));
+
+    TreeNodeIterator<NodeMock> testIt(&node, 0);
+    ++testIt;
+
+    ASSERT_EQ(toRet, *testIt);
+}
+
+TEST_F(TreeNodeIteratorTests, IteratorDecrementationFollowsLeafLinks)
+{
+    NodeMock header;
+    NodeMock node;
+    NodeMock previous;
+
+    configureNodeParent(node, header);
+    configureNodeParent(previous, header);
+    configureHeaderNode(header);
+    node.prevLink = &previous;
+
+    EXPECT_CALL(previous, count())
+        .WillRepeatedly(Return(3));
+    EXPECT_CALL(node, PreviousNode())
+        .Times(0);
+
+    NodeMock::ElementType toRet = 8;
+    EXPECT_CALL(previous, At(2))
+        .WillOnce(ReturnRef(toRet));
+
+    TreeNodeIterator<NodeMock> testIt(&node, 0);
+    --testIt;
+
+    ASSERT_EQ(toRet, *testIt);
+}